@@ -1,4 +1,7 @@
+#include <stddef.h>
+
 #include "alpha_division_effect.h"
+#include "cpu_backend.h"
 #include "util.h"
 
 using namespace std;
@@ -10,4 +13,17 @@ string AlphaDivisionEffect::output_fragment_shader()
 	return read_file("alpha_division_effect.frag");
 }
 
+void AlphaDivisionEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                           unsigned y0, unsigned y1, float *dst) const
+{
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			const CPUPixel p = CPUPixel::load(in + x);
+			(p / p.broadcast<3>()).with_alpha_from(p).store(out + x);
+		}
+	}
+}
+
 }  // namespace
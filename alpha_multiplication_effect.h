@@ -15,6 +15,10 @@ public:
 	std::string effect_type_id() const override { return "AlphaMultiplicationEffect"; }
 	std::string output_fragment_shader() override;
 	bool strong_one_to_one_sampling() const override { return true; }
+
+	bool has_cpu_implementation() const override { return true; }
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
 };
 
 }  // namespace movit
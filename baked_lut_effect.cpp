@@ -0,0 +1,333 @@
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+
+#include "baked_lut_effect.h"
+#include "effect_chain.h"
+#include "effect_util.h"
+#include "flat_input.h"
+#include "fp16.h"
+#include "resource_pool.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Emulates the shader's lookup into the (RGBA) lattice for one color;
+// see baked_lut_effect.frag.
+void lookup_lut(const vector<float> &lut, int lut_size, int interpolation, const float *rgb, float *result)
+{
+	float p[3];
+	int base[3];
+	float f[3];
+	for (unsigned c = 0; c < 3; ++c) {
+		p[c] = min(max(rgb[c], 0.0f), 1.0f) * (lut_size - 1);
+		base[c] = min(int(floor(p[c])), lut_size - 2);
+		f[c] = p[c] - base[c];
+	}
+	auto texel = [&](int dr, int dg, int db, unsigned c) {
+		int r = base[0] + dr, g = base[1] + dg, b = base[2] + db;
+		return lut[((b * lut_size + g) * lut_size + r) * 4 + c];
+	};
+
+	for (unsigned c = 0; c < 3; ++c) {
+		if (interpolation == BakedLUTEffect::INTERPOLATION_TRILINEAR) {
+			float sum = 0.0f;
+			for (int db = 0; db <= 1; ++db) {
+				for (int dg = 0; dg <= 1; ++dg) {
+					for (int dr = 0; dr <= 1; ++dr) {
+						float weight = (dr ? f[0] : 1.0f - f[0]) *
+							(dg ? f[1] : 1.0f - f[1]) *
+							(db ? f[2] : 1.0f - f[2]);
+						sum += weight * texel(dr, dg, db, c);
+					}
+				}
+			}
+			result[c] = sum;
+		} else {
+			// Walk from the nearest corner to the opposite one, along
+			// the axes in order of decreasing fraction.
+			int order[3] = { 0, 1, 2 };
+			sort(order, order + 3, [&](int a, int b) { return f[a] > f[b]; });
+			int offset[3] = { 0, 0, 0 };
+			float prev = texel(0, 0, 0, c);
+			float sum = prev;
+			for (unsigned i = 0; i < 3; ++i) {
+				offset[order[i]] = 1;
+				float next = texel(offset[0], offset[1], offset[2], c);
+				sum += f[order[i]] * (next - prev);
+				prev = next;
+			}
+			result[c] = sum;
+		}
+	}
+}
+
+}  // namespace
+
+BakedLUTEffect::BakedLUTEffect(const vector<Effect *> &effects)
+	: effects(effects),
+	  lut_size(33),
+	  interpolation(INTERPOLATION_TRILINEAR)
+{
+	assert(!effects.empty());
+	for (Effect *effect : effects) {
+		assert(effect->num_inputs() == 1);
+		assert(effect->strong_one_to_one_sampling());
+	}
+	register_int("lut_size", &lut_size);
+	register_int("interpolation", &interpolation);
+}
+
+BakedLUTEffect::~BakedLUTEffect()
+{
+	if (effect_chain == nullptr) {
+		for (Effect *effect : effects) {
+			delete effect;
+		}
+	} else {
+		delete effect_chain;  // Owns the effects and the input.
+	}
+	if (lut_texnum != 0) {
+		glDeleteTextures(1, &lut_texnum);
+		check_error();
+	}
+}
+
+string BakedLUTEffect::output_fragment_shader()
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), "#define LUT_SIZE %d\n#define TETRAHEDRAL %d\n",
+		lut_size, interpolation == INTERPOLATION_TETRAHEDRAL);
+	return buf + read_file("baked_lut_effect.frag");
+}
+
+void BakedLUTEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+	glBindTexture(GL_TEXTURE_3D, lut_texnum);
+	check_error();
+
+	// sampler3D is not one of the uniform types Effect knows about,
+	// so we need to set it ourselves.
+	set_uniform_int(glsl_program_num, prefix, "lut", *sampler_num);
+	++*sampler_num;
+}
+
+void BakedLUTEffect::inform_added(EffectChain *chain)
+{
+	resource_pool = chain->get_resource_pool();
+}
+
+void BakedLUTEffect::inform_input_format(unsigned input_num, const ImageFormat &format)
+{
+	assert(input_num == 0);
+	assert(effect_chain == nullptr);
+	assert(lut_size >= 2);
+	assert(interpolation == INTERPOLATION_TRILINEAR || interpolation == INTERPOLATION_TETRAHEDRAL);
+	assert(format.gamma_curve != GAMMA_INVALID);
+
+	// Evaluate the effects on exactly the kind of data we get, and give out
+	// the same kind, so that EffectChain's conversions around them end up
+	// in the LUT.
+	effect_chain = new EffectChain(lut_size, lut_size * lut_size, resource_pool);
+	input = new FlatInput(format, FORMAT_RGB, GL_FLOAT, lut_size, lut_size * lut_size);
+	effect_chain->add_input(input);
+	for (Effect *effect : effects) {
+		effect_chain->add_effect(effect);
+	}
+	effect_chain->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	effect_chain->finalize();
+
+	input_data.resize(lut_size * lut_size * lut_size * 3);
+	input->set_pixel_data(input_data.data());
+
+	glGenTextures(1, &lut_texnum);
+	check_error();
+	glBindTexture(GL_TEXTURE_3D, lut_texnum);
+	check_error();
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, lut_size, lut_size, lut_size, 0, GL_RGBA, GL_FLOAT, nullptr);
+	check_error();
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	check_error();
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	check_error();
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	check_error();
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	check_error();
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	check_error();
+	glBindTexture(GL_TEXTURE_3D, 0);
+	check_error();
+
+	bake_lut();
+}
+
+bool BakedLUTEffect::bake()
+{
+	assert(effect_chain != nullptr);
+	for (unsigned i = 0; i < effects.size(); ++i) {
+		if (effects[i]->get_parameter_generation() != baked_parameter_generations[i]) {
+			bake_lut();
+			return true;
+		}
+	}
+	return false;
+}
+
+void BakedLUTEffect::bake_lut()
+{
+	baked_parameter_generations.clear();
+	for (Effect *effect : effects) {
+		baked_parameter_generations.push_back(effect->get_parameter_generation());
+	}
+
+	fill_lattice();
+	GLuint texnum = render_input();
+
+	// Copy each blue slice into its layer of the 3D texture; this stays
+	// on the GPU, and converts to fp16 on the way.
+	GLuint fbo = resource_pool->create_fbo(texnum);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	check_error();
+	glBindTexture(GL_TEXTURE_3D, lut_texnum);
+	check_error();
+	for (int b = 0; b < lut_size; ++b) {
+		glCopyTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, b, 0, b * lut_size, lut_size, lut_size);
+		check_error();
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+	check_error();
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	check_error();
+	resource_pool->release_fbo(fbo);
+	resource_pool->release_2d_texture(texnum);
+}
+
+BakedLUTEffect::AccuracyReport BakedLUTEffect::measure_accuracy(unsigned num_samples)
+{
+	assert(effect_chain != nullptr);
+
+	// The LUT, as the GPU sees it.
+	fill_lattice();
+	GLuint texnum = render_input();
+	vector<float> lut;
+	read_texture(texnum, &lut);
+	resource_pool->release_2d_texture(texnum);
+	for (float &x : lut) {
+		x = fp16_to_fp32(fp32_to_fp16(x));
+	}
+
+	// A fixed seed, so that the numbers are comparable between runs.
+	mt19937 rng(1234);
+	uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	const size_t batch_size = lut_size * lut_size * lut_size;
+	float max_error = 0.0f;
+	double sum_sq_error = 0.0;
+	vector<float> colors(batch_size * 3), reference;
+	for (unsigned start = 0; start < num_samples; start += batch_size) {
+		size_t num_colors = min<size_t>(batch_size, num_samples - start);
+		for (size_t i = 0; i < num_colors * 3; ++i) {
+			colors[i] = dist(rng);
+		}
+		fill_input(colors.data(), num_colors);
+		texnum = render_input();
+		read_texture(texnum, &reference);
+		resource_pool->release_2d_texture(texnum);
+
+		for (size_t i = 0; i < num_colors; ++i) {
+			float result[3];
+			lookup_lut(lut, lut_size, interpolation, &colors[i * 3], result);
+			for (unsigned c = 0; c < 3; ++c) {
+				float error = fabs(result[c] - reference[i * 4 + c]);
+				max_error = max(max_error, error);
+				sum_sq_error += error * error;
+			}
+		}
+	}
+
+	// Leave the lattice in place, like bake() would.
+	fill_lattice();
+
+	AccuracyReport report;
+	report.max_error = max_error;
+	report.rms_error = (num_samples == 0) ? 0.0f : sqrt(sum_sq_error / (num_samples * 3));
+	return report;
+}
+
+void BakedLUTEffect::fill_lattice()
+{
+	vector<float> colors(lut_size * lut_size * lut_size * 3);
+	float *ptr = colors.data();
+	for (int b = 0; b < lut_size; ++b) {
+		for (int g = 0; g < lut_size; ++g) {
+			for (int r = 0; r < lut_size; ++r) {
+				*ptr++ = float(r) / (lut_size - 1);
+				*ptr++ = float(g) / (lut_size - 1);
+				*ptr++ = float(b) / (lut_size - 1);
+			}
+		}
+	}
+	fill_input(colors.data(), lut_size * lut_size * lut_size);
+}
+
+void BakedLUTEffect::fill_input(const float *colors, size_t num_colors)
+{
+	// FlatInput takes its rows from the top, so flip.
+	const int height = lut_size * lut_size;
+	fill(input_data.begin(), input_data.end(), 0.0f);
+	for (size_t i = 0; i < num_colors; ++i) {
+		int x = i % lut_size, y = i / lut_size;
+		float *dst = &input_data[((height - 1 - y) * lut_size + x) * 3];
+		dst[0] = colors[i * 3 + 0];
+		dst[1] = colors[i * 3 + 1];
+		dst[2] = colors[i * 3 + 2];
+	}
+	input->invalidate_pixel_data();
+}
+
+GLuint BakedLUTEffect::render_input()
+{
+	const int width = lut_size, height = lut_size * lut_size;
+	GLuint texnum = resource_pool->create_2d_texture(GL_RGBA32F, width, height);
+
+	// The texture might be recycled from someone who used mipmaps;
+	// render_to_texture() needs a non-mipmapped minification mode.
+	glBindTexture(GL_TEXTURE_2D, texnum);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	check_error();
+
+	effect_chain->render_to_texture({{ texnum, GL_RGBA32F }}, width, height);
+	return texnum;
+}
+
+void BakedLUTEffect::read_texture(GLuint texnum, vector<float> *out)
+{
+	const int width = lut_size, height = lut_size * lut_size;
+	out->resize(width * height * 4);
+
+	GLuint fbo = resource_pool->create_fbo(texnum);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, out->data());
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+	resource_pool->release_fbo(fbo);
+}
+
+}  // namespace movit
@@ -0,0 +1,63 @@
+// See baked_lut_effect.h. LUT_SIZE is the number of lattice points along
+// each axis, and TETRAHEDRAL is 1 for tetrahedral interpolation
+// and 0 for trilinear, both #defined from the C++ code.
+
+#ifdef GL_ES
+precision highp sampler3D;
+#endif
+
+// Not an implicit uniform, since Effect only knows about 2D samplers.
+uniform sampler3D PREFIX(lut);
+
+vec4 FUNCNAME(vec2 tc) {
+	vec4 x = INPUT(tc);
+	vec3 rgb = clamp(x.rgb, 0.0, 1.0);
+
+#if TETRAHEDRAL
+	// Split the cube between the eight nearest lattice points into
+	// six tetrahedra along the neutral axis, and interpolate within
+	// the one we are in, using four of the points. We walk from the
+	// nearest corner to the opposite one, along the axes in order
+	// of decreasing fraction.
+	vec3 p = rgb * float(LUT_SIZE - 1);
+	vec3 base = min(floor(p), float(LUT_SIZE - 2));
+	vec3 f = p - base;
+	ivec3 i0 = ivec3(base);
+
+	ivec3 o1, o2;
+	vec3 w;
+	if (f.r >= f.g) {
+		if (f.g >= f.b) {
+			o1 = ivec3(1, 0, 0); o2 = ivec3(1, 1, 0); w = f.rgb;
+		} else if (f.r >= f.b) {
+			o1 = ivec3(1, 0, 0); o2 = ivec3(1, 0, 1); w = f.rbg;
+		} else {
+			o1 = ivec3(0, 0, 1); o2 = ivec3(1, 0, 1); w = f.brg;
+		}
+	} else {
+		if (f.b >= f.g) {
+			o1 = ivec3(0, 0, 1); o2 = ivec3(0, 1, 1); w = f.bgr;
+		} else if (f.b >= f.r) {
+			o1 = ivec3(0, 1, 0); o2 = ivec3(0, 1, 1); w = f.gbr;
+		} else {
+			o1 = ivec3(0, 1, 0); o2 = ivec3(1, 1, 0); w = f.grb;
+		}
+	}
+	vec3 c0 = texelFetch(PREFIX(lut), i0, 0).rgb;
+	vec3 c1 = texelFetch(PREFIX(lut), i0 + o1, 0).rgb;
+	vec3 c2 = texelFetch(PREFIX(lut), i0 + o2, 0).rgb;
+	vec3 c3 = texelFetch(PREFIX(lut), i0 + ivec3(1), 0).rgb;
+	x.rgb = c0 + w.x * (c1 - c0) + w.y * (c2 - c1) + w.z * (c3 - c2);
+#else
+	// Move from [0, 1] to the centers of the first and last texels,
+	// and let the texture unit do the rest.
+	const float scale = float(LUT_SIZE - 1) / float(LUT_SIZE);
+	const float offset = 0.5 / float(LUT_SIZE);
+	x.rgb = texture(PREFIX(lut), rgb * scale + offset).rgb;
+#endif
+
+	return x;
+}
+
+#undef LUT_SIZE
+#undef TETRAHEDRAL
@@ -0,0 +1,151 @@
+#ifndef _MOVIT_BAKED_LUT_EFFECT_H
+#define _MOVIT_BAKED_LUT_EFFECT_H 1
+
+// Evaluates a series of purely per-pixel color effects (e.g. WhiteBalanceEffect,
+// LiftGammaGainEffect and SaturationEffect) ahead of time into a 3D lookup
+// table, and then replaces all of them with a single lookup per pixel.
+// You give it the effects (which it takes ownership of), and then use
+// BakedLUTEffect in your chain instead of them:
+//
+//   WhiteBalanceEffect *white_balance = new WhiteBalanceEffect();
+//   LiftGammaGainEffect *lgg = new LiftGammaGainEffect();
+//   BakedLUTEffect *lut = new BakedLUTEffect({ white_balance, lgg });
+//   chain.add_effect(lut);
+//   ...
+//   chain.finalize();  // Bakes the LUT for the first time.
+//
+//   // For every frame:
+//   CHECK(lgg->set_vec3("gain", gain));
+//   lut->bake();  // Only does something if a parameter changed.
+//   chain.render_to_fbo(...);
+//
+// The effects must have one input, and the output for each pixel must
+// depend on nothing but the input color at that pixel; e.g., VignetteEffect
+// does not qualify, since it also looks at the position. Alpha is passed
+// through untouched, so the effects should not change it either.
+//
+// The LUT works directly on whatever color space and gamma curve the
+// input arrives in, and gives out the same, so the gamma expansion and
+// compression (and colorspace conversions, if any) that EffectChain would
+// otherwise need around the effects are baked into the LUT, too.
+// For instance, with an sRGB input and an sRGB output, the chain ends up
+// with nothing but the input, the LUT and the output. This also means
+// that the LUT is most precise if it gets gamma-encoded input, so
+// put it as early as possible in the chain; if it ends up after something
+// that needs linear light, it will sample the shadows rather coarsely.
+// Input values outside 0..1 are clamped, and output values that the effects
+// push out of 0..1 make for a kink (wherever they get clipped) that the LUT
+// can only follow approximately. If the input has alpha, the LUT is
+// exact for postmultiplied alpha (which is what you have whenever the input
+// is gamma-encoded), but approximate for premultiplied alpha < 1.
+//
+// The LUT is “lut_size” (default 33) points along each axis, stored as
+// RGBA16F, and is looked up with either trilinear interpolation (using the
+// GPU's texture filtering, which is the fastest) or tetrahedral interpolation
+// (four texel fetches, but usually somewhat more accurate for the same size,
+// and less prone to hue shifts along the neutral axis); see “interpolation”.
+// Both must be set before finalize().
+//
+// Baking renders the effects over the entire lattice using an internal
+// EffectChain, which happens in finalize(), and after that, only when
+// you call bake() and the parameters of one of the effects have changed.
+// Like SharedSource::render_frame(), bake() cannot be called from within
+// another chain's render, so it cannot happen automatically.
+// To see how close the LUT gets to evaluating the effects directly,
+// use measure_accuracy().
+
+#include <epoxy/gl.h>
+#include <string>
+#include <vector>
+
+#include "effect.h"
+#include "image_format.h"
+
+namespace movit {
+
+class EffectChain;
+class FlatInput;
+class ResourcePool;
+
+class BakedLUTEffect : public Effect {
+public:
+	// Takes ownership of the effects, which are applied in order.
+	BakedLUTEffect(const std::vector<Effect *> &effects);
+	~BakedLUTEffect();
+	std::string effect_type_id() const override { return "BakedLUTEffect"; }
+	std::string output_fragment_shader() override;
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
+
+	bool needs_linear_light() const override { return false; }
+	bool needs_srgb_primaries() const override { return false; }
+	AlphaHandling alpha_handling() const override { return DONT_CARE_ALPHA_TYPE; }
+	bool strong_one_to_one_sampling() const override { return true; }
+
+	void inform_added(EffectChain *chain) override;
+	void inform_input_format(unsigned input_num, const ImageFormat &format) override;
+
+	// Re-evaluate the effects into the LUT, if any of their parameters
+	// have changed since the last time. Returns true if it did anything.
+	// Must be called with the chain's OpenGL context current, and not
+	// while any chain is rendering.
+	bool bake();
+
+	// How far the LUT lookup is from evaluating the effects directly,
+	// measured at pseudorandom colors in between the lattice points, in units
+	// of the (gamma-encoded, if the input is) output, over all three channels.
+	// The lookup is emulated on the CPU, from the same RGBA16F values
+	// the GPU has; in trilinear mode, this does not include the limited
+	// precision of the GPU's texture filtering (typically 8 bits or so
+	// of the fraction between two lattice points). Same requirements as bake().
+	struct AccuracyReport {
+		float max_error;
+		float rms_error;
+	};
+	AccuracyReport measure_accuracy(unsigned num_samples = 65536);
+
+	enum Interpolation {
+		INTERPOLATION_TRILINEAR = 0,
+		INTERPOLATION_TETRAHEDRAL = 1,
+	};
+
+private:
+	// Re-evaluates the effects over the lattice and copies the result
+	// into the 3D texture, unconditionally.
+	void bake_lut();
+
+	// Puts the lattice (lut_size^3 points) into <input_data>,
+	// in the same order as the LUT itself: red varies the fastest,
+	// then green, then blue, with the first point at the bottom left.
+	void fill_lattice();
+
+	// Puts the given RGB colors into <input_data> in the same order
+	// as fill_lattice(); any unused points are set to black.
+	void fill_input(const float *colors, size_t num_colors);
+
+	// Renders the effects over <input_data> into a lut_size x lut_size^2
+	// RGBA32F texture from the pool; the caller must release it.
+	GLuint render_input();
+
+	// Reads back a texture from render_input() as RGBA floats,
+	// bottom row first.
+	void read_texture(GLuint texnum, std::vector<float> *out);
+
+	std::vector<Effect *> effects;
+	std::vector<unsigned> baked_parameter_generations;
+
+	int lut_size;
+	int interpolation;
+
+	ResourcePool *resource_pool = nullptr;
+
+	// Set up by inform_input_format(); until then, we own the effects.
+	EffectChain *effect_chain = nullptr;
+	FlatInput *input = nullptr;
+	std::vector<float> input_data;
+
+	GLuint lut_texnum = 0;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_BAKED_LUT_EFFECT_H)
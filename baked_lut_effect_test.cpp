@@ -0,0 +1,186 @@
+// Unit tests for BakedLUTEffect.
+
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+#include <epoxy/gl.h>
+
+#include <memory>
+#include <vector>
+
+#include "baked_lut_effect.h"
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "image_format.h"
+#include "saturation_effect.h"
+#include "test_util.h"
+#include "util.h"
+#include "white_balance_effect.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// The grading effects from test_util, baked into a BakedLUTEffect.
+BakedLUTEffect *add_baked_grading_effects(EffectChain *chain, int interpolation = BakedLUTEffect::INTERPOLATION_TRILINEAR)
+{
+	BakedLUTEffect *lut = new BakedLUTEffect(make_grading_effects());
+	CHECK(lut->set_int("interpolation", interpolation));
+	chain->add_effect(lut);
+	return lut;
+}
+
+}  // namespace
+
+TEST(BakedLUTEffectTest, IdentityIsNoop) {
+	float data[] = {
+		0.0f, 0.0f, 0.0f, 1.0f,
+		0.5f, 0.5f, 0.5f, 0.3f,
+		1.0f, 0.0f, 0.0f, 1.0f,
+		0.0f, 1.0f, 0.0f, 0.7f,
+		0.2f, 0.7f, 0.9f, 1.0f,
+	};
+
+	float out_data[5 * 4];
+	EffectChainTester tester(data, 1, 5, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	tester.get_chain()->add_effect(new BakedLUTEffect({ new SaturationEffect() }));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	expect_equal(data, out_data, 4, 5);
+}
+
+TEST(BakedLUTEffectTest, MatchesUnbakedEffects) {
+	const unsigned width = 16, height = 16;
+	vector<float> data = random_rgba(width * height);
+
+	float expected_data[width * height * 4];
+	{
+		EffectChainTester tester(data.data(), width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		add_grading_effects(tester.get_chain());
+		tester.run(expected_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+
+	for (int interpolation : { BakedLUTEffect::INTERPOLATION_TRILINEAR, BakedLUTEffect::INTERPOLATION_TETRAHEDRAL }) {
+		float out_data[width * height * 4];
+		EffectChainTester tester(data.data(), width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		BakedLUTEffect *lut = add_baked_grading_effects(tester.get_chain(), interpolation);
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+		// Nothing but the input and the LUT; all the gamma and
+		// colorspace conversions are in the LUT.
+		Node *node = tester.get_chain()->find_node_for_effect(lut);
+		ASSERT_EQ(1u, node->incoming_links.size());
+		EXPECT_EQ("FlatInput", node->incoming_links[0]->effect->effect_type_id());
+		EXPECT_EQ(0u, node->outgoing_links.size());
+
+		expect_equal(expected_data, out_data, 4 * width, height, 3.0 / 255.0, 0.5 / 255.0);
+	}
+}
+
+TEST(BakedLUTEffectTest, MatchesUnbakedWhiteBalance) {
+	// White balance works in LMS space, so it exercises a different
+	// kind of color matrix than the grading effects.
+	const unsigned width = 16, height = 16;
+	const float neutral_color[] = { 0.55f, 0.5f, 0.45f };
+	vector<float> data = random_rgba(width * height);
+
+	float expected_data[width * height * 4];
+	{
+		EffectChainTester tester(data.data(), width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		Effect *white_balance = tester.get_chain()->add_effect(new WhiteBalanceEffect());
+		CHECK(white_balance->set_vec3("neutral_color", neutral_color));
+		add_grading_effects(tester.get_chain());
+		tester.run(expected_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+
+	for (int interpolation : { BakedLUTEffect::INTERPOLATION_TRILINEAR, BakedLUTEffect::INTERPOLATION_TETRAHEDRAL }) {
+		float out_data[width * height * 4];
+		EffectChainTester tester(data.data(), width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		Effect *white_balance = new WhiteBalanceEffect();
+		CHECK(white_balance->set_vec3("neutral_color", neutral_color));
+		vector<Effect *> effects = make_grading_effects();
+		effects.insert(effects.begin(), white_balance);
+		BakedLUTEffect *lut = new BakedLUTEffect(effects);
+		CHECK(lut->set_int("interpolation", interpolation));
+		tester.get_chain()->add_effect(lut);
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+		expect_equal(expected_data, out_data, 4 * width, height, 3.0 / 255.0, 0.5 / 255.0);
+	}
+}
+
+TEST(BakedLUTEffectTest, BakesOnlyWhenParametersChange) {
+	float data[] = {
+		0.5f, 0.5f, 0.5f, 1.0f,
+		0.8f, 0.4f, 0.2f, 1.0f,
+	};
+	float expected_data[] = {
+		0.5f, 0.5f, 0.5f, 1.0f,
+		0.5f, 0.5f, 0.5f, 1.0f,
+	};
+
+	SaturationEffect *saturation = new SaturationEffect();
+	BakedLUTEffect *lut = new BakedLUTEffect({ saturation });
+
+	float out_data[2 * 4];
+	EffectChainTester tester(data, 1, 2, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.get_chain()->add_effect(lut);
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, 4, 2);
+
+	EXPECT_FALSE(lut->bake());
+
+	// Gray stays gray; the luminance of the other color is about 0.5
+	// (in linear light, which is what we get here).
+	ASSERT_TRUE(saturation->set_float("saturation", 0.0f));
+	EXPECT_TRUE(lut->bake());
+	EXPECT_FALSE(lut->bake());
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expected_data[4] = expected_data[5] = expected_data[6] = 0.2126f * 0.8f + 0.7152f * 0.4f + 0.0722f * 0.2f;
+	expect_equal(expected_data, out_data, 4, 2, 0.01f, 0.005f);
+}
+
+TEST(BakedLUTEffectTest, TetrahedralIsAtLeastAsAccurate) {
+	BakedLUTEffect::AccuracyReport reports[2];
+	for (int interpolation : { BakedLUTEffect::INTERPOLATION_TRILINEAR, BakedLUTEffect::INTERPOLATION_TETRAHEDRAL }) {
+		float data[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		float out_data[4];
+		EffectChainTester tester(data, 1, 1, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		BakedLUTEffect *lut = add_baked_grading_effects(tester.get_chain(), interpolation);
+		CHECK(lut->set_int("lut_size", 17));
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+		reports[interpolation] = lut->measure_accuracy(10000);
+	}
+
+	const BakedLUTEffect::AccuracyReport &trilinear = reports[BakedLUTEffect::INTERPOLATION_TRILINEAR];
+	const BakedLUTEffect::AccuracyReport &tetrahedral = reports[BakedLUTEffect::INTERPOLATION_TETRAHEDRAL];
+	EXPECT_GT(trilinear.max_error, 0.0f);
+	EXPECT_LT(trilinear.max_error, 0.02f);
+	EXPECT_LT(trilinear.rms_error, 0.002f);
+	EXPECT_LE(tetrahedral.rms_error, trilinear.rms_error);
+}
+
+#ifdef HAVE_BENCHMARK
+// The grading effects from test_util on a 1280x720 sRGB frame, directly (0)
+// or baked into a LUT (1).
+void BM_BakedLUTEffect(benchmark::State &state)
+{
+	const unsigned width = 1280, height = 720;
+	vector<float> data = random_rgba(width * height);
+	unique_ptr<float[]> out_data(new float[width * height * 4]);
+
+	EffectChainTester tester(data.data(), width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	if (state.range(0)) {
+		add_baked_grading_effects(tester.get_chain());
+	} else {
+		add_grading_effects(tester.get_chain());
+	}
+	tester.benchmark(state, out_data.get(), GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+}
+BENCHMARK(BM_BakedLUTEffect)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
+}  // namespace movit
@@ -16,6 +16,8 @@ namespace movit {
 BlurEffect::BlurEffect()
 	: num_taps(16),
 	  radius(3.0f),
+	  max_downscale_levels(0),
+	  use_compute_shader(0),
 	  input_width(1280),
 	  input_height(720)
 {
@@ -30,6 +32,28 @@ BlurEffect::BlurEffect()
 
 void BlurEffect::rewrite_graph(EffectChain *graph, Node *self)
 {
+	graph_rewritten = true;
+	if (use_compute_shader && movit_compute_shaders_supported && !graph->is_tiled()) {
+		// The compute passes do not care about mipmap levels,
+		// so they only need the radius.
+		compute_hpass = new SingleBlurPassComputeEffect();
+		CHECK(compute_hpass->set_int("direction", SingleBlurPassComputeEffect::HORIZONTAL));
+		compute_vpass = new SingleBlurPassComputeEffect();
+		CHECK(compute_vpass->set_int("direction", SingleBlurPassComputeEffect::VERTICAL));
+		delete hpass;
+		delete vpass;
+		hpass = vpass = nullptr;
+		update_radius();
+
+		Node *hpass_node = graph->add_node(compute_hpass);
+		Node *vpass_node = graph->add_node(compute_vpass);
+		graph->connect_nodes(hpass_node, vpass_node);
+		graph->replace_receiver(self, hpass_node);
+		graph->replace_sender(self, vpass_node);
+		self->disabled = true;
+		return;
+	}
+
 	Node *hpass_node = graph->add_node(hpass);
 	Node *vpass_node = graph->add_node(vpass);
 	graph->connect_nodes(hpass_node, vpass_node);
@@ -52,12 +76,31 @@ void BlurEffect::inform_input_size(unsigned input_num, unsigned width, unsigned
 		
 void BlurEffect::update_radius()
 {
+	if (compute_hpass != nullptr) {
+		bool ok = compute_hpass->set_float("radius", radius);
+		ok |= compute_vpass->set_float("radius", radius);
+		assert(ok);
+		return;
+	}
+
 	// We only have 16 taps to work with on each side, and we want that to
 	// reach out to about 2.5*sigma. Bump up the mipmap levels (giving us
-	// box blurs) until we have what we need.
+	// box blurs) until we have what we need. After that, go down up to
+	// max_downscale_levels more levels, as long as the radius stays at least
+	// two pixels; anything finer than that would show up as blockiness
+	// after the upscaling.
 	unsigned mipmap_width = input_width, mipmap_height = input_height;
 	float adjusted_radius = radius;
-	while ((mipmap_width > 1 || mipmap_height > 1) && adjusted_radius * 1.5f > num_taps / 2) {
+	int extra_levels = 0;
+	while (mipmap_width > 1 || mipmap_height > 1) {
+		if (adjusted_radius * 1.5f <= num_taps / 2) {
+			// We have what we need; see if we are allowed to go further.
+			if (extra_levels >= max_downscale_levels || adjusted_radius < 4.0f) {
+				break;
+			}
+			++extra_levels;
+		}
+
 		// Find the next mipmap size (round down, minimum 1 pixel).
 		mipmap_width = max(mipmap_width / 2, 1u);
 		mipmap_height = max(mipmap_height / 2, 1u);
@@ -101,6 +144,22 @@ bool BlurEffect::set_int(const string &key, int value) {
 		update_radius();
 		return true;
 	}
+	if (key == "use_compute_shader") {
+		// The passes are chosen in rewrite_graph().
+		if ((value != 0 && value != 1) || graph_rewritten) {
+			return false;
+		}
+		use_compute_shader = value;
+		return true;
+	}
+	if (key == "max_downscale_levels") {
+		if (value < 0) {
+			return false;
+		}
+		max_downscale_levels = value;
+		update_radius();
+		return true;
+	}
 	return false;
 }
 
@@ -218,8 +277,121 @@ void SingleBlurPassEffect::set_gl_state(GLuint glsl_program_num, const string &p
 	delete[] weight;
 }
 
+Region SingleBlurPassEffect::get_needed_input_region(unsigned input_num, const Region &output_region) const
+{
+	// We sample up to num_taps texels away on either side, in the mip level
+	// that has our output size. Add a couple of texels for the mip levels
+	// themselves (each texel is made from the ones in the level below)
+	// and for the mip level size not being exactly our size.
+	Region region = output_region;
+	if (direction == HORIZONTAL) {
+		const float margin = (num_taps + 4) / float(width);
+		region.x0 -= margin;
+		region.x1 += margin;
+	} else {
+		const float margin = (num_taps + 4) / float(height);
+		region.y0 -= margin;
+		region.y1 += margin;
+	}
+	return region;
+}
+
 void SingleBlurPassEffect::clear_gl_state()
 {
 }
 
+constexpr int SingleBlurPassComputeEffect::group_size;
+constexpr int SingleBlurPassComputeEffect::max_support;
+
+SingleBlurPassComputeEffect::SingleBlurPassComputeEffect()
+	: radius(3.0f),
+	  direction(HORIZONTAL)
+{
+	register_float("radius", &radius);
+	register_int("direction", (int *)&direction);
+	register_uniform_float_array("weights", weights, max_support + 1);
+	register_uniform_int("margin", &margin);
+	register_uniform_float("inv_width", &inv_width);
+	register_uniform_float("inv_height", &inv_height);
+}
+
+string SingleBlurPassComputeEffect::output_fragment_shader()
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), "#define DIRECTION_VERTICAL %d\n#define GROUP_SIZE %d\n#define MAX_SUPPORT %d\n",
+		(direction == VERTICAL), group_size, max_support);
+	return buf + read_file("blur_effect.comp");
+}
+
+void SingleBlurPassComputeEffect::inform_input_size(unsigned input_num, unsigned width, unsigned height)
+{
+	assert(input_num == 0);
+	this->width = width;
+	this->height = height;
+}
+
+int SingleBlurPassComputeEffect::get_support() const
+{
+	// Four sigmas out, the logistic kernel is down to about 0.3% of its peak.
+	return min(int(ceil(radius * 4.0f)), max_support);
+}
+
+void SingleBlurPassComputeEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+
+	inv_width = 1.0f / width;
+	inv_height = 1.0f / height;
+	margin = get_support();
+
+	// The same kernel as in SingleBlurPassEffect; see there for comments.
+	// We only need the right side, since it is symmetric.
+	for (int i = 0; i < max_support + 1; ++i) {
+		weights[i] = 0.0f;
+	}
+	if (radius < 1e-3) {
+		weights[0] = 1.0f;
+		return;
+	}
+	const float s = (sqrt(3.0) / M_PI) * radius;
+	float sum = 0.0f;
+	for (int i = 0; i <= margin; ++i) {
+		float z = i / (2.0 * s);
+		weights[i] = 1.0f / (cosh(z) * cosh(z));
+		sum += (i == 0) ? weights[i] : 2.0f * weights[i];
+	}
+	for (int i = 0; i <= margin; ++i) {
+		weights[i] /= sum;
+	}
+}
+
+Region SingleBlurPassComputeEffect::get_needed_input_region(unsigned input_num, const Region &output_region) const
+{
+	Region region = output_region;
+	if (direction == HORIZONTAL) {
+		const float margin_tc = get_support() / float(width);
+		region.x0 -= margin_tc;
+		region.x1 += margin_tc;
+	} else {
+		const float margin_tc = get_support() / float(height);
+		region.y0 -= margin_tc;
+		region.y1 += margin_tc;
+	}
+	return region;
+}
+
+void SingleBlurPassComputeEffect::get_compute_dimensions(unsigned output_width, unsigned output_height,
+                                                         unsigned *x, unsigned *y, unsigned *z) const
+{
+	// One workgroup for each run of group_size pixels along each line.
+	if (direction == HORIZONTAL) {
+		*x = (output_width + group_size - 1) / group_size;
+		*y = output_height;
+	} else {
+		*x = (output_height + group_size - 1) / group_size;
+		*y = output_width;
+	}
+	*z = 1;
+}
+
 }  // namespace movit
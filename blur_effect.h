@@ -13,6 +13,25 @@
 // but uglier; a tradeoff that might be worth it as part of more complicated
 // effects. This can be set only before finalization, and must be an
 // even number.
+//
+// If “use_compute_shader” is set to 1 (before finalization), and compute
+// shaders are supported, BlurEffect instead uses two copies of
+// SingleBlurPassComputeEffect, which work at full resolution with an
+// exact kernel (so num_taps is ignored) for radii up to 16; see below.
+// This is off by default, and only for when you need the exact kernel:
+// it is slower than the fragment shader version (on llvmpipe, about 2x
+// at radius 3 for 720p), and more so the larger the radius. Tiled chains (see
+// EffectChain::set_tile_size()) always use the fragment shader version.
+//
+// The fragment shader version blurs on the smallest mipmap level (ie.,
+// the input scaled down by 2x, 4x, etc.) where num_taps still reach far
+// enough, and its output is also at that resolution; whatever effect
+// uses it scales it back up by bilinear filtering. If “max_downscale_levels”
+// is set to a positive number, it goes down up to that many levels further,
+// as long as the radius stays at least two pixels at the reduced resolution,
+// trading a little accuracy for fill rate. The default is 0; GlowEffect and
+// DiffusionEffect set it to 2. Like the radius, it can be changed freely
+// after finalization. The compute shader version ignores it.
 
 #include <epoxy/gl.h>
 #include <assert.h>
@@ -25,6 +44,7 @@ namespace movit {
 
 class EffectChain;
 class Node;
+class SingleBlurPassComputeEffect;
 class SingleBlurPassEffect;
 
 class BlurEffect : public Effect {
@@ -42,6 +62,9 @@ public:
 		assert(false);
 	}
 
+	// Inserts the two blur passes; compute shader versions if asked for
+	// and supported (and the chain is not tiled), fragment shader
+	// versions otherwise.
 	void rewrite_graph(EffectChain *graph, Node *self) override;
 	bool set_float(const std::string &key, float value) override;
 	bool set_int(const std::string &key, int value) override;
@@ -51,7 +74,14 @@ private:
 
 	int num_taps;
 	float radius;
+	int max_downscale_levels;
+	int use_compute_shader;
+	bool graph_rewritten = false;
+
+	// Only one of these pairs is non-nullptr after rewrite_graph().
 	SingleBlurPassEffect *hpass, *vpass;
+	SingleBlurPassComputeEffect *compute_hpass = nullptr, *compute_vpass = nullptr;
+
 	unsigned input_width, input_height;
 };
 
@@ -88,6 +118,8 @@ public:
 		*virtual_height = this->virtual_height;
 	}
 
+	Region get_needed_input_region(unsigned input_num, const Region &output_region) const override;
+
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
 	void clear_gl_state() override;
 	
@@ -102,6 +134,55 @@ private:
 	float *uniform_samples;
 };
 
+// A compute shader version of SingleBlurPassEffect. Each workgroup computes
+// a run of pixels along one row (or column), keeping the input it needs
+// in shared memory, so that every input pixel is read only once
+// no matter how many taps use it. It convolves directly, with the same
+// logistic kernel as SingleBlurPassEffect, but with one exact weight per
+// pixel (out to four sigmas) instead of a piecewise linear approximation
+// on a mipmap level. The kernel is cut off at max_support pixels on either
+// side, so for radii above max_support / 4, it gets increasingly boxy.
+class SingleBlurPassComputeEffect : public Effect {
+public:
+	SingleBlurPassComputeEffect();
+	std::string effect_type_id() const override { return "SingleBlurPassComputeEffect"; }
+
+	std::string output_fragment_shader() override;
+
+	bool needs_srgb_primaries() const override { return false; }
+	AlphaHandling alpha_handling() const override { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
+	bool is_compute_shader() const override { return true; }
+	void get_compute_dimensions(unsigned output_width, unsigned output_height,
+	                            unsigned *x, unsigned *y, unsigned *z) const override;
+
+	void inform_input_size(unsigned input_num, unsigned width, unsigned height) override;
+
+	Region get_needed_input_region(unsigned input_num, const Region &output_region) const override;
+
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
+
+	enum Direction { HORIZONTAL = 0, VERTICAL = 1 };
+
+private:
+	// The kernel support (on each side) for the current radius.
+	int get_support() const;
+
+	// Pixels output by each workgroup; also the number of threads.
+	static constexpr int group_size = 128;
+
+	// Largest kernel support (on each side) we convolve with.
+	static constexpr int max_support = 64;
+
+	float radius;
+	Direction direction;
+	unsigned width = 1280, height = 720;
+
+	// Uniforms.
+	float weights[max_support + 1];
+	int margin;
+	float inv_width, inv_height;
+};
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_BLUR_EFFECT_H)
@@ -1,17 +1,34 @@
 // Unit tests for BlurEffect.
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
 #include <epoxy/gl.h>
 #include <math.h>
 #include <string.h>
 
+#include <memory>
+
 #include "blur_effect.h"
 #include "effect_chain.h"
 #include "gtest/gtest.h"
 #include "image_format.h"
 #include "test_util.h"
 
+using namespace std;
+
 namespace movit {
 
-TEST(BlurEffectTest, IdentityTransformDoesNothing) {
+class BlurEffectTest : public testing::TestWithParam<string> {
+protected:
+	BlurEffectTest() : disabler(GetParam() == "fragment") {}
+	bool should_skip() { return disabler.should_skip(); }
+
+private:
+	DisableComputeShadersTemporarily disabler;
+};
+
+TEST_P(BlurEffectTest, IdentityTransformDoesNothing) {
+	if (should_skip()) return;
 	const int size = 4;
 
 	float data[size * size] = {
@@ -25,6 +42,7 @@ TEST(BlurEffectTest, IdentityTransformDoesNothing) {
 	for (int num_taps = 2; num_taps < 20; num_taps += 2) {
 		EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
 		Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+		ASSERT_TRUE(blur_effect->set_int("use_compute_shader", GetParam() == "compute"));
 		ASSERT_TRUE(blur_effect->set_float("radius", 0.0f));
 		ASSERT_TRUE(blur_effect->set_int("num_taps", num_taps));
 		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
@@ -52,7 +70,8 @@ void add_blurred_point(float *out, int size, int x0, int y0, float strength, flo
 
 }  // namespace
 
-TEST(BlurEffectTest, BlurTwoDotsSmallRadius) {
+TEST_P(BlurEffectTest, BlurTwoDotsSmallRadius) {
+	if (should_skip()) return;
 	const float sigma = 3.0f;
 	const int size = 32;
 	const int x1 = 8;
@@ -72,6 +91,7 @@ TEST(BlurEffectTest, BlurTwoDotsSmallRadius) {
 
 	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
 	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	ASSERT_TRUE(blur_effect->set_int("use_compute_shader", GetParam() == "compute"));
 	ASSERT_TRUE(blur_effect->set_float("radius", sigma));
 	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
 
@@ -79,7 +99,8 @@ TEST(BlurEffectTest, BlurTwoDotsSmallRadius) {
 	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
 }
 
-TEST(BlurEffectTest, BlurTwoDotsLargeRadius) {
+TEST_P(BlurEffectTest, BlurTwoDotsLargeRadius) {
+	if (should_skip()) return;
 	const float sigma = 20.0f;  // Large enough that we will begin scaling.
 	const int size = 256;
 	const int x1 = 64;
@@ -99,13 +120,15 @@ TEST(BlurEffectTest, BlurTwoDotsLargeRadius) {
 
 	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
 	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	ASSERT_TRUE(blur_effect->set_int("use_compute_shader", GetParam() == "compute"));
 	ASSERT_TRUE(blur_effect->set_float("radius", sigma));
 	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
 
 	expect_equal(expected_data, out_data, size, size, 0.1f, 1e-3);
 }
 
-TEST(BlurEffectTest, BlurTwoDotsSmallRadiusFewerTaps) {
+TEST_P(BlurEffectTest, BlurTwoDotsSmallRadiusFewerTaps) {
+	if (should_skip()) return;
 	const float sigma = 3.0f;
 	const int size = 32;
 	const int x1 = 8;
@@ -125,6 +148,7 @@ TEST(BlurEffectTest, BlurTwoDotsSmallRadiusFewerTaps) {
 
 	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
 	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	ASSERT_TRUE(blur_effect->set_int("use_compute_shader", GetParam() == "compute"));
 	ASSERT_TRUE(blur_effect->set_float("radius", sigma));
 	ASSERT_TRUE(blur_effect->set_int("num_taps", 10));
 	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
@@ -133,4 +157,134 @@ TEST(BlurEffectTest, BlurTwoDotsSmallRadiusFewerTaps) {
 	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
 }
 
+// For larger radii, we do not compare against the exact kernel,
+// only check that the energy stays the same, that nothing moves, and that
+// the blur has the right width (standard deviation). The compute shader
+// version convolves at full resolution up to radius 16; the fragment shader
+// version moves the image by a pixel or more at these radii, due to the mipmaps.
+TEST(BlurEffectComputeTest, VeryLargeRadiusHasRightWidth) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	const int size = 1024;
+	const float strength = 1000.0f;
+
+	static float data[size * size], out_data[size * size];
+	memset(data, 0, sizeof(data));
+	data[(size / 2) * size + size / 2] = strength;
+
+	for (float sigma : { 4.0f, 10.0f, 16.0f }) {
+		EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+		ASSERT_TRUE(blur_effect->set_int("use_compute_shader", 1));
+		ASSERT_TRUE(blur_effect->set_float("radius", sigma));
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+		double sum = 0.0, sum_x = 0.0, sum_y = 0.0;
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				sum += out_data[y * size + x];
+				sum_x += out_data[y * size + x] * x;
+				sum_y += out_data[y * size + x] * y;
+			}
+		}
+		double mean_x = sum_x / sum, mean_y = sum_y / sum;
+		double var_x = 0.0, var_y = 0.0;
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				var_x += out_data[y * size + x] * (x - mean_x) * (x - mean_x);
+				var_y += out_data[y * size + x] * (y - mean_y) * (y - mean_y);
+			}
+		}
+		EXPECT_NEAR(strength, sum, strength * 0.01);
+		EXPECT_NEAR(size / 2, mean_x, 0.5);
+		EXPECT_NEAR(size / 2, mean_y, 0.5);
+		EXPECT_NEAR(sigma, sqrt(var_x / sum), sigma * 0.05);
+		EXPECT_NEAR(sigma, sqrt(var_y / sum), sigma * 0.05);
+	}
+}
+
+// Blurring at reduced resolution should give nearly the same result
+// as blurring at the resolution num_taps alone would pick, as long as
+// the radius is large enough. This also checks that max_downscale_levels
+// can be changed after finalization.
+TEST(BlurEffectTest, DownscaledBlurIsCloseToUsualResolution) {
+	const int size = 256;
+
+	// A bright square in the middle, so that we have both flat areas
+	// and sharp edges.
+	static float data[size * size], ref_data[size * size], out_data[size * size];
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			bool inside = (x >= 96 && x < 160 && y >= 96 && y < 160);
+			data[y * size + x] = inside ? 1.0f : 0.0f;
+		}
+	}
+
+	// Each of these gets to go down one more level (to half resolution,
+	// quarter and eighth, respectively) than num_taps would need.
+	for (float sigma : { 5.0f, 10.0f, 20.0f }) {
+		EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+		ASSERT_TRUE(blur_effect->set_float("radius", sigma));
+		tester.run(ref_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+		ASSERT_TRUE(blur_effect->set_int("max_downscale_levels", 2));
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+		// The vertical pass is a bit blocky at any mipmap level,
+		// so single pixels can be some way off.
+		expect_equal(ref_data, out_data, size, size, 0.15f, 1e-4);
+	}
+}
+
+TEST(BlurEffectTest, UseComputeShaderCanOnlyBeSetBeforeFinalization) {
+	float data[] = { 0.0f, 1.0f, 0.5f, 0.25f };
+	float out_data[4];
+
+	EffectChainTester tester(data, 2, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	EXPECT_FALSE(blur_effect->set_int("use_compute_shader", 2));
+	EXPECT_TRUE(blur_effect->set_int("use_compute_shader", 0));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	EXPECT_FALSE(blur_effect->set_int("use_compute_shader", 1));
+}
+
+INSTANTIATE_TEST_CASE_P(BlurEffectTest,
+                        BlurEffectTest,
+                        testing::Values("fragment", "compute"));
+
+#ifdef HAVE_BENCHMARK
+void BM_BlurEffect(benchmark::State &state, float radius, const std::string &shader_type, int max_downscale_levels)
+{
+	DisableComputeShadersTemporarily disabler(shader_type == "fragment");
+	if (disabler.should_skip(&state)) return;
+
+	unsigned width = state.range(0), height = state.range(1);
+	unique_ptr<float[]> data(new float[width * height * 4]);
+	unique_ptr<float[]> out_data(new float[width * height * 4]);
+	for (unsigned i = 0; i < width * height * 4; ++i) {
+		data[i] = rand() / (RAND_MAX + 1.0);
+	}
+
+	EffectChainTester tester(data.get(), width, height, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	ASSERT_TRUE(blur_effect->set_int("use_compute_shader", shader_type == "compute"));
+	ASSERT_TRUE(blur_effect->set_int("max_downscale_levels", max_downscale_levels));
+	ASSERT_TRUE(blur_effect->set_float("radius", radius));
+
+	tester.benchmark(state, out_data.get(), GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+}
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius3, 3.0f, "fragment", 0)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius10, 10.0f, "fragment", 0)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius10Downscaled, 10.0f, "fragment", 2)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius20, 20.0f, "fragment", 0)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius20Downscaled, 20.0f, "fragment", 2)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius100, 100.0f, "fragment", 0)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius3Compute, 3.0f, "compute", 0)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_BlurEffect, Radius16Compute, 16.0f, "compute", 0)->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
 }  // namespace movit
@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <epoxy/gl.h>
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "chain_batch.h"
+#include "effect_chain.h"
+#include "flat_input.h"
+#include "input.h"
+#include "resource_pool.h"
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+void ChainBatch::add_chain(EffectChain *chain, GLuint dest_fbo,
+                           unsigned x, unsigned y, unsigned width, unsigned height)
+{
+	assert(chain->finalized);
+	assert(width > 0 && height > 0);
+	jobs.push_back(Job{ chain, dest_fbo, {}, x, y, width, height });
+}
+
+void ChainBatch::add_chain(EffectChain *chain, const vector<EffectChain::DestinationTexture> &destinations,
+                           unsigned width, unsigned height)
+{
+	assert(chain->finalized);
+	assert(!destinations.empty());
+	jobs.push_back(Job{ chain, (GLuint)-1, destinations, 0, 0, width, height });
+}
+
+void ChainBatch::render()
+{
+	TraceScope trace_scope("render", "ChainBatch::render");
+
+	// Find FlatInputs that would upload the same data, upload it once,
+	// and let the others borrow that texture for this frame.
+	vector<FlatInput *> candidates;
+	set<FlatInput *> seen;
+	for (const Job &job : jobs) {
+		for (Input *input : job.chain->inputs) {
+			FlatInput *flat_input = dynamic_cast<FlatInput *>(input);
+			if (flat_input == nullptr || seen.count(flat_input)) {
+				continue;
+			}
+			seen.insert(flat_input);
+
+			// Inputs with textures given by the user are left alone.
+			if (flat_input->needs_upload() || flat_input->get_owns_texture()) {
+				candidates.push_back(flat_input);
+			}
+		}
+	}
+
+	vector<FlatInput *> borrowers;
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		if (candidates[i] == nullptr) {
+			continue;
+		}
+		vector<FlatInput *> group{ candidates[i] };
+		for (size_t j = i + 1; j < candidates.size(); ++j) {
+			if (candidates[j] != nullptr && candidates[i]->has_same_pixel_data(*candidates[j])) {
+				group.push_back(candidates[j]);
+				candidates[j] = nullptr;
+			}
+		}
+		if (group.size() == 1) {
+			continue;
+		}
+
+		// Prefer an input that already has the texture uploaded.
+		FlatInput *owner = group[0];
+		for (FlatInput *flat_input : group) {
+			if (!flat_input->needs_upload()) {
+				owner = flat_input;
+				break;
+			}
+		}
+		if (owner->needs_upload()) {
+			glActiveTexture(GL_TEXTURE0);
+			check_error();
+			owner->upload_texture();
+		}
+		for (FlatInput *flat_input : group) {
+			if (flat_input != owner && flat_input->needs_upload()) {
+				flat_input->set_texture_num(owner->get_texture_num());
+				borrowers.push_back(flat_input);
+			}
+		}
+	}
+
+	// Render chains with the same programs after each other.
+	// This is a stable sort, so otherwise, the order is kept.
+	vector<pair<vector<GLuint>, const Job *>> order;
+	for (const Job &job : jobs) {
+		vector<GLuint> program_signature;
+		for (Phase *phase : job.chain->phases) {
+			program_signature.push_back(phase->glsl_program_num);
+		}
+		order.emplace_back(move(program_signature), &job);
+	}
+	stable_sort(order.begin(), order.end(),
+		[](const pair<vector<GLuint>, const Job *> &a, const pair<vector<GLuint>, const Job *> &b) {
+			return a.first < b.first;
+		});
+
+	const bool final_srgb = EffectChain::setup_render_state();
+	for (const auto &signature_and_job : order) {
+		const Job &job = *signature_and_job.second;
+		EffectChain *chain = job.chain;
+		if (job.destinations.empty()) {
+			chain->render_phases(job.dest_fbo, {}, job.x, job.y, job.width, job.height, final_srgb);
+		} else if (!chain->has_dummy_effect) {
+			// Same as in EffectChain::render_to_texture().
+			GLuint texnums[4] = { 0, 0, 0, 0 };
+			for (unsigned i = 0; i < job.destinations.size() && i < 4; ++i) {
+				texnums[i] = job.destinations[i].texnum;
+			}
+			GLuint dest_fbo = chain->resource_pool->create_fbo(texnums[0], texnums[1], texnums[2], texnums[3]);
+			chain->render_phases(dest_fbo, {}, 0, 0, job.width, job.height, final_srgb);
+			chain->resource_pool->release_fbo(dest_fbo);
+		} else {
+			chain->render_phases((GLuint)-1, job.destinations, 0, 0, job.width, job.height, final_srgb);
+		}
+	}
+	EffectChain::reset_render_state();
+
+	// Give back the borrowed textures; if the pixel data is still the same
+	// on the next frame, we will simply borrow them again.
+	for (FlatInput *flat_input : borrowers) {
+		flat_input->set_texture_num(0);
+	}
+}
+
+}  // namespace movit
@@ -0,0 +1,62 @@
+#ifndef _MOVIT_CHAIN_BATCH_H
+#define _MOVIT_CHAIN_BATCH_H 1
+
+// A ChainBatch renders a number of finalized EffectChains in one go,
+// which is cheaper than calling render_to_fbo() on each of them if you have
+// many small chains, such as in a multiviewer. In particular:
+//
+//  - The basic OpenGL state that every render() sets up and tears down
+//    (dither, blending, depth test, sRGB query) is only done once.
+//  - If several chains have FlatInputs with identical pixel data (the same
+//    pointer or PBO, format and size), it is only uploaded once, and the
+//    other inputs borrow that texture for the duration of render().
+//  - Chains that use the same sequence of shader programs are rendered
+//    right after each other, to minimize program and texture switches.
+//    For this to be effective, the chains should share a ResourcePool,
+//    so that identical phases compile to the same program.
+//
+// Since the chains can be reordered, they should not render to overlapping
+// parts of the same output (a multiviewer grid is fine); other than that,
+// the results are exactly as if the chains were rendered one by one.
+// The chains are not owned by the batch.
+
+#include <epoxy/gl.h>
+#include <vector>
+
+#include "effect_chain.h"
+
+namespace movit {
+
+class ChainBatch {
+public:
+	// Render <chain> to the rectangle (x, y, width, height) of <dest_fbo>,
+	// like EffectChain::render_to_fbo() with the viewport set to that rectangle.
+	void add_chain(EffectChain *chain, GLuint dest_fbo,
+	               unsigned x, unsigned y, unsigned width, unsigned height);
+
+	// Render <chain> to the given textures, like EffectChain::render_to_texture().
+	void add_chain(EffectChain *chain, const std::vector<EffectChain::DestinationTexture> &destinations,
+	               unsigned width, unsigned height);
+
+	// Remove all chains from the batch.
+	void clear() { jobs.clear(); }
+
+	size_t size() const { return jobs.size(); }
+
+	// Render all the chains in the batch. The batch is kept, so that it can
+	// be rendered again for the next frame.
+	void render();
+
+private:
+	struct Job {
+		EffectChain *chain;
+		GLuint dest_fbo;  // (GLuint)-1 if rendering to <destinations>.
+		std::vector<EffectChain::DestinationTexture> destinations;
+		unsigned x, y, width, height;
+	};
+	std::vector<Job> jobs;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_CHAIN_BATCH_H)
@@ -3,6 +3,7 @@
 #include <Eigen/LU>
 
 #include "colorspace_conversion_effect.h"
+#include "cpu_backend.h"
 #include "d65.h"
 #include "util.h"
 
@@ -145,7 +146,7 @@ Matrix3d ColorspaceConversionEffect::get_xyz_matrix(Colorspace space)
 	return m;
 }
 
-string ColorspaceConversionEffect::output_fragment_shader()
+Matrix3d ColorspaceConversionEffect::get_conversion_matrix() const
 {
 	// Create a matrix to convert from source space -> XYZ,
 	// another matrix to convert from XYZ -> destination space,
@@ -155,10 +156,37 @@ string ColorspaceConversionEffect::output_fragment_shader()
 	// concatenation order needs to be the opposite of the operation order.
 	Matrix3d source_space_to_xyz = get_xyz_matrix(source_space);
 	Matrix3d xyz_to_destination_space = get_xyz_matrix(destination_space).inverse();
-	Matrix3d m = xyz_to_destination_space * source_space_to_xyz;
+	return xyz_to_destination_space * source_space_to_xyz;
+}
 
-	return output_glsl_mat3("PREFIX(conversion_matrix)", m) +
+string ColorspaceConversionEffect::output_fragment_shader()
+{
+	return output_glsl_mat3("PREFIX(conversion_matrix)", get_conversion_matrix()) +
 		read_file("colorspace_conversion_effect.frag");
 }
 
+void ColorspaceConversionEffect::set_cpu_state()
+{
+	cpu_conversion_matrix = get_conversion_matrix().cast<float>();
+}
+
+void ColorspaceConversionEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                                 unsigned y0, unsigned y1, float *dst) const
+{
+	// The columns of the matrix.
+	const Matrix3f &m = cpu_conversion_matrix;
+	const CPUPixel r_column(m(0, 0), m(1, 0), m(2, 0), 0.0f);
+	const CPUPixel g_column(m(0, 1), m(1, 1), m(2, 1), 0.0f);
+	const CPUPixel b_column(m(0, 2), m(1, 2), m(2, 2), 0.0f);
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			const CPUPixel p = CPUPixel::load(in + x);
+			(r_column * p.broadcast<0>() + g_column * p.broadcast<1>() + b_column * p.broadcast<2>())
+				.with_alpha_from(p).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
@@ -30,11 +30,20 @@ public:
 	AlphaHandling alpha_handling() const override { return DONT_CARE_ALPHA_TYPE; }
 	bool strong_one_to_one_sampling() const override { return true; }
 
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 	// Get a conversion matrix from the given color space to XYZ.
 	static Eigen::Matrix3d get_xyz_matrix(Colorspace space);
 
 private:
+	// The matrix converting from source_space to destination_space.
+	Eigen::Matrix3d get_conversion_matrix() const;
+
 	Colorspace source_space, destination_space;
+	Eigen::Matrix3f cpu_conversion_matrix;  // Set by set_cpu_state().
 };
 
 }  // namespace movit
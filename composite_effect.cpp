@@ -0,0 +1,230 @@
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "composite_effect.h"
+#include "effect_chain.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Texture units we leave for other effects that end up in the same phase
+// as a composite pass (e.g. the dither texture, or lookup tables).
+const int reserved_samplers = 4;
+
+}  // namespace
+
+CompositeEffect::CompositeEffect(unsigned num_layers)
+	: num_layers(num_layers),
+	  layers(num_layers),
+	  output_width(1280),
+	  output_height(720),
+	  max_layers_per_phase(0)
+{
+	assert(num_layers >= 1);
+	register_int("width", &output_width);
+	register_int("height", &output_height);
+	register_int("max_layers_per_phase", &max_layers_per_phase);
+
+	for (unsigned i = 0; i < num_layers; ++i) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "left_%u", i);
+		register_float(buf, &layers[i].left);
+		snprintf(buf, sizeof(buf), "top_%u", i);
+		register_float(buf, &layers[i].top);
+		snprintf(buf, sizeof(buf), "width_%u", i);
+		register_float(buf, &layers[i].width);
+		snprintf(buf, sizeof(buf), "height_%u", i);
+		register_float(buf, &layers[i].height);
+		snprintf(buf, sizeof(buf), "opacity_%u", i);
+		register_float(buf, &layers[i].opacity);
+		snprintf(buf, sizeof(buf), "blend_mode_%u", i);
+		register_int(buf, &layers[i].blend_mode);
+	}
+}
+
+void CompositeEffect::rewrite_graph(EffectChain *graph, Node *self)
+{
+	unsigned layers_per_phase = max_layers_per_phase;
+	if (layers_per_phase == 0) {
+		GLint max_texture_units;
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_texture_units);
+		check_error();
+		layers_per_phase = max(max_texture_units - reserved_samplers, 2);
+	}
+	assert(layers_per_phase >= 2);
+
+	// Take ourselves out of the graph; the passes will be connected
+	// to the layers instead. (A layer could be connected to us more than
+	// once, so we cannot use replace_receiver() one link at a time.)
+	vector<Node *> layer_nodes = self->incoming_links;
+	for (Node *sender : layer_nodes) {
+		vector<Node *> &links = sender->outgoing_links;
+		links.erase(remove(links.begin(), links.end(), self), links.end());
+	}
+	self->incoming_links.clear();
+
+	// The first pass takes as many layers as it can; the next ones
+	// need one sampler for the previous pass, so they get one less.
+	Node *prev_pass_node = nullptr;
+	unsigned first_layer = 0;
+	while (first_layer < num_layers) {
+		unsigned capacity = (prev_pass_node == nullptr) ? layers_per_phase : layers_per_phase - 1;
+		unsigned pass_layers = min(capacity, num_layers - first_layer);
+		Node *pass_node = graph->add_node(
+			new SingleCompositePassEffect(this, first_layer, pass_layers, prev_pass_node != nullptr));
+		if (prev_pass_node != nullptr) {
+			graph->connect_nodes(prev_pass_node, pass_node);
+		}
+		for (unsigned i = 0; i < pass_layers; ++i) {
+			graph->connect_nodes(layer_nodes[first_layer + i], pass_node);
+		}
+		prev_pass_node = pass_node;
+		first_layer += pass_layers;
+	}
+	graph->replace_sender(self, prev_pass_node);
+	self->disabled = true;
+}
+
+SingleCompositePassEffect::SingleCompositePassEffect(const CompositeEffect *parent, unsigned first_layer, unsigned num_layers, bool has_base)
+	: parent(parent),
+	  first_layer(first_layer),
+	  num_layers(num_layers),
+	  has_base(has_base),
+	  input_sizes(num_inputs()),
+	  uniform_rects(num_layers * 4),
+	  uniform_inv_sizes(num_layers * 2),
+	  uniform_opacities(num_layers)
+{
+	register_uniform_vec2("output_size", uniform_output_size);
+	register_uniform_vec4_array("rects", uniform_rects.data(), num_layers);
+	register_uniform_vec2_array("inv_sizes", uniform_inv_sizes.data(), num_layers);
+	register_uniform_float_array("opacities", uniform_opacities.data(), num_layers);
+}
+
+string SingleCompositePassEffect::output_fragment_shader()
+{
+	string layer_code;
+	for (unsigned i = 0; i < num_layers; ++i) {
+		const char *blend_func = nullptr;
+		switch (parent->layers[first_layer + i].blend_mode) {
+		case CompositeEffect::BLEND_NORMAL:
+			blend_func = "blend_normal";
+			break;
+		case CompositeEffect::BLEND_ADD:
+			blend_func = "blend_add";
+			break;
+		case CompositeEffect::BLEND_MULTIPLY:
+			blend_func = "blend_multiply";
+			break;
+		case CompositeEffect::BLEND_SCREEN:
+			blend_func = "blend_screen";
+			break;
+		default:
+			assert(false);
+		}
+
+		char input_name[32];
+		if (num_inputs() == 1) {
+			snprintf(input_name, sizeof(input_name), "INPUT");
+		} else {
+			snprintf(input_name, sizeof(input_name), "INPUT%u", i + (has_base ? 2 : 1));
+		}
+
+		// This all needs to go on one line, since it is part of a #define.
+		char buf[512];
+		snprintf(buf, sizeof(buf),
+			"alpha = PREFIX(layer_alpha)(pos, PREFIX(rects)[%u], PREFIX(opacities)[%u]); "
+			"if (alpha > 0.0) { "
+			"result = PREFIX(%s)(alpha * %s(PREFIX(layer_tc)(pos, PREFIX(rects)[%u], PREFIX(inv_sizes)[%u])), result); "
+			"} ",
+			i, i, blend_func, input_name, i, i);
+		layer_code += buf;
+	}
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "#define HAS_BASE %d\n#define NUM_LAYERS %u\n", has_base, num_layers);
+	return buf + ("#define COMPOSITE_LAYERS " + layer_code + "\n") + read_file("composite_effect.frag");
+}
+
+void SingleCompositePassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+
+	uniform_output_size[0] = parent->output_width;
+	uniform_output_size[1] = parent->output_height;
+	for (unsigned i = 0; i < num_layers; ++i) {
+		float x0, y0, x1, y1;
+		get_layer_rect(i, &x0, &y0, &x1, &y1);
+		uniform_rects[i * 4 + 0] = x0;
+		uniform_rects[i * 4 + 1] = y0;
+		uniform_rects[i * 4 + 2] = x1;
+		uniform_rects[i * 4 + 3] = y1;
+
+		// An empty rectangle never gets sampled, so the scale does not matter.
+		uniform_inv_sizes[i * 2 + 0] = (x1 > x0) ? 1.0f / (x1 - x0) : 0.0f;
+		uniform_inv_sizes[i * 2 + 1] = (y1 > y0) ? 1.0f / (y1 - y0) : 0.0f;
+		uniform_opacities[i] = parent->layers[first_layer + i].opacity;
+	}
+}
+
+void SingleCompositePassEffect::get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const
+{
+	*virtual_width = *width = parent->output_width;
+	*virtual_height = *height = parent->output_height;
+}
+
+void SingleCompositePassEffect::inform_input_size(unsigned input_num, unsigned width, unsigned height)
+{
+	assert(input_num < input_sizes.size());
+	input_sizes[input_num] = make_pair(width, height);
+}
+
+void SingleCompositePassEffect::get_layer_rect(unsigned layer_num, float *x0, float *y0, float *x1, float *y1) const
+{
+	const CompositeEffect::Layer &layer = parent->layers[first_layer + layer_num];
+	const pair<unsigned, unsigned> &input_size = input_sizes[layer_num + (has_base ? 1 : 0)];
+	float width = (layer.width > 0.0f) ? layer.width : input_size.first;
+	float height = (layer.height > 0.0f) ? layer.height : input_size.second;
+	*x0 = layer.left;
+	*x1 = layer.left + width;
+	*y0 = parent->output_height - layer.top - height;
+	*y1 = parent->output_height - layer.top;
+}
+
+Region SingleCompositePassEffect::get_needed_input_region(unsigned input_num, const Region &output_region) const
+{
+	if (has_base) {
+		if (input_num == 0) {
+			return output_region;
+		}
+		--input_num;
+	}
+
+	// The part of the layer's rectangle that is in the output region,
+	// in the layer's own coordinates.
+	float x0, y0, x1, y1;
+	get_layer_rect(input_num, &x0, &y0, &x1, &y1);
+	if (x1 <= x0 || y1 <= y0) {
+		return Region();
+	}
+	const float out_width = parent->output_width, out_height = parent->output_height;
+	Region needed(max(output_region.x0 * out_width, x0),
+	              max(output_region.y0 * out_height, y0),
+	              min(output_region.x1 * out_width, x1),
+	              min(output_region.y1 * out_height, y1));
+	if (needed.empty()) {
+		return Region();
+	}
+	return Region((needed.x0 - x0) / (x1 - x0),
+	              (needed.y0 - y0) / (y1 - y0),
+	              (needed.x1 - x0) / (x1 - x0),
+	              (needed.y1 - y0) / (y1 - y0));
+}
+
+}  // namespace movit
@@ -0,0 +1,63 @@
+// One pass of CompositeEffect; see composite_effect.h. HAS_BASE is
+// #defined to 1 if the first input is the output of the previous pass,
+// NUM_LAYERS is the number of layers in this pass, and COMPOSITE_LAYERS
+// is the code that draws them in order, all from the C++ code.
+
+// Implicit uniforms:
+// uniform vec2 PREFIX(output_size);
+// uniform vec4 PREFIX(rects)[NUM_LAYERS];  // x0, y0, x1, y1 in output pixels.
+// uniform vec2 PREFIX(inv_sizes)[NUM_LAYERS];
+// uniform float PREFIX(opacities)[NUM_LAYERS];
+
+// How much of the pixel centered at <pos> the layer covers,
+// times the layer's opacity. (See also PaddingEffect.)
+float PREFIX(layer_alpha)(vec2 pos, vec4 rect, float opacity)
+{
+	vec2 coverage = clamp(min(pos + 0.5, rect.zw) - max(pos - 0.5, rect.xy), 0.0, 1.0);
+	return coverage.x * coverage.y * opacity;
+}
+
+vec2 PREFIX(layer_tc)(vec2 pos, vec4 rect, vec2 inv_size)
+{
+	return (pos - rect.xy) * inv_size;
+}
+
+// The blend functions take and give premultiplied alpha; all of them
+// have the same alpha as “over”. See e.g. the W3C Compositing and
+// Blending specification for the formulas.
+vec4 PREFIX(blend_normal)(vec4 top, vec4 bottom)
+{
+	return top + (1.0 - top.a) * bottom;
+}
+
+vec4 PREFIX(blend_add)(vec4 top, vec4 bottom)
+{
+	return vec4(top.rgb + bottom.rgb, top.a + (1.0 - top.a) * bottom.a);
+}
+
+vec4 PREFIX(blend_multiply)(vec4 top, vec4 bottom)
+{
+	vec3 rgb = top.rgb * bottom.rgb + (1.0 - bottom.a) * top.rgb + (1.0 - top.a) * bottom.rgb;
+	return vec4(rgb, top.a + (1.0 - top.a) * bottom.a);
+}
+
+vec4 PREFIX(blend_screen)(vec4 top, vec4 bottom)
+{
+	return vec4(top.rgb + bottom.rgb - top.rgb * bottom.rgb, top.a + (1.0 - top.a) * bottom.a);
+}
+
+vec4 FUNCNAME(vec2 tc) {
+	vec2 pos = tc * PREFIX(output_size);
+#if HAS_BASE
+	vec4 result = INPUT1(tc);
+#else
+	vec4 result = vec4(0.0);
+#endif
+	float alpha;
+	COMPOSITE_LAYERS
+	return result;
+}
+
+#undef HAS_BASE
+#undef NUM_LAYERS
+#undef COMPOSITE_LAYERS
@@ -0,0 +1,140 @@
+#ifndef _MOVIT_COMPOSITE_EFFECT_H
+#define _MOVIT_COMPOSITE_EFFECT_H 1
+
+// Composites any number of layers on top of each other in one effect,
+// each with its own placement rectangle, opacity and blend mode. This is
+// what you would otherwise build from a cascade of OverlayEffect (or
+// MixEffect) nodes, with a PaddingEffect or ResizeEffect in front of each
+// layer that is not full-frame, but it is done in as few passes as possible,
+// and pixels outside a layer's rectangle never sample that layer.
+//
+// The first input is the bottom layer. The output is “width” x “height”
+// pixels (default 1280x720), and transparent wherever no layer covers it.
+// For each layer N (counting from zero), the following parameters exist:
+//
+//   - “left_N”, “top_N”: The position of the layer's upper-left corner,
+//     in output pixels. Default 0.
+//   - “width_N”, “height_N”: The size the layer is stretched to, in
+//     output pixels. Default 0, meaning the layer's own size.
+//   - “opacity_N”: Multiplied onto the layer (including alpha) before
+//     blending. Default 1.
+//   - “blend_mode_N”: One of the BlendMode values below. Default BLEND_NORMAL.
+//     This one cannot be changed after finalize().
+//
+// Fractional placement gives antialiased edges, like PaddingEffect.
+// The layers are sampled bilinearly, with no mipmaps, so if you scale
+// a layer down by much more than 2x, you should put a ResampleEffect
+// in front of it.
+//
+// All the layers of one pass need their own texture sampler, so if there
+// are more layers than there are texture units, the layers are split
+// between a number of passes, each drawing on top of the output of the
+// previous one; this is the minimum number of intermediate textures the
+// sampler limit allows. The limit is normally taken from
+// GL_MAX_TEXTURE_IMAGE_UNITS, keeping some for other effects that end up
+// in the same phase, but it can be lowered using “max_layers_per_phase”
+// (which must be set before finalize()).
+
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "effect.h"
+
+namespace movit {
+
+class EffectChain;
+class Node;
+class SingleCompositePassEffect;
+
+class CompositeEffect : public Effect {
+public:
+	CompositeEffect(unsigned num_layers);
+	std::string effect_type_id() const override { return "CompositeEffect"; }
+
+	std::string output_fragment_shader() override {
+		assert(false);
+	}
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override {
+		assert(false);
+	}
+
+	unsigned num_inputs() const override { return num_layers; }
+
+	// Replaces ourselves with one or more SingleCompositePassEffects.
+	void rewrite_graph(EffectChain *graph, Node *self) override;
+
+	enum BlendMode {
+		// Porter-Duff “over”, like OverlayEffect.
+		BLEND_NORMAL = 0,
+
+		// The layer is added to what is below it.
+		BLEND_ADD = 1,
+
+		// The layer is multiplied with what is below it (darkens).
+		BLEND_MULTIPLY = 2,
+
+		// The inverse of multiplying the inverses (lightens).
+		BLEND_SCREEN = 3,
+	};
+
+private:
+	friend class SingleCompositePassEffect;
+
+	struct Layer {
+		float left = 0.0f, top = 0.0f;
+		float width = 0.0f, height = 0.0f;
+		float opacity = 1.0f;
+		int blend_mode = BLEND_NORMAL;
+	};
+
+	unsigned num_layers;
+	std::vector<Layer> layers;
+	int output_width, output_height;
+	int max_layers_per_phase;
+};
+
+// One pass of CompositeEffect; draws the layers <first_layer> up to
+// (but not including) <first_layer> + <num_layers> of the parent.
+// If <has_base> is true, the first input is the output of the previous
+// pass, which is drawn underneath (full-frame, no blending).
+class SingleCompositePassEffect : public Effect {
+public:
+	SingleCompositePassEffect(const CompositeEffect *parent, unsigned first_layer, unsigned num_layers, bool has_base);
+	std::string effect_type_id() const override { return "SingleCompositePassEffect"; }
+
+	std::string output_fragment_shader() override;
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
+
+	unsigned num_inputs() const override { return num_layers + (has_base ? 1 : 0); }
+
+	// We sample the layers wherever their rectangles say.
+	bool needs_texture_bounce() const override { return true; }
+
+	bool changes_output_size() const override { return true; }
+	bool sets_virtual_output_size() const override { return false; }
+	void get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const override;
+	void inform_input_size(unsigned input_num, unsigned width, unsigned height) override;
+	Region get_needed_input_region(unsigned input_num, const Region &output_region) const override;
+
+private:
+	// The layer's rectangle in output pixels, with (0,0) in the lower-left
+	// corner (the same way up as texture coordinates).
+	void get_layer_rect(unsigned layer_num, float *x0, float *y0, float *x1, float *y1) const;
+
+	const CompositeEffect *parent;
+	unsigned first_layer, num_layers;
+	bool has_base;
+
+	// Indexed by input number.
+	std::vector<std::pair<unsigned, unsigned>> input_sizes;
+
+	float uniform_output_size[2];
+	std::vector<float> uniform_rects, uniform_inv_sizes, uniform_opacities;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_COMPOSITE_EFFECT_H)
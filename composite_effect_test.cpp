@@ -0,0 +1,241 @@
+// Unit tests for CompositeEffect.
+
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+#include <epoxy/gl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "composite_effect.h"
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "image_format.h"
+#include "input.h"
+#include "test_util.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+void set_layer_float(Effect *effect, const char *key, unsigned layer_num, float value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s_%u", key, layer_num);
+	CHECK(effect->set_float(buf, value));
+}
+
+}  // namespace
+
+TEST(CompositeEffectTest, NormalBlendIsOver) {
+	float bottom[] = {
+		1.0f, 0.0f, 0.0f, 1.0f,
+		0.0f, 0.25f, 0.0f, 0.5f,
+	};
+	float top[] = {
+		0.0f, 0.0f, 0.5f, 0.5f,
+		0.0f, 0.0f, 0.0f, 0.0f,
+	};
+	float expected_data[] = {
+		0.5f, 0.0f, 0.5f, 1.0f,
+		0.0f, 0.25f, 0.0f, 0.5f,
+	};
+	float out_data[2 * 4];
+
+	EffectChainTester tester(nullptr, 2, 1);
+	Effect *input1 = tester.add_input(bottom, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, 2, 1);
+	Effect *input2 = tester.add_input(top, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, 2, 1);
+	Effect *effect = tester.get_chain()->add_effect(new CompositeEffect(2), input1, input2);
+	CHECK(effect->set_int("width", 2));
+	CHECK(effect->set_int("height", 1));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	expect_equal(expected_data, out_data, 2 * 4, 1);
+}
+
+TEST(CompositeEffectTest, PlacementAndScaling) {
+	// A single pixel stretched to cover the output,
+	// and a 2x2 image in the middle at its own size.
+	float background[] = { 0.2f };
+	float foreground[] = {
+		1.0f, 0.5f,
+		0.8f, 0.3f,
+	};
+	float expected_data[4 * 4] = {
+		0.2f, 0.2f, 0.2f, 0.2f,
+		0.2f, 1.0f, 0.5f, 0.2f,
+		0.2f, 0.8f, 0.3f, 0.2f,
+		0.2f, 0.2f, 0.2f, 0.2f,
+	};
+	float out_data[4 * 4];
+
+	EffectChainTester tester(nullptr, 4, 4);
+	Effect *input1 = tester.add_input(background, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, 1, 1);
+	Effect *input2 = tester.add_input(foreground, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, 2, 2);
+	Effect *effect = tester.get_chain()->add_effect(new CompositeEffect(2), input1, input2);
+	CHECK(effect->set_int("width", 4));
+	CHECK(effect->set_int("height", 4));
+	set_layer_float(effect, "width", 0, 4.0f);
+	set_layer_float(effect, "height", 0, 4.0f);
+	set_layer_float(effect, "left", 1, 1.0f);
+	set_layer_float(effect, "top", 1, 1.0f);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	expect_equal(expected_data, out_data, 4, 4);
+}
+
+TEST(CompositeEffectTest, UncoveredPixelsAreTransparent) {
+	float data[] = {
+		1.0f, 0.0f, 0.0f, 1.0f,
+	};
+	float expected_data[] = {
+		0.0f, 0.0f, 0.0f, 0.0f,
+		1.0f, 0.0f, 0.0f, 1.0f,
+		0.0f, 0.0f, 0.0f, 0.0f,
+	};
+	float out_data[3 * 4];
+
+	EffectChainTester tester(nullptr, 3, 1);
+	tester.add_input(data, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, 1, 1);
+	Effect *effect = tester.get_chain()->add_effect(new CompositeEffect(1));
+	CHECK(effect->set_int("width", 3));
+	CHECK(effect->set_int("height", 1));
+	set_layer_float(effect, "left", 0, 1.0f);
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	expect_equal(expected_data, out_data, 3 * 4, 1);
+}
+
+TEST(CompositeEffectTest, BlendModesWithOpacity) {
+	float bottom[] = {
+		0.4f, 0.2f, 0.8f, 1.0f,
+		0.2f, 0.1f, 0.0f, 0.5f,
+	};
+	float top[] = {
+		0.5f, 0.5f, 0.0f, 1.0f,
+		0.25f, 0.0f, 0.25f, 0.5f,
+	};
+	const float opacity = 0.5f;
+
+	for (int blend_mode : { CompositeEffect::BLEND_ADD, CompositeEffect::BLEND_MULTIPLY, CompositeEffect::BLEND_SCREEN }) {
+		float expected_data[2 * 4];
+		for (unsigned i = 0; i < 2; ++i) {
+			const float *b = bottom + i * 4;
+			float t[4];
+			for (unsigned c = 0; c < 4; ++c) {
+				t[c] = top[i * 4 + c] * opacity;
+			}
+			for (unsigned c = 0; c < 3; ++c) {
+				float result;
+				if (blend_mode == CompositeEffect::BLEND_ADD) {
+					result = t[c] + b[c];
+				} else if (blend_mode == CompositeEffect::BLEND_MULTIPLY) {
+					result = t[c] * b[c] + (1.0f - b[3]) * t[c] + (1.0f - t[3]) * b[c];
+				} else {
+					result = t[c] + b[c] - t[c] * b[c];
+				}
+				expected_data[i * 4 + c] = result;
+			}
+			expected_data[i * 4 + 3] = t[3] + (1.0f - t[3]) * b[3];
+		}
+		float out_data[2 * 4];
+
+		EffectChainTester tester(nullptr, 2, 1, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA32F);
+		Effect *input1 = tester.add_input(bottom, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, 2, 1);
+		Effect *input2 = tester.add_input(top, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, 2, 1);
+		Effect *effect = tester.get_chain()->add_effect(new CompositeEffect(2), input1, input2);
+		CHECK(effect->set_int("width", 2));
+		CHECK(effect->set_int("height", 1));
+		CHECK(effect->set_int("blend_mode_1", blend_mode));
+		set_layer_float(effect, "opacity", 1, opacity);
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+		expect_equal(expected_data, out_data, 2 * 4, 1);
+	}
+}
+
+TEST(CompositeEffectTest, SplitsIntoMinimumNumberOfPhases) {
+	// Seven half-transparent layers, three per phase. The first phase
+	// takes three, and the next two take two each (plus the previous phase).
+	const unsigned num_layers = 7;
+	float layer_data[num_layers][4];
+	float expected_data[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (unsigned i = 0; i < num_layers; ++i) {
+		layer_data[i][0] = 0.5f * ((i & 1) ? 1.0f : 0.0f);
+		layer_data[i][1] = 0.5f * ((i & 2) ? 1.0f : 0.0f);
+		layer_data[i][2] = 0.5f * ((i & 4) ? 1.0f : 0.0f);
+		layer_data[i][3] = 0.5f;
+		for (unsigned c = 0; c < 4; ++c) {
+			expected_data[c] = layer_data[i][c] + 0.5f * expected_data[c];
+		}
+	}
+	float out_data[4];
+
+	EffectChainTester tester(nullptr, 1, 1, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA32F);
+	vector<Effect *> inputs;
+	for (unsigned i = 0; i < num_layers; ++i) {
+		inputs.push_back(tester.add_input(layer_data[i], FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, 1, 1));
+	}
+	Effect *effect = tester.get_chain()->add_effect(new CompositeEffect(num_layers), inputs);
+	CHECK(effect->set_int("width", 1));
+	CHECK(effect->set_int("height", 1));
+	CHECK(effect->set_int("max_layers_per_phase", 3));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	expect_equal(expected_data, out_data, 4, 1);
+
+	set<Phase *> phases;
+	for (Effect *input : inputs) {
+		Node *node = tester.get_chain()->find_node_for_effect(input);
+		ASSERT_EQ(1u, node->outgoing_links.size());
+		phases.insert(node->outgoing_links[0]->containing_phase);
+	}
+	EXPECT_EQ(3u, phases.size());
+}
+
+#ifdef HAVE_BENCHMARK
+// Picture-in-picture; a full-frame background and <num_layers> - 1
+// quarter-size layers, spread out over the frame.
+void BM_CompositeEffect(benchmark::State &state)
+{
+	const unsigned width = 1280, height = 720;
+	const unsigned num_layers = state.range(0);
+
+	unique_ptr<float[]> background(new float[width * height * 4]);
+	unique_ptr<float[]> layer(new float[(width / 4) * (height / 4) * 4]);
+	unique_ptr<float[]> out_data(new float[width * height * 4]);
+	for (unsigned i = 0; i < width * height * 4; ++i) {
+		background[i] = rand() / (RAND_MAX + 1.0);
+	}
+	for (unsigned i = 0; i < (width / 4) * (height / 4) * 4; ++i) {
+		layer[i] = rand() / (RAND_MAX + 1.0);
+	}
+
+	EffectChainTester tester(nullptr, width, height, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	vector<Effect *> inputs;
+	inputs.push_back(tester.add_input(background.get(), FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, width, height));
+	for (unsigned i = 1; i < num_layers; ++i) {
+		inputs.push_back(tester.add_input(layer.get(), FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, width / 4, height / 4));
+	}
+	Effect *effect = tester.get_chain()->add_effect(new CompositeEffect(num_layers), inputs);
+	CHECK(effect->set_int("width", width));
+	CHECK(effect->set_int("height", height));
+	for (unsigned i = 1; i < num_layers; ++i) {
+		set_layer_float(effect, "left", i, ((i - 1) % 4) * (width / 4));
+		set_layer_float(effect, "top", i, ((i - 1) / 4 % 4) * (height / 4));
+	}
+
+	tester.benchmark(state, out_data.get(), GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+}
+BENCHMARK(BM_CompositeEffect)->Arg(2)->Arg(5)->Arg(10)->Arg(17)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
+}  // namespace movit
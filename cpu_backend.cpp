@@ -0,0 +1,204 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu_backend.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// How many bytes each strip should touch, at most. The effect chain
+// counts only one row buffer, since there is typically one for each
+// effect in a phase and we want them all to stay in the L2 cache,
+// from one effect to the next.
+const size_t strip_bytes = 64 << 10;
+
+// A set of threads, one less than the number of CPU cores, that run
+// the tasks of parallel_for_strips(), together with the thread calling it.
+// They live for as long as the process, so that a render does not need
+// to start (and wait for) new threads every time.
+//
+// Several calls can run at the same time (e.g. for different EffectChains
+// in different threads); their tasks are handed out oldest call first.
+// Each task is a strip, and takes tens of microseconds at the very least,
+// so we can afford to take a lock for each.
+class WorkerPool {
+public:
+	WorkerPool();
+	~WorkerPool();
+
+	// Calls func(0), func(1), ..., func(num_tasks - 1), and returns
+	// when they are all done.
+	void run(unsigned num_tasks, const function<void(unsigned)> &func);
+
+private:
+	struct Job {
+		const function<void(unsigned)> *func;
+		unsigned num_tasks;
+		unsigned next_task, tasks_done;
+	};
+
+	void worker_thread();
+
+	// Hands out the next task of <job> (whose tasks must not all have
+	// been handed out yet), and runs it. <lock> must be held on <mu>,
+	// but is released while the task runs.
+	void run_one_task(Job *job, unique_lock<mutex> *lock);
+
+	mutex mu;
+	condition_variable work_available, work_done;  // Under <mu>.
+	deque<Job *> jobs;  // Under <mu>. Only those with tasks left to hand out.
+	bool quit = false;  // Under <mu>.
+	vector<thread> threads;
+};
+
+WorkerPool::WorkerPool()
+{
+	const unsigned num_threads = max(thread::hardware_concurrency(), 1u) - 1;
+	for (unsigned i = 0; i < num_threads; ++i) {
+		threads.emplace_back(&WorkerPool::worker_thread, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> lock(mu);
+		quit = true;
+	}
+	work_available.notify_all();
+	for (thread &t : threads) {
+		t.join();
+	}
+}
+
+void WorkerPool::run(unsigned num_tasks, const function<void(unsigned)> &func)
+{
+	if (num_tasks == 0) {
+		return;
+	}
+	Job job{ &func, num_tasks, 0, 0 };
+	unique_lock<mutex> lock(mu);
+	if (num_tasks > 1) {
+		jobs.push_back(&job);
+		work_available.notify_all();
+	}
+
+	// Help out with our own job, and then wait for the tasks
+	// the other threads took, if any.
+	while (job.next_task < job.num_tasks) {
+		run_one_task(&job, &lock);
+	}
+	work_done.wait(lock, [&job] { return job.tasks_done == job.num_tasks; });
+}
+
+void WorkerPool::worker_thread()
+{
+	unique_lock<mutex> lock(mu);
+	for ( ;; ) {
+		work_available.wait(lock, [this] { return quit || !jobs.empty(); });
+		if (quit) {
+			return;
+		}
+		run_one_task(jobs.front(), &lock);
+	}
+}
+
+void WorkerPool::run_one_task(Job *job, unique_lock<mutex> *lock)
+{
+	const unsigned task = job->next_task++;
+	if (job->next_task == job->num_tasks) {
+		auto it = find(jobs.begin(), jobs.end(), job);
+		if (it != jobs.end()) {
+			jobs.erase(it);
+		}
+	}
+
+	lock->unlock();
+	(*job->func)(task);
+	lock->lock();
+
+	// Once this is done, the caller of run() can return at any time,
+	// so we cannot touch <job> after it.
+	if (++job->tasks_done == job->num_tasks) {
+		work_done.notify_all();
+	}
+}
+
+}  // namespace
+
+void CPUImage::sample_bilinear(float x, float y, float *rgba) const
+{
+	assert(y_begin == 0 && y_end == height);
+
+	// Clamp before converting to integer, in case of huge (or NaN) coordinates.
+	const float fx = min(max(x * width - 0.5f, -1.0f), float(width));
+	const float fy = min(max(y * height - 0.5f, -1.0f), float(height));
+	const int ix = int(floorf(fx)), iy = int(floorf(fy));
+	const float wx = fx - ix, wy = fy - iy;
+
+	const unsigned x0 = min<int>(max(ix, 0), width - 1), x1 = min<int>(max(ix + 1, 0), width - 1);
+	const unsigned y0 = min<int>(max(iy, 0), height - 1), y1 = min<int>(max(iy + 1, 0), height - 1);
+	const CPUPixel p00 = CPUPixel::load(row(y0) + x0 * 4), p01 = CPUPixel::load(row(y0) + x1 * 4);
+	const CPUPixel p10 = CPUPixel::load(row(y1) + x0 * 4), p11 = CPUPixel::load(row(y1) + x1 * 4);
+	const CPUPixel bottom = p00 + CPUPixel(wx) * (p01 - p00);
+	const CPUPixel top = p10 + CPUPixel(wx) * (p11 - p10);
+	(bottom + CPUPixel(wy) * (top - bottom)).store(rgba);
+}
+
+void resample_cpu_rows(const CPUImage &src, unsigned width, unsigned height,
+                       unsigned y0, unsigned y1, float *dst)
+{
+	if (src.width == width && src.height == height) {
+		for (unsigned y = y0; y < y1; ++y) {
+			memcpy(dst + size_t(y - y0) * width * 4, src.row(y), width * 4 * sizeof(float));
+		}
+		return;
+	}
+	for (unsigned y = y0; y < y1; ++y) {
+		const float tc_y = (y + 0.5f) / height;
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width; ++x) {
+			src.sample_bilinear((x + 0.5f) / width, tc_y, out + x * 4);
+		}
+	}
+}
+
+void parallel_for_strips(size_t bytes_per_row, unsigned height,
+                         const function<void(unsigned, unsigned)> &func)
+{
+	static WorkerPool pool;
+
+	const unsigned rows_per_strip = max<size_t>(strip_bytes / max<size_t>(bytes_per_row, 1), 1);
+	const unsigned num_strips = (height + rows_per_strip - 1) / rows_per_strip;
+
+	// The strips are handed out one by one, so that a thread that happens
+	// to get the cheap ones (e.g. all border) does not sit idle.
+	pool.run(num_strips, [&](unsigned strip) {
+		const unsigned y0 = strip * rows_per_strip;
+		func(y0, min(y0 + rows_per_strip, height));
+	});
+}
+
+float srgb8_to_linear(unsigned char x)
+{
+	static const vector<float> table = [] {
+		vector<float> table(256);
+		for (unsigned i = 0; i < 256; ++i) {
+			const double v = i / 255.0;
+			table[i] = (v <= 0.04045) ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+		}
+		return table;
+	}();
+	return table[x];
+}
+
+}  // namespace movit
@@ -0,0 +1,227 @@
+#ifndef _MOVIT_CPU_BACKEND_H
+#define _MOVIT_CPU_BACKEND_H 1
+
+// Support code for running an EffectChain on the CPU instead of through
+// OpenGL (see EffectChain::set_backend()). Effects that can do this implement
+// Effect::render_cpu_rows(), which works on RGBA float pixels, a strip of rows
+// at a time; the helpers here are for them and for EffectChain itself.
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <functional>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace movit {
+
+// A view of (part of) an RGBA float image, as given to and produced by
+// Effect::render_cpu_rows(). Rows are numbered from the bottom, like in
+// OpenGL, and stored one after the other, <width> * 4 floats each;
+// only rows <y_begin> up to (but not including) <y_end> are present.
+struct CPUImage {
+	const float *pixels;
+	unsigned width, height;
+	unsigned y_begin, y_end;
+
+	const float *row(unsigned y) const
+	{
+		assert(y >= y_begin && y < y_end);
+		return pixels + size_t(y - y_begin) * width * 4;
+	}
+
+	// Sample the image at normalized coordinates (x, y) the way the GPU
+	// would with GL_LINEAR and GL_CLAMP_TO_EDGE, ie., bilinearly between
+	// the four nearest pixel centers. All rows must be present.
+	void sample_bilinear(float x, float y, float *rgba) const;
+};
+
+// Four floats, typically the R, G, B and A of one pixel, that the CPU kernels
+// do their arithmetic on all at once. With SSE2 (which all x86-64 CPUs have),
+// this is one register; otherwise, it is a plain array, and the compiler is
+// on its own. (GCC does not vectorize the pixel loops of the kernels by
+// itself at -O2, since each iteration works on one four-channel pixel.)
+//
+// The interface is the same for both:
+//
+//   CPUPixel(x), CPUPixel(r, g, b, a): All four set to x, or the given values.
+//   CPUPixel::load(src), p.store(dst): From or to four floats in memory.
+//   p.broadcast<c>(): All four set to channel c of p.
+//   p.with_alpha_from(q): R, G and B from p, and alpha from q.
+//   +, -, *, /: For each channel.
+//   min(a, b), max(a, b): For each channel, (a < b) ? a : b and (a > b) ? a : b,
+//     respectively, so if a is NaN, you get b, like the SSE instructions do.
+//   select_greater(a, b, t, f): For each channel, (a > b) ? t : f.
+//   sqrt(x).
+//   pow(x, y): x^y, for finite x >= 0. With SSE2, this is computed as
+//     2^(y log2 x) with polynomials, accurate to about 1e-6 (relative),
+//     which is far better than the GPUs' pow(); x = 0 gives a tiny positive
+//     number (2^-127 or so to the power of y) instead of 0.
+//
+// The functions are only found through argument-dependent lookup,
+// so they do not hide the usual ones for float.
+#ifdef __SSE2__
+
+class CPUPixel {
+public:
+	CPUPixel() {}
+	explicit CPUPixel(float x) : v(_mm_set1_ps(x)) {}
+	CPUPixel(float r, float g, float b, float a) : v(_mm_setr_ps(r, g, b, a)) {}
+
+	static CPUPixel load(const float *src) { return CPUPixel(_mm_loadu_ps(src)); }
+	void store(float *dst) const { _mm_storeu_ps(dst, v); }
+
+	template<unsigned c>
+	CPUPixel broadcast() const { return CPUPixel(_mm_shuffle_ps(v, v, _MM_SHUFFLE(c, c, c, c))); }
+
+	CPUPixel with_alpha_from(const CPUPixel &other) const
+	{
+		// [b, b, a', a'], and then [r, g] from us and [b, a'] from that.
+		const __m128 ba = _mm_shuffle_ps(v, other.v, _MM_SHUFFLE(3, 3, 2, 2));
+		return CPUPixel(_mm_shuffle_ps(v, ba, _MM_SHUFFLE(2, 0, 1, 0)));
+	}
+
+	CPUPixel operator+ (const CPUPixel &other) const { return CPUPixel(_mm_add_ps(v, other.v)); }
+	CPUPixel operator- (const CPUPixel &other) const { return CPUPixel(_mm_sub_ps(v, other.v)); }
+	CPUPixel operator* (const CPUPixel &other) const { return CPUPixel(_mm_mul_ps(v, other.v)); }
+	CPUPixel operator/ (const CPUPixel &other) const { return CPUPixel(_mm_div_ps(v, other.v)); }
+
+	friend CPUPixel min(const CPUPixel &a, const CPUPixel &b) { return CPUPixel(_mm_min_ps(a.v, b.v)); }
+	friend CPUPixel max(const CPUPixel &a, const CPUPixel &b) { return CPUPixel(_mm_max_ps(a.v, b.v)); }
+	friend CPUPixel sqrt(const CPUPixel &x) { return CPUPixel(_mm_sqrt_ps(x.v)); }
+
+	friend CPUPixel select_greater(const CPUPixel &a, const CPUPixel &b,
+	                               const CPUPixel &if_greater, const CPUPixel &otherwise)
+	{
+		const __m128 mask = _mm_cmpgt_ps(a.v, b.v);
+		return CPUPixel(_mm_or_ps(_mm_and_ps(mask, if_greater.v), _mm_andnot_ps(mask, otherwise.v)));
+	}
+
+	friend CPUPixel pow(const CPUPixel &x, const CPUPixel &y)
+	{
+		return CPUPixel(exp2(_mm_mul_ps(y.v, log2(x.v))));
+	}
+
+private:
+	explicit CPUPixel(__m128 v) : v(v) {}
+
+	// Split x into 2^e * m, with m in [sqrt(2)/2, sqrt(2)), and use the
+	// series ln(m) = 2 atanh(t) = 2(t + t³/3 + t⁵/5 + ...), where
+	// t = (m - 1) / (m + 1) is at most 0.172 in magnitude.
+	static __m128 log2(__m128 x)
+	{
+		const __m128i bits = _mm_castps_si128(x);
+		__m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+		__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+		const __m128 large = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+		m = _mm_sub_ps(m, _mm_and_ps(large, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+		e = _mm_sub_epi32(e, _mm_castps_si128(large));  // <large> is all ones, ie., -1.
+
+		const __m128 t = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+		const __m128 t2 = _mm_mul_ps(t, t);
+		__m128 series = _mm_set1_ps(1.0f / 7.0f);
+		series = _mm_add_ps(_mm_mul_ps(series, t2), _mm_set1_ps(1.0f / 5.0f));
+		series = _mm_add_ps(_mm_mul_ps(series, t2), _mm_set1_ps(1.0f / 3.0f));
+		series = _mm_add_ps(_mm_mul_ps(series, t2), _mm_set1_ps(1.0f));
+		const __m128 log2_m = _mm_mul_ps(_mm_mul_ps(series, t), _mm_set1_ps(2.0f / 0.69314718f));
+		return _mm_add_ps(_mm_cvtepi32_ps(e), log2_m);
+	}
+
+	// Round z to the nearest integer n, so that f = z - n is in [-0.5, 0.5],
+	// and then 2^z = 2^n * e^(f ln 2), where the latter is a Taylor series.
+	// z is clamped so that 2^n stays a normal float.
+	static __m128 exp2(__m128 z)
+	{
+		z = _mm_min_ps(_mm_max_ps(z, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+		const __m128i n = _mm_cvtps_epi32(z);
+		const __m128 f = _mm_mul_ps(_mm_sub_ps(z, _mm_cvtepi32_ps(n)), _mm_set1_ps(0.69314718f));
+		__m128 exp_f = _mm_set1_ps(1.0f / 5040.0f);
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(1.0f / 720.0f));
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(1.0f / 120.0f));
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(1.0f / 24.0f));
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(1.0f / 6.0f));
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(0.5f));
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(1.0f));
+		exp_f = _mm_add_ps(_mm_mul_ps(exp_f, f), _mm_set1_ps(1.0f));
+		const __m128 exp_n = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+		return _mm_mul_ps(exp_f, exp_n);
+	}
+
+	__m128 v;
+};
+
+#else
+
+class CPUPixel {
+public:
+	CPUPixel() {}
+	explicit CPUPixel(float x) : v{ x, x, x, x } {}
+	CPUPixel(float r, float g, float b, float a) : v{ r, g, b, a } {}
+
+	static CPUPixel load(const float *src) { return CPUPixel(src[0], src[1], src[2], src[3]); }
+	void store(float *dst) const { for (unsigned c = 0; c < 4; ++c) dst[c] = v[c]; }
+
+	template<unsigned c>
+	CPUPixel broadcast() const { return CPUPixel(v[c]); }
+
+	CPUPixel with_alpha_from(const CPUPixel &other) const { return CPUPixel(v[0], v[1], v[2], other.v[3]); }
+
+	CPUPixel operator+ (const CPUPixel &other) const { return map2(*this, other, [](float a, float b) { return a + b; }); }
+	CPUPixel operator- (const CPUPixel &other) const { return map2(*this, other, [](float a, float b) { return a - b; }); }
+	CPUPixel operator* (const CPUPixel &other) const { return map2(*this, other, [](float a, float b) { return a * b; }); }
+	CPUPixel operator/ (const CPUPixel &other) const { return map2(*this, other, [](float a, float b) { return a / b; }); }
+
+	friend CPUPixel min(const CPUPixel &a, const CPUPixel &b) { return map2(a, b, [](float a, float b) { return (a < b) ? a : b; }); }
+	friend CPUPixel max(const CPUPixel &a, const CPUPixel &b) { return map2(a, b, [](float a, float b) { return (a > b) ? a : b; }); }
+	friend CPUPixel sqrt(const CPUPixel &x) { return map2(x, x, [](float a, float) { return sqrtf(a); }); }
+	friend CPUPixel pow(const CPUPixel &x, const CPUPixel &y) { return map2(x, y, [](float a, float b) { return powf(a, b); }); }
+
+	friend CPUPixel select_greater(const CPUPixel &a, const CPUPixel &b,
+	                               const CPUPixel &if_greater, const CPUPixel &otherwise)
+	{
+		CPUPixel ret;
+		for (unsigned c = 0; c < 4; ++c) {
+			ret.v[c] = (a.v[c] > b.v[c]) ? if_greater.v[c] : otherwise.v[c];
+		}
+		return ret;
+	}
+
+private:
+	template<class Func>
+	static CPUPixel map2(const CPUPixel &a, const CPUPixel &b, Func func)
+	{
+		CPUPixel ret;
+		for (unsigned c = 0; c < 4; ++c) {
+			ret.v[c] = func(a.v[c], b.v[c]);
+		}
+		return ret;
+	}
+
+	float v[4];
+};
+
+#endif  // defined(__SSE2__)
+
+// Render rows [y0, y1> of a <width> x <height> image into <dst> by sampling
+// <src> bilinearly (see CPUImage::sample_bilinear()) at the pixel centers.
+// If the sizes match, this is simply a copy.
+void resample_cpu_rows(const CPUImage &src, unsigned width, unsigned height,
+                       unsigned y0, unsigned y1, float *dst);
+
+// Split <height> rows into strips small enough that their working set
+// stays in the CPU cache, given that <func> touches <bytes_per_row> bytes
+// (counting both what it reads and writes) for each row, and call
+// <func>(y0, y1) for each strip, spread out over all CPU cores (by a pool
+// of threads that is started on first use and shared by all callers).
+// Returns when all strips are done; <func> must be thread-safe. It is fine
+// to call this from several threads at the same time.
+void parallel_for_strips(size_t bytes_per_row, unsigned height,
+                         const std::function<void(unsigned, unsigned)> &func);
+
+// Exact sRGB decoding of an 8-bit value, like GL_SRGB8 textures do.
+float srgb8_to_linear(unsigned char x);
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_CPU_BACKEND_H)
@@ -0,0 +1,336 @@
+// Unit tests for the CPU backend (EffectChain::set_backend()). Mostly,
+// they run the same chain through OpenGL and on the CPU, and check that
+// the results are the same.
+
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+#include <epoxy/gl.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "cpu_backend.h"
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "image_format.h"
+#include "mix_effect.h"
+#include "overlay_effect.h"
+#include "padding_effect.h"
+#include "resample_effect.h"
+#include "test_util.h"
+#include "util.h"
+#include "ycbcr_input.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Runs the chain that <setup> builds through OpenGL into <gpu_out>,
+// and on the CPU into <cpu_out>, both <width> x <height> RGBA.
+template<class T>
+void run_on_both_backends(unsigned width, unsigned height,
+                          const function<void(EffectChainTester *)> &setup,
+                          T *gpu_out, T *cpu_out,
+                          Colorspace color_space = COLORSPACE_sRGB,
+                          GammaCurve gamma_curve = GAMMA_sRGB,
+                          GLenum framebuffer_format = GL_RGBA16F_ARB)
+{
+	for (EffectChainBackend backend : { BACKEND_OPENGL, BACKEND_CPU }) {
+		EffectChainTester tester(nullptr, width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA,
+			COLORSPACE_sRGB, GAMMA_LINEAR, framebuffer_format);
+		tester.get_chain()->set_backend(backend);
+		setup(&tester);
+		tester.run(backend == BACKEND_CPU ? cpu_out : gpu_out, GL_RGBA, color_space, gamma_curve);
+	}
+}
+
+}  // namespace
+
+TEST(CPUBackendTest, GradingChainInsRGB) {
+	const unsigned width = 16, height = 9;
+	vector<float> data = random_rgba(width * height);
+
+	float gpu_out[width * height * 4], cpu_out[width * height * 4];
+	run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+		tester->add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		add_grading_effects(tester->get_chain());
+	}, gpu_out, cpu_out);
+
+	expect_equal(gpu_out, cpu_out, width * 4, height);
+}
+
+TEST(CPUBackendTest, MixAndOverlayAcrossColorspaces) {
+	const unsigned width = 8, height = 6;
+	vector<float> bottom = random_rgba(width * height);
+	vector<float> top = random_rgba(width * height, /*random_alpha=*/true);
+	vector<float> fade = random_rgba(width * height);
+
+	float gpu_out[width * height * 4], cpu_out[width * height * 4];
+	run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+		Input *input1 = tester->add_input(bottom.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_REC_601_525, GAMMA_sRGB);
+		Input *input2 = tester->add_input(fade.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_REC_709);
+		Input *input3 = tester->add_input(top.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		Effect *mix = tester->get_chain()->add_effect(new MixEffect(), input1, input2);
+		CHECK(mix->set_float("strength_first", 0.7f));
+		CHECK(mix->set_float("strength_second", 0.3f));
+		tester->get_chain()->add_effect(new OverlayEffect(), mix, input3);
+	}, gpu_out, cpu_out);
+
+	expect_equal(gpu_out, cpu_out, width * 4, height);
+}
+
+TEST(CPUBackendTest, Resample) {
+	struct {
+		unsigned in_width, in_height, out_width, out_height;
+		float zoom, offset;
+	} cases[] = {
+		{ 8, 6, 13, 10, 1.0f, 0.0f },   // Up.
+		{ 16, 12, 7, 5, 1.0f, 0.0f },   // Down.
+		{ 10, 10, 10, 10, 1.3f, 0.0f },  // Zoom.
+		{ 10, 10, 12, 12, 1.0f, 2.3f },  // Offset.
+	};
+	for (const auto &c : cases) {
+		vector<float> data = random_rgba(c.in_width * c.in_height);
+		vector<float> gpu_out(c.out_width * c.out_height * 4), cpu_out(c.out_width * c.out_height * 4);
+		run_on_both_backends<float>(c.out_width, c.out_height, [&](EffectChainTester *tester) {
+			tester->add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, c.in_width, c.in_height);
+			Effect *resample = tester->get_chain()->add_effect(new ResampleEffect());
+			CHECK(resample->set_int("width", c.out_width));
+			CHECK(resample->set_int("height", c.out_height));
+			CHECK(resample->set_float("zoom_x", c.zoom));
+			CHECK(resample->set_float("zoom_y", c.zoom));
+			CHECK(resample->set_float("left", c.offset));
+			CHECK(resample->set_float("top", c.offset));
+		}, gpu_out.data(), cpu_out.data(), COLORSPACE_sRGB, GAMMA_LINEAR);
+
+		expect_equal(gpu_out.data(), cpu_out.data(), c.out_width * 4, c.out_height);
+	}
+}
+
+TEST(CPUBackendTest, Padding) {
+	const unsigned in_width = 5, in_height = 4, width = 9, height = 7;
+	vector<float> data = random_rgba(in_width * in_height);
+	const RGBATuple border_color(0.2f, 0.4f, 0.6f, 1.0f);
+
+	// The input is linear, since with fractional padding, OpenGL would
+	// interpolate between the pixels before gamma expansion and we
+	// interpolate after (see EffectChain::set_backend()).
+	for (bool integral : { false, true }) {
+		float gpu_out[width * height * 4], cpu_out[width * height * 4];
+		run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+			tester->add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR, in_width, in_height);
+			Effect *padding = tester->get_chain()->add_effect(integral ? new IntegralPaddingEffect() : new PaddingEffect());
+			CHECK(padding->set_int("width", width));
+			CHECK(padding->set_int("height", height));
+			CHECK(padding->set_vec4("border_color", (const float *)&border_color));
+			if (integral) {
+				CHECK(padding->set_int("left", 3));
+				CHECK(padding->set_int("top", 1));
+				CHECK(padding->set_float("border_offset_right", -0.5f));
+			} else {
+				CHECK(padding->set_float("left", 2.25f));
+				CHECK(padding->set_float("top", 1.5f));
+			}
+		}, gpu_out, cpu_out);
+
+		expect_equal(gpu_out, cpu_out, width * 4, height);
+	}
+}
+
+TEST(CPUBackendTest, YCbCrInput420) {
+	const unsigned width = 4, height = 4;
+	unsigned char y[width * height] = {
+		126, 126, 126, 126,
+		126, 126, 126, 126,
+		126, 126, 126, 126,
+		126, 126, 126, 126,
+	};
+	unsigned char cb[(width/2) * (height/2)] = {
+		64, 128,
+		128, 192,
+	};
+	unsigned char cr[(width/2) * (height/2)] = {
+		128, 128,
+		128, 128,
+	};
+
+	// Only the blue channel; see YCbCrInputTest.Subsampling420.
+	float expected_blue[width * height] = {
+		0.000, 0.125, 0.375, 0.500,
+		0.125, 0.250, 0.500, 0.625,
+		0.375, 0.500, 0.750, 0.875,
+		0.500, 0.625, 0.875, 1.000,
+	};
+
+	float gpu_out[width * height * 4], cpu_out[width * height * 4];
+	run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+		ImageFormat format;
+		format.color_space = COLORSPACE_sRGB;
+		format.gamma_curve = GAMMA_sRGB;
+
+		YCbCrFormat ycbcr_format;
+		ycbcr_format.luma_coefficients = YCBCR_REC_601;
+		ycbcr_format.full_range = false;
+		ycbcr_format.num_levels = 256;
+		ycbcr_format.chroma_subsampling_x = 2;
+		ycbcr_format.chroma_subsampling_y = 2;
+		ycbcr_format.cb_x_position = 0.5f;
+		ycbcr_format.cb_y_position = 0.5f;
+		ycbcr_format.cr_x_position = 0.5f;
+		ycbcr_format.cr_y_position = 0.5f;
+
+		YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+		input->set_pixel_data(0, y);
+		input->set_pixel_data(1, cb);
+		input->set_pixel_data(2, cr);
+		tester->get_chain()->add_input(input);
+	}, gpu_out, cpu_out);
+
+	expect_equal(gpu_out, cpu_out, width * 4, height);
+
+	float cpu_blue[width * height];
+	for (unsigned i = 0; i < width * height; ++i) {
+		cpu_blue[i] = cpu_out[i * 4 + 2];
+	}
+	expect_equal(expected_blue, cpu_blue, width, height, 0.01, 0.002);
+}
+
+TEST(CPUBackendTest, YCbCrInputWithChromaFilter) {
+	const unsigned width = 8, height = 6;
+	unsigned char y[width * height], cb[width * height / 4], cr[width * height / 4];
+	for (unsigned i = 0; i < width * height; ++i) {
+		y[i] = 16 + rand() % 220;
+	}
+	for (unsigned i = 0; i < width * height / 4; ++i) {
+		cb[i] = 16 + rand() % 225;
+		cr[i] = 16 + rand() % 225;
+	}
+
+	float gpu_out[width * height * 4], cpu_out[width * height * 4];
+	run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+		ImageFormat format;
+		format.color_space = COLORSPACE_sRGB;
+		format.gamma_curve = GAMMA_sRGB;
+
+		YCbCrFormat ycbcr_format;
+		ycbcr_format.luma_coefficients = YCBCR_REC_709;
+		ycbcr_format.full_range = false;
+		ycbcr_format.num_levels = 256;
+		ycbcr_format.chroma_subsampling_x = 2;
+		ycbcr_format.chroma_subsampling_y = 2;
+		ycbcr_format.cb_x_position = 0.0f;
+		ycbcr_format.cb_y_position = 0.5f;
+		ycbcr_format.cr_x_position = 0.0f;
+		ycbcr_format.cr_y_position = 0.5f;
+
+		YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+		CHECK(input->set_int("chroma_filter", YCbCrInput::CHROMA_FILTER_LANCZOS));
+		input->set_pixel_data(0, y);
+		input->set_pixel_data(1, cb);
+		input->set_pixel_data(2, cr);
+		tester->get_chain()->add_input(input);
+	}, gpu_out, cpu_out);
+
+	// The GPU computes the bilinear weights for the merged middle taps
+	// with limited precision, and the Lanczos lobes amplify that a bit.
+	expect_equal(gpu_out, cpu_out, width * 4, height, 0.02, 0.002);
+}
+
+TEST(CPUBackendTest, DitheredEightBitOutput) {
+	const unsigned width = 37, height = 23;
+	vector<float> data = random_rgba(width * height);
+
+	for (DitherPattern pattern : { DITHER_PATTERN_WHITE_NOISE, DITHER_PATTERN_BLUE_NOISE }) {
+		unsigned char gpu_out[width * height * 4], cpu_out[width * height * 4];
+		run_on_both_backends<unsigned char>(width, height, [&](EffectChainTester *tester) {
+			tester->add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+			add_grading_effects(tester->get_chain());
+			tester->get_chain()->set_dither_bits(8);
+			tester->get_chain()->set_dither_pattern(pattern);
+		}, gpu_out, cpu_out, COLORSPACE_sRGB, GAMMA_sRGB, GL_RGBA8);
+
+		// Same noise, so both round the same way, except where
+		// a value is so close to the rounding point that the two
+		// come out on different sides of it.
+		expect_equal(gpu_out, cpu_out, width * 4, height, 2, 0.1);
+	}
+}
+
+TEST(CPUBackendTest, TopLeftOrigin) {
+	const unsigned width = 6, height = 5;
+	vector<float> data = random_rgba(width * height);
+
+	float gpu_out[width * height * 4], cpu_out[width * height * 4];
+	run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+		tester->add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		tester->get_chain()->set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+		add_grading_effects(tester->get_chain());
+	}, gpu_out, cpu_out);
+
+	expect_equal(gpu_out, cpu_out, width * 4, height);
+}
+
+TEST(CPUBackendTest, LargeImageWithSeveralPhases) {
+	// Large enough to be split into many strips, with a resampling
+	// in the middle so that there are several phases.
+	const unsigned in_width = 300, in_height = 200, width = 640, height = 360;
+	vector<float> data = random_rgba(in_width * in_height);
+
+	vector<float> gpu_out(width * height * 4), cpu_out(width * height * 4);
+	run_on_both_backends<float>(width, height, [&](EffectChainTester *tester) {
+		tester->add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB, in_width, in_height);
+		add_grading_effects(tester->get_chain());
+		Effect *resample = tester->get_chain()->add_effect(new ResampleEffect());
+		CHECK(resample->set_int("width", width));
+		CHECK(resample->set_int("height", height));
+	}, gpu_out.data(), cpu_out.data(), COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	// The GPU combines pairs of resampling taps into one bilinear lookup,
+	// which is only approximately the same; on noise this sharp, that
+	// shows up in a few pixels. (We compare in linear light, since sRGB
+	// would magnify this in the darkest pixels.)
+	expect_equal(gpu_out.data(), cpu_out.data(), width * 4, height, 0.02, 0.2 / 255.0);
+}
+
+TEST(CPUBackendTest, PixelPow) {
+	// The SIMD version is a polynomial approximation, so check it
+	// against libm over the range the kernels use it for.
+	for (unsigned i = 1; i <= 1000; ++i) {
+		const float x = i / 250.0f;
+		float out[4];
+		pow(CPUPixel(x), CPUPixel(1.0f / 2.2f, 2.2f, 0.9f, 2.4f)).store(out);
+		EXPECT_NEAR(powf(x, 1.0f / 2.2f), out[0], 1e-6 * powf(x, 1.0f / 2.2f));
+		EXPECT_NEAR(powf(x, 2.2f), out[1], 1e-6 * powf(x, 2.2f));
+		EXPECT_NEAR(powf(x, 0.9f), out[2], 1e-6 * powf(x, 0.9f));
+		EXPECT_NEAR(powf(x, 2.4f), out[3], 1e-6 * powf(x, 2.4f));
+	}
+}
+
+#ifdef HAVE_BENCHMARK
+// The grading chain on a 1280x720 sRGB frame, through OpenGL (0)
+// or on the CPU (1).
+void BM_CPUBackend(benchmark::State &state)
+{
+	const unsigned width = 1280, height = 720;
+	vector<float> data = random_rgba(width * height);
+	unique_ptr<float[]> out_data(new float[width * height * 4]);
+
+	EffectChainTester tester(nullptr, width, height);
+	if (state.range(0)) {
+		tester.get_chain()->set_backend(BACKEND_CPU);
+	}
+	tester.add_input(data.data(), FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	add_grading_effects(tester.get_chain());
+	tester.benchmark(state, out_data.get(), GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+}
+BENCHMARK(BM_CPUBackend)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
+}  // namespace movit
@@ -10,10 +10,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <new>
+#include <tuple>
 
 #include "deconvolution_sharpen_effect.h"
+#include "effect_chain.h"
 #include "effect_util.h"
+#include "fft_convolution_effect.h"
 #include "util.h"
 
 using namespace Eigen;
@@ -27,11 +34,13 @@ DeconvolutionSharpenEffect::DeconvolutionSharpenEffect()
 	  gaussian_radius(0.0f),
 	  correlation(0.95f),
 	  noise(0.01f),
+	  background_kernel_update(0),
+	  min_fft_matrix_size(8),
+	  fft_input_width(0),
+	  fft_input_height(0),
+	  fft_convolution_effect(nullptr),
+	  fft_kernel(nullptr),
 	  last_R(-1),
-	  last_circle_radius(-1.0f),
-	  last_gaussian_radius(-1.0f),
-	  last_correlation(-1.0f),
-	  last_noise(-1.0f),
 	  uniform_samples(nullptr)
 {
 	register_int("matrix_size", &R);
@@ -39,25 +48,97 @@ DeconvolutionSharpenEffect::DeconvolutionSharpenEffect()
 	register_float("gaussian_radius", &gaussian_radius);
 	register_float("correlation", &correlation);
 	register_float("noise", &noise);
+	register_int("background_kernel_update", &background_kernel_update);
+	register_int("min_fft_matrix_size", &min_fft_matrix_size);
+	register_int("input_width", &fft_input_width);
+	register_int("input_height", &fft_input_height);
 }
 
 DeconvolutionSharpenEffect::~DeconvolutionSharpenEffect()
 {
+	// Note that if there is a kernel being computed in the background,
+	// the destructor of pending_g will wait for it.
 	delete[] uniform_samples;
+	delete[] fft_kernel;
 }
 
-string DeconvolutionSharpenEffect::output_fragment_shader()
+void DeconvolutionSharpenEffect::rewrite_graph(EffectChain *graph, Node *self)
 {
-	char buf[256];
-	sprintf(buf, "#define R %u\n", R);
+	if (R < min_fft_matrix_size || fft_input_width <= 0 || fft_input_height <= 0) {
+		return;
+	}
+
+	// Stay in the graph (as a passthrough) so that we get set_gl_state()
+	// calls, and can send the kernel on to the FFTConvolutionEffect
+	// after us before it needs it.
+	fft_convolution_effect = new FFTConvolutionEffect(fft_input_width, fft_input_height, 2 * R + 1, 2 * R + 1);
+	fft_convolution_effect->set_kernel_origin(R, R);
+	fft_kernel = new float[(2 * R + 1) * (2 * R + 1)];
+
+	Node *fft_node = graph->add_node(fft_convolution_effect);
+	graph->replace_sender(self, fft_node);
+	graph->connect_nodes(self, fft_node);
+}
+
+void DeconvolutionSharpenEffect::inform_input_size(unsigned input_num, unsigned width, unsigned height)
+{
+	this->width = width;
+	this->height = height;
+
+	// FFTConvolutionEffect is set up for a given size in rewrite_graph(),
+	// and the shaders are compiled by now, so there is no way back
+	// to direct convolution.
+	if (fft_convolution_effect != nullptr &&
+	    (int(width) != fft_input_width || int(height) != fft_input_height)) {
+		fprintf(stderr, "DeconvolutionSharpenEffect: Input is %ux%u, but input_width and input_height were set to %dx%d.\n",
+			width, height, fft_input_width, fft_input_height);
+		fprintf(stderr, "Set them to the actual input size (or leave them unset to use direct convolution).\n");
+		abort();
+	}
+}
+
+bool DeconvolutionSharpenEffect::set_int(const string &key, int value)
+{
+	if (fft_convolution_effect != nullptr &&
+	    (key == "input_width" || key == "input_height") &&
+	    value != *(key == "input_width" ? &fft_input_width : &fft_input_height)) {
+		// The FFTConvolutionEffect has already been made for the old size.
+		return false;
+	}
+	return Effect::set_int(key, value);
+}
+
+bool DeconvolutionSharpenEffect::KernelParameters::operator< (const KernelParameters &other) const
+{
+	return make_tuple(R, circle_radius, gaussian_radius, correlation, noise) <
+		make_tuple(other.R, other.circle_radius, other.gaussian_radius, other.correlation, other.noise);
+}
 
+bool DeconvolutionSharpenEffect::KernelParameters::close_to(const KernelParameters &other) const
+{
+	return R == other.R &&
+		fabs(circle_radius - other.circle_radius) <= 1e-3 &&
+		fabs(gaussian_radius - other.gaussian_radius) <= 1e-3 &&
+		fabs(correlation - other.correlation) <= 1e-3 &&
+		fabs(noise - other.noise) <= 1e-3;
+}
+
+string DeconvolutionSharpenEffect::output_fragment_shader()
+{
 	assert(R >= 1);
 	assert(R <= 25);  // Same limit as Refocus.
 
+	last_R = R;
+	if (fft_convolution_effect != nullptr) {
+		return read_file("identity.frag");
+	}
+
+	char buf[256];
+	sprintf(buf, "#define R %u\n", R);
+
 	uniform_samples = new float[4 * (R + 1) * (R + 1)];
 	register_uniform_vec4_array("samples", uniform_samples, (R + 1) * (R + 1));
 
-	last_R = R;
 	return buf + read_file("deconvolution_sharpen_effect.frag");
 }
 
@@ -159,103 +240,93 @@ float circle_impulse_response(int x, int y, float r)
 	return covered_area / (cell_width * cell_height);
 }
 
-// Compute a ⊙ b. Note that we compute the “full” convolution,
-// ie., our matrix will be big enough to hold every nonzero element of the result.
-MatrixXf convolve(const MatrixXf &a, const MatrixXf &b)
+// Compute a ⊙ b, but only the elements where b is entirely inside a
+// (as opposed to symmetric_convolve() below, which assumes every element
+// outside of a is zero). This is the same as conv2(a, b, 'valid') in Octave.
+//
+// a must be the larger matrix of the two, and both must be square
+// and symmetrical around their centers in x and y, and along the diagonal
+// (ie., f(x, y) = f(|x|, |y|) = f(|y|, |x|)), which holds for everything
+// we convolve below. The result then has the same symmetries, so we only
+// need to compute 1/8 of it.
+MatrixXf symmetric_central_convolve(const MatrixXf &a, const MatrixXf &b)
 {
-	MatrixXf result(a.rows() + b.rows() - 1, a.cols() + b.cols() - 1);
-	for (int yr = 0; yr < result.rows(); ++yr) {
-		for (int xr = 0; xr < result.cols(); ++xr) {
-			float sum = 0.0f;
-
-			// Given that x_b = x_r - x_a, find the values of x_a where
-			// x_a is in [0, a_cols> and x_b is in [0, b_cols>. (y is similar.)
-			//
-			// The second demand gives:
-			//
-			//   0 <= x_r - x_a < b_cols
-			//   0 >= x_a - x_r > -b_cols
-			//   x_r >= x_a > x_r - b_cols
-			int ya_min = yr - b.rows() + 1;
-			int ya_max = yr;
-			int xa_min = xr - b.rows() + 1;
-			int xa_max = xr;
-
-			// Now fit to the first demand.
-			ya_min = max<int>(ya_min, 0);
-			ya_max = min<int>(ya_max, a.rows() - 1);
-			xa_min = max<int>(xa_min, 0);
-			xa_max = min<int>(xa_max, a.cols() - 1);
-
-			assert(ya_max >= ya_min);
-			assert(xa_max >= xa_min);
-
-			for (int ya = ya_min; ya <= ya_max; ++ya) {
-				for (int xa = xa_min; xa <= xa_max; ++xa) {
-					sum += a(ya, xa) * b(yr - ya, xr - xa);
-				}
-			}
-
-			result(yr, xr) = sum;
+	assert(a.rows() == a.cols() && a.rows() % 2 == 1);
+	assert(b.rows() == b.cols() && b.rows() % 2 == 1);
+	assert(a.rows() >= b.rows());
+	const int size = a.rows() - b.rows() + 1;
+	const int center = size / 2;
+	const MatrixXf b_flipped = b.reverse();
+	MatrixXf result(size, size);
+	for (int x = center; x < size; ++x) {
+		for (int y = center; y <= x; ++y) {
+			float val = a.block(y, x, b.rows(), b.cols()).cwiseProduct(b_flipped).sum();
+			int mirror_x = 2 * center - x, mirror_y = 2 * center - y;
+			result(y, x) = result(mirror_y, x) = result(y, mirror_x) = result(mirror_y, mirror_x) = val;
+			result(x, y) = result(mirror_x, y) = result(x, mirror_y) = result(mirror_x, mirror_y) = val;
 		}
 	}
 	return result;
 }
 
-// Similar to convolve(), but instead of assuming every element outside
-// of b is zero, we make no such assumption and instead return only the
-// elements where we know the right answer. (This is the only difference
-// between the two.)
-// This is the same as conv2(a, b, 'valid') in Octave.
-//
-// a must be the larger matrix of the two.
-MatrixXf central_convolve(const MatrixXf &a, const MatrixXf &b)
+// Compute a ⊙ b. Note that we compute the “full” convolution,
+// ie., our matrix will be big enough to hold every nonzero element of the result.
+// Has the same demands on a and b as symmetric_central_convolve().
+MatrixXf symmetric_convolve(const MatrixXf &a, const MatrixXf &b)
 {
-	assert(a.rows() >= b.rows());
-	assert(a.cols() >= b.cols());
-	MatrixXf result(a.rows() - b.rows() + 1, a.cols() - b.cols() + 1);
-	for (int yr = b.rows() - 1; yr < result.rows() + b.rows() - 1; ++yr) {
-		for (int xr = b.cols() - 1; xr < result.cols() + b.cols() - 1; ++xr) {
-			float sum = 0.0f;
-
-			// Given that x_b = x_r - x_a, find the values of x_a where
-			// x_a is in [0, a_cols> and x_b is in [0, b_cols>. (y is similar.)
-			//
-			// The second demand gives:
-			//
-			//   0 <= x_r - x_a < b_cols
-			//   0 >= x_a - x_r > -b_cols
-			//   x_r >= x_a > x_r - b_cols
-			int ya_min = yr - b.rows() + 1;
-			int ya_max = yr;
-			int xa_min = xr - b.rows() + 1;
-			int xa_max = xr;
-
-			// Now fit to the first demand.
-			ya_min = max<int>(ya_min, 0);
-			ya_max = min<int>(ya_max, a.rows() - 1);
-			xa_min = max<int>(xa_min, 0);
-			xa_max = min<int>(xa_max, a.cols() - 1);
-
-			assert(ya_max >= ya_min);
-			assert(xa_max >= xa_min);
-
-			for (int ya = ya_min; ya <= ya_max; ++ya) {
-				for (int xa = xa_min; xa <= xa_max; ++xa) {
-					sum += a(ya, xa) * b(yr - ya, xr - xa);
-				}
-			}
+	MatrixXf padded_a(MatrixXf::Zero(a.rows() + 2 * (b.rows() - 1), a.cols() + 2 * (b.cols() - 1)));
+	padded_a.block(b.rows() - 1, b.cols() - 1, a.rows(), a.cols()) = a;
+	return symmetric_central_convolve(padded_a, b);
+}
 
-			result(yr - b.rows() + 1, xr - b.cols() + 1) = sum;
+}  // namespace
+
+shared_ptr<const MatrixXf> DeconvolutionSharpenEffect::get_deconvolution_kernel(const KernelParameters &params, bool compute_if_missing)
+{
+	// Kernels computed so far, shared between all instances. The queue
+	// holds the parameters in insertion order, so that we can throw out
+	// the oldest ones when the cache gets full. Pointers for the same reason
+	// as movit_data_directory in init.cpp.
+	static mutex cache_mutex;
+	static map<KernelParameters, shared_ptr<const MatrixXf>> *cache = new map<KernelParameters, shared_ptr<const MatrixXf>>;
+	static deque<KernelParameters> *cache_order = new deque<KernelParameters>;
+	static const size_t max_cache_size = 64;
+
+	{
+		lock_guard<mutex> lock(cache_mutex);
+		auto it = cache->find(params);
+		if (it != cache->end()) {
+			return it->second;
 		}
 	}
-	return result;
-}
+	if (!compute_if_missing) {
+		return nullptr;
+	}
 
-}  // namespace
+	// Not found, so compute it, without holding the lock. If someone else
+	// computes the same kernel in the meantime, we simply use theirs.
+	shared_ptr<const MatrixXf> g(new MatrixXf(compute_deconvolution_kernel(params)));
+
+	lock_guard<mutex> lock(cache_mutex);
+	auto ret = cache->insert(make_pair(params, g));
+	if (ret.second) {
+		cache_order->push_back(params);
+		if (cache_order->size() > max_cache_size) {
+			cache->erase(cache_order->front());
+			cache_order->pop_front();
+		}
+	}
+	return ret.first->second;
+}
 
-void DeconvolutionSharpenEffect::update_deconvolution_kernel()
+MatrixXf DeconvolutionSharpenEffect::compute_deconvolution_kernel(const KernelParameters &params)
 {
+	const int R = params.R;
+	const float circle_radius = params.circle_radius;
+	const float gaussian_radius = params.gaussian_radius;
+	const float correlation = params.correlation;
+	const float noise = params.noise;
+
 	// Figure out the impulse response for the circular part of the blur.
 	MatrixXf circ_h(2 * R + 1, 2 * R + 1);
 	for (int y = -R; y <= R; ++y) {	
@@ -266,7 +337,7 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 
 	// Same, for the Gaussian part of the blur. We make this a lot larger
 	// since we're going to convolve with it soon, and it has infinite support
-	// (see comments for central_convolve()).
+	// (see comments for symmetric_central_convolve()).
 	MatrixXf gaussian_h(4 * R + 1, 4 * R + 1);
 	for (int y = -2 * R; y <= 2 * R; ++y) {	
 		for (int x = -2 * R; x <= 2 * R; ++x) {
@@ -281,7 +352,7 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 	}
 
 	// h, the (assumed) impulse response that we're trying to invert.
-	MatrixXf h = central_convolve(gaussian_h, circ_h);
+	MatrixXf h = symmetric_central_convolve(gaussian_h, circ_h);
 	assert(h.rows() == 2 * R + 1);
 	assert(h.cols() == 2 * R + 1);
 
@@ -307,7 +378,7 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 	// degenerate case of correlation=0), but we have to chop it off
 	// somewhere. Since we convolve it with a 4*R+1 large matrix below,
 	// we need to make it twice as big as that, so that we have enough
-	// data to make r_vv valid. (central_convolve() effectively enforces
+	// data to make r_vv valid. (symmetric_central_convolve() effectively enforces
 	// that we get at least the right size.)
 	MatrixXf r_uu(8 * R + 1, 8 * R + 1);
 	for (int y = -4 * R; y <= 4 * R; ++y) {	
@@ -320,13 +391,13 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 	// Since we know that v = h ⊙ u and both are symmetrical,
 	// convolution and correlation are the same, and
 	// r_vv = v ⊙ v = (h ⊙ u) ⊙ (h ⊙ u) = (h ⊙ h) ⊙ r_uu.
-	MatrixXf r_vv = central_convolve(r_uu, convolve(h, h));
+	MatrixXf r_vv = symmetric_central_convolve(r_uu, symmetric_convolve(h, h));
 	assert(r_vv.rows() == 4 * R + 1);
 	assert(r_vv.cols() == 4 * R + 1);
 
 	// Similarly, r_uv = u ⊙ v = u ⊙ (h ⊙ u) = h ⊙ r_uu.
 	MatrixXf r_uu_center = r_uu.block(2 * R, 2 * R, 4 * R + 1, 4 * R + 1);
-	MatrixXf r_uv = central_convolve(r_uu_center, h);
+	MatrixXf r_uv = symmetric_central_convolve(r_uu_center, h);
 	assert(r_uv.rows() == 2 * R + 1);
 	assert(r_uv.cols() == 2 * R + 1);
 	
@@ -378,23 +449,35 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 	//
 	// This both increases accuracy and provides us with a very nice speed
 	// boost.
-	MatrixXf M(MatrixXf::Zero((R + 1) * (R + 1), (R + 1) * (R + 1)));
-	MatrixXf r_uv_flattened(MatrixXf::Zero((R + 1) * (R + 1), 1));
-	for (int outer_i = 0; outer_i < 2 * R + 1; ++outer_i) {
-		int folded_outer_i = abs(outer_i - R);
-		for (int outer_j = 0; outer_j < 2 * R + 1; ++outer_j) {
-			int folded_outer_j = abs(outer_j - R);
-			int row = folded_outer_i * (R + 1) + folded_outer_j;
-			for (int inner_i = 0; inner_i < 2 * R + 1; ++inner_i) {
-				int folded_inner_i = abs(inner_i - R);
-				for (int inner_j = 0; inner_j < 2 * R + 1; ++inner_j) {
-					int folded_inner_j = abs(inner_j - R);
-					int col = folded_inner_i * (R + 1) + folded_inner_j;
-					M(row, col) += r_vv((inner_i - R) - (outer_i - R) + 2 * R,
-					                    (inner_j - R) - (outer_j - R) + 2 * R);
+	//
+	// We do the folding directly as we build the matrix. Since r_vv is
+	// symmetrical, all the outer positions (i, j) that fold into the same row,
+	// ie. (±i, ±j), contribute the same values to it (the set of inner
+	// positions for each column is mirrored along with them), so we only
+	// need to look at one of them and multiply by how many there are.
+	MatrixXf M((R + 1) * (R + 1), (R + 1) * (R + 1));
+	MatrixXf r_uv_flattened((R + 1) * (R + 1), 1);
+	for (int outer_i = 0; outer_i <= R; ++outer_i) {
+		for (int outer_j = 0; outer_j <= R; ++outer_j) {
+			int row = outer_i * (R + 1) + outer_j;
+			int num_folded = ((outer_i == 0) ? 1 : 2) * ((outer_j == 0) ? 1 : 2);
+			for (int inner_i = 0; inner_i <= R; ++inner_i) {
+				for (int inner_j = 0; inner_j <= R; ++inner_j) {
+					int col = inner_i * (R + 1) + inner_j;
+					float sum = r_vv(inner_i - outer_i + 2 * R, inner_j - outer_j + 2 * R);
+					if (inner_i != 0) {
+						sum += r_vv(-inner_i - outer_i + 2 * R, inner_j - outer_j + 2 * R);
+					}
+					if (inner_j != 0) {
+						sum += r_vv(inner_i - outer_i + 2 * R, -inner_j - outer_j + 2 * R);
+					}
+					if (inner_i != 0 && inner_j != 0) {
+						sum += r_vv(-inner_i - outer_i + 2 * R, -inner_j - outer_j + 2 * R);
+					}
+					M(row, col) = num_folded * sum;
 				}
 			}
-			r_uv_flattened(row) += r_uv(outer_i, outer_j);
+			r_uv_flattened(row) = num_folded * r_uv(outer_i + R, outer_j + R);
 		}
 	}
 
@@ -404,7 +487,7 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 	assert(g_flattened.cols() == 1);
 
 	// Normalize and de-flatten the deconvolution matrix.
-	g = MatrixXf(R + 1, R + 1);
+	MatrixXf g(R + 1, R + 1);
 	sum = 0.0f;
 	for (int i = 0; i < g_flattened.rows(); ++i) {
 		int y = i / (R + 1);
@@ -422,11 +505,7 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 		int x = i % (R + 1);
 		g(y, x) = g_flattened(i) / sum;
 	}
-
-	last_circle_radius = circle_radius;
-	last_gaussian_radius = gaussian_radius;
-	last_correlation = correlation;
-	last_noise = noise;
+	return g;
 }
 
 void DeconvolutionSharpenEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
@@ -435,19 +514,60 @@ void DeconvolutionSharpenEffect::set_gl_state(GLuint glsl_program_num, const str
 
 	assert(R == last_R);
 
-	if (fabs(circle_radius - last_circle_radius) > 1e-3 ||
-	    fabs(gaussian_radius - last_gaussian_radius) > 1e-3 ||
-	    fabs(correlation - last_correlation) > 1e-3 ||
-	    fabs(noise - last_noise) > 1e-3) {
-		update_deconvolution_kernel();
+	// Pick up the kernel from the background thread if it is done.
+	const shared_ptr<const MatrixXf> old_g = g;
+	if (pending_g.valid() &&
+	    pending_g.wait_for(chrono::seconds(0)) == future_status::ready) {
+		g = pending_g.get();
+		g_params = pending_g_params;
 	}
+
+	const KernelParameters params{ R, circle_radius, gaussian_radius, correlation, noise };
+	if (g == nullptr || !g_params.close_to(params)) {
+		if (g == nullptr || !background_kernel_update) {
+			if (pending_g.valid()) {
+				// Left over from background mode; it would be outdated anyway.
+				pending_g.wait();
+				pending_g = future<shared_ptr<const MatrixXf>>();
+			}
+			g = get_deconvolution_kernel(params, /*compute_if_missing=*/true);
+			g_params = params;
+		} else if (!pending_g.valid()) {
+			shared_ptr<const MatrixXf> cached_g = get_deconvolution_kernel(params, /*compute_if_missing=*/false);
+			if (cached_g != nullptr) {
+				g = cached_g;
+				g_params = params;
+			} else {
+				pending_g = async(launch::async, get_deconvolution_kernel, params, /*compute_if_missing=*/true);
+				pending_g_params = params;
+			}
+		}
+		// Otherwise, we are still waiting for a kernel from the background
+		// thread; once that is done, we will start on the next one if the
+		// parameters have changed since then.
+	}
+
+	if (fft_convolution_effect != nullptr) {
+		// inform_input_size() has checked that the size is what we set up for.
+		if (g != old_g) {
+			// Unfold the kernel; FFTInput will FFT it the next time it is used.
+			for (int y = -R; y <= R; ++y) {
+				for (int x = -R; x <= R; ++x) {
+					fft_kernel[(y + R) * (2 * R + 1) + (x + R)] = (*g)(abs(y), abs(x));
+				}
+			}
+			fft_convolution_effect->set_convolution_kernel(fft_kernel);
+		}
+		return;
+	}
+
 	// Now encode it as uniforms, and pass it on to the shader.
 	for (int y = 0; y <= R; ++y) {
 		for (int x = 0; x <= R; ++x) {
 			int i = y * (R + 1) + x;
 			uniform_samples[i * 4 + 0] = x / float(width);
 			uniform_samples[i * 4 + 1] = y / float(height);
-			uniform_samples[i * 4 + 2] = g(y, x);
+			uniform_samples[i * 4 + 2] = (*g)(y, x);
 			uniform_samples[i * 4 + 3] = 0.0f;
 		}
 	}
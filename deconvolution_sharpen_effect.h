@@ -10,23 +10,48 @@
 //
 // The effect gives generally better results than unsharp masking, but can be very
 // GPU intensive, and requires a fair bit of tweaking to get good results without
-// ringing and/or excessive noise. It should be mentioned that for the larger
-// convolutions (e.g. R approaching 10), we should probably move to FFT-based
-// convolution algorithms, especially as Mesa's shader compiler starts having
-// problems compiling our shader.
+// ringing and/or excessive noise.
+//
+// The direct convolution samples (2R + 1)² times per pixel, all unrolled
+// into one shader, which gets slow (and hard on shader compilers, notably
+// Mesa's) as R approaches 10. Thus, for R >= min_fft_matrix_size, we instead
+// do the convolution with FFTConvolutionEffect, whose cost depends much less
+// on R; the effect itself then only passes its input through, and feeds the
+// kernel to the FFTConvolutionEffect. However, this needs the input size at
+// finalize() time (and it cannot change afterwards), so you need to set
+// input_width and input_height for it to happen; otherwise, we always use
+// the direct convolution. If the input then turns out to have a different
+// size, the chain cannot render it; we print an error and abort,
+// since by then, it is too late to go back to the direct path.
+// Also note that the FFT path does its
+// computations in fp16 (see FFTPassEffect), so it is somewhat less accurate.
 //
 // We follow the same book as Refocus was implemented from, namely
 //
 //   Jain, Anil K.: “Fundamentals of Digital Image Processing”, Prentice Hall, 1988.
+//
+// Finding the deconvolution kernel means solving an equation system with
+// (R + 1)² unknowns, which for large R can take tens of milliseconds.
+// Kernels are cached (across all instances) by their parameters, so going
+// back and forth between a few settings is cheap. If you animate the
+// parameters in a realtime setting, you can also set background_kernel_update
+// to 1; the kernel will then be computed in a separate thread, and the old one
+// will be used until it is done (which means the output will lag behind
+// the parameters by a few frames, and is no longer deterministic).
+// The very first kernel is always computed synchronously.
 
 #include <epoxy/gl.h>
 #include <Eigen/Dense>
+#include <future>
+#include <memory>
 #include <string>
 
 #include "effect.h"
 
 namespace movit {
 
+class FFTConvolutionEffect;
+
 class DeconvolutionSharpenEffect : public Effect {
 public:
 	DeconvolutionSharpenEffect();
@@ -34,14 +59,14 @@ public:
 	std::string effect_type_id() const override { return "DeconvolutionSharpenEffect"; }
 	std::string output_fragment_shader() override;
 
-	// Samples a lot of times from its input.
-	bool needs_texture_bounce() const override { return true; }
+	// Samples a lot of times from its input (unless we are using
+	// FFTConvolutionEffect, in which case we just pass it through).
+	bool needs_texture_bounce() const override { return fft_convolution_effect == nullptr; }
+
+	void rewrite_graph(EffectChain *graph, Node *self) override;
 
-	void inform_input_size(unsigned input_num, unsigned width, unsigned height) override
-	{
-		this->width = width;
-		this->height = height;
-	}
+	void inform_input_size(unsigned input_num, unsigned width, unsigned height) override;
+	bool set_int(const std::string &key, int value) override;
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
 	AlphaHandling alpha_handling() const override { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
@@ -63,14 +88,50 @@ private:
 	// Note that once the radius starts going too far past R, you will get nonsensical results.
 	float circle_radius, gaussian_radius, correlation, noise;
 
-	// The deconvolution kernel, and the parameters last time we did an update.
-	Eigen::MatrixXf g;
+	// If nonzero, compute new kernels in the background; see the top of the file.
+	int background_kernel_update;
+
+	// For choosing the FFT path; see the top of the file. The default for
+	// min_fft_matrix_size is 8; the crossover in speed is usually a bit lower,
+	// but the direct path is more accurate.
+	int min_fft_matrix_size;
+	int fft_input_width, fft_input_height;
+
+	// Set in rewrite_graph() if we use the FFT path. Owned by the EffectChain.
+	// <fft_kernel> holds the full (2R + 1) x (2R + 1) kernel for it.
+	FFTConvolutionEffect *fft_convolution_effect;
+	float *fft_kernel;
+
+	// Everything the deconvolution kernel depends on.
+	struct KernelParameters {
+		int R;
+		float circle_radius, gaussian_radius, correlation, noise;
+
+		bool operator< (const KernelParameters &other) const;
+
+		// Whether the difference is small enough that we don't bother
+		// computing a new kernel.
+		bool close_to(const KernelParameters &other) const;
+	};
+
+	// The deconvolution kernel, and the parameters it was made from.
+	std::shared_ptr<const Eigen::MatrixXf> g;
+	KernelParameters g_params;
 	int last_R;
-	float last_circle_radius, last_gaussian_radius, last_correlation, last_noise;
+
+	// A kernel being computed in the background, if any.
+	std::future<std::shared_ptr<const Eigen::MatrixXf>> pending_g;
+	KernelParameters pending_g_params;
 
 	float *uniform_samples;
-	
-	void update_deconvolution_kernel();
+
+	// Returns the kernel for the given parameters from the cache; if it is
+	// not there, computes it (and puts it in the cache) if <compute_if_missing>
+	// is set, or else returns nullptr. Thread-safe.
+	static std::shared_ptr<const Eigen::MatrixXf> get_deconvolution_kernel(const KernelParameters &params, bool compute_if_missing);
+
+	// Does the actual computation.
+	static Eigen::MatrixXf compute_deconvolution_kernel(const KernelParameters &params);
 };
 
 }  // namespace movit
@@ -3,6 +3,8 @@
 #include <epoxy/gl.h>
 #include <math.h>
 #include <stdlib.h>
+#include <chrono>
+#include <thread>
 
 #include "deconvolution_sharpen_effect.h"
 #include "effect_chain.h"
@@ -235,4 +237,95 @@ TEST(DeconvolutionSharpenEffectTest, CircularDeconvolutionKeepsAlpha) {
 	expect_equal(expected_alpha, out_data, size, size);
 }
 
+TEST(DeconvolutionSharpenEffectTest, FFTPathMatchesDirectConvolution) {
+	const int width = 48, height = 40;
+
+	// Something with a lot of detail, including near the edges.
+	float data[width * height];
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			data[y * width + x] = 0.5f + 0.25f * sin(x * 0.7f + y * 0.2f) * cos(y * 0.9f - x * 0.1f);
+		}
+	}
+	float expected_data[width * height], out_data[width * height];
+
+	for (int use_fft = 0; use_fft <= 1; ++use_fft) {
+		EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		Effect *deconvolution_effect = tester.get_chain()->add_effect(new DeconvolutionSharpenEffect());
+		ASSERT_TRUE(deconvolution_effect->set_int("matrix_size", 8));
+		ASSERT_TRUE(deconvolution_effect->set_float("circle_radius", 2.0f));
+		ASSERT_TRUE(deconvolution_effect->set_float("gaussian_radius", 0.5f));
+		ASSERT_TRUE(deconvolution_effect->set_float("correlation", 0.95f));
+		ASSERT_TRUE(deconvolution_effect->set_float("noise", 0.01f));
+		if (use_fft) {
+			ASSERT_TRUE(deconvolution_effect->set_int("min_fft_matrix_size", 8));
+			ASSERT_TRUE(deconvolution_effect->set_int("input_width", width));
+			ASSERT_TRUE(deconvolution_effect->set_int("input_height", height));
+			tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+			// The FFT path is set up for this size now, so it cannot change.
+			EXPECT_FALSE(deconvolution_effect->set_int("input_width", width * 2));
+			EXPECT_FALSE(deconvolution_effect->set_int("input_height", height * 2));
+			EXPECT_TRUE(deconvolution_effect->set_int("input_width", width));
+		} else {
+			ASSERT_TRUE(deconvolution_effect->set_int("min_fft_matrix_size", 9));
+			tester.run(expected_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		}
+	}
+
+	// The FFT path works in fp16, so the limits are similar to those
+	// in FFTConvolutionEffectTest.
+	expect_equal(expected_data, out_data, width, height, 0.02f, 0.003f);
+}
+
+TEST(DeconvolutionSharpenEffectTest, BackgroundKernelUpdateEventuallyTakesEffect) {
+	const int size = 13;
+
+	float data[size * size] = { 0.0f };
+	data[(size / 2) * size + size / 2] = 1.0f;
+	float expected_data[size * size], out_data[size * size];
+
+	// Start out with the identity transform. The first kernel is always
+	// computed synchronously.
+	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *deconvolution_effect = tester.get_chain()->add_effect(new DeconvolutionSharpenEffect());
+	ASSERT_TRUE(deconvolution_effect->set_int("matrix_size", 5));
+	ASSERT_TRUE(deconvolution_effect->set_int("background_kernel_update", 1));
+	ASSERT_TRUE(deconvolution_effect->set_float("circle_radius", 0.0f));
+	ASSERT_TRUE(deconvolution_effect->set_float("gaussian_radius", 0.0f));
+	ASSERT_TRUE(deconvolution_effect->set_float("correlation", 0.0001f));
+	ASSERT_TRUE(deconvolution_effect->set_float("noise", 0.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, size, size);
+
+	// Now change the parameters (to something no other test uses, so that
+	// the kernel is not in the cache already), and keep rendering until
+	// the new kernel is in use (or we give up). Until then, we should get
+	// the output with the old kernel.
+	ASSERT_TRUE(deconvolution_effect->set_float("circle_radius", 1.5f));
+	ASSERT_TRUE(deconvolution_effect->set_float("correlation", 0.9f));
+	ASSERT_TRUE(deconvolution_effect->set_float("noise", 0.05f));
+	for (int i = 0; i < 1000; ++i) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		if (fabs(out_data[(size / 2) * size + size / 2] - 1.0f) > 1e-3) {
+			break;
+		}
+		expect_equal(data, out_data, size, size);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	// Check that we got the same as we would without the background thread.
+	{
+		EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		Effect *deconvolution_effect = tester.get_chain()->add_effect(new DeconvolutionSharpenEffect());
+		ASSERT_TRUE(deconvolution_effect->set_int("matrix_size", 5));
+		ASSERT_TRUE(deconvolution_effect->set_float("circle_radius", 1.5f));
+		ASSERT_TRUE(deconvolution_effect->set_float("gaussian_radius", 0.0f));
+		ASSERT_TRUE(deconvolution_effect->set_float("correlation", 0.9f));
+		ASSERT_TRUE(deconvolution_effect->set_float("noise", 0.05f));
+		tester.run(expected_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	}
+	expect_equal(expected_data, out_data, size, size);
+}
+
 }  // namespace movit
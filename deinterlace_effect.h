@@ -44,6 +44,8 @@
 // of the same resolution, or the effect will assert-fail. If you cannot supply
 // this, you could simply reuse the current field for previous/next as
 // required; it won't be optimal in any way, but it also won't blow up on you.
+// FrameHistory and HistoryInput (see history_input.h) can keep the fields
+// around for you, so that each of them is uploaded only once.
 //
 // This requirement to “see the future” will mean you have an extra full frame
 // of delay (33.3 ms at 60i, 40 ms at 50i). You will also need to tell the
@@ -15,6 +15,7 @@ DiffusionEffect::DiffusionEffect()
 	  overlay_matte(new OverlayMatteEffect),
 	  owns_overlay_matte(true)
 {
+	CHECK(blur->set_int("max_downscale_levels", 2));
 }
 
 DiffusionEffect::~DiffusionEffect()
@@ -47,6 +48,10 @@ bool DiffusionEffect::set_float(const string &key, float value) {
 	return blur->set_float(key, value);
 }
 
+bool DiffusionEffect::set_int(const string &key, int value) {
+	return blur->set_int(key, value);
+}
+
 OverlayMatteEffect::OverlayMatteEffect()
 	: blurred_mix_amount(0.3f)
 {
@@ -11,6 +11,9 @@
 // We do a relatively simple version, sometimes known as "white diffusion",
 // where we first blur the picture, and then overlay it on the original
 // using the original as a matte.
+//
+// As in GlowEffect, the blur runs at a lower resolution when the radius
+// is large enough (see “max_downscale_levels” in BlurEffect).
 
 #include <epoxy/gl.h>
 #include <assert.h>
@@ -33,6 +36,7 @@ public:
 
 	void rewrite_graph(EffectChain *graph, Node *self) override;
 	bool set_float(const std::string &key, float value) override;
+	bool set_int(const std::string &key, int value) override;
 	
 	std::string output_fragment_shader() override {
 		assert(false);
@@ -1,11 +1,17 @@
 #include <epoxy/gl.h>
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <algorithm>
+#include <mutex>
 
+#include "cpu_backend.h"
 #include "dither_effect.h"
+#include "effect_chain.h"
 #include "effect_util.h"
+#include "fp16.h"
 #include "init.h"
+#include "resource_pool.h"
 #include "util.h"
 
 using namespace std;
@@ -26,26 +32,161 @@ unsigned lcg_rand(unsigned x)
 	return (x * 1103515245U + 12345U) & ((1U << 31) - 1);
 } 
 
+// The blue noise tile is BLUE_NOISE_SIZE x BLUE_NOISE_SIZE pixels.
+// The energy filter for void-and-cluster is a Gaussian with sigma=1.5,
+// as recommended by Ulichney; we cut it off where it drops below 1e-3.
+#define BLUE_NOISE_SIZE 64
+#define BLUE_NOISE_PIXELS (BLUE_NOISE_SIZE * BLUE_NOISE_SIZE)
+#define ENERGY_FILTER_RADIUS 6
+#define ENERGY_FILTER_SIGMA 1.5f
+
+// A binary pattern on the BLUE_NOISE_SIZE x BLUE_NOISE_SIZE torus,
+// along with the energy (the energy filter convolved with the pattern)
+// in each pixel.
+class BinaryPattern {
+public:
+	BinaryPattern()
+	{
+		fill(pattern, pattern + BLUE_NOISE_PIXELS, false);
+		fill(energy, energy + BLUE_NOISE_PIXELS, 0.0f);
+		for (int dy = -ENERGY_FILTER_RADIUS; dy <= ENERGY_FILTER_RADIUS; ++dy) {
+			for (int dx = -ENERGY_FILTER_RADIUS; dx <= ENERGY_FILTER_RADIUS; ++dx) {
+				filter[dy + ENERGY_FILTER_RADIUS][dx + ENERGY_FILTER_RADIUS] =
+					exp(-(dx * dx + dy * dy) / (2.0f * ENERGY_FILTER_SIGMA * ENERGY_FILTER_SIGMA));
+			}
+		}
+	}
+
+	bool is_set(int i) const { return pattern[i]; }
+
+	void toggle(int i)
+	{
+		pattern[i] = !pattern[i];
+		float sign = pattern[i] ? 1.0f : -1.0f;
+		int x = i % BLUE_NOISE_SIZE, y = i / BLUE_NOISE_SIZE;
+		for (int dy = -ENERGY_FILTER_RADIUS; dy <= ENERGY_FILTER_RADIUS; ++dy) {
+			int yy = (y + dy) & (BLUE_NOISE_SIZE - 1);
+			for (int dx = -ENERGY_FILTER_RADIUS; dx <= ENERGY_FILTER_RADIUS; ++dx) {
+				int xx = (x + dx) & (BLUE_NOISE_SIZE - 1);
+				energy[yy * BLUE_NOISE_SIZE + xx] += sign * filter[dy + ENERGY_FILTER_RADIUS][dx + ENERGY_FILTER_RADIUS];
+			}
+		}
+	}
+
+	// The set pixel with the highest energy.
+	int tightest_cluster() const
+	{
+		int best = -1;
+		for (int i = 0; i < BLUE_NOISE_PIXELS; ++i) {
+			if (pattern[i] && (best == -1 || energy[i] > energy[best])) {
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	// The unset pixel with the lowest energy. Note that since the filter
+	// sums to the same everywhere, this is also the tightest cluster
+	// of unset pixels, so we do not need to invert the pattern
+	// for the last half of the ranks like the original algorithm does.
+	int largest_void() const
+	{
+		int best = -1;
+		for (int i = 0; i < BLUE_NOISE_PIXELS; ++i) {
+			if (!pattern[i] && (best == -1 || energy[i] < energy[best])) {
+				best = i;
+			}
+		}
+		return best;
+	}
+
+private:
+	bool pattern[BLUE_NOISE_PIXELS];
+	float energy[BLUE_NOISE_PIXELS];
+	float filter[2 * ENERGY_FILTER_RADIUS + 1][2 * ENERGY_FILTER_RADIUS + 1];
+};
+
+// The rank (0..BLUE_NOISE_PIXELS-1) of each pixel in the blue noise
+// dither array; lower ranks get lower thresholds. Made by
+// init_blue_noise_ranks(), which you need to call (through
+// blue_noise_init_done) before use.
+static once_flag blue_noise_init_done;
+unsigned short blue_noise_ranks[BLUE_NOISE_PIXELS];
+
+void init_blue_noise_ranks()
+{
+	BinaryPattern *prototype = new BinaryPattern;
+
+	// Start with 10% of the pixels set at random...
+	unsigned seed = 1;
+	int num_set = 0;
+	while (num_set < BLUE_NOISE_PIXELS / 10) {
+		seed = lcg_rand(seed);
+		int i = (seed >> 8) % BLUE_NOISE_PIXELS;
+		if (!prototype->is_set(i)) {
+			prototype->toggle(i);
+			++num_set;
+		}
+	}
+
+	// ...then spread them out by moving the pixel in the tightest cluster
+	// to the largest void until that no longer changes anything.
+	// (It always converges in practice, but we put a limit on it to be sure.)
+	for (int iteration = 0; iteration < BLUE_NOISE_PIXELS; ++iteration) {
+		int cluster = prototype->tightest_cluster();
+		prototype->toggle(cluster);
+		int void_pixel = prototype->largest_void();
+		prototype->toggle(void_pixel);
+		if (void_pixel == cluster) {
+			break;
+		}
+	}
+
+	// Rank the set pixels by removing them one by one, tightest cluster first.
+	BinaryPattern *pattern = new BinaryPattern(*prototype);
+	for (int rank = num_set - 1; rank >= 0; --rank) {
+		int cluster = pattern->tightest_cluster();
+		pattern->toggle(cluster);
+		blue_noise_ranks[cluster] = rank;
+	}
+	delete pattern;
+
+	// And the rest by filling in the largest voids, one by one.
+	for (int rank = num_set; rank < BLUE_NOISE_PIXELS; ++rank) {
+		int void_pixel = prototype->largest_void();
+		prototype->toggle(void_pixel);
+		blue_noise_ranks[void_pixel] = rank;
+	}
+	delete prototype;
+}
+
 }  // namespace
 
 DitherEffect::DitherEffect()
-	: width(1280), height(720), num_bits(8),
-	  last_width(-1), last_height(-1), last_num_bits(-1)
+	: width(1280), height(720), num_bits(8), pattern(DITHER_PATTERN_WHITE_NOISE),
+	  last_width(-1), last_height(-1), last_num_bits(-1), last_pattern(-1),
+	  resource_pool(nullptr), texnum(0)
 {
 	register_int("output_width", &width);
 	register_int("output_height", &height);
 	register_int("num_bits", &num_bits);
+	register_int("pattern", &pattern);
 	register_uniform_float("round_fac", &uniform_round_fac);
 	register_uniform_float("inv_round_fac", &uniform_inv_round_fac);
 	register_uniform_vec2("tc_scale", uniform_tc_scale);
 	register_uniform_sampler2d("dither_tex", &uniform_dither_tex);
-
-	glGenTextures(1, &texnum);
 }
 
 DitherEffect::~DitherEffect()
 {
-	glDeleteTextures(1, &texnum);
+	if (texnum != 0) {
+		resource_pool->release_shared_texture(texnum);
+	}
+}
+
+void DitherEffect::inform_added(EffectChain *chain)
+{
+	resource_pool = chain->get_resource_pool();
 }
 
 string DitherEffect::output_fragment_shader()
@@ -55,10 +196,12 @@ string DitherEffect::output_fragment_shader()
 	return buf + read_file("dither_effect.frag");
 }
 
-void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+unsigned DitherEffect::compute_texture_size()
 {
-	float *dither_noise = new float[width * height];
-	float dither_double_amplitude = 1.0f / (1 << num_bits);
+	if (pattern == DITHER_PATTERN_BLUE_NOISE) {
+		texture_width = texture_height = BLUE_NOISE_SIZE;
+		return 0;
+	}
 
 	// We don't need a strictly nonrepeating dither; reducing the resolution
 	// to max 128x128 saves a lot of texture bandwidth, without causing any
@@ -69,16 +212,54 @@ void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix,
 	// Using the resolution as a seed gives us a consistent dither from frame to frame.
 	// It also gives a different dither for e.g. different aspect ratios, which _feels_
 	// good, but probably shouldn't matter.
-	unsigned seed = (width << 16) ^ height;
-	for (int i = 0; i < texture_width * texture_height; ++i) {
-		seed = lcg_rand(seed);
-		float normalized_rand = seed * (1.0f / (1U << 31)) - 0.5;  // [-0.5, 0.5>
-		dither_noise[i] = dither_double_amplitude * normalized_rand;
+	return (width << 16) ^ height;
+}
+
+void DitherEffect::generate_noise(float *dither_noise, unsigned seed) const
+{
+	float dither_double_amplitude = 1.0f / (1 << num_bits);
+	if (pattern == DITHER_PATTERN_BLUE_NOISE) {
+		call_once(blue_noise_init_done, init_blue_noise_ranks);
+		for (int i = 0; i < BLUE_NOISE_PIXELS; ++i) {
+			float normalized_rand = (blue_noise_ranks[i] + 0.5f) * (1.0f / BLUE_NOISE_PIXELS) - 0.5f;  // <-0.5, 0.5>
+			dither_noise[i] = dither_double_amplitude * normalized_rand;
+		}
+	} else {
+		for (int i = 0; i < texture_width * texture_height; ++i) {
+			seed = lcg_rand(seed);
+			float normalized_rand = seed * (1.0f / (1U << 31)) - 0.5;  // [-0.5, 0.5>
+			dither_noise[i] = dither_double_amplitude * normalized_rand;
+		}
 	}
+}
 
-	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+void DitherEffect::update_texture()
+{
+	if (texnum != 0) {
+		resource_pool->release_shared_texture(texnum);
+		texnum = 0;
+	}
+
+	unsigned seed = compute_texture_size();
+	char key[256];
+	if (pattern == DITHER_PATTERN_BLUE_NOISE) {
+		snprintf(key, sizeof(key), "DitherEffect:blue:%d", num_bits);
+	} else {
+		snprintf(key, sizeof(key), "DitherEffect:white:%dx%d:%u:%d", texture_width, texture_height, seed, num_bits);
+	}
+
+	texnum = resource_pool->get_shared_texture(key);
+	if (texnum != 0) {
+		return;
+	}
+
+	float *dither_noise = new float[texture_width * texture_height];
+	generate_noise(dither_noise, seed);
+
+	GLuint new_texnum;
+	glGenTextures(1, &new_texnum);
 	check_error();
-	glBindTexture(GL_TEXTURE_2D, texnum);
+	glBindTexture(GL_TEXTURE_2D, new_texnum);
 	check_error();
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	check_error();
@@ -92,6 +273,8 @@ void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix,
 	check_error();
 
 	delete[] dither_noise;
+
+	texnum = resource_pool->add_shared_texture(key, new_texnum);
 }
 
 void DitherEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
@@ -101,16 +284,19 @@ void DitherEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, u
 	assert(width > 0);
 	assert(height > 0);
 	assert(num_bits > 0);
+	assert(pattern == DITHER_PATTERN_WHITE_NOISE || pattern == DITHER_PATTERN_BLUE_NOISE);
 
-	if (width != last_width || height != last_height || num_bits != last_num_bits) {
-		update_texture(glsl_program_num, prefix, sampler_num);
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+
+	if (width != last_width || height != last_height || num_bits != last_num_bits || pattern != last_pattern) {
+		update_texture();
 		last_width = width;
 		last_height = height;
 		last_num_bits = num_bits;
+		last_pattern = pattern;
 	}
 
-	glActiveTexture(GL_TEXTURE0 + *sampler_num);
-	check_error();
 	glBindTexture(GL_TEXTURE_2D, texnum);
 	check_error();
 
@@ -129,4 +315,47 @@ void DitherEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, u
 	uniform_inv_round_fac = 1.0f / round_fac;
 }
 
+void DitherEffect::set_cpu_state()
+{
+	assert(width > 0);
+	assert(height > 0);
+	assert(num_bits > 0);
+	assert(pattern == DITHER_PATTERN_WHITE_NOISE || pattern == DITHER_PATTERN_BLUE_NOISE);
+
+	if (width != last_width || height != last_height || num_bits != last_num_bits || pattern != last_pattern) {
+		unsigned seed = compute_texture_size();
+		cpu_noise.resize(texture_width * texture_height);
+		generate_noise(cpu_noise.data(), seed);
+
+		// Round the same way as the GL_R16F texture, so that we get
+		// exactly the same output.
+		for (float &noise : cpu_noise) {
+			noise = fp16_to_fp32(fp32_to_fp16(noise));
+		}
+
+		last_width = width;
+		last_height = height;
+		last_num_bits = num_bits;
+		last_pattern = pattern;
+	}
+}
+
+void DitherEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                   unsigned y0, unsigned y1, float *dst) const
+{
+	// The noise is laid out over the output pixels exactly like the
+	// texture is in dither_effect.frag (tiled, with GL_NEAREST).
+	// We do not need to round explicitly, since render_to_cpu() rounds
+	// correctly anyway. Alpha is not dithered; see the shader.
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		const float *noise = &cpu_noise[(y % texture_height) * texture_width];
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width; ++x) {
+			const float d = noise[x % texture_width];
+			(CPUPixel::load(in + x * 4) + CPUPixel(d, d, d, 0.0f)).store(out + x * 4);
+		}
+	}
+}
+
 }  // namespace movit
@@ -42,14 +42,33 @@
 // this ensures we don't upset video codecs too much. (One could also dither in time,
 // like many LCD monitors do, but it starts to get very hairy, again, for limited gains.)
 // The dither is also deterministic across runs.
+//
+// Optionally (see EffectChain::set_dither_pattern()), we can use blue noise
+// instead of white noise; each pixel still gets a uniformly distributed
+// offset, but neighboring pixels tend to get very different offsets,
+// so the noise has very little low-frequency energy. This gets us some
+// of the benefits of noise shaping (the noise is much less visible,
+// since the eye is most sensitive to the lower frequencies) without its
+// problems, since the pattern is precomputed. It is made once per process
+// with the void-and-cluster method:
+//
+//   Robert Ulichney: “The void-and-cluster method for dither array generation”
+//   Proc. SPIE 1913, Human Vision, Visual Processing, and Digital Display IV (1993)
+//
+// The dither textures are shared between all chains through the ResourcePool,
+// keyed on their contents, so chains that alternate between output sizes
+// (or many chains with the same size) do not need to regenerate them.
 
 #include <epoxy/gl.h>
 #include <string>
+#include <vector>
 
 #include "effect.h"
 
 namespace movit {
 
+class ResourcePool;
+
 class DitherEffect : public Effect {
 private:
 	// Should not be instantiated by end users;
@@ -68,19 +87,39 @@ public:
 	AlphaHandling alpha_handling() const override { return DONT_CARE_ALPHA_TYPE; }
 	bool strong_one_to_one_sampling() const override { return true; }
 
+	void inform_added(EffectChain *chain) override;
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
 
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 private:
-	void update_texture(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+	// Gets the texture for the current parameters from the ResourcePool,
+	// creating it if needed.
+	void update_texture();
+
+	// Sets texture_width and texture_height for the current parameters,
+	// and returns the seed to give to generate_noise().
+	unsigned compute_texture_size();
 
-	int width, height, num_bits;
-	int last_width, last_height, last_num_bits;
+	// Fills <dither_noise> (texture_width x texture_height values)
+	// with the noise for the current parameters.
+	void generate_noise(float *dither_noise, unsigned seed) const;
+
+	int width, height, num_bits, pattern;
+	int last_width, last_height, last_num_bits, last_pattern;
 	int texture_width, texture_height;
 
-	GLuint texnum;
+	ResourcePool *resource_pool;
+	GLuint texnum;  // Owned by the ResourcePool; 0 if none yet.
 	float uniform_round_fac, uniform_inv_round_fac;
 	float uniform_tc_scale[2];
 	GLint uniform_dither_tex;
+
+	// The same noise as in the texture, for the CPU backend.
+	std::vector<float> cpu_noise;
 };
 
 }  // namespace movit
@@ -65,4 +65,75 @@ TEST(DitherEffectTest, SinusoidBelowOneLevelComesThrough) {
 	EXPECT_NEAR(amplitude, sum / (size * 255.0f), 1.1e-5);
 }
 
+TEST(DitherEffectTest, SinusoidBelowOneLevelComesThroughWithBlueNoise) {
+	// Blue noise has most of its energy in the high frequencies,
+	// so test a lower frequency than above; that is where it matters the most.
+	const float frequency = 2.0f * M_PI / 32.0f;
+	const unsigned width = 128, height = 64;
+	const float amplitude = 0.25f / 255.0f;  // 6 dB below what can be represented without dithering.
+
+	// Unlike in the previous test, we need more than one line, since any
+	// single line of the (64x64) blue noise tile will not be uniformly distributed.
+	float data[width * height];
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			data[y * width + x] = 0.2 + amplitude * sin(x * frequency);
+		}
+	}
+	unsigned char out_data[width * height];
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA8);
+	tester.get_chain()->set_dither_bits(8);
+	tester.get_chain()->set_dither_pattern(DITHER_PATTERN_BLUE_NOISE);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	// Measure how strong the given sinusoid is in the output.
+	float sum = 0.0f;
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			sum += 2.0 * (int(out_data[y * width + x]) - 0.2*255.0) * sin(x * frequency);
+		}
+	}
+
+	EXPECT_NEAR(amplitude, sum / (width * height * 255.0f), 1.1e-5);
+}
+
+TEST(DitherEffectTest, BlueNoiseHasLittleLowFrequencyError) {
+	const unsigned size = 64;
+
+	// Exactly halfway between two levels, so half of the pixels
+	// should be rounded up and half down.
+	float data[size * size];
+	for (unsigned i = 0; i < size * size; ++i) {
+		data[i] = 51.5f / 255.0f;
+	}
+	unsigned char out_data[size * size];
+
+	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA8);
+	tester.get_chain()->set_dither_bits(8);
+	tester.get_chain()->set_dither_pattern(DITHER_PATTERN_BLUE_NOISE);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	// Look at the average over each 4x4 block. With white noise, each pixel
+	// would be rounded up or down independently, so the RMS error of the
+	// averages would be 0.5 / sqrt(16) = 0.125 levels; with blue noise,
+	// the pixels that are rounded up are evenly spread out, so it should be
+	// less than half of that.
+	float sum_sq_error = 0.0f;
+	for (unsigned by = 0; by < size; by += 4) {
+		for (unsigned bx = 0; bx < size; bx += 4) {
+			int sum = 0;
+			for (unsigned y = by; y < by + 4; ++y) {
+				for (unsigned x = bx; x < bx + 4; ++x) {
+					EXPECT_TRUE(out_data[y * size + x] == 51 || out_data[y * size + x] == 52);
+					sum += out_data[y * size + x];
+				}
+			}
+			float error = sum / 16.0f - 51.5f;
+			sum_sq_error += error * error;
+		}
+	}
+	EXPECT_LT(sqrt(sum_sq_error / ((size / 4) * (size / 4))), 0.0625f);
+}
+
 }  // namespace movit
@@ -1,11 +1,13 @@
 #include <epoxy/gl.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <utility>
 
 #include "effect.h"
 #include "effect_util.h"
+#include "util.h"
 
 using namespace Eigen;
 using namespace std;
@@ -18,6 +20,7 @@ bool Effect::set_int(const string &key, int value)
 		return false;
 	}
 	*params_int[key] = value;
+	++parameter_generation;
 	return true;
 }
 
@@ -27,6 +30,7 @@ bool Effect::set_ivec2(const string &key, const int *values)
 		return false;
 	}
 	memcpy(params_ivec2[key], values, sizeof(int) * 2);
+	++parameter_generation;
 	return true;
 }
 
@@ -36,6 +40,7 @@ bool Effect::set_float(const string &key, float value)
 		return false;
 	}
 	*params_float[key] = value;
+	++parameter_generation;
 	return true;
 }
 
@@ -45,6 +50,7 @@ bool Effect::set_vec2(const string &key, const float *values)
 		return false;
 	}
 	memcpy(params_vec2[key], values, sizeof(float) * 2);
+	++parameter_generation;
 	return true;
 }
 
@@ -54,6 +60,7 @@ bool Effect::set_vec3(const string &key, const float *values)
 		return false;
 	}
 	memcpy(params_vec3[key], values, sizeof(float) * 3);
+	++parameter_generation;
 	return true;
 }
 
@@ -63,9 +70,86 @@ bool Effect::set_vec4(const string &key, const float *values)
 		return false;
 	}
 	memcpy(params_vec4[key], values, sizeof(float) * 4);
+	++parameter_generation;
 	return true;
 }
 
+StagedParameter *Effect::find_staged_parameter(StagedParameter::Type type, const string &key)
+{
+	for (StagedParameter &staged : staged_parameters) {
+		if (staged.type == type && staged.key == key) {
+			return &staged;
+		}
+	}
+	StagedParameter staged;
+	staged.type = type;
+	staged.key = key;
+	staged_parameters.push_back(staged);
+	return &staged_parameters.back();
+}
+
+void Effect::stage_int(const string &key, int value)
+{
+	find_staged_parameter(StagedParameter::INT, key)->int_values[0] = value;
+}
+
+void Effect::stage_ivec2(const string &key, const int *values)
+{
+	memcpy(find_staged_parameter(StagedParameter::IVEC2, key)->int_values, values, sizeof(int) * 2);
+}
+
+void Effect::stage_float(const string &key, float value)
+{
+	find_staged_parameter(StagedParameter::FLOAT, key)->float_values[0] = value;
+}
+
+void Effect::stage_vec2(const string &key, const float *values)
+{
+	memcpy(find_staged_parameter(StagedParameter::VEC2, key)->float_values, values, sizeof(float) * 2);
+}
+
+void Effect::stage_vec3(const string &key, const float *values)
+{
+	memcpy(find_staged_parameter(StagedParameter::VEC3, key)->float_values, values, sizeof(float) * 3);
+}
+
+void Effect::stage_vec4(const string &key, const float *values)
+{
+	memcpy(find_staged_parameter(StagedParameter::VEC4, key)->float_values, values, sizeof(float) * 4);
+}
+
+void Effect::take_staged_parameters(vector<StagedParameter> *staged)
+{
+	staged->insert(staged->end(), staged_parameters.begin(), staged_parameters.end());
+	staged_parameters.clear();
+}
+
+void Effect::apply_staged_parameters(const vector<StagedParameter> &staged)
+{
+	for (const StagedParameter &param : staged) {
+		switch (param.type) {
+		case StagedParameter::INT:
+			CHECK(set_int(param.key, param.int_values[0]));
+			break;
+		case StagedParameter::IVEC2:
+			CHECK(set_ivec2(param.key, param.int_values));
+			break;
+		case StagedParameter::FLOAT:
+			CHECK(set_float(param.key, param.float_values[0]));
+			break;
+		case StagedParameter::VEC2:
+			CHECK(set_vec2(param.key, param.float_values));
+			break;
+		case StagedParameter::VEC3:
+			CHECK(set_vec3(param.key, param.float_values));
+			break;
+		case StagedParameter::VEC4:
+			CHECK(set_vec4(param.key, param.float_values));
+			break;
+		}
+	}
+}
+
 void Effect::register_int(const string &key, int *value)
 {
 	assert(params_int.count(key) == 0);
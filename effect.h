@@ -19,11 +19,13 @@
 #include <Eigen/Core>
 
 #include "defs.h"
+#include "image_format.h"
 
 namespace movit {
 
 class EffectChain;
 class Node;
+struct CPUImage;
 
 // Can alias on a float[2].
 struct Point2D {
@@ -52,6 +54,20 @@ struct RGBATuple {
 	float r, g, b, a;
 };
 
+// A rectangle in normalized texture coordinates, ie., (0,0) is the lower-left
+// corner of the image and (1,1) is the upper-right. Used for partial rendering;
+// see Effect::get_needed_input_region().
+struct Region {
+	Region()
+		: x0(0.0f), y0(0.0f), x1(0.0f), y1(0.0f) {}
+	Region(float x0, float y0, float x1, float y1)
+		: x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+	bool empty() const { return x0 >= x1 || y0 >= y1; }
+
+	float x0, y0, x1, y1;
+};
+
 // Represents a registered uniform.
 template<class T>
 struct Uniform {
@@ -62,6 +78,16 @@ struct Uniform {
 	GLint location;  // Filled in only after phases have been constructed. -1 if no location.
 };
 
+// A parameter change recorded by Effect::stage_*(), to be applied later
+// with the corresponding set_*(); see EffectChain::commit_parameters().
+struct StagedParameter {
+	enum Type { INT, IVEC2, FLOAT, VEC2, VEC3, VEC4 };
+	Type type;
+	std::string key;
+	int int_values[2];
+	float float_values[4];
+};
+
 class Effect {
 public:
 	virtual ~Effect() {}
@@ -201,6 +227,15 @@ public:
 		}
 	}
 
+	// If the effect uses mipmaps, how much it will scale down the given
+	// input (at most) when sampling from it; this decides how many mipmap
+	// levels are needed if the chain generates them itself (see
+	// EffectChain::set_mipmap_filter()). The default, 0.0, means to use
+	// the ratio between the input and output sizes, which is right for
+	// effects that stretch their input over their output, like ResizeEffect;
+	// if you zoom in some other way, you will need to override this.
+	virtual float mipmap_minification(unsigned input_num) const { return 0.0f; }
+
 	// Whether there is a direct correspondence between input and output
 	// texels. Specifically, the effect must not:
 	//
@@ -232,6 +267,27 @@ public:
 	// An effect that it strong one-to-one must also be one-to-one.
 	virtual bool strong_one_to_one_sampling() const { return false; }
 
+	// For partial rendering (see EffectChain::render_region_to_fbo()):
+	// Given the part of this effect's output that is needed, return the
+	// part of input number <input_num> that the effect will sample to compute
+	// it. The output region is in the normalized coordinates of your output,
+	// and the returned region should be in those of the given input; it is
+	// allowed to extend outside 0..1 (it will be clipped). You do not need to
+	// care about the neighbors used by bilinear filtering, since EffectChain
+	// adds a texel of margin everywhere, but if you need mipmaps, the region
+	// must also cover the texels making up the mip levels you sample from.
+	//
+	// The default is right for effects with strong_one_to_one_sampling(),
+	// and otherwise conservatively asks for the entire input. This is always
+	// correct, but means everything before this effect is rendered in full.
+	virtual Region get_needed_input_region(unsigned input_num, const Region &output_region) const {
+		if (strong_one_to_one_sampling()) {
+			return output_region;
+		} else {
+			return Region(0.0f, 0.0f, 1.0f, 1.0f);
+		}
+	}
+
 	// Whether this effect wants to output to a different size than
 	// its input(s) (see inform_input_size(), below). See also
 	// sets_virtual_output_size() below.
@@ -330,6 +386,15 @@ public:
 	// given resolution before you get the input.
 	virtual void inform_input_size(unsigned input_num, unsigned width, unsigned height) {}
 
+	// Tells the effect the color space and gamma curve of each of its inputs,
+	// as they ended up after EffectChain has inserted all its conversions.
+	// Called once, at the end of finalize(), before output_fragment_shader().
+	// Most effects will not need this, since they say what they need through
+	// needs_linear_light() and needs_srgb_primaries() instead; it is for those
+	// that can work on anything, but need to know what it is (see e.g.
+	// BakedLUTEffect).
+	virtual void inform_input_format(unsigned input_num, const ImageFormat &format) {}
+
 	// How many inputs this effect will take (a fixed number).
 	// If you have only one input, it will be called INPUT() in GLSL;
 	// if you have several, they will be INPUT1(), INPUT2(), and so on.
@@ -372,6 +437,27 @@ public:
 	// after rendering here. The default implementation does nothing.
 	virtual void clear_gl_state();
 
+	// For the CPU backend (see EffectChain::set_backend()). Effects that can
+	// run without OpenGL return true here and implement the two functions
+	// below; a chain using the CPU backend can only contain such effects.
+	virtual bool has_cpu_implementation() const { return false; }
+
+	// The CPU counterpart of set_gl_state(); called once before each render,
+	// after inform_input_size(). Typically computes whatever set_gl_state()
+	// would have put into uniforms.
+	virtual void set_cpu_state() {}
+
+	// Compute rows [y0, y1> (counted from the bottom, like in OpenGL) of
+	// a <width> x <height> output, as RGBA floats, into <dst>, which holds
+	// <width> * 4 floats per row. If the effect does not change the output
+	// size, inputs[i] holds the same rows of input i, sampled on the same
+	// grid; if it does, inputs[i] holds all of input i, at its own size.
+	// Inputs get nullptr and render their own pixels, at their own size.
+	// This is called from several threads at the same time, for different
+	// rows, so it must not modify the effect.
+	virtual void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                             unsigned y0, unsigned y1, float *dst) const {}
+
 	// Set a parameter; intended to be called from user code.
 	// Neither of these take ownership of the pointer.
 	virtual bool set_int(const std::string &key, int value) MUST_CHECK_RESULT;
@@ -381,6 +467,37 @@ public:
 	virtual bool set_vec3(const std::string &key, const float *values) MUST_CHECK_RESULT;
 	virtual bool set_vec4(const std::string &key, const float *values) MUST_CHECK_RESULT;
 
+	// A counter that is increased every time a parameter is successfully set
+	// through one of the functions above. Useful if you cache something that
+	// is computed from the parameters of an effect you do not control.
+	unsigned get_parameter_generation() const { return parameter_generation; }
+
+	// Double-buffered versions of set_*(), for changing parameters from
+	// another thread than the one rendering. The value is only recorded
+	// (overwriting any earlier staged value for the same key), and does not
+	// touch the effect's live state; EffectChain::commit_parameters()
+	// then publishes everything staged on the chain's effects as one
+	// snapshot, which the next render applies through set_*() on the
+	// rendering thread, before anything else is done. Thus, the rendering
+	// thread never sees half of an update, and you never need to wait
+	// for a render to finish before preparing the next frame.
+	//
+	// Only one thread may stage and commit on a given chain's effects
+	// at any time. Since the value cannot be checked until it is applied,
+	// staging something set_*() would refuse is a fatal error at that point.
+	void stage_int(const std::string &key, int value);
+	void stage_ivec2(const std::string &key, const int *values);
+	void stage_float(const std::string &key, float value);
+	void stage_vec2(const std::string &key, const float *values);
+	void stage_vec3(const std::string &key, const float *values);
+	void stage_vec4(const std::string &key, const float *values);
+
+	// Used by EffectChain: take_staged_parameters() moves everything staged
+	// so far to the end of <staged>, and apply_staged_parameters() calls
+	// set_*() for each entry, in order.
+	void take_staged_parameters(std::vector<StagedParameter> *staged);
+	void apply_staged_parameters(const std::vector<StagedParameter> &staged);
+
 protected:
 	// Register a parameter. Whenever set_*() is called with the same key,
 	// it will update the value in the given pointer (typically a pointer
@@ -433,6 +550,14 @@ protected:
 	void register_uniform_mat3(const std::string &key, const Eigen::Matrix3d *matrix);
 
 private:
+	// Finds the staged entry for <key> (of the given type), or adds a new one.
+	StagedParameter *find_staged_parameter(StagedParameter::Type type, const std::string &key);
+
+	unsigned parameter_generation = 0;
+
+	// Touched only by the thread staging parameters; see stage_int().
+	std::vector<StagedParameter> staged_parameters;
+
 	std::map<std::string, int *> params_int;
 	std::map<std::string, int *> params_ivec2;
 	std::map<std::string, float *> params_float;
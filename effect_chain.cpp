@@ -6,6 +6,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <set>
 #include <stack>
 #include <utility>
@@ -15,6 +18,7 @@
 #include "alpha_division_effect.h"
 #include "alpha_multiplication_effect.h"
 #include "colorspace_conversion_effect.h"
+#include "cpu_backend.h"
 #include "dither_effect.h"
 #include "effect.h"
 #include "effect_chain.h"
@@ -24,6 +28,7 @@
 #include "init.h"
 #include "input.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 #include "ycbcr_conversion_effect.h"
 
@@ -60,38 +65,57 @@ EffectChain::EffectChain(float aspect_nom, float aspect_denom, ResourcePool *res
 	  output_origin(OUTPUT_ORIGIN_BOTTOM_LEFT),
 	  finalized(false),
 	  resource_pool(resource_pool),
-	  do_phase_timing(false) {
+	  do_phase_timing(false),
+	  phase_timing_mode(PHASE_TIMING_NONBLOCKING),
+	  phase_timing_window(100) {
 	if (resource_pool == nullptr) {
 		this->resource_pool = new ResourcePool();
 		owns_resource_pool = true;
 	} else {
 		owns_resource_pool = false;
 	}
-
-	// Generate a VBO with some data in (shared position and texture coordinate data).
-	float vertices[] = {
-		0.0f, 2.0f,
-		0.0f, 0.0f,
-		2.0f, 0.0f
-	};
-	vbo = generate_vbo(2, GL_FLOAT, sizeof(vertices), vertices);
 }
 
+// One commit_parameters() worth of changes, and the commit before it
+// that has not been applied yet, if any.
+struct EffectChain::CommittedParameters {
+	vector<pair<Effect *, vector<StagedParameter>>> changes;
+	CommittedParameters *next;
+};
+
 EffectChain::~EffectChain()
 {
 	for (unsigned i = 0; i < nodes.size(); ++i) {
 		delete nodes[i]->effect;
 		delete nodes[i];
 	}
+	if (backend == BACKEND_OPENGL) {
+		collect_trace_query_results(/*discard=*/true);
+	}
 	for (unsigned i = 0; i < phases.size(); ++i) {
-		resource_pool->release_glsl_program(phases[i]->glsl_program_num);
+		if (backend == BACKEND_OPENGL) {
+			resource_pool->release_glsl_program(phases[i]->glsl_program_num);
+			const vector<GLuint> &trace_queries = phases[i]->trace_query_objects_free;
+			if (!trace_queries.empty()) {
+				glDeleteQueries(trace_queries.size(), trace_queries.data());
+				check_error();
+			}
+		}
 		delete phases[i];
 	}
+	delete mipmap_generator;
+	for (CommittedParameters *committed = committed_parameters.load(); committed != nullptr; ) {
+		CommittedParameters *next = committed->next;
+		delete committed;
+		committed = next;
+	}
 	if (owns_resource_pool) {
 		delete resource_pool;
 	}
-	glDeleteBuffers(1, &vbo);
-	check_error();
+	if (vbo != 0) {
+		glDeleteBuffers(1, &vbo);
+		check_error();
+	}
 }
 
 Input *EffectChain::add_input(Input *input)
@@ -363,6 +387,18 @@ void collect_uniform_locations(GLuint glsl_program_num, vector<Uniform<T>> *phas
 
 void EffectChain::compile_glsl_program(Phase *phase)
 {
+	TraceScope trace_scope("compile", "EffectChain::compile_glsl_program");
+	if (tracing_enabled()) {
+		string effect_list;
+		for (Node *node : phase->effects) {
+			if (!effect_list.empty()) {
+				effect_list += ", ";
+			}
+			effect_list += node->effect->effect_type_id();
+		}
+		trace_scope.add_arg("effects", effect_list);
+	}
+
 	string frag_shader_header;
 	if (phase->is_compute_shader) {
 		frag_shader_header = read_file("header.comp");
@@ -371,6 +407,25 @@ void EffectChain::compile_glsl_program(Phase *phase)
 	}
 	string frag_shader = "";
 
+	// For tiled rendering, the vertex shader and the RTT inputs need to know
+	// where the current tile is; see Phase::tile_tc_scale etc.
+	const bool tiled = (tile_width != 0);
+	assert(!(tiled && phase->is_compute_shader));
+	auto add_tile_uniform = [phase](const string &name, Point2D *value) {
+		Uniform<float> uniform;
+		uniform.name = name;
+		uniform.value = (float *)value;
+		uniform.prefix = "tile";
+		uniform.num_values = 1;
+		uniform.location = -1;
+		phase->uniforms_vec2.push_back(uniform);
+	};
+	if (tiled) {
+		// Must not be resized later, as the uniforms point into them.
+		phase->input_tile_scale.resize(phase->inputs.size());
+		phase->input_tile_offset.resize(phase->inputs.size());
+	}
+
 	// Create functions and uniforms for all the texture inputs that we need.
 	for (unsigned i = 0; i < phase->inputs.size(); ++i) {
 		Node *input = phase->inputs[i]->output_node;
@@ -379,8 +434,17 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		phase->effect_ids.insert(make_pair(make_pair(input, IN_ANOTHER_PHASE), effect_id));
 	
 		frag_shader += string("uniform sampler2D tex_") + effect_id + ";\n";
-		frag_shader += string("vec4 ") + effect_id + "(vec2 tc) {\n";
-		frag_shader += "\tvec4 tmp = tex2D(tex_" + string(effect_id) + ", tc);\n";
+		if (tiled) {
+			// The texture only holds the part of the input that the current tile needs.
+			frag_shader += string("uniform vec2 tile_") + effect_id + "_offset, tile_" + effect_id + "_scale;\n";
+			frag_shader += string("vec4 ") + effect_id + "(vec2 tc) {\n";
+			frag_shader += "\tvec4 tmp = tex2D(tex_" + string(effect_id) + ", (tc - tile_" + effect_id + "_offset) * tile_" + effect_id + "_scale);\n";
+			add_tile_uniform(string(effect_id) + "_offset", &phase->input_tile_offset[i]);
+			add_tile_uniform(string(effect_id) + "_scale", &phase->input_tile_scale[i]);
+		} else {
+			frag_shader += string("vec4 ") + effect_id + "(vec2 tc) {\n";
+			frag_shader += "\tvec4 tmp = tex2D(tex_" + string(effect_id) + ", tc);\n";
+		}
 
 		if (intermediate_transformation == SQUARE_ROOT_FRAMEBUFFER_TRANSFORMATION &&
 		    phase->inputs[i]->output_node->output_gamma_curve == GAMMA_LINEAR) {
@@ -589,6 +653,15 @@ void EffectChain::compile_glsl_program(Phase *phase)
 			vert_shader[pos + needle.size() - 1] = '1';
 		}
 	}
+	if (tiled) {
+		const string needle = "#define TILED 0";
+		size_t pos = vert_shader.find(needle);
+		assert(pos != string::npos);
+
+		vert_shader[pos + needle.size() - 1] = '1';
+		add_tile_uniform("tc_scale", &phase->tile_tc_scale);
+		add_tile_uniform("tc_offset", &phase->tile_tc_offset);
+	}
 
 	frag_shader = frag_shader_header + frag_shader_uniforms + frag_shader;
 
@@ -848,14 +921,21 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 		phase->effects[i]->containing_phase = phase;
 	}
 
-	// Actually make the shader for this phase.
-	compile_glsl_program(phase);
+	// Actually make the shader for this phase. (The CPU backend runs
+	// the effects directly, so it has no use for one.)
+	if (backend == BACKEND_OPENGL) {
+		compile_glsl_program(phase);
+	} else {
+		phase->glsl_program_num = 0;
+	}
 
 	// Initialize timers.
-	if (movit_timer_queries_supported) {
-		phase->time_elapsed_ns = 0;
-		phase->num_measured_iterations = 0;
-	}
+	phase->time_elapsed_ns = 0;
+	phase->num_measured_iterations = 0;
+	phase->cpu_execute_ns = 0;
+	phase->cpu_set_gl_state_ns = 0;
+	phase->num_cpu_measured_iterations = 0;
+	phase->output_format = GL_NONE;
 
 	assert(completed_effects->count(output) == 0);
 	completed_effects->insert(make_pair(output, phase));
@@ -865,6 +945,18 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 
 void EffectChain::output_dot(const char *filename)
 {
+	// Every step of finalize() ends with a call to output_dot(),
+	// so this is a convenient place to record how long each step took.
+	if (tracing_enabled()) {
+		double now_us = trace_timestamp_us(chrono::steady_clock::now());
+		string step_name = filename;
+		if (step_name.size() > 4 && step_name.compare(step_name.size() - 4, 4, ".dot") == 0) {
+			step_name.resize(step_name.size() - 4);
+		}
+		trace_complete("finalize", step_name, finalize_step_start_us, now_us - finalize_step_start_us);
+		finalize_step_start_us = now_us;
+	}
+
 	if (movit_debug_level != MOVIT_DEBUG_ON) {
 		return;
 	}
@@ -1786,6 +1878,14 @@ void EffectChain::add_ycbcr_conversion_if_needed()
 	connect_nodes(output, ycbcr_conversion_effect_node);
 }
 	
+void EffectChain::set_dither_pattern(DitherPattern pattern)
+{
+	dither_pattern = pattern;
+	if (dither_effect != nullptr) {
+		CHECK(dither_effect->set_int("pattern", pattern));
+	}
+}
+
 // If the user has requested dither, add a DitherEffect right at the end
 // (after GammaCompressionEffect etc.). This needs to be done after everything else,
 // since dither is about the only effect that can _not_ be done in linear space.
@@ -1797,6 +1897,7 @@ void EffectChain::add_dither_if_needed()
 	Node *output = find_output_node();
 	Node *dither = add_node(new DitherEffect());
 	CHECK(dither->effect->set_int("num_bits", num_dither_bits));
+	CHECK(dither->effect->set_int("pattern", dither_pattern));
 	connect_nodes(output, dither);
 
 	dither_effect = dither->effect;
@@ -1861,6 +1962,9 @@ Node *EffectChain::find_output_node()
 
 void EffectChain::finalize()
 {
+	TraceScope trace_scope("finalize", "EffectChain::finalize");
+	finalize_step_start_us = trace_timestamp_us(chrono::steady_clock::now());
+
 	// Output the graph as it is before we do any conversions on it.
 	output_dot("step0-start.dot");
 
@@ -1915,7 +2019,38 @@ void EffectChain::finalize()
 	add_dummy_effect_if_needed();
 
 	output_dot("step20-final.dot");
+
+	if (backend == BACKEND_CPU) {
+		if (num_output_color_ycbcr != 0) {
+			fprintf(stderr, "Y'CbCr output is not supported with BACKEND_CPU.\n");
+			abort();
+		}
+		if (is_tiled()) {
+			fprintf(stderr, "set_tile_size() is not supported with BACKEND_CPU.\n");
+			abort();
+		}
+		for (Node *node : nodes) {
+			if (!node->disabled && !node->effect->has_cpu_implementation()) {
+				fprintf(stderr, "%s has no CPU implementation, so it cannot be used with BACKEND_CPU.\n",
+					node->effect->effect_type_id().c_str());
+				abort();
+			}
+		}
+	}
 	
+	// The formats are now final, so tell the effects what they will get.
+	for (Node *node : nodes) {
+		if (node->disabled) {
+			continue;
+		}
+		for (unsigned i = 0; i < node->incoming_links.size(); ++i) {
+			ImageFormat format;
+			format.color_space = node->incoming_links[i]->output_color_space;
+			format.gamma_curve = node->incoming_links[i]->output_gamma_curve;
+			node->effect->inform_input_format(i, format);
+		}
+	}
+
 	// Construct all needed GLSL programs, starting at the output.
 	// We need to keep track of which effects have already been computed,
 	// as an effect with multiple users could otherwise be calculated
@@ -1963,13 +2098,38 @@ void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height
 	render(dest_fbo, {}, x, y, width, height);
 }
 
+void EffectChain::render_region_to_fbo(GLuint dest_fbo, unsigned width, unsigned height,
+                                       unsigned region_x, unsigned region_y,
+                                       unsigned region_width, unsigned region_height)
+{
+	GLuint x = 0, y = 0;
+
+	if (width == 0 && height == 0) {
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		x = viewport[0];
+		y = viewport[1];
+		width = viewport[2];
+		height = viewport[3];
+	}
+	assert(region_x + region_width <= width);
+	assert(region_y + region_height <= height);
+
+	const Region output_region(
+		float(region_x) / width, float(region_y) / height,
+		float(region_x + region_width) / width, float(region_y + region_height) / height);
+	render(dest_fbo, {}, x, y, width, height, &output_region);
+}
+
 void EffectChain::render_to_texture(const vector<DestinationTexture> &destinations, unsigned width, unsigned height)
 {
 	assert(finalized);
 	assert(!destinations.empty());
 
-	if (!has_dummy_effect) {
-		// We don't end in a compute shader, so there's nothing specific for us to do.
+	if (!has_dummy_effect || !compute_output_matches_size(width, height)) {
+		// We don't end in a compute shader (or it doesn't output the size
+		// we want, so we need the dummy phase to scale it), so there's
+		// nothing specific for us to do.
 		// Create an FBO for this set of textures, and just render to that.
 		GLuint texnums[4] = { 0, 0, 0, 0 };
 		for (unsigned i = 0; i < destinations.size() && i < 4; ++i) {
@@ -1983,11 +2143,336 @@ void EffectChain::render_to_texture(const vector<DestinationTexture> &destinatio
 	}
 }
 
-void EffectChain::render(GLuint dest_fbo, const vector<DestinationTexture> &destinations, unsigned x, unsigned y, unsigned width, unsigned height)
+void EffectChain::commit_parameters()
 {
 	assert(finalized);
-	assert(destinations.size() <= 1);
 
+	CommittedParameters *committed = new CommittedParameters;
+	for (Node *node : nodes) {
+		vector<StagedParameter> staged;
+		node->effect->take_staged_parameters(&staged);
+		if (!staged.empty()) {
+			committed->changes.emplace_back(node->effect, move(staged));
+		}
+	}
+	if (committed->changes.empty()) {
+		delete committed;
+		return;
+	}
+
+	// Push it onto the stack. We never take anything back out
+	// (only apply_committed_parameters() does, and then everything),
+	// so there is no ABA problem.
+	committed->next = committed_parameters.load(memory_order_relaxed);
+	while (!committed_parameters.compare_exchange_weak(committed->next, committed,
+	                                                   memory_order_release, memory_order_relaxed))
+		;
+}
+
+void EffectChain::apply_committed_parameters()
+{
+	CommittedParameters *committed = committed_parameters.exchange(nullptr, memory_order_acquire);
+	if (committed == nullptr) {
+		return;
+	}
+
+	// The stack has the newest commit first; reverse it, so that
+	// we can merge them in the order they were made.
+	vector<unique_ptr<CommittedParameters>> commits;
+	for ( ; committed != nullptr; committed = committed->next) {
+		commits.emplace_back(committed);
+	}
+	reverse(commits.begin(), commits.end());
+
+	// Merge changes to the same parameter, so that each one is set only once,
+	// to the last value committed. As within a single commit, each one keeps
+	// the place where it was first changed.
+	vector<pair<Effect *, vector<StagedParameter>>> changes = move(commits[0]->changes);
+	for (unsigned i = 1; i < commits.size(); ++i) {
+		for (pair<Effect *, vector<StagedParameter>> &change : commits[i]->changes) {
+			auto effect_it = find_if(changes.begin(), changes.end(),
+				[&change](const pair<Effect *, vector<StagedParameter>> &c) { return c.first == change.first; });
+			if (effect_it == changes.end()) {
+				changes.push_back(move(change));
+				continue;
+			}
+			vector<StagedParameter> *merged = &effect_it->second;
+			for (StagedParameter &param : change.second) {
+				auto param_it = find_if(merged->begin(), merged->end(),
+					[&param](const StagedParameter &p) { return p.type == param.type && p.key == param.key; });
+				if (param_it == merged->end()) {
+					merged->push_back(move(param));
+				} else {
+					*param_it = move(param);
+				}
+			}
+		}
+	}
+
+	for (const pair<Effect *, vector<StagedParameter>> &change : changes) {
+		change.first->apply_staged_parameters(change.second);
+	}
+}
+
+struct EffectChain::CPUPhaseContext {
+	// The outputs of the earlier phases that are still needed,
+	// by their output nodes.
+	map<Node *, CPUImage> phase_outputs;
+
+	// Nodes in the current phase that have been rendered in full,
+	// at their own size, and the memory holding them.
+	map<Node *, CPUImage> full_images;
+	vector<unique_ptr<float[]>> full_image_storage;
+};
+
+void EffectChain::render_to_cpu(float *dst, unsigned width, unsigned height)
+{
+	assert(finalized);
+	assert(backend == BACKEND_CPU);
+
+	TraceScope trace_scope("render", "EffectChain::render_to_cpu");
+	apply_committed_parameters();
+
+	// Like render_phases(), we keep each phase's output only for as long
+	// as there are phases left that need it.
+	map<Phase *, unique_ptr<float[]>> output_buffers;
+	map<Phase *, int> ref_counts;
+	for (Phase *phase : phases) {
+		for (Phase *input : phase->inputs) {
+			++ref_counts[input];
+		}
+	}
+
+	CPUPhaseContext context;
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		const bool last_phase = (phase_num == phases.size() - 1);
+		if (last_phase && dither_effect != nullptr) {
+			CHECK(dither_effect->set_int("output_width", width));
+			CHECK(dither_effect->set_int("output_height", height));
+		}
+
+		inform_input_sizes(phase);
+		find_output_size(phase);
+		for (Node *node : phase->effects) {
+			node->effect->set_cpu_state();
+		}
+
+		TraceScope phase_trace_scope("render", "Phase");
+		if (last_phase) {
+			render_phase_cpu(&context, phase, width, height, dst);
+		} else {
+			const unsigned phase_width = phase->output_width, phase_height = phase->output_height;
+			float *buf = new float[size_t(phase_width) * phase_height * 4];
+			output_buffers[phase].reset(buf);
+			render_phase_cpu(&context, phase, phase_width, phase_height, buf);
+			context.phase_outputs[phase->output_node] = CPUImage{ buf, phase_width, phase_height, 0, phase_height };
+		}
+
+		for (Phase *input : phase->inputs) {
+			if (--ref_counts[input] == 0) {
+				context.phase_outputs.erase(input->output_node);
+				output_buffers.erase(input);
+			}
+		}
+	}
+
+	if (output_origin == OUTPUT_ORIGIN_TOP_LEFT) {
+		unique_ptr<float[]> tmp(new float[width * 4]);
+		for (unsigned y = 0; y < height / 2; ++y) {
+			float *row1 = dst + size_t(y) * width * 4;
+			float *row2 = dst + size_t(height - 1 - y) * width * 4;
+			memcpy(tmp.get(), row1, width * 4 * sizeof(float));
+			memcpy(row1, row2, width * 4 * sizeof(float));
+			memcpy(row2, tmp.get(), width * 4 * sizeof(float));
+		}
+	}
+}
+
+void EffectChain::render_to_cpu(unsigned char *dst, unsigned width, unsigned height)
+{
+	unique_ptr<float[]> buf(new float[size_t(width) * height * 4]);
+	render_to_cpu(buf.get(), width, height);
+	parallel_for_strips(width * 4 * (sizeof(float) + 1), height, [&](unsigned y0, unsigned y1) {
+		for (size_t i = size_t(y0) * width * 4; i < size_t(y1) * width * 4; ++i) {
+			const float x = buf[i] * 255.0f;
+			dst[i] = (x > 0.0f) ? lrintf(min(x, 255.0f)) : 0;  // Also maps NaN to 0.
+		}
+	});
+}
+
+void EffectChain::render_phase_cpu(CPUPhaseContext *context, Phase *phase, unsigned width, unsigned height, float *dst)
+{
+	prepare_node_cpu(context, phase->output_node, IN_SAME_PHASE, width, height);
+	parallel_for_strips(width * 4 * sizeof(float), height, [&](unsigned y0, unsigned y1) {
+		render_node_cpu_rows(*context, phase->output_node, IN_SAME_PHASE,
+			width, height, y0, y1, dst + size_t(y0) * width * 4);
+	});
+	context->full_images.clear();
+	context->full_image_storage.clear();
+}
+
+// Effects that do not change the output size are computed on whatever
+// grid their output is wanted on, the same way a fragment shader evaluates
+// them wherever the next effect samples. All others are computed at their
+// own size, and need all of their inputs at their own sizes, too.
+// This mirrors what happens within a phase on the GPU, except that if
+// such a node is wanted on a different grid, we interpolate its output
+// bilinearly instead of evaluating it at the exact position (which is
+// what sampling a texture would give anyway, in the case of inputs).
+void EffectChain::prepare_node_cpu(CPUPhaseContext *context, Node *node, NodeLinkType link_type, unsigned width, unsigned height)
+{
+	if (link_type == IN_ANOTHER_PHASE) {
+		return;
+	}
+	Effect *effect = node->effect;
+	if (effect->num_inputs() != 0 && !effect->changes_output_size()) {
+		for (unsigned i = 0; i < node->incoming_links.size(); ++i) {
+			prepare_node_cpu(context, node->incoming_links[i], node->incoming_link_type[i], width, height);
+		}
+		return;
+	}
+	for (unsigned i = 0; i < node->incoming_links.size(); ++i) {
+		render_node_in_full_cpu(context, node->incoming_links[i], node->incoming_link_type[i]);
+	}
+	if (node->output_width != width || node->output_height != height) {
+		render_node_in_full_cpu(context, node, link_type);
+	}
+}
+
+void EffectChain::render_node_in_full_cpu(CPUPhaseContext *context, Node *node, NodeLinkType link_type)
+{
+	if (link_type == IN_ANOTHER_PHASE || context->full_images.count(node)) {
+		return;
+	}
+	const unsigned width = node->output_width, height = node->output_height;
+	assert(width != 0 && height != 0);
+	prepare_node_cpu(context, node, link_type, width, height);
+
+	float *buf = new float[size_t(width) * height * 4];
+	context->full_image_storage.emplace_back(buf);
+	parallel_for_strips(width * 4 * sizeof(float), height, [&](unsigned y0, unsigned y1) {
+		render_node_cpu_rows(*context, node, link_type, width, height, y0, y1, buf + size_t(y0) * width * 4);
+	});
+	context->full_images[node] = CPUImage{ buf, width, height, 0, height };
+}
+
+namespace {
+
+// Memory for the rows render_node_cpu_rows() computes for the inputs of
+// an effect, kept by each thread for as long as it lives, so that we do
+// not need to allocate anew for every node and strip. Since
+// render_node_cpu_rows() recurses depth-first, buffers are taken
+// and given back in stack order.
+class CPUScratchRows {
+public:
+	// Returns a buffer of (at least) <num_floats> floats, which is
+	// valid until the matching give_back().
+	float *take(size_t num_floats)
+	{
+		if (depth == buffers.size()) {
+			buffers.emplace_back();
+		}
+		Buffer *buf = &buffers[depth++];
+		if (buf->size < num_floats) {
+			buf->data.reset(new float[num_floats]);
+			buf->size = num_floats;
+		}
+		return buf->data.get();
+	}
+
+	void give_back(unsigned num_buffers)
+	{
+		assert(depth >= num_buffers);
+		depth -= num_buffers;
+	}
+
+private:
+	struct Buffer {
+		unique_ptr<float[]> data;
+		size_t size = 0;
+	};
+	deque<Buffer> buffers;  // Not vector, so that growing it does not move the Buffers.
+	unsigned depth = 0;
+};
+
+thread_local CPUScratchRows cpu_scratch_rows;
+
+}  // namespace
+
+void EffectChain::render_node_cpu_rows(const CPUPhaseContext &context, Node *node, NodeLinkType link_type,
+                                       unsigned width, unsigned height, unsigned y0, unsigned y1, float *dst)
+{
+	if (link_type == IN_ANOTHER_PHASE) {
+		resample_cpu_rows(context.phase_outputs.at(node), width, height, y0, y1, dst);
+		return;
+	}
+
+	Effect *effect = node->effect;
+	const size_t num_inputs = node->incoming_links.size();
+
+	// Most effects have one or two inputs, so avoid allocating for those, too.
+	CPUImage inline_inputs[4];
+	vector<CPUImage> more_inputs;
+	CPUImage *inputs = inline_inputs;
+	if (num_inputs > 4) {
+		more_inputs.resize(num_inputs);
+		inputs = more_inputs.data();
+	}
+
+	if (effect->num_inputs() != 0 && !effect->changes_output_size()) {
+		// Compute the same rows of all the inputs, and then this effect on top.
+		for (unsigned i = 0; i < num_inputs; ++i) {
+			float *rows = cpu_scratch_rows.take(size_t(y1 - y0) * width * 4);
+			render_node_cpu_rows(context, node->incoming_links[i], node->incoming_link_type[i],
+				width, height, y0, y1, rows);
+			inputs[i] = CPUImage{ rows, width, height, y0, y1 };
+		}
+		effect->render_cpu_rows(inputs, width, height, y0, y1, dst);
+		cpu_scratch_rows.give_back(num_inputs);
+		return;
+	}
+
+	if (node->output_width != width || node->output_height != height) {
+		resample_cpu_rows(context.full_images.at(node), width, height, y0, y1, dst);
+		return;
+	}
+	for (unsigned i = 0; i < num_inputs; ++i) {
+		Node *input = node->incoming_links[i];
+		if (node->incoming_link_type[i] == IN_ANOTHER_PHASE) {
+			inputs[i] = context.phase_outputs.at(input);
+		} else {
+			inputs[i] = context.full_images.at(input);
+		}
+	}
+	effect->render_cpu_rows(num_inputs == 0 ? nullptr : inputs, width, height, y0, y1, dst);
+}
+
+bool EffectChain::compute_output_matches_size(unsigned width, unsigned height)
+{
+	assert(has_dummy_effect);
+	assert(phases.size() >= 2);
+
+	// The sizes can depend on the effects' parameters, so we need
+	// to propagate them from the start, like render() does.
+	for (Phase *phase : phases) {
+		inform_input_sizes(phase);
+		find_output_size(phase);
+	}
+	const Phase *phase = phases[phases.size() - 2];
+	assert(phase->is_compute_shader);
+	return phase->output_width == width && phase->output_height == height;
+}
+
+void EffectChain::render(GLuint dest_fbo, const vector<DestinationTexture> &destinations, unsigned x, unsigned y, unsigned width, unsigned height, const Region *output_region)
+{
+	const bool final_srgb = setup_render_state();
+	render_phases(dest_fbo, destinations, x, y, width, height, final_srgb, output_region);
+	reset_render_state();
+}
+
+bool EffectChain::setup_render_state()
+{
 	// This needs to be set anew, in case we are coming from a different context
 	// from when we initialized.
 	check_error();
@@ -1996,7 +2481,6 @@ void EffectChain::render(GLuint dest_fbo, const vector<DestinationTexture> &dest
 
 	const bool final_srgb = glIsEnabled(GL_FRAMEBUFFER_SRGB);
 	check_error();
-	bool current_srgb = final_srgb;
 
 	// Basic state.
 	check_error();
@@ -2007,19 +2491,74 @@ void EffectChain::render(GLuint dest_fbo, const vector<DestinationTexture> &dest
 	glDepthMask(GL_FALSE);
 	check_error();
 
-	set<Phase *> generated_mipmaps;
+	return final_srgb;
+}
 
-	// We keep one texture per output, but only for as long as we actually have any
-	// phases that need it as an input. (We don't make any effort to reorder phases
-	// to minimize the number of textures in play, as register allocation can be
-	// complicated and we rarely have much to gain, since our graphs are typically
-	// pretty linear.)
-	map<Phase *, GLuint> output_textures;
-	map<Phase *, int> ref_counts;
-	for (Phase *phase : phases) {
-		for (Phase *input : phase->inputs) {
-			++ref_counts[input];
-		}
+void EffectChain::reset_render_state()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+	glUseProgram(0);
+	check_error();
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	check_error();
+	glBindVertexArray(0);
+	check_error();
+}
+
+namespace {
+
+// A query object from <free_queries> (left over from an earlier render),
+// or a new one if there are none.
+GLuint take_query_object(vector<GLuint> *free_queries)
+{
+	GLuint query;
+	if (free_queries->empty()) {
+		glGenQueries(1, &query);
+		check_error();
+	} else {
+		query = free_queries->back();
+		free_queries->pop_back();
+	}
+	return query;
+}
+
+}  // namespace
+
+void EffectChain::render_phases(GLuint dest_fbo, const vector<DestinationTexture> &destinations, unsigned x, unsigned y, unsigned width, unsigned height, bool final_srgb, const Region *output_region)
+{
+	assert(finalized);
+	assert(backend == BACKEND_OPENGL);
+	assert(destinations.size() <= 1);
+
+	TraceScope trace_scope("render", "EffectChain::render");
+	apply_committed_parameters();
+
+	// If we are tracing, we also want to show the GPU execution of each phase,
+	// which needs timestamp queries. Find the offset between the GPU clock and
+	// the one we use for tracing, so that the two can be shown side by side.
+	// (glGetInteger64v(GL_TIMESTAMP) gives the time when all previous commands
+	// have reached the GPU, which is good enough for our use.)
+	const bool trace_gpu = tracing_enabled() && movit_timer_queries_supported;
+	double gpu_to_trace_offset_us = 0.0;
+	if (trace_gpu) {
+		GLint64 gpu_now_ns;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_now_ns);
+		check_error();
+		gpu_to_trace_offset_us = trace_timestamp_us(chrono::steady_clock::now()) - gpu_now_ns * 1e-3;
+	}
+
+	bool current_srgb = final_srgb;
+
+	if (vbo == 0) {
+		// Generate a VBO with some data in (shared position and texture coordinate data).
+		float vertices[] = {
+			0.0f, 2.0f,
+			0.0f, 0.0f,
+			2.0f, 0.0f
+		};
+		vbo = generate_vbo(2, GL_FLOAT, sizeof(vertices), vertices);
 	}
 
 	size_t num_phases = phases.size();
@@ -2039,132 +2578,483 @@ void EffectChain::render(GLuint dest_fbo, const vector<DestinationTexture> &dest
 		// directly and skip the dummy phase.
 		--num_phases;
 	}
+	assert(output_region == nullptr || destinations.empty());
 
-	for (unsigned phase_num = 0; phase_num < num_phases; ++phase_num) {
-		Phase *phase = phases[phase_num];
+	// The rectangles of the output to render, one after the other, in pixels
+	// relative to (x, y). Unless we are rendering in tiles, this is simply
+	// all of the output (and <output_region> is taken care of by the scissor test).
+	struct OutputTile {
+		unsigned x0, y0, x1, y1;
+	};
+	vector<OutputTile> tiles;
+	if (tile_width == 0) {
+		tiles.push_back(OutputTile{ 0, 0, width, height });
+	} else {
+		unsigned region_x0 = 0, region_y0 = 0, region_x1 = width, region_y1 = height;
+		if (output_region != nullptr) {
+			region_x0 = lrintf(output_region->x0 * width);
+			region_y0 = lrintf(output_region->y0 * height);
+			region_x1 = lrintf(output_region->x1 * width);
+			region_y1 = lrintf(output_region->y1 * height);
+		}
+		for (unsigned tile_y = 0; tile_y < height; tile_y += tile_height) {
+			for (unsigned tile_x = 0; tile_x < width; tile_x += tile_width) {
+				OutputTile tile{
+					max(tile_x, region_x0), max(tile_y, region_y0),
+					min(tile_x + tile_width, region_x1), min(tile_y + tile_height, region_y1)
+				};
+				if (tile.x0 < tile.x1 && tile.y0 < tile.y1) {
+					tiles.push_back(tile);
+				}
+			}
+		}
+	}
+
+	// The parts of the output to render are given in the coordinate system
+	// of the framebuffer, so they need to be flipped if the vertex shader
+	// flips the texture coordinates (see OutputOrigin).
+	auto output_to_texcoords = [this](const Region &region) {
+		if (output_origin == OUTPUT_ORIGIN_TOP_LEFT) {
+			return Region(region.x0, 1.0f - region.y1, region.x1, 1.0f - region.y0);
+		} else {
+			return region;
+		}
+	};
+
+	// Round the needed region of an intermediate phase outwards to whole pixels,
+	// with an extra pixel on each side for bilinear filtering, and then further
+	// out to a multiple of <alignment> pixels.
+	auto round_region = [](const Region &region, const Phase *phase, int alignment,
+	                       int *x0, int *y0, int *x1, int *y1) {
+		const int phase_width = phase->output_width, phase_height = phase->output_height;
+		*x0 = max(int(floor(region.x0 * phase_width)) - 1, 0) / alignment * alignment;
+		*y0 = max(int(floor(region.y0 * phase_height)) - 1, 0) / alignment * alignment;
+		*x1 = min((int(ceil(region.x1 * phase_width)) + alignment) / alignment * alignment, phase_width);
+		*y1 = min((int(ceil(region.y1 * phase_height)) + alignment) / alignment * alignment, phase_height);
+	};
 
+	// To tell which parts of their inputs they need, the effects need to know
+	// their sizes, so find those up front (find_needed_regions() gives them
+	// to the effects again, and so will the rendering below).
+	if (tile_width != 0 || output_region != nullptr) {
+		for (Phase *phase : phases) {
+			inform_input_sizes(phase);
+			find_output_size(phase);
+		}
+	}
+
+	// With tiled rendering, each phase runs once per tile, but we still
+	// want one measurement (and one trace event) per phase and render,
+	// so each tile adds to the same group of queries.
+	for (unsigned phase_num = 0; phase_num < num_phases && !tiles.empty(); ++phase_num) {
+		Phase *phase = phases[phase_num];
 		if (do_phase_timing) {
-			GLuint timer_query_object;
-			if (phase->timer_query_objects_free.empty()) {
-				glGenQueries(1, &timer_query_object);
-			} else {
-				timer_query_object = phase->timer_query_objects_free.front();
-				phase->timer_query_objects_free.pop_front();
+			phase->timer_query_objects_running.emplace_back();
+			++phase->num_cpu_measured_iterations;
+		}
+		if (trace_gpu) {
+			Phase::TraceQuery trace_query;
+			trace_query.gpu_to_trace_offset_us = gpu_to_trace_offset_us;
+			phase->trace_queries_running.push_back(trace_query);
+		}
+	}
+
+	for (const OutputTile &tile : tiles) {
+		map<Phase *, Region> needed_regions;
+		if (tile_width != 0) {
+			const Region tile_region(
+				float(tile.x0) / width, float(tile.y0) / height,
+				float(tile.x1) / width, float(tile.y1) / height);
+			find_needed_regions(output_to_texcoords(tile_region), &needed_regions);
+		} else if (output_region != nullptr) {
+			find_needed_regions(output_to_texcoords(*output_region), &needed_regions);
+		}
+
+		map<Phase *, unsigned> generated_mipmap_levels;
+
+		// We keep one texture per output, but only for as long as we actually have any
+		// phases that need it as an input. (We don't make any effort to reorder phases
+		// to minimize the number of textures in play, as register allocation can be
+		// complicated and we rarely have much to gain, since our graphs are typically
+		// pretty linear.)
+		map<Phase *, GLuint> output_textures;
+		map<Phase *, int> ref_counts;
+		for (Phase *phase : phases) {
+			for (Phase *input : phase->inputs) {
+				++ref_counts[input];
 			}
-			glBeginQuery(GL_TIME_ELAPSED, timer_query_object);
-			phase->timer_query_objects_running.push_back(timer_query_object);
 		}
-		bool last_phase = (phase_num == num_phases - 1);
-		if (last_phase) {
-			// Last phase goes to the output the user specified.
-			if (!phase->is_compute_shader) {
-				assert(dest_fbo != (GLuint)-1);
-				glBindFramebuffer(GL_FRAMEBUFFER, dest_fbo);
+
+		for (unsigned phase_num = 0; phase_num < num_phases; ++phase_num) {
+			Phase *phase = phases[phase_num];
+
+			if (do_phase_timing) {
+				GLuint timer_query_object;
+				if (phase->timer_query_objects_free.empty()) {
+					glGenQueries(1, &timer_query_object);
+				} else {
+					timer_query_object = phase->timer_query_objects_free.front();
+					phase->timer_query_objects_free.pop_front();
+				}
+				glBeginQuery(GL_TIME_ELAPSED, timer_query_object);
+				phase->timer_query_objects_running.back().push_back(timer_query_object);
+			}
+			if (trace_gpu) {
+				GLuint start_query = take_query_object(&phase->trace_query_objects_free);
+				glQueryCounter(start_query, GL_TIMESTAMP);
+				check_error();
+				phase->trace_queries_running.back().start_queries.push_back(start_query);
+			}
+			bool last_phase = (phase_num == num_phases - 1);
+			if (last_phase) {
+				// Last phase goes to the output the user specified.
+				if (!phase->is_compute_shader) {
+					assert(dest_fbo != (GLuint)-1);
+					glBindFramebuffer(GL_FRAMEBUFFER, dest_fbo);
+					check_error();
+					GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+					assert(status == GL_FRAMEBUFFER_COMPLETE);
+					glViewport(x + tile.x0, y + tile.y0, tile.x1 - tile.x0, tile.y1 - tile.y0);
+				}
+				if (dither_effect != nullptr) {
+					CHECK(dither_effect->set_int("output_width", width));
+					CHECK(dither_effect->set_int("output_height", height));
+				}
+			}
+
+			// Enable sRGB rendering for intermediates in case we are
+			// rendering to an sRGB format.
+			// TODO: Support this for compute shaders.
+			bool needs_srgb = last_phase ? final_srgb : true;
+			if (needs_srgb && !current_srgb) {
+				glEnable(GL_FRAMEBUFFER_SRGB);
+				check_error();
+				current_srgb = true;
+			} else if (!needs_srgb && current_srgb) {
+				glDisable(GL_FRAMEBUFFER_SRGB);
 				check_error();
-				GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-				assert(status == GL_FRAMEBUFFER_COMPLETE);
-				glViewport(x, y, width, height);
+				current_srgb = false;
 			}
-			if (dither_effect != nullptr) {
-				CHECK(dither_effect->set_int("output_width", width));
-				CHECK(dither_effect->set_int("output_height", height));
+
+			inform_input_sizes(phase);
+			find_output_size(phase);
+
+			// If we are rendering in tiles, find out which part of this phase
+			// we need for the current tile, and tell the shaders where it is.
+			unsigned texture_width = phase->output_width, texture_height = phase->output_height;
+			if (tile_width != 0) {
+				unsigned full_width, full_height;
+				if (last_phase) {
+					phase->tile_x0 = tile.x0;
+					phase->tile_y0 = tile.y0;
+					phase->tile_x1 = tile.x1;
+					phase->tile_y1 = tile.y1;
+					full_width = width;
+					full_height = height;
+				} else {
+					const Region &region = needed_regions[phase];
+					if (region.empty()) {
+						// Not used for this tile, but the texture still needs to exist.
+						phase->tile_x0 = phase->tile_y0 = 0;
+						phase->tile_x1 = phase->tile_y1 = 1;
+					} else {
+						// Align to 16 pixels, so that at least the first few
+						// mipmap levels (if any) line up with those we would
+						// get for the full frame.
+						int x0, y0, x1, y1;
+						round_region(region, phase, 16, &x0, &y0, &x1, &y1);
+						phase->tile_x0 = x0;
+						phase->tile_y0 = y0;
+						phase->tile_x1 = x1;
+						phase->tile_y1 = y1;
+					}
+					full_width = phase->output_width;
+					full_height = phase->output_height;
+					texture_width = phase->tile_x1 - phase->tile_x0;
+					texture_height = phase->tile_y1 - phase->tile_y0;
+				}
+				phase->tile_tc_scale = Point2D(
+					float(phase->tile_x1 - phase->tile_x0) / full_width,
+					float(phase->tile_y1 - phase->tile_y0) / full_height);
+				phase->tile_tc_offset = Point2D(
+					float(phase->tile_x0) / full_width,
+					float(phase->tile_y0) / full_height);
+				for (unsigned i = 0; i < phase->inputs.size(); ++i) {
+					const Phase *input = phase->inputs[i];
+					phase->input_tile_scale[i] = Point2D(
+						float(input->output_width) / (input->tile_x1 - input->tile_x0),
+						float(input->output_height) / (input->tile_y1 - input->tile_y0));
+					phase->input_tile_offset[i] = Point2D(
+						float(input->tile_x0) / input->output_width,
+						float(input->tile_y0) / input->output_height);
+				}
+			}
+
+			// Find a texture for this phase.
+			vector<DestinationTexture> phase_destinations;
+			if (!last_phase) {
+				GLuint tex_num = resource_pool->create_2d_texture(intermediate_format, texture_width, texture_height);
+				output_textures.insert(make_pair(phase, tex_num));
+				phase->output_format = intermediate_format;
+				phase_destinations.push_back(DestinationTexture{ tex_num, intermediate_format });
+
+				// The output texture needs to have valid state to be written to by a compute shader.
+				glActiveTexture(GL_TEXTURE0);
+				check_error();
+				glBindTexture(GL_TEXTURE_2D, tex_num);
+				check_error();
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				check_error();
+			} else if (phase->is_compute_shader) {
+				assert(!destinations.empty());
+				phase_destinations = destinations;
+				phase->output_format = destinations[0].format;
+			} else {
+				phase->output_format = GL_NONE;
+			}
+
+			if (output_region != nullptr && tile_width == 0 && !phase->is_compute_shader) {
+				int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+				if (last_phase) {
+					// This is exactly the region the user asked for.
+					x0 = x + lrintf(output_region->x0 * width);
+					y0 = y + lrintf(output_region->y0 * height);
+					x1 = x + lrintf(output_region->x1 * width);
+					y1 = y + lrintf(output_region->y1 * height);
+				} else if (!needed_regions[phase].empty()) {
+					round_region(needed_regions[phase], phase, 1, &x0, &y0, &x1, &y1);
+				}
+				glEnable(GL_SCISSOR_TEST);
+				check_error();
+				glScissor(x0, y0, x1 - x0, y1 - y0);
+				check_error();
+			}
+
+			if (tracing_enabled()) {
+				char name[64];
+				if (tile_width != 0) {
+					snprintf(name, sizeof(name), "Phase %u, tile %u", phase_num, unsigned(&tile - &tiles[0]));
+				} else {
+					snprintf(name, sizeof(name), "Phase %u", phase_num);
+				}
+				TraceScope phase_trace_scope("render", name);
+				execute_phase(phase, output_textures, phase_destinations, &generated_mipmap_levels);
+			} else {
+				execute_phase(phase, output_textures, phase_destinations, &generated_mipmap_levels);
+			}
+			if (do_phase_timing) {
+				glEndQuery(GL_TIME_ELAPSED);
+			}
+			if (trace_gpu) {
+				GLuint end_query = take_query_object(&phase->trace_query_objects_free);
+				glQueryCounter(end_query, GL_TIMESTAMP);
+				check_error();
+				phase->trace_queries_running.back().end_queries.push_back(end_query);
+			}
+
+			// Drop any input textures we don't need anymore.
+			for (Phase *input : phase->inputs) {
+				assert(ref_counts[input] > 0);
+				if (--ref_counts[input] == 0) {
+					resource_pool->release_2d_texture(output_textures[input]);
+					output_textures.erase(input);
+				}
 			}
 		}
 
-		// Enable sRGB rendering for intermediates in case we are
-		// rendering to an sRGB format.
-		// TODO: Support this for compute shaders.
-		bool needs_srgb = last_phase ? final_srgb : true;
-		if (needs_srgb && !current_srgb) {
-			glEnable(GL_FRAMEBUFFER_SRGB);
-			check_error();
-			current_srgb = true;
-		} else if (!needs_srgb && current_srgb) {
-			glDisable(GL_FRAMEBUFFER_SRGB);
-			check_error();
-			current_srgb = true;
+		for (const auto &phase_and_texnum : output_textures) {
+			resource_pool->release_2d_texture(phase_and_texnum.second);
+		}
+	}
+
+	if (output_region != nullptr) {
+		glDisable(GL_SCISSOR_TEST);
+		check_error();
+	}
+
+	if (do_phase_timing) {
+		collect_timer_query_results(phase_timing_mode == PHASE_TIMING_BLOCKING);
+	}
+	collect_trace_query_results(/*discard=*/false);
+}
+
+void EffectChain::find_needed_regions(const Region &output_region, map<Phase *, Region> *needed_regions)
+{
+	const Region full_region(0.0f, 0.0f, 1.0f, 1.0f);
+	auto add_region = [](const Region &region, Region *dst) {
+		// Clip to the image, then take the union.
+		Region clipped(max(region.x0, 0.0f), max(region.y0, 0.0f),
+		               min(region.x1, 1.0f), min(region.y1, 1.0f));
+		if (clipped.empty()) {
+			return;
+		}
+		if (dst->empty()) {
+			*dst = clipped;
+		} else {
+			*dst = Region(min(dst->x0, clipped.x0), min(dst->y0, clipped.y0),
+			              max(dst->x1, clipped.x1), max(dst->y1, clipped.y1));
 		}
+	};
 
-		// Find a texture for this phase.
+	// The phases are sorted so that every phase comes after its inputs,
+	// so going backwards, we have seen all consumers of a phase
+	// by the time we get to it.
+	add_region(output_region, &(*needed_regions)[phases.back()]);
+	for (auto phase_it = phases.rbegin(); phase_it != phases.rend(); ++phase_it) {
+		Phase *phase = *phase_it;
+		Region &phase_region = (*needed_regions)[phase];
+
+		// Some effects keep state across phases (e.g. ResampleEffect's
+		// two passes share their sizes), so make sure the effects
+		// in this phase have the right input sizes before we ask them.
 		inform_input_sizes(phase);
-		find_output_size(phase);
-		vector<DestinationTexture> phase_destinations;
-		if (!last_phase) {
-			GLuint tex_num = resource_pool->create_2d_texture(intermediate_format, phase->output_width, phase->output_height);
-			output_textures.insert(make_pair(phase, tex_num));
-			phase_destinations.push_back(DestinationTexture{ tex_num, intermediate_format });
-
-			// The output texture needs to have valid state to be written to by a compute shader.
-			glActiveTexture(GL_TEXTURE0);
-			check_error();
-			glBindTexture(GL_TEXTURE_2D, tex_num);
-			check_error();
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			check_error();
-		} else if (phase->is_compute_shader) {
-			assert(!destinations.empty());
-			phase_destinations = destinations;
-		}
-
-		execute_phase(phase, output_textures, phase_destinations, &generated_mipmaps);
-		if (do_phase_timing) {
-			glEndQuery(GL_TIME_ELAPSED);
+		if (phase->is_compute_shader) {
+			// We cannot scissor a compute shader, so it will need all of its input.
+			phase_region = full_region;
 		}
 
-		// Drop any input textures we don't need anymore.
-		for (Phase *input : phase->inputs) {
-			assert(ref_counts[input] > 0);
-			if (--ref_counts[input] == 0) {
-				resource_pool->release_2d_texture(output_textures[input]);
-				output_textures.erase(input);
+		// Same within the phase; the effects are in topological order.
+		map<Node *, Region> node_regions;
+		node_regions[phase->output_node] = phase_region;
+		for (auto node_it = phase->effects.rbegin(); node_it != phase->effects.rend(); ++node_it) {
+			Node *node = *node_it;
+			if (node->effect->num_inputs() == 0) {
+				continue;
+			}
+			const Region node_region = node_regions[node];
+			if (node_region.empty()) {
+				continue;
+			}
+			for (size_t i = 0; i < node->incoming_links.size(); ++i) {
+				Node *dep = node->incoming_links[i];
+				Region input_region = node->effect->get_needed_input_region(i, node_region);
+				if (phase->is_compute_shader) {
+					input_region = full_region;
+				}
+				if (node->incoming_link_type[i] == IN_SAME_PHASE) {
+					add_region(input_region, &node_regions[dep]);
+					continue;
+				}
+				for (Phase *input_phase : phase->inputs) {
+					if (input_phase->output_node == dep) {
+						add_region(input_region, &(*needed_regions)[input_phase]);
+					}
+				}
 			}
 		}
 	}
+}
 
-	for (const auto &phase_and_texnum : output_textures) {
-		resource_pool->release_2d_texture(phase_and_texnum.second);
-	}
+void EffectChain::collect_trace_query_results(bool discard)
+{
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		while (!phase->trace_queries_running.empty()) {
+			const Phase::TraceQuery &trace_query = phase->trace_queries_running.front();
+			assert(trace_query.start_queries.size() == trace_query.end_queries.size());
+			if (!discard && !trace_query.end_queries.empty()) {
+				// The queries finish in order, so if the end of this one
+				// is not available yet, neither are any of the others.
+				GLint available;
+				glGetQueryObjectiv(trace_query.end_queries.back(), GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available) {
+					break;
+				}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	check_error();
-	glUseProgram(0);
-	check_error();
+				// With tiled rendering, the event starts with the first tile,
+				// and is as long as all the tiles together.
+				GLuint64 start_ns = 0, duration_ns = 0;
+				for (size_t i = 0; i < trace_query.start_queries.size(); ++i) {
+					GLuint64 tile_start_ns, tile_end_ns;
+					glGetQueryObjectui64v(trace_query.start_queries[i], GL_QUERY_RESULT, &tile_start_ns);
+					glGetQueryObjectui64v(trace_query.end_queries[i], GL_QUERY_RESULT, &tile_end_ns);
+					if (i == 0) {
+						start_ns = tile_start_ns;
+					}
+					duration_ns += tile_end_ns - tile_start_ns;
+				}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	check_error();
-	glBindVertexArray(0);
+				TraceArgs args;
+				string effect_list;
+				for (Node *node : phase->effects) {
+					if (!effect_list.empty()) {
+						effect_list += ", ";
+					}
+					effect_list += node->effect->effect_type_id();
+				}
+				args.push_back(make_pair("effects", effect_list));
+				if (trace_query.start_queries.size() > 1) {
+					args.push_back(make_pair("tiles", to_string(trace_query.start_queries.size())));
+				}
+
+				// Named apart from the CPU side of the phase (which is
+				// on the track of the thread that rendered it).
+				char name[64];
+				snprintf(name, sizeof(name), "Phase %u (GPU)", phase_num);
+				trace_complete("gpu", name,
+					start_ns * 1e-3 + trace_query.gpu_to_trace_offset_us,
+					duration_ns * 1e-3,
+					TRACE_TRACK_GPU, args);
+			}
+			vector<GLuint> &free_queries = phase->trace_query_objects_free;
+			free_queries.insert(free_queries.end(), trace_query.start_queries.begin(), trace_query.start_queries.end());
+			free_queries.insert(free_queries.end(), trace_query.end_queries.begin(), trace_query.end_queries.end());
+			phase->trace_queries_running.pop_front();
+		}
+	}
 	check_error();
+}
 
-	if (do_phase_timing) {
-		// Get back the timer queries.
-		for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
-			Phase *phase = phases[phase_num];
-			for (auto timer_it = phase->timer_query_objects_running.cbegin();
-			     timer_it != phase->timer_query_objects_running.cend(); ) {
-				GLint timer_query_object = *timer_it;
-				GLint available;
-				glGetQueryObjectiv(timer_query_object, GL_QUERY_RESULT_AVAILABLE, &available);
-				if (available) {
-					GLuint64 time_elapsed;
-					glGetQueryObjectui64v(timer_query_object, GL_QUERY_RESULT, &time_elapsed);
-					phase->time_elapsed_ns += time_elapsed;
-					++phase->num_measured_iterations;
+void EffectChain::collect_timer_query_results(bool wait)
+{
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		for (auto timer_it = phase->timer_query_objects_running.cbegin();
+		     timer_it != phase->timer_query_objects_running.cend(); ) {
+			// One render; with tiled rendering, the sum of all its tiles.
+			const vector<GLuint> &timer_query_objects = *timer_it;
+			bool available = true;
+			if (!wait) {
+				for (GLuint timer_query_object : timer_query_objects) {
+					GLint tile_available;
+					glGetQueryObjectiv(timer_query_object, GL_QUERY_RESULT_AVAILABLE, &tile_available);
+					if (!tile_available) {
+						available = false;
+						break;
+					}
+				}
+			}
+			if (available) {
+				GLuint64 time_elapsed = 0;
+				for (GLuint timer_query_object : timer_query_objects) {
+					GLuint64 tile_time_elapsed;
+					glGetQueryObjectui64v(timer_query_object, GL_QUERY_RESULT, &tile_time_elapsed);
+					time_elapsed += tile_time_elapsed;
 					phase->timer_query_objects_free.push_back(timer_query_object);
-					phase->timer_query_objects_running.erase(timer_it++);
-				} else {
-					++timer_it;
 				}
+				phase->time_elapsed_ns += time_elapsed;
+				++phase->num_measured_iterations;
+				phase->recent_time_elapsed_ns.push_back(time_elapsed);
+				while (phase->recent_time_elapsed_ns.size() > phase_timing_window) {
+					phase->recent_time_elapsed_ns.pop_front();
+				}
+				phase->timer_query_objects_running.erase(timer_it++);
+			} else {
+				++timer_it;
 			}
 		}
 	}
 }
 
-void EffectChain::enable_phase_timing(bool enable)
+void EffectChain::enable_phase_timing(bool enable, PhaseTimingMode mode, size_t window_size)
 {
 	if (enable) {
 		assert(movit_timer_queries_supported);
+		assert(window_size > 0);
 	}
 	this->do_phase_timing = enable;
+	this->phase_timing_mode = mode;
+	this->phase_timing_window = window_size;
 }
 
 void EffectChain::reset_phase_timing()
@@ -2173,21 +3063,97 @@ void EffectChain::reset_phase_timing()
 		Phase *phase = phases[phase_num];
 		phase->time_elapsed_ns = 0;
 		phase->num_measured_iterations = 0;
+		phase->recent_time_elapsed_ns.clear();
+		phase->cpu_execute_ns = 0;
+		phase->cpu_set_gl_state_ns = 0;
+		phase->num_cpu_measured_iterations = 0;
 	}
 }
 
+vector<PhaseTiming> EffectChain::get_phase_timing()
+{
+	assert(finalized);
+	if (do_phase_timing) {
+		collect_timer_query_results(/*wait=*/false);
+	}
+
+	vector<PhaseTiming> timings;
+	for (Phase *phase : phases) {
+		PhaseTiming timing;
+		for (Node *node : phase->effects) {
+			timing.effect_type_ids.push_back(node->effect->effect_type_id());
+		}
+		timing.output_width = phase->output_width;
+		timing.output_height = phase->output_height;
+		timing.output_format = phase->output_format;
+
+		// GPU statistics, over the window of recent measurements.
+		vector<uint64_t> recent(phase->recent_time_elapsed_ns.begin(), phase->recent_time_elapsed_ns.end());
+		timing.num_gpu_measured_iterations = recent.size();
+		if (recent.empty()) {
+			timing.gpu_avg_ns = timing.gpu_min_ns = timing.gpu_max_ns = timing.gpu_p99_ns = 0;
+		} else {
+			sort(recent.begin(), recent.end());
+			uint64_t sum = 0;
+			for (uint64_t time_elapsed : recent) {
+				sum += time_elapsed;
+			}
+			timing.gpu_avg_ns = sum / recent.size();
+			timing.gpu_min_ns = recent.front();
+			timing.gpu_max_ns = recent.back();
+			size_t p99_index = (recent.size() * 99 + 99) / 100 - 1;  // ceil(0.99 n) - 1.
+			timing.gpu_p99_ns = recent[p99_index];
+		}
+
+		timing.num_gpu_total_iterations = phase->num_measured_iterations;
+		if (phase->num_measured_iterations == 0) {
+			timing.gpu_total_avg_ns = 0;
+		} else {
+			timing.gpu_total_avg_ns = phase->time_elapsed_ns / phase->num_measured_iterations;
+		}
+
+		// CPU statistics.
+		timing.num_cpu_measured_iterations = phase->num_cpu_measured_iterations;
+		if (phase->num_cpu_measured_iterations == 0) {
+			timing.cpu_execute_avg_ns = timing.cpu_set_gl_state_avg_ns = 0;
+		} else {
+			timing.cpu_execute_avg_ns = phase->cpu_execute_ns / phase->num_cpu_measured_iterations;
+			timing.cpu_set_gl_state_avg_ns = phase->cpu_set_gl_state_ns / phase->num_cpu_measured_iterations;
+		}
+
+		// Memory traffic estimates.
+		timing.bytes_read = 0;
+		for (Phase *input : phase->inputs) {
+			size_t bytes_per_pixel = (input->output_format == GL_NONE) ? 4 : ResourcePool::estimate_bytes_per_pixel(input->output_format);
+			timing.bytes_read += uint64_t(input->output_width) * input->output_height * bytes_per_pixel;
+		}
+		for (Node *node : phase->effects) {
+			if (node->effect->num_inputs() == 0) {
+				Input *input = static_cast<Input *>(node->effect);
+				timing.bytes_read += uint64_t(input->get_width()) * input->get_height() * 4;
+			}
+		}
+		size_t bytes_per_pixel = (phase->output_format == GL_NONE) ? 4 : ResourcePool::estimate_bytes_per_pixel(phase->output_format);
+		timing.bytes_written = uint64_t(phase->output_width) * phase->output_height * bytes_per_pixel;
+
+		timings.push_back(timing);
+	}
+	return timings;
+}
+
 void EffectChain::print_phase_timing()
 {
+	vector<PhaseTiming> timings = get_phase_timing();
 	double total_time_ms = 0.0;
-	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
-		Phase *phase = phases[phase_num];
-		double avg_time_ms = phase->time_elapsed_ns * 1e-6 / phase->num_measured_iterations;
+	for (unsigned phase_num = 0; phase_num < timings.size(); ++phase_num) {
+		const PhaseTiming &timing = timings[phase_num];
+		double avg_time_ms = timing.gpu_total_avg_ns * 1e-6;
 		printf("Phase %d: %5.1f ms  [", phase_num, avg_time_ms);
-		for (unsigned effect_num = 0; effect_num < phase->effects.size(); ++effect_num) {
+		for (unsigned effect_num = 0; effect_num < timing.effect_type_ids.size(); ++effect_num) {
 			if (effect_num != 0) {
 				printf(", ");
 			}
-			printf("%s", phase->effects[effect_num]->effect->effect_type_id().c_str());
+			printf("%s", timing.effect_type_ids[effect_num].c_str());
 		}
 		printf("]\n");
 		total_time_ms += avg_time_ms;
@@ -2198,8 +3164,14 @@ void EffectChain::print_phase_timing()
 void EffectChain::execute_phase(Phase *phase,
                                 const map<Phase *, GLuint> &output_textures,
                                 const vector<DestinationTexture> &destinations,
-                                set<Phase *> *generated_mipmaps)
+                                map<Phase *, unsigned> *generated_mipmap_levels)
 {
+	chrono::steady_clock::time_point start_time;
+	chrono::steady_clock::duration set_gl_state_time = chrono::steady_clock::duration::zero();
+	if (do_phase_timing) {
+		start_time = chrono::steady_clock::now();
+	}
+
 	// Set up RTT inputs for this phase.
 	for (unsigned sampler = 0; sampler < phase->inputs.size(); ++sampler) {
 		glActiveTexture(GL_TEXTURE0 + sampler);
@@ -2233,12 +3205,45 @@ void EffectChain::execute_phase(Phase *phase,
 		}
 		assert(!(any_needs_mipmaps && any_refuses_mipmaps));
 
-		if (any_needs_mipmaps && generated_mipmaps->count(input) == 0) {
-			glGenerateMipmap(GL_TEXTURE_2D);
-			check_error();
-			generated_mipmaps->insert(input);
+		unsigned max_mipmap_level = 1000;  // The OpenGL default.
+		if (any_needs_mipmaps) {
+			// If we are rendering in tiles, the texture only holds the tile.
+			unsigned texture_width = input->output_width, texture_height = input->output_height;
+			if (tile_width != 0) {
+				texture_width = input->tile_x1 - input->tile_x0;
+				texture_height = input->tile_y1 - input->tile_y0;
+			}
+			const bool use_generator =
+				mipmap_filter != MIPMAP_FILTER_DRIVER &&
+				movit_compute_shaders_supported &&
+				MipmapGenerator::supports_format(input->output_format);
+			if (use_generator) {
+				max_mipmap_level = min(find_needed_mipmap_level(phase, input),
+				                       MipmapGenerator::max_mipmap_level(texture_width, texture_height));
+			}
+			auto level_it = generated_mipmap_levels->find(input);
+			if (level_it == generated_mipmap_levels->end() || level_it->second < max_mipmap_level) {
+				if (use_generator) {
+					if (mipmap_generator == nullptr) {
+						mipmap_generator = new MipmapGenerator(resource_pool);
+					}
+					mipmap_generator->generate(it->second, input->output_format,
+						texture_width, texture_height, max_mipmap_level, mipmap_filter);
+				} else {
+					// Make sure all levels are generated, even if
+					// MipmapGenerator has had this texture earlier.
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_mipmap_level);
+					check_error();
+					glGenerateMipmap(GL_TEXTURE_2D);
+					check_error();
+					resource_pool->mark_texture_mipmapped(it->second);
+				}
+				(*generated_mipmap_levels)[input] = max_mipmap_level;
+			} else {
+				max_mipmap_level = level_it->second;
+			}
 		}
-		setup_rtt_sampler(sampler, any_needs_mipmaps);
+		setup_rtt_sampler(sampler, any_needs_mipmaps, max_mipmap_level);
 		phase->input_samplers[sampler] = sampler;  // Bind the sampler to the right uniform.
 	}
 
@@ -2265,7 +3270,12 @@ void EffectChain::execute_phase(Phase *phase,
 		assert(destinations.size() == 1);
 		fbo = resource_pool->create_fbo(destinations[0].texnum);
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glViewport(0, 0, phase->output_width, phase->output_height);
+		if (tile_width != 0) {
+			// The texture only holds the current tile; see render_phases().
+			glViewport(0, 0, phase->tile_x1 - phase->tile_x0, phase->tile_y1 - phase->tile_y0);
+		} else {
+			glViewport(0, 0, phase->output_width, phase->output_height);
+		}
 	}
 
 	// Give the required parameters to all the effects.
@@ -2273,7 +3283,13 @@ void EffectChain::execute_phase(Phase *phase,
 	for (unsigned i = 0; i < phase->effects.size(); ++i) {
 		Node *node = phase->effects[i];
 		unsigned old_sampler_num = sampler_num;
-		node->effect->set_gl_state(instance_program_num, phase->effect_ids[make_pair(node, IN_SAME_PHASE)], &sampler_num);
+		if (do_phase_timing) {
+			chrono::steady_clock::time_point set_gl_state_start = chrono::steady_clock::now();
+			node->effect->set_gl_state(instance_program_num, phase->effect_ids[make_pair(node, IN_SAME_PHASE)], &sampler_num);
+			set_gl_state_time += chrono::steady_clock::now() - set_gl_state_start;
+		} else {
+			node->effect->set_gl_state(instance_program_num, phase->effect_ids[make_pair(node, IN_SAME_PHASE)], &sampler_num);
+		}
 		check_error();
 
 		if (node->effect->is_single_texture()) {
@@ -2320,6 +3336,12 @@ void EffectChain::execute_phase(Phase *phase,
 	if (fbo != 0) {
 		resource_pool->release_fbo(fbo);
 	}
+
+	if (do_phase_timing) {
+		chrono::steady_clock::duration execute_time = chrono::steady_clock::now() - start_time;
+		phase->cpu_execute_ns += chrono::duration_cast<chrono::nanoseconds>(execute_time).count();
+		phase->cpu_set_gl_state_ns += chrono::duration_cast<chrono::nanoseconds>(set_gl_state_time).count();
+	}
 }
 
 void EffectChain::setup_uniforms(Phase *phase)
@@ -2396,10 +3418,48 @@ void EffectChain::setup_uniforms(Phase *phase)
 	}
 }
 
-void EffectChain::setup_rtt_sampler(int sampler_num, bool use_mipmaps)
+unsigned EffectChain::find_needed_mipmap_level(Phase *phase, Phase *input)
+{
+	Node *output_node = phase->is_compute_shader ? phase->compute_shader_node : phase->effects.back();
+	float max_scale = 1.0f;
+	for (Node *node : phase->effects) {
+		for (size_t i = 0; i < node->incoming_links.size(); ++i) {
+			if (node->incoming_links[i] != input->output_node ||
+			    node->incoming_link_type[i] != IN_ANOTHER_PHASE ||
+			    node->needs_mipmaps != Effect::NEEDS_MIPMAPS) {
+				continue;
+			}
+
+			float minification = node->effect->mipmap_minification(i);
+			if (minification > 0.0f) {
+				max_scale = max(max_scale, minification);
+				continue;
+			}
+
+			// The last effect in the phase may have a virtual size
+			// different from what is actually rendered, and effects
+			// whose inputs disagree about size do not have one at all.
+			unsigned width = node->output_width, height = node->output_height;
+			if (node == output_node || width == 0 || height == 0) {
+				width = phase->output_width;
+				height = phase->output_height;
+			}
+			max_scale = max(max_scale, float(input->output_width) / width);
+			max_scale = max(max_scale, float(input->output_height) / height);
+		}
+	}
+
+	// OpenGL picks the level closest to log2 of the scale factor
+	// (for GL_LINEAR_MIPMAP_NEAREST), so rounding up is always enough.
+	return unsigned(ceil(log2(max_scale) - 1e-3));
+}
+
+void EffectChain::setup_rtt_sampler(int sampler_num, bool use_mipmaps, unsigned max_mipmap_level)
 {
 	glActiveTexture(GL_TEXTURE0 + sampler_num);
 	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_mipmap_level);
+	check_error();
 	if (use_mipmaps) {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
 		check_error();
@@ -17,12 +17,19 @@
 // the EffectChain holds textures and other OpenGL objects that are tied to the
 // context.
 //
+// The one exception is parameter changes made through Effect::stage_*()
+// and commit_parameters(), which may happen in another thread while
+// rendering; see there.
+//
 // Memory management (only relevant if you use multiple contexts):
 // See corresponding comment in resource_pool.h. This holds even if you don't
 // allocate your own ResourcePool, but let EffectChain hold its own.
 
 #include <epoxy/gl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <atomic>
+#include <deque>
 #include <list>
 #include <map>
 #include <set>
@@ -32,6 +39,7 @@
 
 #include "effect.h"
 #include "image_format.h"
+#include "mipmap_generator.h"
 #include "ycbcr.h"
 
 namespace movit {
@@ -99,6 +107,29 @@ enum OutputOrigin {
 	OUTPUT_ORIGIN_TOP_LEFT,
 };
 
+// What kind of noise DitherEffect uses; see set_dither_pattern() below.
+enum DitherPattern {
+	// Uniformly distributed white noise, in a tile of up to 128x128 pixels.
+	// This is the default.
+	DITHER_PATTERN_WHITE_NOISE,
+
+	// Blue noise (noise with the low frequencies suppressed), in a 64x64 tile.
+	// The noise is just as strong, but is much less visible as grain,
+	// and the smaller tile takes less texture bandwidth.
+	DITHER_PATTERN_BLUE_NOISE,
+};
+
+// Where an EffectChain does its work; see EffectChain::set_backend().
+enum EffectChainBackend {
+	// Each phase is compiled to a GLSL program and run through OpenGL.
+	// This is the default.
+	BACKEND_OPENGL,
+
+	// Each phase is run on the CPU, using the effects' CPU implementations
+	// (see Effect::render_cpu_rows()). Needs no OpenGL context.
+	BACKEND_CPU,
+};
+
 // Transformation to apply (if any) to pixel data in temporary buffers.
 // See set_intermediate_format() below for more information.
 enum FramebufferTransformation {
@@ -209,6 +240,16 @@ struct Phase {
 	int uniform_output_size[2];
 	Point2D inv_output_size, output_texcoord_adjust;
 
+	// For tiled rendering (see EffectChain::set_tile_size()): The rectangle
+	// of this phase's output that is rendered for the current tile, in pixels.
+	// The vertex shader maps the tile to the right texture coordinates using
+	// <tile_tc_scale> and <tile_tc_offset>, and phases reading from this one
+	// map them back using their <input_tile_scale> and <input_tile_offset>
+	// (one for each input).
+	unsigned tile_x0, tile_y0, tile_x1, tile_y1;
+	Point2D tile_tc_scale, tile_tc_offset;
+	std::vector<Point2D> input_tile_scale, input_tile_offset;
+
 	// Identifier used to create unique variables in GLSL.
 	// Unique per-phase to increase cacheability of compiled shaders.
 	std::map<std::pair<Node *, NodeLinkType>, std::string> effect_ids;
@@ -225,11 +266,90 @@ struct Phase {
 	std::vector<Uniform<float>> uniforms_vec4;
 	std::vector<Uniform<Eigen::Matrix3d>> uniforms_mat3;
 
-	// For measurement of GPU time used.
-	std::list<GLuint> timer_query_objects_running;
+	// For measurement of GPU time used. Each element of
+	// <timer_query_objects_running> is one render; with tiled rendering,
+	// it holds one query per tile, which are summed into one measurement.
+	std::list<std::vector<GLuint>> timer_query_objects_running;
 	std::list<GLuint> timer_query_objects_free;
 	uint64_t time_elapsed_ns;
 	uint64_t num_measured_iterations;
+
+	// The last few GPU time measurements, oldest first. Used for the
+	// min/max/percentile statistics in get_phase_timing().
+	std::deque<uint64_t> recent_time_elapsed_ns;
+
+	// For measurement of CPU time used, in execute_phase() as a whole
+	// and in the effects' set_gl_state() in particular.
+	uint64_t cpu_execute_ns;
+	uint64_t cpu_set_gl_state_ns;
+	uint64_t num_cpu_measured_iterations;
+
+	// For tracing the GPU execution of this phase: Pairs of GL_TIMESTAMP
+	// queries around the phase (one pair per tile with tiled rendering,
+	// which become a single event), and the offset from the GPU clock to
+	// the tracing clock (in microseconds) at the time they were issued.
+	struct TraceQuery {
+		std::vector<GLuint> start_queries, end_queries;
+		double gpu_to_trace_offset_us;
+	};
+	std::list<TraceQuery> trace_queries_running;
+	std::vector<GLuint> trace_query_objects_free;
+
+	// The format of the texture this phase rendered into the last time
+	// it was executed, or GL_NONE if it is not known (e.g. when rendering
+	// to a user-supplied FBO).
+	GLenum output_format;
+};
+
+// How EffectChain should collect GPU timer query results; see
+// EffectChain::enable_phase_timing().
+enum PhaseTimingMode {
+	// Only pick up the results that are already available at the end
+	// of each render; the rest are picked up at the end of a later render.
+	// This never stalls the CPU, but the statistics will lag a frame or two
+	// behind.
+	PHASE_TIMING_NONBLOCKING,
+
+	// Wait for all results at the end of each render. Gives up-to-date
+	// statistics, at the cost of synchronizing with the GPU every frame.
+	PHASE_TIMING_BLOCKING,
+};
+
+// Timing and bandwidth information for a single phase, as returned by
+// EffectChain::get_phase_timing(). All times are in nanoseconds.
+struct PhaseTiming {
+	// The effect_type_id() of all effects in the phase, in order.
+	std::vector<std::string> effect_type_ids;
+
+	// Output size and format of the phase, as of the last render.
+	// output_format is GL_NONE if the phase rendered to a user-supplied FBO,
+	// since we don't know its format.
+	unsigned output_width, output_height;
+	GLenum output_format;
+
+	// GPU time, over the last measured iterations (at most the window size
+	// given to enable_phase_timing()). All zero if nothing has been measured.
+	uint64_t num_gpu_measured_iterations;
+	uint64_t gpu_avg_ns, gpu_min_ns, gpu_max_ns, gpu_p99_ns;
+
+	// Average GPU time over all iterations measured since phase timing
+	// was enabled or last reset, regardless of the window size. This is
+	// what print_phase_timing() prints.
+	uint64_t num_gpu_total_iterations;
+	uint64_t gpu_total_avg_ns;
+
+	// Average CPU time per render spent in execute_phase() for this phase
+	// (ie., binding inputs, setting state and submitting the draw call
+	// or compute dispatch), and the part of that spent in the effects'
+	// set_gl_state() (which includes uploading any input textures).
+	uint64_t num_cpu_measured_iterations;
+	uint64_t cpu_execute_avg_ns, cpu_set_gl_state_avg_ns;
+
+	// Rough estimates of the memory traffic per render: Every texel of each
+	// RTT input read once, and every output texel written once. Inputs are
+	// counted as four bytes per pixel, since their storage format is not known
+	// in general, and so is an output of unknown format.
+	uint64_t bytes_read, bytes_written;
 };
 
 class EffectChain {
@@ -338,6 +458,11 @@ public:
 		this->num_dither_bits = num_bits;
 	}
 
+	// Set what kind of noise to dither with (see DitherPattern).
+	// Has no effect unless dither is turned on with set_dither_bits().
+	// Can be changed at any time.
+	void set_dither_pattern(DitherPattern pattern);
+
 	// Set where (0,0) is taken to be in the output. The default is
 	// OUTPUT_ORIGIN_BOTTOM_LEFT, which is usually what you want
 	// (see OutputOrigin above for more details).
@@ -346,6 +471,55 @@ public:
 		this->output_origin = output_origin;
 	}
 
+	// Render the output in tiles of (at most) the given size, instead of all
+	// at once. Each tile is rendered through all the phases on its own, with
+	// intermediate textures only as large as that tile needs (found the same
+	// way as for render_region_to_fbo(), plus a small margin), so that memory
+	// use is bounded by the tile size instead of by the output size. This is
+	// useful for outputs that are too large to hold in GPU memory (or larger
+	// than the maximum texture size), at the cost of rendering the overlapping
+	// borders between tiles more than once. Note that the bound only holds
+	// as far as the effects report their sampling footprint; an effect that
+	// does not (see Effect::get_needed_input_region()) will need all of
+	// its input for every tile.
+	//
+	// This must be called before finalize(), as the shaders are compiled
+	// differently for tiled rendering. The default, 0x0, means no tiling.
+	// Chains with compute shaders cannot be rendered in tiles (BlurEffect
+	// will use its fragment shader version even if asked for the compute
+	// shader version). Also, effects
+	// that use mipmaps will get them computed for each tile separately,
+	// which can give slightly different results near the tile borders.
+	//
+	// Note that only the intermediate textures are bounded; the inputs are
+	// still uploaded in full, so they must each fit in GPU memory and within
+	// GL_MAX_TEXTURE_SIZE. Phase timing and tracing count each phase once
+	// per render, summed over all the tiles.
+	void set_tile_size(unsigned tile_width, unsigned tile_height)
+	{
+		assert(!finalized);
+		assert((tile_width == 0) == (tile_height == 0));
+		this->tile_width = tile_width;
+		this->tile_height = tile_height;
+	}
+	bool is_tiled() const { return tile_width != 0; }
+
+	// Set how mipmaps are generated for intermediate textures that are
+	// sampled by effects that want them (see Effect::needs_mipmaps()).
+	// The default, MIPMAP_FILTER_DRIVER, uses glGenerateMipmap(), whose
+	// filter (and speed) is up to the driver. The others use MipmapGenerator,
+	// which has a known filter (see MipmapFilter), and only generates the levels
+	// that will actually be sampled, based on how much the effects scale down
+	// (see Effect::mipmap_minification()). This requires compute shaders;
+	// if they are not supported, or the intermediate format cannot be written
+	// from a compute shader (e.g. GL_SRGB8_ALPHA8), glGenerateMipmap()
+	// is used anyway. Mipmaps for inputs are not affected.
+	// Can be changed at any time.
+	void set_mipmap_filter(MipmapFilter filter)
+	{
+		this->mipmap_filter = filter;
+	}
+
 	// Set intermediate format for framebuffers used when we need to bounce
 	// to a temporary texture. The default, GL_RGBA16F, is good for most uses;
 	// it is precise, has good range, and is relatively efficient. However,
@@ -386,15 +560,68 @@ public:
 		this->intermediate_transformation = transformation;
 	}
 
+	// Run the chain on the CPU instead of through OpenGL, for machines that
+	// have no usable GPU. The graph is set up exactly as for OpenGL (the same
+	// conversions are inserted, and the effects are split into the same
+	// phases), but each phase is then computed in strips of rows small enough
+	// to stay in the CPU cache, spread over all CPU cores, with all the effects
+	// in the phase applied to a strip before moving on to the next one.
+	//
+	// This is a fallback, not a speedup: Where OpenGL is available at all,
+	// even in software (e.g. llvmpipe), it is typically several times faster.
+	// (On one core, the benchmark in cpu_backend_test runs a 1280x720
+	// grading chain in about 9 ms through llvmpipe, and 82 ms on the CPU;
+	// most of the latter is the pow() calls of LiftGammaGainEffect.)
+	//
+	// Every effect in the chain needs a CPU implementation (see
+	// Effect::has_cpu_implementation()); currently, that is FlatInput,
+	// YCbCrInput, the conversions EffectChain inserts by itself (gamma, color
+	// space, alpha and dither), MixEffect, OverlayEffect, SaturationEffect,
+	// LiftGammaGainEffect, ResampleEffect and PaddingEffect (including
+	// IntegralPaddingEffect). Inputs must get their pixels as plain pointers,
+	// not PBOs or textures. Only RGBA output is supported (not Y'CbCr),
+	// rendered with render_to_cpu() below. Intermediate results are always 32-bit floats,
+	// so set_intermediate_format() does nothing, and set_tile_size() is not
+	// supported.
+	//
+	// The results are the same as with OpenGL up to rounding, with one
+	// exception: An effect that changes the size (e.g. PaddingEffect with
+	// a fractional offset) gets its input computed at the input's own size
+	// and then interpolated, whereas a shader would interpolate between
+	// the texels of the input first and apply the effects in between
+	// (e.g. gamma expansion) afterwards.
+	//
+	// Must be called before finalize().
+	void set_backend(EffectChainBackend backend)
+	{
+		assert(!finalized);
+		this->backend = backend;
+	}
+	EffectChainBackend get_backend() const { return backend; }
+
 	void finalize();
 
-	// Measure the GPU time used for each actual phase during rendering.
+	// Measure the GPU and CPU time used for each actual phase during rendering.
 	// Note that this is only available if GL_ARB_timer_query
 	// (or, equivalently, OpenGL 3.3) is available. Also note that measurement
-	// will incur a performance cost, as we wait for the measurements to
-	// complete at the end of rendering.
-	void enable_phase_timing(bool enable);
+	// will incur a performance cost, especially with PHASE_TIMING_BLOCKING,
+	// where we wait for the measurements to complete at the end of rendering.
+	//
+	// <window_size> is the number of recent GPU measurements per phase that
+	// are kept for the min/max/percentile statistics in get_phase_timing().
+	void enable_phase_timing(bool enable,
+	                         PhaseTimingMode mode = PHASE_TIMING_NONBLOCKING,
+	                         size_t window_size = 100);
 	void reset_phase_timing();
+
+	// Get the collected statistics for each phase, in execution order.
+	// Never waits for the GPU; measurements that are still outstanding
+	// will simply not be counted yet.
+	std::vector<PhaseTiming> get_phase_timing();
+
+	// Print a human-readable summary of get_phase_timing() to stdout,
+	// with the average GPU time per phase over all measured iterations
+	// (gpu_total_avg_ns).
 	void print_phase_timing();
 
 	// Note: If you already know the width and height of the viewport,
@@ -409,9 +636,27 @@ public:
 	// the current viewport.
 	void render_to_fbo(GLuint fbo, unsigned width, unsigned height);
 
+	// Like render_to_fbo(), but only renders the given rectangle of the output
+	// (in pixels, relative to the lower-left corner of the output), leaving
+	// the rest of the FBO untouched. This is useful if only a small part of
+	// the output can have changed since the last frame, e.g. a lower-third
+	// graphics overlay. The needed part of each intermediate phase is found
+	// by asking each effect which part of its input it samples from
+	// (see Effect::get_needed_input_region()), and only that part is rendered,
+	// using the scissor test (which is left disabled afterwards). Compute
+	// shader phases are always run in full.
+	//
+	// The output is the same as if the entire chain had been rendered,
+	// within the rectangle, provided that the effects' answers are correct.
+	void render_region_to_fbo(GLuint fbo, unsigned width, unsigned height,
+	                          unsigned region_x, unsigned region_y,
+	                          unsigned region_width, unsigned region_height);
+
 	// Render the effect chain to the given set of textures. This is equivalent
 	// to render_to_fbo() with a freshly created FBO bound to the given textures,
-	// except that it is more efficient if the last phase contains a compute shader.
+	// except that it is more efficient if the last phase contains a compute shader
+	// (as long as that phase outputs <width> x <height> pixels; if not,
+	// it needs to be scaled like any other phase, which we do through an FBO).
 	// Thus, prefer this to render_to_fbo() where possible.
 	//
 	// Only one destination texture is supported. This restriction will be lifted
@@ -430,6 +675,25 @@ public:
 	};
 	void render_to_texture(const std::vector<DestinationTexture> &destinations, unsigned width, unsigned height);
 
+	// Render the chain on the CPU (see set_backend()) into <dst>, which holds
+	// <width> x <height> RGBA pixels, either as floats or as 8-bit values
+	// (rounded the same way as when rendering to a GL_RGBA8 framebuffer).
+	// Rows are in the order given by set_output_origin(), so by default,
+	// the bottom row comes first, like with glReadPixels().
+	void render_to_cpu(float *dst, unsigned width, unsigned height);
+	void render_to_cpu(unsigned char *dst, unsigned width, unsigned height);
+
+	// Publish everything staged (see Effect::stage_int()) on this chain's
+	// effects since the last call, as one atomic update. The next render
+	// call picks up all of it before rendering anything, or none of it
+	// if it started earlier; if several commits happen between two renders,
+	// they are all applied, as if in order (a parameter changed in more than
+	// one of them is only set once, to its last value). This is lock-free,
+	// and is the only function on an EffectChain you may call from another
+	// thread while it is rendering (but only one such thread at a time).
+	// Must be called after finalize().
+	void commit_parameters();
+
 	Effect *last_added_effect() {
 		if (nodes.empty()) {
 			return nullptr;
@@ -473,6 +737,8 @@ public:
 	ResourcePool *get_resource_pool() { return resource_pool; }
 
 private:
+	friend class ChainBatch;
+
 	// Make sure the output rectangle is at least large enough to hold
 	// the given input rectangle in both dimensions, and is of the
 	// current aspect ratio (aspect_nom/aspect_denom).
@@ -486,6 +752,11 @@ private:
 	// Requires that all input phases (if any) already have output sizes set.
 	void find_output_size(Phase *phase);
 
+	// Whether the last compute shader phase (the one before the dummy phase)
+	// outputs exactly <width> x <height> pixels, so that it can write
+	// directly to the destination textures. Requires has_dummy_effect.
+	bool compute_output_matches_size(unsigned width, unsigned height);
+
 	// Find all inputs eventually feeding into this effect that have
 	// output gamma different from GAMMA_LINEAR.
 	void find_all_nonlinear_inputs(Node *effect, std::vector<Node *> *nonlinear_inputs);
@@ -502,22 +773,76 @@ private:
 	// renders to that FBO. If <destinations> is non-empty, render to that set
 	// of textures (last phase, save for the dummy phase, must be a compute shader),
 	// with x/y ignored. Having both set is an error.
+	// If <output_region> is set, only that part of the output (in normalized
+	// coordinates) is rendered; see render_region_to_fbo().
 	void render(GLuint dest_fbo, const std::vector<DestinationTexture> &destinations,
-	            unsigned x, unsigned y, unsigned width, unsigned height);
+	            unsigned x, unsigned y, unsigned width, unsigned height,
+	            const Region *output_region = nullptr);
+
+	// render() is split into three parts, so that ChainBatch can set up and
+	// reset the basic OpenGL state only once for many chains.
+	// setup_render_state() returns whether GL_FRAMEBUFFER_SRGB was enabled
+	// (and thus, whether the final output should be sRGB-encoded);
+	// render_phases() leaves it in that state when done.
+	static bool setup_render_state();
+	void render_phases(GLuint dest_fbo, const std::vector<DestinationTexture> &destinations,
+	                   unsigned x, unsigned y, unsigned width, unsigned height,
+	                   bool final_srgb, const Region *output_region = nullptr);
+	static void reset_render_state();
+
+	// Applies what commit_parameters() has published since last time,
+	// if anything. Called first thing by render_phases() and render_to_cpu().
+	void apply_committed_parameters();
+
+	// For partial rendering: Find which part of each phase's output is
+	// needed to render <output_region> of the last phase, by walking
+	// backwards through the phases and their effects.
+	void find_needed_regions(const Region &output_region, std::map<Phase *, Region> *needed_regions);
 
 	// Execute one phase, ie. set up all inputs, effects and outputs, and render the quad.
 	// If <destinations> is empty, uses whatever output is current (and the phase must not be
 	// a compute shader).
+	// <generated_mipmap_levels> holds the highest mipmap level generated
+	// so far for each input in this frame.
 	void execute_phase(Phase *phase,
 	                   const std::map<Phase *, GLuint> &output_textures,
 	                   const std::vector<DestinationTexture> &destinations,
-	                   std::set<Phase *> *generated_mipmaps);
+	                   std::map<Phase *, unsigned> *generated_mipmap_levels);
+
+	// Find the highest mipmap level that any effect in <phase> that
+	// wants mipmaps from <input> will sample from, judging from
+	// how much it scales down.
+	unsigned find_needed_mipmap_level(Phase *phase, Phase *input);
+
+	// Pick up the results of any finished timer queries. If <wait> is true,
+	// blocks until all of them are finished.
+	void collect_timer_query_results(bool wait);
+
+	// Same, for the timestamp queries used for tracing (see trace.h).
+	// Never blocks. If <discard> is true, throws away all outstanding
+	// queries without waiting for them.
+	void collect_trace_query_results(bool discard);
+
+	// For render_to_cpu(): Compute one phase at <width> x <height> into <dst>,
+	// strip by strip. Nodes that cannot be computed a strip at a time (inputs
+	// to effects that change the output size, or nodes that need to be
+	// resampled to the phase's size) are first rendered in full, at their own
+	// size; prepare_node_cpu() finds those, and render_node_in_full_cpu()
+	// renders them. <link_type> tells whether <node> comes from an earlier
+	// phase, in which case its output is simply there already.
+	struct CPUPhaseContext;
+	void render_phase_cpu(CPUPhaseContext *context, Phase *phase, unsigned width, unsigned height, float *dst);
+	void prepare_node_cpu(CPUPhaseContext *context, Node *node, NodeLinkType link_type, unsigned width, unsigned height);
+	void render_node_in_full_cpu(CPUPhaseContext *context, Node *node, NodeLinkType link_type);
+	void render_node_cpu_rows(const CPUPhaseContext &context, Node *node, NodeLinkType link_type,
+	                          unsigned width, unsigned height, unsigned y0, unsigned y1, float *dst);
 
 	// Set up uniforms for one phase. The program must already be bound.
 	void setup_uniforms(Phase *phase);
 
 	// Set up the given sampler number for sampling from an RTT texture.
-	void setup_rtt_sampler(int sampler_num, bool use_mipmaps);
+	// Only levels up to <max_mipmap_level> will be sampled.
+	void setup_rtt_sampler(int sampler_num, bool use_mipmaps, unsigned max_mipmap_level);
 
 	// Output the current graph to the given file in a Graphviz-compatible format;
 	// only useful for debugging.
@@ -586,9 +911,23 @@ private:
 	GLenum intermediate_format;
 	FramebufferTransformation intermediate_transformation;
 	unsigned num_dither_bits;
+	DitherPattern dither_pattern = DITHER_PATTERN_WHITE_NOISE;
 	OutputOrigin output_origin;
+	unsigned tile_width = 0, tile_height = 0;  // See set_tile_size().
+	MipmapFilter mipmap_filter = MIPMAP_FILTER_DRIVER;
+	MipmapGenerator *mipmap_generator = nullptr;  // Created on first use.
+	EffectChainBackend backend = BACKEND_OPENGL;
 	bool finalized;
-	GLuint vbo;  // Contains vertex and texture coordinate data.
+	GLuint vbo = 0;  // Contains vertex and texture coordinate data. Created on first render.
+
+	// Parameter changes from commit_parameters() that have not yet been
+	// picked up by apply_committed_parameters(), as a lock-free stack
+	// (newest first), or nullptr. commit_parameters() only ever pushes
+	// a fully built commit onto it, and apply_committed_parameters()
+	// takes all of it at once by exchanging in nullptr, so no commit
+	// can be missed or seen half-built.
+	struct CommittedParameters;
+	std::atomic<CommittedParameters *> committed_parameters{nullptr};
 
 	// Whether the last effect (which will then be in a phase all by itself)
 	// is a dummy effect that is only added because the last phase uses a compute
@@ -599,7 +938,12 @@ private:
 	ResourcePool *resource_pool;
 	bool owns_resource_pool;
 
+	// When the current step of finalize() started, for tracing.
+	double finalize_step_start_us = 0.0;
+
 	bool do_phase_timing;
+	PhaseTimingMode phase_timing_mode;
+	size_t phase_timing_window;
 };
 
 }  // namespace movit
@@ -2,13 +2,19 @@
 //
 // Note that this also contains the tests for some of the simpler effects.
 
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
 #include <locale>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <epoxy/gl.h>
 #include <assert.h>
 
+#include "blur_effect.h"
+#include "chain_batch.h"
 #include "effect.h"
 #include "effect_chain.h"
 #include "flat_input.h"
@@ -17,9 +23,11 @@
 #include "input.h"
 #include "mirror_effect.h"
 #include "multiply_effect.h"
+#include "resample_effect.h"
 #include "resize_effect.h"
 #include "resource_pool.h"
 #include "test_util.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -571,6 +579,7 @@ class MipmapNeedingEffect : public Effect {
 public:
 	MipmapNeedingEffect() {}
 	MipmapRequirements needs_mipmaps() const override { return NEEDS_MIPMAPS; }
+	float mipmap_minification(unsigned input_num) const override { return 4.0f; }
 
 	// To be allowed to mess with the sampler state.
 	bool needs_texture_bounce() const override { return true; }
@@ -778,6 +787,135 @@ TEST(EffectChainTest, ResizeDownByFourThenUpByFour) {
 	expect_equal(expected_data, out_data, 4, 16);
 }
 
+TEST(EffectChainTest, MipmapGeneratorBoxFilterAveragesBlocks) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	// Scaling down 16x needs four levels, which takes two dispatches.
+	const unsigned size = 64, out_size = 4, block_size = size / out_size;
+	float data[size * size];
+	for (unsigned i = 0; i < size * size; ++i) {
+		data[i] = (i * 7919 % 256) / 255.0f;
+	}
+	float expected_data[out_size * out_size];
+	for (unsigned y = 0; y < out_size; ++y) {
+		for (unsigned x = 0; x < out_size; ++x) {
+			float sum = 0.0f;
+			for (unsigned yy = 0; yy < block_size; ++yy) {
+				for (unsigned xx = 0; xx < block_size; ++xx) {
+					sum += data[(y * block_size + yy) * size + x * block_size + xx];
+				}
+			}
+			expected_data[y * out_size + x] = sum / (block_size * block_size);
+		}
+	}
+	float out_data[out_size * out_size];
+
+	ResizeEffect *downscale = new ResizeEffect();
+	ASSERT_TRUE(downscale->set_int("width", out_size));
+	ASSERT_TRUE(downscale->set_int("height", out_size));
+
+	EffectChainTester tester(nullptr, out_size, out_size);
+	tester.get_chain()->set_mipmap_filter(MIPMAP_FILTER_BOX);
+	tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, size, size);
+	tester.get_chain()->add_effect(new IdentityEffect());  // Force an intermediate texture.
+	tester.get_chain()->add_effect(downscale);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, out_size, out_size);
+}
+
+TEST(EffectChainTest, MipmapGeneratorBilinearFilter) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	float data[] = {
+		0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+	};
+	float expected_data[] = {
+		// The bilinear filter is [1 3 3 1] / 8, centered between two pixels.
+		0.0f, 0.375f, 0.125f, 0.0f,
+	};
+	float out_data[4];
+
+	ResizeEffect *downscale = new ResizeEffect();
+	ASSERT_TRUE(downscale->set_int("width", 4));
+	ASSERT_TRUE(downscale->set_int("height", 1));
+
+	EffectChainTester tester(nullptr, 4, 1);
+	tester.get_chain()->set_mipmap_filter(MIPMAP_FILTER_BILINEAR);
+	tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, 8, 1);
+	tester.get_chain()->add_effect(new IdentityEffect());  // Force an intermediate texture.
+	tester.get_chain()->add_effect(downscale);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 4, 1);
+}
+
+TEST(EffectChainTest, MipmapGeneratorLanczosFilterKeepsFlatAreasFlat) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	// The filter needs to be normalized, also near the edges
+	// (where samples are clamped).
+	const unsigned size = 32, out_size = 4;
+	float data[size * size];
+	for (unsigned i = 0; i < size * size; ++i) {
+		data[i] = 0.6f;
+	}
+	float expected_data[out_size * out_size];
+	for (unsigned i = 0; i < out_size * out_size; ++i) {
+		expected_data[i] = 0.6f;
+	}
+	float out_data[out_size * out_size];
+
+	ResizeEffect *downscale = new ResizeEffect();
+	ASSERT_TRUE(downscale->set_int("width", out_size));
+	ASSERT_TRUE(downscale->set_int("height", out_size));
+
+	EffectChainTester tester(nullptr, out_size, out_size);
+	tester.get_chain()->set_mipmap_filter(MIPMAP_FILTER_LANCZOS);
+	tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, size, size);
+	tester.get_chain()->add_effect(new IdentityEffect());  // Force an intermediate texture.
+	tester.get_chain()->add_effect(downscale);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, out_size, out_size);
+}
+
+TEST(EffectChainTest, MipmapGeneratorRespectsEffectMinification) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	// One bright pixel in the corner of each 4x4 block. MipmapNeedingEffect
+	// does not change the size, so without asking the effect, we would
+	// only generate level 0, and the samples would miss the bright pixels.
+	const float block_values[] = { 1.0f, 0.5f, 0.25f, 0.75f };
+	float data[8 * 8];
+	for (unsigned y = 0; y < 8; ++y) {
+		for (unsigned x = 0; x < 8; ++x) {
+			bool corner = (x % 4 == 0 && y % 4 == 0);
+			data[y * 8 + x] = corner ? block_values[(y / 4) * 2 + x / 4] : 0.0f;
+		}
+	}
+	float expected_data[8 * 8];
+	for (unsigned y = 0; y < 8; ++y) {
+		for (unsigned x = 0; x < 8; ++x) {
+			// Repeated; see mipmap_needing_effect.frag.
+			expected_data[y * 8 + x] = block_values[(y % 2) * 2 + x % 2] / 16.0f;
+		}
+	}
+	float out_data[8 * 8];
+
+	EffectChainTester tester(data, 8, 8, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.get_chain()->set_mipmap_filter(MIPMAP_FILTER_BOX);
+	tester.get_chain()->add_effect(new IdentityEffect());  // Force an intermediate texture.
+	tester.get_chain()->add_effect(new MipmapNeedingEffect());
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 8, 8);
+}
+
 // An effect to verify that you can turn off mipmaps; it downscales by two,
 // which gives blur with mipmaps and aliasing (picks out every other pixel)
 // without.
@@ -1428,6 +1566,396 @@ TEST(EffectChainTest, IdentityWithOwnPool) {
 	movit_debug_level = old_movit_debug_level;
 }
 
+TEST(EffectChainTest, ChainBatch) {
+	const int width = 3, height = 2;
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+
+	// The first chain renders the data as is into the left half of the output,
+	// the second one mirrors it into the right half. (Since we read back
+	// with glReadPixels(), the output is also flipped vertically.)
+	const float expected_data[] = {
+		0.75f, 1.0f, 1.0f,   1.0f, 1.0f, 0.75f,
+		0.0f, 0.25f, 0.3f,   0.3f, 0.25f, 0.0f,
+	};
+	float out_data[width * height * 2], temp[width * height * 2 * 4];
+
+	EffectChainTester dummy_tester(nullptr, 1, 1);  // Just to get an OpenGL context.
+	ResourcePool pool;
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	EffectChain chain1(width, height, &pool);
+	FlatInput *input1 = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input1->set_pixel_data(data);
+	chain1.add_input(input1);
+	chain1.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain1.finalize();
+
+	EffectChain chain2(width, height, &pool);
+	FlatInput *input2 = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input2->set_pixel_data(data);
+	chain2.add_input(input2);
+	chain2.add_effect(new MirrorEffect());
+	chain2.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain2.finalize();
+
+	GLuint texnum, fbo;
+	glGenTextures(1, &texnum);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, texnum);
+	check_error();
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width * 2, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	check_error();
+
+	glGenFramebuffers(1, &fbo);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glFramebufferTexture2D(
+		GL_FRAMEBUFFER,
+		GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D,
+		texnum,
+		0);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	ChainBatch batch;
+	batch.add_chain(&chain1, fbo, 0, 0, width, height);
+	batch.add_chain(&chain2, fbo, width, 0, width, height);
+	EXPECT_EQ(2u, batch.size());
+
+	// Render twice, to check that the shared input survives between frames.
+	for (unsigned frame = 0; frame < 2; ++frame) {
+		batch.render();
+
+		// The pixel data is the same, so it should only have been uploaded once.
+		ResourcePoolStatistics stats = pool.get_statistics();
+		EXPECT_EQ(1u, stats.num_live_textures);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		check_error();
+		glReadPixels(0, 0, width * 2, height, GL_RGBA, GL_FLOAT, temp);
+		check_error();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		check_error();
+		for (unsigned i = 0; i < width * height * 2; ++i) {
+			out_data[i] = temp[i * 4];
+		}
+		expect_equal(expected_data, out_data, width * 2, height);
+	}
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(1, &texnum);
+	check_error();
+}
+
+namespace {
+
+// Creates an FBO with a single RGBA32F texture attached.
+void create_float_fbo(unsigned width, unsigned height, GLuint *texnum, GLuint *fbo)
+{
+	glGenTextures(1, texnum);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, *texnum);
+	check_error();
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	check_error();
+
+	glGenFramebuffers(1, fbo);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+	check_error();
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texnum, 0);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+}
+
+// Reads back the red channel of the given FBO.
+void read_red_channel(GLuint fbo, unsigned width, unsigned height, float *out_data)
+{
+	vector<float> temp(width * height * 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, temp.data());
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+	for (unsigned i = 0; i < width * height; ++i) {
+		out_data[i] = temp[i * 4];
+	}
+}
+
+}  // namespace
+
+TEST(EffectChainTest, RenderRegion) {
+	// Upscale, mirror and blur, so that the needed part of each
+	// intermediate is different from the part of the output we render.
+	const unsigned in_width = 16, in_height = 8;
+	const unsigned width = 32, height = 16;
+	const unsigned region_x = 4, region_y = 6, region_width = 10, region_height = 5;
+
+	float data[in_width * in_height], data2[in_width * in_height];
+	for (unsigned i = 0; i < in_width * in_height; ++i) {
+		data[i] = data2[i] = ((i * 37) % 64) / 64.0f;
+	}
+	for (unsigned y = 2; y < 6; ++y) {
+		for (unsigned x = 9; x < 14; ++x) {
+			data2[y * in_width + x] = 1.0f - data[y * in_width + x];
+		}
+	}
+
+	EffectChainTester dummy_tester(nullptr, 1, 1);  // Just to get an OpenGL context.
+	ResourcePool pool;
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	EffectChain chain(width, height, &pool);
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, in_width, in_height);
+	input->set_pixel_data(data);
+	chain.add_input(input);
+	Effect *resample = chain.add_effect(new ResampleEffect());
+	ASSERT_TRUE(resample->set_int("width", width));
+	ASSERT_TRUE(resample->set_int("height", height));
+	chain.add_effect(new MirrorEffect());
+	Effect *blur = chain.add_effect(new BlurEffect());
+	ASSERT_TRUE(blur->set_int("num_taps", 4));
+	ASSERT_TRUE(blur->set_float("radius", 1.0f));
+	chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain.finalize();
+
+	GLuint texnum, fbo, ref_texnum, ref_fbo;
+	create_float_fbo(width, height, &texnum, &fbo);
+	create_float_fbo(width, height, &ref_texnum, &ref_fbo);
+
+	// The old frame, and the full new frame for reference.
+	float old_frame[width * height], new_frame[width * height], out_data[width * height];
+	chain.render_to_fbo(fbo, width, height);
+	read_red_channel(fbo, width, height, old_frame);
+	input->set_pixel_data(data2);
+	chain.render_to_fbo(ref_fbo, width, height);
+	read_red_channel(ref_fbo, width, height, new_frame);
+
+	// Now update only the region; the rest should keep the old frame.
+	input->set_pixel_data(data2);
+	chain.render_region_to_fbo(fbo, width, height, region_x, region_y, region_width, region_height);
+	read_red_channel(fbo, width, height, out_data);
+
+	float expected_data[width * height];
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			bool inside = (x >= region_x && x < region_x + region_width &&
+			               y >= region_y && y < region_y + region_height);
+			expected_data[y * width + x] = inside ? new_frame[y * width + x] : old_frame[y * width + x];
+		}
+	}
+	expect_equal(expected_data, out_data, width, height, 1e-3, 1e-4);
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(1, &texnum);
+	check_error();
+	glDeleteFramebuffers(1, &ref_fbo);
+	check_error();
+	glDeleteTextures(1, &ref_texnum);
+	check_error();
+}
+
+TEST(EffectChainTest, RenderRegionWithTopLeftOrigin) {
+	// Like RenderRegion, but with the output flipped, and on a freshly
+	// finalized chain, so that no full frame has been rendered first.
+	const unsigned in_width = 16, in_height = 8;
+	const unsigned width = 32, height = 16;
+	const unsigned region_x = 4, region_y = 2, region_width = 10, region_height = 5;
+
+	float data[in_width * in_height];
+	for (unsigned i = 0; i < in_width * in_height; ++i) {
+		data[i] = ((i * 37) % 64) / 64.0f;
+	}
+
+	EffectChainTester dummy_tester(nullptr, 1, 1);  // Just to get an OpenGL context.
+	ResourcePool pool;
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	EffectChain ref_chain(width, height, &pool), chain(width, height, &pool);
+	for (EffectChain *c : { &ref_chain, &chain }) {
+		FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, in_width, in_height);
+		input->set_pixel_data(data);
+		c->add_input(input);
+		Effect *resample = c->add_effect(new ResampleEffect());
+		ASSERT_TRUE(resample->set_int("width", width));
+		ASSERT_TRUE(resample->set_int("height", height));
+		c->add_effect(new MirrorEffect());
+		Effect *blur = c->add_effect(new BlurEffect());
+		ASSERT_TRUE(blur->set_int("num_taps", 4));
+		ASSERT_TRUE(blur->set_float("radius", 1.0f));
+		c->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+		c->set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+		c->finalize();
+	}
+
+	GLuint texnum, fbo, ref_texnum, ref_fbo;
+	create_float_fbo(width, height, &texnum, &fbo);
+	create_float_fbo(width, height, &ref_texnum, &ref_fbo);
+
+	float new_frame[width * height], out_data[width * height];
+	ref_chain.render_to_fbo(ref_fbo, width, height);
+	read_red_channel(ref_fbo, width, height, new_frame);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
+	check_error();
+	glClear(GL_COLOR_BUFFER_BIT);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+	chain.render_region_to_fbo(fbo, width, height, region_x, region_y, region_width, region_height);
+	read_red_channel(fbo, width, height, out_data);
+
+	float expected_data[width * height];
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			bool inside = (x >= region_x && x < region_x + region_width &&
+			               y >= region_y && y < region_y + region_height);
+			expected_data[y * width + x] = inside ? new_frame[y * width + x] : 0.25f;
+		}
+	}
+	expect_equal(expected_data, out_data, width, height, 1e-3, 1e-4);
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(1, &texnum);
+	check_error();
+	glDeleteFramebuffers(1, &ref_fbo);
+	check_error();
+	glDeleteTextures(1, &ref_texnum);
+	check_error();
+}
+
+namespace {
+
+// Renders a chain much like the one in RenderRegion, so that each
+// intermediate phase needs a different part of its input for each tile,
+// both in tiles and in one go, and checks that the results are the same.
+// The output origin is flipped, and the tiles do not divide the output evenly.
+void check_tiled_rendering(GLenum intermediate_format, float limit, float rms_limit)
+{
+	const unsigned in_width = 40, in_height = 24;
+	const unsigned width = 80, height = 48;
+
+	float data[in_width * in_height];
+	for (unsigned i = 0; i < in_width * in_height; ++i) {
+		data[i] = ((i * 37) % 64) / 64.0f;
+	}
+
+	EffectChainTester dummy_tester(nullptr, 1, 1);  // Just to get an OpenGL context.
+	ResourcePool pool;
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	EffectChain ref_chain(width, height, &pool), chain(width, height, &pool);
+	chain.set_tile_size(32, 20);
+	for (EffectChain *c : { &ref_chain, &chain }) {
+		c->set_intermediate_format(intermediate_format);
+		FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, in_width, in_height);
+		input->set_pixel_data(data);
+		c->add_input(input);
+		c->add_effect(new MirrorEffect());
+		Effect *resample = c->add_effect(new ResampleEffect());
+		ASSERT_TRUE(resample->set_int("width", width));
+		ASSERT_TRUE(resample->set_int("height", height));
+		Effect *blur = c->add_effect(new BlurEffect());
+		ASSERT_TRUE(blur->set_int("num_taps", 4));
+		ASSERT_TRUE(blur->set_float("radius", 1.0f));
+		c->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+		c->set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+		c->finalize();
+	}
+
+	GLuint texnum, fbo, ref_texnum, ref_fbo;
+	create_float_fbo(width, height, &texnum, &fbo);
+	create_float_fbo(width, height, &ref_texnum, &ref_fbo);
+
+	float expected_data[width * height], out_data[width * height];
+	ref_chain.render_to_fbo(ref_fbo, width, height);
+	read_red_channel(ref_fbo, width, height, expected_data);
+	chain.render_to_fbo(fbo, width, height);
+	read_red_channel(fbo, width, height, out_data);
+	expect_equal(expected_data, out_data, width, height, limit, rms_limit);
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(1, &texnum);
+	check_error();
+	glDeleteFramebuffers(1, &ref_fbo);
+	check_error();
+	glDeleteTextures(1, &ref_texnum);
+	check_error();
+}
+
+}  // namespace
+
+TEST(EffectChainTest, TiledRendering) {
+	check_tiled_rendering(GL_RGBA16F, 1e-3, 1e-4);
+}
+
+TEST(EffectChainTest, TiledRenderingWithsRGBIntermediates) {
+	// The destination is not sRGB, so GL_FRAMEBUFFER_SRGB must be turned
+	// off for the last phase of each tile, and on again for the
+	// intermediate phases of the next one. The intermediates are 8-bit,
+	// so a value can round differently from one tile to the next.
+	check_tiled_rendering(GL_SRGB8_ALPHA8, 2e-2, 2e-3);
+
+	// This state should have been preserved.
+	EXPECT_FALSE(glIsEnabled(GL_FRAMEBUFFER_SRGB));
+}
+
+TEST(EffectChainTest, TiledRenderingTimesEachPhaseOncePerRender) {
+	const unsigned width = 40, height = 24;
+	float data[width * height], out_data[width * height];
+	for (unsigned i = 0; i < width * height; ++i) {
+		data[i] = (i % 16) / 16.0f;
+	}
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	if (!movit_timer_queries_supported) {
+		fprintf(stderr, "Skipping test; no support for timer queries.\n");
+		return;
+	}
+	tester.get_chain()->set_tile_size(16, 16);  // Six tiles.
+	tester.get_chain()->add_effect(new IdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->enable_phase_timing(true, PHASE_TIMING_BLOCKING);
+	for (unsigned i = 0; i < 2; ++i) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	}
+	expect_equal(data, out_data, width, height);
+
+	vector<PhaseTiming> timings = tester.get_chain()->get_phase_timing();
+	ASSERT_EQ(2u, timings.size());
+	for (const PhaseTiming &timing : timings) {
+		EXPECT_EQ(2u, timing.num_gpu_measured_iterations);
+		EXPECT_EQ(2u, timing.num_gpu_total_iterations);
+		EXPECT_EQ(2u, timing.num_cpu_measured_iterations);
+	}
+}
+
 // A dummy effect whose only purpose is to test sprintf decimal behavior.
 class PrintfingBlueEffect : public Effect {
 public:
@@ -1644,6 +2172,174 @@ TEST(EffectChainTest, ProgramsAreClonedForMultipleThreads) {
 	expect_equal(data, out_data, 3, 2);
 }
 
+TEST(EffectChainTest, StagedParametersAreAppliedOnCommit) {
+	float data[] = {
+		0.0f, 0.25f, 0.5f,
+		0.75f, 1.0f, 0.125f,
+	};
+	float half_data[6], out_data[6];
+	for (unsigned i = 0; i < 6; ++i) {
+		half_data[i] = data[i] * 0.5f;
+	}
+
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	MultiplyEffect *effect = new MultiplyEffect();
+	tester.get_chain()->add_effect(effect);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, 3, 2);
+
+	// Staging alone changes nothing, not even the parameter generation.
+	const unsigned generation = effect->get_parameter_generation();
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	effect->stage_vec4("factor", half);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, 3, 2);
+	EXPECT_EQ(generation, effect->get_parameter_generation());
+
+	tester.get_chain()->commit_parameters();
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(half_data, out_data, 3, 2);
+	EXPECT_NE(generation, effect->get_parameter_generation());
+
+	// Two commits before the next render are both applied, as if in order;
+	// since they change the same parameter, it is only set once,
+	// to the last value.
+	const float zero[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	const float one[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	const unsigned generation_before_two_commits = effect->get_parameter_generation();
+	effect->stage_vec4("factor", zero);
+	tester.get_chain()->commit_parameters();
+	effect->stage_vec4("factor", one);
+	tester.get_chain()->commit_parameters();
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, 3, 2);
+	EXPECT_EQ(generation_before_two_commits + 1, effect->get_parameter_generation());
+}
+
+TEST(EffectChainTest, CommitWhileRendering) {
+	const unsigned width = 16, height = 8;
+	float data[width * height];
+	for (unsigned i = 0; i < width * height; ++i) {
+		data[i] = (i % 7) / 8.0f;
+	}
+	float out_data[width * height];
+
+	// Two effects that cancel each other out, as long as they are
+	// always updated together.
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, GL_RGBA32F);
+	MultiplyEffect *up = new MultiplyEffect();
+	MultiplyEffect *down = new MultiplyEffect();
+	tester.get_chain()->add_effect(up);
+	tester.get_chain()->add_effect(down);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+
+	atomic<bool> done{false};
+	thread control_thread([&] {
+		for (unsigned i = 0; !done; ++i) {
+			const float f = float(1 << (i % 8));
+			const float up_factor[] = { f, f, f, 1.0f };
+			const float down_factor[] = { 1.0f / f, 1.0f / f, 1.0f / f, 1.0f };
+			up->stage_vec4("factor", up_factor);
+			down->stage_vec4("factor", down_factor);
+			tester.get_chain()->commit_parameters();
+		}
+	});
+	for (unsigned i = 0; i < 100; ++i) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(data, out_data, width, height);
+	}
+	done = true;
+	control_thread.join();
+}
+
+TEST(EffectChainTest, ResourcePoolStatistics) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.get_chain()->add_effect(new IdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	ResourcePool *resource_pool = tester.get_chain()->get_resource_pool();
+	ResourcePoolStatistics stats = resource_pool->get_statistics();
+
+	// Both phases have been compiled (or found in the cache, since the pool
+	// is shared with other tests), and the intermediate texture has been
+	// put back on the freelist.
+	EXPECT_LE(2u, stats.program_cache_misses + stats.program_cache_hits);
+	EXPECT_LE(2u, stats.num_live_programs);
+	EXPECT_LE(1u, stats.texture_freelist_misses + stats.texture_freelist_hits);
+	EXPECT_LE(1u, stats.num_free_textures);
+	EXPECT_LT(0u, stats.free_texture_bytes);
+	// The FlatInput keeps its texture until the data changes.
+	EXPECT_EQ(1u, stats.num_live_textures);
+
+	// The second run should reuse textures from the freelist.
+	resource_pool->reset_statistics();
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	stats = resource_pool->get_statistics();
+	EXPECT_EQ(0u, stats.program_cache_misses);
+	EXPECT_EQ(0u, stats.texture_freelist_misses);
+	EXPECT_LE(1u, stats.texture_freelist_hits);
+	EXPECT_EQ(stats.texture_freelist_hits, stats.num_sync_waits);
+}
+
+TEST(EffectChainTest, ResourcePoolStatisticsCountMipmaps) {
+	float data[] = { 0.0f };
+	EffectChainTester tester(data, 1, 1);  // Just to get an OpenGL context.
+
+	ResourcePool pool;
+	GLuint tex = pool.create_2d_texture(GL_RGBA8, 4, 4);
+	ResourcePoolStatistics stats = pool.get_statistics();
+	ASSERT_EQ(1u, stats.texture_classes.size());
+	EXPECT_EQ(GL_RGBA8, stats.texture_classes[0].internal_format);
+	EXPECT_EQ(4, stats.texture_classes[0].width);
+	EXPECT_EQ(4, stats.texture_classes[0].height);
+	EXPECT_EQ(1u, stats.num_live_textures);
+	EXPECT_EQ(4u * 4u * 4u, stats.live_texture_bytes);
+
+	// 4x4, 2x2 and 1x1.
+	pool.mark_texture_mipmapped(tex);
+	stats = pool.get_statistics();
+	EXPECT_EQ((16u + 4u + 1u) * 4u, stats.live_texture_bytes);
+
+	pool.release_2d_texture(tex);
+	stats = pool.get_statistics();
+	EXPECT_EQ(0u, stats.num_live_textures);
+	EXPECT_EQ(1u, stats.num_free_textures);
+	EXPECT_EQ((16u + 4u + 1u) * 4u, stats.free_texture_bytes);
+}
+
+TEST(EffectChainTest, ResourcePoolResetsMaxLevelOnReuse) {
+	float data[] = { 0.0f };
+	EffectChainTester tester(data, 1, 1);  // Just to get an OpenGL context.
+
+	ResourcePool pool;
+	GLuint tex = pool.create_2d_texture(GL_RGBA8, 4, 4);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	check_error();
+	pool.release_2d_texture(tex);
+
+	ASSERT_EQ(tex, pool.create_2d_texture(GL_RGBA8, 4, 4));
+	GLint max_level;
+	glBindTexture(GL_TEXTURE_2D, tex);
+	check_error();
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	check_error();
+	EXPECT_EQ(1000, max_level);
+	pool.release_2d_texture(tex);
+}
+
 TEST(ComputeShaderTest, Identity) {
 	float data[] = {
 		0.0f, 0.25f, 0.3f,
@@ -1998,4 +2694,121 @@ TEST(EffectChainTest, BounceResetsMipmapNeeds) {
 	          downscale->replaced_node->containing_phase);
 }
 
+TEST(EffectChainTest, PhaseTiming) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	if (!movit_timer_queries_supported) {
+		fprintf(stderr, "Skipping test; no support for timer queries.\n");
+		return;
+	}
+	tester.get_chain()->add_effect(new IdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->enable_phase_timing(true, PHASE_TIMING_BLOCKING, 2);
+	for (unsigned i = 0; i < 3; ++i) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	}
+	expect_equal(data, out_data, 3, 2);
+
+	vector<PhaseTiming> timings = tester.get_chain()->get_phase_timing();
+	ASSERT_EQ(2u, timings.size());
+
+	// The first phase is the input and the first identity effect,
+	// bounced to an intermediate texture. Inputs count as four bytes per pixel.
+	ASSERT_EQ(2u, timings[0].effect_type_ids.size());
+	EXPECT_EQ("FlatInput", timings[0].effect_type_ids[0]);
+	EXPECT_EQ("IdentityEffect", timings[0].effect_type_ids[1]);
+	EXPECT_EQ(3u, timings[0].output_width);
+	EXPECT_EQ(2u, timings[0].output_height);
+	EXPECT_EQ(GLenum(GL_RGBA16F), timings[0].output_format);
+	EXPECT_EQ(3u * 2u * 4u, timings[0].bytes_read);
+	EXPECT_EQ(3u * 2u * 8u, timings[0].bytes_written);
+
+	// The second one reads from that texture, and outputs to our FBO.
+	ASSERT_LE(1u, timings[1].effect_type_ids.size());
+	EXPECT_EQ("IdentityEffect", timings[1].effect_type_ids[0]);
+	EXPECT_EQ(GLenum(GL_NONE), timings[1].output_format);
+	EXPECT_EQ(3u * 2u * 8u, timings[1].bytes_read);
+
+	for (const PhaseTiming &timing : timings) {
+		// Blocking mode, so all renders should be measured, but only the
+		// last two are kept.
+		EXPECT_EQ(2u, timing.num_gpu_measured_iterations);
+		EXPECT_LE(timing.gpu_min_ns, timing.gpu_avg_ns);
+		EXPECT_LE(timing.gpu_avg_ns, timing.gpu_max_ns);
+		EXPECT_EQ(timing.gpu_max_ns, timing.gpu_p99_ns);
+
+		// The total average is over all three.
+		EXPECT_EQ(3u, timing.num_gpu_total_iterations);
+
+		EXPECT_EQ(3u, timing.num_cpu_measured_iterations);
+		EXPECT_LE(timing.cpu_set_gl_state_avg_ns, timing.cpu_execute_avg_ns);
+	}
+
+	tester.get_chain()->reset_phase_timing();
+	timings = tester.get_chain()->get_phase_timing();
+	EXPECT_EQ(0u, timings[0].num_gpu_measured_iterations);
+	EXPECT_EQ(0u, timings[0].num_gpu_total_iterations);
+	EXPECT_EQ(0u, timings[0].num_cpu_measured_iterations);
+}
+
+TEST(EffectChainTest, Tracing) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+
+	char filename[] = "/tmp/movit-trace-test-XXXXXX";
+	int fd = mkstemp(filename);
+	ASSERT_NE(-1, fd);
+	close(fd);
+	ASSERT_TRUE(start_tracing(filename));
+
+	{
+		EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		tester.get_chain()->add_effect(new IdentityEffect());
+		tester.get_chain()->add_effect(new BouncingIdentityEffect());
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+		// The GPU events of a render are picked up by the next one,
+		// once the GPU is done with it (which reading back the
+		// result of the first one makes sure of).
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	}
+	stop_tracing();
+
+	string trace;
+	FILE *fp = fopen(filename, "r");
+	ASSERT_TRUE(fp != nullptr);
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		trace.append(buf, len);
+	}
+	fclose(fp);
+	unlink(filename);
+
+	// A well-formed JSON array of events.
+	ASSERT_LE(2u, trace.size());
+	EXPECT_EQ('[', trace[0]);
+	EXPECT_EQ("]\n", trace.substr(trace.size() - 2));
+
+	EXPECT_NE(string::npos, trace.find("\"name\":\"EffectChain::finalize\""));
+	EXPECT_NE(string::npos, trace.find("\"name\":\"step0-start\""));
+	EXPECT_NE(string::npos, trace.find("\"name\":\"EffectChain::compile_glsl_program\""));
+	EXPECT_NE(string::npos, trace.find("\"name\":\"EffectChain::render\""));
+	EXPECT_NE(string::npos, trace.find("\"name\":\"Phase 0\""));
+	EXPECT_NE(string::npos, trace.find("\"name\":\"Phase 1\""));
+	if (movit_timer_queries_supported) {
+		EXPECT_NE(string::npos, trace.find("\"name\":\"Phase 0 (GPU)\",\"cat\":\"gpu\""));
+		EXPECT_NE(string::npos, trace.find("\"name\":\"Phase 1 (GPU)\",\"cat\":\"gpu\""));
+	}
+	EXPECT_NE(string::npos, trace.find("\"name\":\"FlatInput upload\""));
+	EXPECT_NE(string::npos, trace.find("\"args\":{\"effects\":"));
+}
+
 }  // namespace movit
@@ -20,6 +20,8 @@ FFTConvolutionEffect::FFTConvolutionEffect(int input_width, int input_height, in
 	  input_height(input_height),
 	  convolve_width(convolve_width),
 	  convolve_height(convolve_height),
+	  origin_x(0),
+	  origin_y(0),
 	  fft_input(new FFTInput(convolve_width, convolve_height)),
 	  crop_effect(new PaddingEffect()),
 	  owns_effects(true) {
@@ -39,15 +41,18 @@ FFTConvolutionEffect::~FFTConvolutionEffect()
 
 namespace {
 
-// Returns the last Effect in the new chain.
-Effect *add_overlap_and_fft(EffectChain *chain, Effect *last_effect, int fft_size, int pad_size, FFTPassEffect::Direction direction)
+// Returns the last Effect in the new chain. <origin> is the position of the
+// kernel's origin along this direction (see set_kernel_origin()); the overlap
+// reads (pad_size - origin) pixels before each slice and <origin> pixels
+// after it, instead of all of the padding before.
+Effect *add_overlap_and_fft(EffectChain *chain, Effect *last_effect, int fft_size, int pad_size, int origin, FFTPassEffect::Direction direction)
 {
 	// Overlap.
 	{
 		Effect *overlap_effect = chain->add_effect(new SliceEffect(), last_effect);
 		CHECK(overlap_effect->set_int("input_slice_size", fft_size - pad_size));
 		CHECK(overlap_effect->set_int("output_slice_size", fft_size));
-		CHECK(overlap_effect->set_int("offset", -pad_size));
+		CHECK(overlap_effect->set_int("offset", origin - pad_size));
 		if (direction == FFTPassEffect::HORIZONTAL) {
 			CHECK(overlap_effect->set_int("direction", SliceEffect::HORIZONTAL));
 		} else {
@@ -230,11 +235,11 @@ void FFTConvolutionEffect::rewrite_graph(EffectChain *chain, Node *self)
 	// Do FFT.
 	Effect *last_effect = last_node->effect;
 	if (best_x_before_y_fft) {
-		last_effect = add_overlap_and_fft(chain, last_effect, fft_width, pad_width, FFTPassEffect::HORIZONTAL);
-		last_effect = add_overlap_and_fft(chain, last_effect, fft_height, pad_height, FFTPassEffect::VERTICAL);
+		last_effect = add_overlap_and_fft(chain, last_effect, fft_width, pad_width, origin_x, FFTPassEffect::HORIZONTAL);
+		last_effect = add_overlap_and_fft(chain, last_effect, fft_height, pad_height, origin_y, FFTPassEffect::VERTICAL);
 	} else {
-		last_effect = add_overlap_and_fft(chain, last_effect, fft_height, pad_height, FFTPassEffect::VERTICAL);
-		last_effect = add_overlap_and_fft(chain, last_effect, fft_width, pad_width, FFTPassEffect::HORIZONTAL);
+		last_effect = add_overlap_and_fft(chain, last_effect, fft_height, pad_height, origin_y, FFTPassEffect::VERTICAL);
+		last_effect = add_overlap_and_fft(chain, last_effect, fft_width, pad_width, origin_x, FFTPassEffect::HORIZONTAL);
 	}
 
 	// Normalizer.
@@ -12,7 +12,10 @@
 // you sample from the origin pixel, and then up and to the left from that. This means
 // that (in horizontal 1D) [1 0 0 0 0 ...] would be an identity transform, and that
 // [0 1 0 0 0 ...] would mean sampling one pixel to the left of the origin, which
-// effectively move would move the image one pixel to the right.
+// effectively move would move the image one pixel to the right. You can
+// move the origin elsewhere with set_kernel_origin(); in particular, for the
+// common case of a (2R+1)x(2R+1) kernel centered on the output pixel,
+// set it to (R, R).
 //
 // The basic idea of the acceleration comes from the the convolution theorem
 // (which holds in any number of dimensions), namely that FFT(A ⊙ B) =
@@ -97,9 +100,21 @@ public:
 		fft_input->set_pixel_data(pixel_data);
 	}
 
+	// Which element of the kernel is multiplied with the origin pixel;
+	// the default is (0, 0). Must be called before finalize().
+	void set_kernel_origin(int x, int y)
+	{
+		assert(owns_effects);
+		assert(x >= 0 && x < convolve_width);
+		assert(y >= 0 && y < convolve_height);
+		origin_x = x;
+		origin_y = y;
+	}
+
 private:
 	int input_width, input_height;
 	int convolve_width, convolve_height;
+	int origin_x, origin_y;
 
 	// Both of these are owned by us if owns_effects is true (before finalize()),
 	// and otherwise owned by the EffectChain.
@@ -109,6 +109,42 @@ TEST(FFTConvolutionEffectTest, MoveRight) {
 	expect_equal(expected_data, out_data, size, size, 0.02, 0.003);
 }
 
+TEST(FFTConvolutionEffectTest, MoveUpWithCenteredOrigin) {
+	const int size = 4, convolve_size = 3;
+
+	float data[size * size] = {
+		0.1, 1.1, 2.1, 3.1,
+		0.2, 1.2, 2.2, 3.2,
+		0.3, 1.3, 2.3, 3.3,
+		0.4, 1.4, 2.4, 3.4,
+	};
+
+	// With the origin in the center, this samples from the pixel below.
+	float kernel[convolve_size * convolve_size] = {
+		0.0, 1.0, 0.0,
+		0.0, 0.0, 0.0,
+		0.0, 0.0, 0.0,
+	};
+	float expected_data[size * size] = {
+		0.2, 1.2, 2.2, 3.2,
+		0.3, 1.3, 2.3, 3.3,
+		0.4, 1.4, 2.4, 3.4,
+		0.4, 1.4, 2.4, 3.4,
+	};
+	float out_data[size * size];
+
+	EffectChainTester tester(nullptr, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, size, size);
+
+	FFTConvolutionEffect *fft_effect = new FFTConvolutionEffect(size, size, convolve_size, convolve_size);
+	fft_effect->set_kernel_origin(1, 1);
+	tester.get_chain()->add_effect(fft_effect);
+	fft_effect->set_convolution_kernel(kernel);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	expect_equal(expected_data, out_data, size, size, 0.02, 0.003);
+}
+
 TEST(FFTConvolutionEffectTest, MoveDown) {
 	const int size = 4, convolve_size = 3;
 
@@ -1,10 +1,13 @@
 #include <string.h>
 #include <assert.h>
 #include <epoxy/gl.h>
+#include <utility>
 
+#include "cpu_backend.h"
 #include "effect_util.h"
 #include "flat_input.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -66,103 +69,8 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 	glActiveTexture(GL_TEXTURE0 + *sampler_num);
 	check_error();
 
-	if (texture_num == 0 && (pbo != 0 || pixel_data != nullptr)) {
-		// Translate the input format to OpenGL's enums.
-		GLint internal_format;
-		GLenum format;
-		if (type == GL_FLOAT) {
-			if (pixel_format == FORMAT_R) {
-				internal_format = GL_R32F;
-			} else if (pixel_format == FORMAT_RG) {
-				internal_format = GL_RG32F;
-			} else if (pixel_format == FORMAT_RGB) {
-				internal_format = GL_RGB32F;
-			} else {
-				internal_format = GL_RGBA32F;
-			}
-		} else if (type == GL_HALF_FLOAT) {
-			if (pixel_format == FORMAT_R) {
-				internal_format = GL_R16F;
-			} else if (pixel_format == FORMAT_RG) {
-				internal_format = GL_RG16F;
-			} else if (pixel_format == FORMAT_RGB) {
-				internal_format = GL_RGB16F;
-			} else {
-				internal_format = GL_RGBA16F;
-			}
-		} else if (type == GL_UNSIGNED_SHORT) {
-			if (pixel_format == FORMAT_R) {
-				internal_format = GL_R16;
-			} else if (pixel_format == FORMAT_RG) {
-				internal_format = GL_RG16;
-			} else if (pixel_format == FORMAT_RGB) {
-				internal_format = GL_RGB16;
-			} else {
-				internal_format = GL_RGBA16;
-			}
-		} else if (output_linear_gamma) {
-			assert(type == GL_UNSIGNED_BYTE);
-			if (pixel_format == FORMAT_RGB) {
-				internal_format = GL_SRGB8;
-			} else if (pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA) {
-				internal_format = GL_SRGB8_ALPHA8;
-			} else {
-				assert(false);
-			}
-		} else {
-			assert(type == GL_UNSIGNED_BYTE);
-			if (pixel_format == FORMAT_R) {
-				internal_format = GL_R8;
-			} else if (pixel_format == FORMAT_RG) {
-				internal_format = GL_RG8;
-			} else if (pixel_format == FORMAT_RGB) {
-				internal_format = GL_RGB8;
-			} else {
-				internal_format = GL_RGBA8;
-			}
-		}
-		if (pixel_format == FORMAT_RGB) {
-			format = GL_RGB;
-		} else if (pixel_format == FORMAT_RGBA_PREMULTIPLIED_ALPHA ||
-			   pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA) {
-			format = GL_RGBA;
-		} else if (pixel_format == FORMAT_RG) {
-			format = GL_RG;
-		} else if (pixel_format == FORMAT_R) {
-			format = GL_RED;
-		} else {
-			assert(false);
-		}
-
-		// (Re-)upload the texture.
-		texture_num = resource_pool->create_2d_texture(internal_format, width, height);
-		glBindTexture(GL_TEXTURE_2D, texture_num);
-		check_error();
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
-		check_error();
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, needs_mipmaps ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
-		check_error();
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		check_error();
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
-		check_error();
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, pixel_data);
-		check_error();
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-		check_error();
-		if (needs_mipmaps) {
-			glGenerateMipmap(GL_TEXTURE_2D);
-			check_error();
-		}
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-		check_error();
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		check_error();
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		check_error();
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-		check_error();
-		owns_texture = true;
+	if (needs_upload()) {
+		upload_texture();
 	} else {
 		glBindTexture(GL_TEXTURE_2D, texture_num);
 		check_error();
@@ -175,6 +83,110 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 	++*sampler_num;
 }
 
+void FlatInput::upload_texture()
+{
+	assert(needs_upload());
+
+	// Translate the input format to OpenGL's enums.
+	GLint internal_format;
+	GLenum format;
+	if (type == GL_FLOAT) {
+		if (pixel_format == FORMAT_R) {
+			internal_format = GL_R32F;
+		} else if (pixel_format == FORMAT_RG) {
+			internal_format = GL_RG32F;
+		} else if (pixel_format == FORMAT_RGB) {
+			internal_format = GL_RGB32F;
+		} else {
+			internal_format = GL_RGBA32F;
+		}
+	} else if (type == GL_HALF_FLOAT) {
+		if (pixel_format == FORMAT_R) {
+			internal_format = GL_R16F;
+		} else if (pixel_format == FORMAT_RG) {
+			internal_format = GL_RG16F;
+		} else if (pixel_format == FORMAT_RGB) {
+			internal_format = GL_RGB16F;
+		} else {
+			internal_format = GL_RGBA16F;
+		}
+	} else if (type == GL_UNSIGNED_SHORT) {
+		if (pixel_format == FORMAT_R) {
+			internal_format = GL_R16;
+		} else if (pixel_format == FORMAT_RG) {
+			internal_format = GL_RG16;
+		} else if (pixel_format == FORMAT_RGB) {
+			internal_format = GL_RGB16;
+		} else {
+			internal_format = GL_RGBA16;
+		}
+	} else if (output_linear_gamma) {
+		assert(type == GL_UNSIGNED_BYTE);
+		if (pixel_format == FORMAT_RGB) {
+			internal_format = GL_SRGB8;
+		} else if (pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA) {
+			internal_format = GL_SRGB8_ALPHA8;
+		} else {
+			assert(false);
+		}
+	} else {
+		assert(type == GL_UNSIGNED_BYTE);
+		if (pixel_format == FORMAT_R) {
+			internal_format = GL_R8;
+		} else if (pixel_format == FORMAT_RG) {
+			internal_format = GL_RG8;
+		} else if (pixel_format == FORMAT_RGB) {
+			internal_format = GL_RGB8;
+		} else {
+			internal_format = GL_RGBA8;
+		}
+	}
+	if (pixel_format == FORMAT_RGB) {
+		format = GL_RGB;
+	} else if (pixel_format == FORMAT_RGBA_PREMULTIPLIED_ALPHA ||
+		   pixel_format == FORMAT_RGBA_POSTMULTIPLIED_ALPHA) {
+		format = GL_RGBA;
+	} else if (pixel_format == FORMAT_RG) {
+		format = GL_RG;
+	} else if (pixel_format == FORMAT_R) {
+		format = GL_RED;
+	} else {
+		assert(false);
+	}
+
+	// (Re-)upload the texture.
+	TraceScope trace_scope("upload", "FlatInput upload");
+	texture_num = resource_pool->create_2d_texture(internal_format, width, height);
+	glBindTexture(GL_TEXTURE_2D, texture_num);
+	check_error();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, needs_mipmaps ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+	check_error();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	check_error();
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
+	check_error();
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, pixel_data);
+	check_error();
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	check_error();
+	if (needs_mipmaps) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+		check_error();
+		resource_pool->mark_texture_mipmapped(texture_num);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	check_error();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	check_error();
+	owns_texture = true;
+}
+
 string FlatInput::output_fragment_shader()
 {
 	char buf[256];
@@ -183,6 +195,97 @@ string FlatInput::output_fragment_shader()
 	return buf + read_file("flat_input.frag");
 }
 
+namespace {
+
+float to_cpu_float(float x) { return x; }
+float to_cpu_float(fp16_int_t x) { return fp16_to_fp32(x); }
+float to_cpu_float(unsigned short x) { return x * (1.0f / 65535.0f); }
+float to_cpu_float(unsigned char x) { return x * (1.0f / 255.0f); }
+
+template<class T>
+void convert_row_to_rgba(const T *src, unsigned width, unsigned num_channels, bool srgb, float *dst)
+{
+	for (unsigned x = 0; x < width; ++x) {
+		float *out = dst + x * 4;
+		out[1] = out[2] = 0.0f;
+		out[3] = 1.0f;
+		for (unsigned c = 0; c < num_channels; ++c) {
+			out[c] = to_cpu_float(src[x * num_channels + c]);
+		}
+	}
+}
+
+// Like GL_SRGB8 and GL_SRGB8_ALPHA8; alpha is never sRGB-encoded.
+template<>
+void convert_row_to_rgba(const unsigned char *src, unsigned width, unsigned num_channels, bool srgb, float *dst)
+{
+	for (unsigned x = 0; x < width; ++x) {
+		float *out = dst + x * 4;
+		out[1] = out[2] = 0.0f;
+		out[3] = 1.0f;
+		for (unsigned c = 0; c < num_channels; ++c) {
+			const unsigned char v = src[x * num_channels + c];
+			out[c] = (srgb && c < 3) ? srgb8_to_linear(v) : to_cpu_float(v);
+		}
+	}
+}
+
+}  // namespace
+
+void FlatInput::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                unsigned y0, unsigned y1, float *dst) const
+{
+	assert(pixel_data != nullptr && pbo == 0);
+	assert(width == this->width && height == this->height);
+
+	unsigned num_channels;
+	switch (pixel_format) {
+	case FORMAT_R:
+		num_channels = 1;
+		break;
+	case FORMAT_RG:
+		num_channels = 2;
+		break;
+	case FORMAT_RGB:
+		num_channels = 3;
+		break;
+	default:
+		num_channels = 4;
+		break;
+	}
+
+	for (unsigned y = y0; y < y1; ++y) {
+		// See flat_input.frag; the data has a top-left origin.
+		const size_t offset = size_t(height - 1 - y) * pitch * num_channels;
+		float *out = dst + size_t(y - y0) * width * 4;
+		switch (type) {
+		case GL_FLOAT:
+			convert_row_to_rgba(static_cast<const float *>(pixel_data) + offset, width, num_channels, false, out);
+			break;
+		case GL_HALF_FLOAT:
+			convert_row_to_rgba(static_cast<const fp16_int_t *>(pixel_data) + offset, width, num_channels, false, out);
+			break;
+		case GL_UNSIGNED_SHORT:
+			convert_row_to_rgba(static_cast<const unsigned short *>(pixel_data) + offset, width, num_channels, false, out);
+			break;
+		case GL_UNSIGNED_BYTE:
+			convert_row_to_rgba(static_cast<const unsigned char *>(pixel_data) + offset, width, num_channels, output_linear_gamma, out);
+			break;
+		default:
+			assert(false);
+		}
+		for (unsigned x = 0; x < width; ++x) {
+			float *pixel = out + x * 4;
+			if (fixup_swap_rb) {
+				swap(pixel[0], pixel[2]);
+			}
+			if (fixup_red_to_grayscale) {
+				pixel[1] = pixel[2] = pixel[0];
+			}
+		}
+	}
+}
+
 void FlatInput::invalidate_pixel_data()
 {
 	possibly_release_texture();
@@ -55,6 +55,11 @@ public:
 	// Uploads the texture if it has changed since last time.
 	void set_gl_state(GLuint glsl_program_num, const std::string& prefix, unsigned *sampler_num) override;
 
+	// Reads straight from the pixel data; PBOs and textures are not supported.
+	bool has_cpu_implementation() const override { return true; }
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 	unsigned get_width() const override { return width; }
 	unsigned get_height() const override { return height; }
 	Colorspace get_color_space() const override { return image_format.color_space; }
@@ -149,11 +154,56 @@ public:
 		this->owns_texture = false;
 	}
 
+	// The remaining functions are intended for ChainBatch, which uses them
+	// to upload pixel data only once even if it is used by inputs in several
+	// chains (borrowing the texture with set_texture_num() for the others).
+
+	// Whether set_gl_state() would need to upload a new texture.
+	bool needs_upload() const
+	{
+		return texture_num == 0 && (pbo != 0 || pixel_data != nullptr);
+	}
+
+	// Whether this input would upload exactly the same texture as <other>.
+	bool has_same_pixel_data(const FlatInput &other) const
+	{
+		return (pixel_data != nullptr || pbo != 0) &&
+			pixel_data == other.pixel_data &&
+			pbo == other.pbo &&
+			type == other.type &&
+			pixel_format == other.pixel_format &&
+			width == other.width &&
+			height == other.height &&
+			pitch == other.pitch &&
+			output_linear_gamma == other.output_linear_gamma &&
+			needs_mipmaps == other.needs_mipmaps &&
+			resource_pool == other.resource_pool;
+	}
+
+	// Upload the texture now instead of in set_gl_state(), leaving it bound
+	// to GL_TEXTURE_2D on the current texture unit. needs_upload() must be true.
+	void upload_texture();
+
+	GLuint get_texture_num() const { return texture_num; }
+	bool get_owns_texture() const { return owns_texture; }
+
+	// Whether the chain has asked for mipmaps on this input. Mostly useful
+	// for subclasses that supply their own textures (see SharedInput).
+	bool get_needs_mipmaps() const { return needs_mipmaps; }
+
 	void inform_added(EffectChain *chain) override
 	{
 		resource_pool = chain->get_resource_pool();
 	}
 
+	// For FlatInputs that are only used for uploading, and never added
+	// to a chain (see FrameHistory); sets the pool that would otherwise
+	// come from the chain.
+	void set_resource_pool(ResourcePool *resource_pool)
+	{
+		this->resource_pool = resource_pool;
+	}
+
 private:
 	// Release the texture if we have any, and it is owned by us.
 	void possibly_release_texture();
@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
 
+#include "cpu_backend.h"
 #include "effect_util.h"
 #include "gamma_compression_effect.h"
 #include "util.h"
@@ -33,7 +37,16 @@ string GammaCompressionEffect::output_fragment_shader()
 void GammaCompressionEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
 	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	compute_curve_coefficients();
+}
 
+void GammaCompressionEffect::set_cpu_state()
+{
+	compute_curve_coefficients();
+}
+
+void GammaCompressionEffect::compute_curve_coefficients()
+{
 	// See GammaExpansionEffect for more details about the approximations in use;
 	// we will primarily deal with the differences here.
 	//
@@ -116,4 +129,29 @@ void GammaCompressionEffect::set_gl_state(GLuint glsl_program_num, const string
 	}
 }
 
+void GammaCompressionEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                              unsigned y0, unsigned y1, float *dst) const
+{
+	const CPUPixel c[] = {
+		CPUPixel(uniform_c[0]), CPUPixel(uniform_c[1]), CPUPixel(uniform_c[2]), CPUPixel(uniform_c[3]), CPUPixel(uniform_c[4])
+	};
+	const CPUPixel beta(uniform_beta), linear_scale(uniform_linear_scale);
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		if (destination_curve == GAMMA_LINEAR) {
+			memcpy(out, in, width * 4 * sizeof(float));
+			continue;
+		}
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			// Same as gamma_compression_effect.frag; NaN becomes 0.
+			const CPUPixel p = CPUPixel::load(in + x);
+			const CPUPixel v = min(max(p, CPUPixel(0.0f)), CPUPixel(1.0f));
+			const CPUPixel s = sqrt(v);
+			const CPUPixel b = c[0] + (c[1] + (c[2] + (c[3] + c[4] * s) * s) * s) * s;
+			select_greater(v, beta, b, v * linear_scale).with_alpha_from(p).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
 
+#include "cpu_backend.h"
 #include "effect_util.h"
 #include "gamma_expansion_effect.h"
 #include "util.h"
@@ -33,7 +37,16 @@ string GammaExpansionEffect::output_fragment_shader()
 void GammaExpansionEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
 	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	compute_curve_coefficients();
+}
 
+void GammaExpansionEffect::set_cpu_state()
+{
+	compute_curve_coefficients();
+}
+
+void GammaExpansionEffect::compute_curve_coefficients()
+{
 	// All of these curves follow a continuous curve that's piecewise defined;
 	// very low values (up to some β) are linear. Above β, we have a power curve
 	// that looks like this:
@@ -127,4 +140,27 @@ void GammaExpansionEffect::set_gl_state(GLuint glsl_program_num, const string &p
 	}
 }
 
+void GammaExpansionEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                            unsigned y0, unsigned y1, float *dst) const
+{
+	const CPUPixel c[] = {
+		CPUPixel(uniform_c[0]), CPUPixel(uniform_c[1]), CPUPixel(uniform_c[2]), CPUPixel(uniform_c[3]), CPUPixel(uniform_c[4])
+	};
+	const CPUPixel beta(uniform_beta), linear_scale(uniform_linear_scale);
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		if (source_curve == GAMMA_LINEAR) {
+			memcpy(out, in, width * 4 * sizeof(float));
+			continue;
+		}
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			// Same as gamma_expansion_effect.frag.
+			const CPUPixel v = CPUPixel::load(in + x);
+			const CPUPixel b = c[0] + (c[1] + (c[2] + (c[3] + c[4] * v) * v) * v) * v;
+			select_greater(v, beta, b, v * linear_scale).with_alpha_from(v).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
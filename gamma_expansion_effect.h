@@ -28,6 +28,11 @@ public:
 	std::string output_fragment_shader() override;
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
 
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 	bool needs_linear_light() const override { return false; }
 	bool needs_srgb_primaries() const override { return false; }
 	bool strong_one_to_one_sampling() const override { return true; }
@@ -37,6 +42,9 @@ public:
 	AlphaHandling alpha_handling() const override { return DONT_CARE_ALPHA_TYPE; }
 
 private:
+	// Sets the uniforms below for the current source curve.
+	void compute_curve_coefficients();
+
 	GammaCurve source_curve;
 	float uniform_linear_scale, uniform_c[5], uniform_beta;
 };
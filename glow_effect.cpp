@@ -17,6 +17,7 @@ GlowEffect::GlowEffect()
 	  mix(new MixEffect)
 {
 	CHECK(blur->set_float("radius", 20.0f));
+	CHECK(blur->set_int("max_downscale_levels", 2));
 	CHECK(mix->set_float("strength_first", 1.0f));
 	CHECK(mix->set_float("strength_second", 1.0f));
 	CHECK(cutoff->set_float("cutoff", 0.2f));
@@ -49,6 +50,10 @@ bool GlowEffect::set_float(const string &key, float value) {
 	return blur->set_float(key, value);
 }
 
+bool GlowEffect::set_int(const string &key, int value) {
+	return blur->set_int(key, value);
+}
+
 HighlightCutoffEffect::HighlightCutoffEffect()
 	: cutoff(0.0f)
 {
@@ -3,6 +3,10 @@
 
 // Glow: Cut out the highlights of the image (everything above a certain threshold),
 // blur them, and overlay them onto the original image.
+//
+// The blur runs at a lower resolution than BlurEffect would otherwise pick
+// when the radius is large enough (see “max_downscale_levels” in BlurEffect,
+// which defaults to 2 here; set it to 0 for BlurEffect's usual resolution).
 
 #include <epoxy/gl.h>
 #include <assert.h>
@@ -27,6 +31,7 @@ public:
 
 	void rewrite_graph(EffectChain *graph, Node *self) override;
 	bool set_float(const std::string &key, float value) override;
+	bool set_int(const std::string &key, int value) override;
 
 	std::string output_fragment_shader() override {
 		assert(false);
@@ -0,0 +1,35 @@
+#define GTEST_HAS_EXCEPTIONS 0
+
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "test_context.h"
+
+int main(int argc, char **argv) {
+	// Set up an OpenGL context; see test_context.h.
+	movit::create_test_context();
+
+	int err;
+	if (argc >= 2 && strcmp(argv[1], "--benchmark") == 0) {
+#ifdef HAVE_BENCHMARK
+		--argc;
+		::benchmark::Initialize(&argc, argv + 1);
+		if (::benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+		::benchmark::RunSpecifiedBenchmarks();
+		err = 0;
+#else
+		fprintf(stderr, "No support for microbenchmarks compiled in.\n");
+		err = 1;
+#endif
+	} else {
+		testing::InitGoogleTest(&argc, argv);
+		err = RUN_ALL_TESTS();
+	}
+	movit::destroy_test_context();
+	return err;
+}
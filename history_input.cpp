@@ -0,0 +1,110 @@
+#include <assert.h>
+#include <epoxy/gl.h>
+
+#include "history_input.h"
+#include "resource_pool.h"
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+FrameHistory::FrameHistory(ImageFormat format, MovitPixelFormat pixel_format, GLenum type,
+                           unsigned width, unsigned height, unsigned num_frames,
+                           ResourcePool *resource_pool)
+	: format(format),
+	  pixel_format(pixel_format),
+	  type(type),
+	  width(width),
+	  height(height),
+	  resource_pool(resource_pool),
+	  slot_has_mipmaps(num_frames, false),
+	  newest(0),
+	  num_valid_frames(0)
+{
+	assert(num_frames > 0);
+	assert(resource_pool != nullptr);
+	for (unsigned i = 0; i < num_frames; ++i) {
+		FlatInput *slot = new FlatInput(format, pixel_format, type, width, height);
+		slot->set_resource_pool(resource_pool);
+		slots.push_back(slot);
+	}
+}
+
+FrameHistory::~FrameHistory()
+{
+	for (FlatInput *slot : slots) {
+		delete slot;
+	}
+}
+
+void FrameHistory::clear()
+{
+	for (FlatInput *slot : slots) {
+		slot->invalidate_pixel_data();
+	}
+	num_valid_frames = 0;
+}
+
+FlatInput *FrameHistory::next_slot()
+{
+	newest = (newest + 1) % slots.size();
+	return slots[newest];
+}
+
+void FrameHistory::upload_newest()
+{
+	TraceScope trace_scope("upload", "FrameHistory::push_frame");
+	FlatInput *slot = slots[newest];
+	assert(slot->needs_upload());
+	slot->upload_texture();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	check_error();
+
+	slot_has_mipmaps[newest] = false;
+	if (num_valid_frames < slots.size()) {
+		++num_valid_frames;
+	}
+}
+
+GLuint FrameHistory::get_texture_num(unsigned age, bool need_mipmaps)
+{
+	assert(num_valid_frames > 0);  // Forgot to call push_frame()?
+	if (age >= num_valid_frames) {
+		age = num_valid_frames - 1;
+	}
+	const unsigned index = (newest + slots.size() - age) % slots.size();
+	const GLuint texture_num = slots[index]->get_texture_num();
+	assert(texture_num != 0);
+
+	if (need_mipmaps && !slot_has_mipmaps[index]) {
+		glBindTexture(GL_TEXTURE_2D, texture_num);
+		check_error();
+		glGenerateMipmap(GL_TEXTURE_2D);
+		check_error();
+		resource_pool->mark_texture_mipmapped(texture_num);
+		slot_has_mipmaps[index] = true;
+	}
+	return texture_num;
+}
+
+HistoryInput::HistoryInput(FrameHistory *history, unsigned age)
+	: FlatInput(history->get_image_format(), history->get_pixel_format(),
+	            history->get_type(), history->get_width(), history->get_height()),
+	  history(history),
+	  age(age)
+{
+	assert(age < history->get_num_frames());
+}
+
+void HistoryInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
+{
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+	set_texture_num(history->get_texture_num(age, get_needs_mipmaps()));
+
+	FlatInput::set_gl_state(glsl_program_num, prefix, sampler_num);
+}
+
+}  // namespace movit
@@ -0,0 +1,152 @@
+#ifndef _MOVIT_HISTORY_INPUT_H
+#define _MOVIT_HISTORY_INPUT_H 1
+
+// FrameHistory and HistoryInput give effects that look at several frames
+// (or fields) in time, such as DeinterlaceEffect, access to the last few
+// frames of a source without the user having to manage a separate input for
+// each of them and shuffle textures around every frame.
+//
+// A FrameHistory keeps a ring of the last <num_frames> frames uploaded to it,
+// each in its own texture from the ResourcePool. Every frame is uploaded
+// exactly once, when you push it; after that, it simply moves one step further
+// back in the ring, without any copies. A HistoryInput is an input that reads
+// the frame a given number of frames back (the age), so e.g. YADIF, which
+// wants the previous two fields, the current one and the two next ones, would
+// be set up like this:
+//
+//   FrameHistory history(format, FORMAT_GRAYSCALE, GL_UNSIGNED_BYTE, 720, 288, 5, pool);
+//   Effect *deinterlace = chain.add_effect(new DeinterlaceEffect(),
+//       chain.add_input(new HistoryInput(&history, 4)),
+//       chain.add_input(new HistoryInput(&history, 3)),
+//       chain.add_input(new HistoryInput(&history, 2)),  // The current field.
+//       chain.add_input(new HistoryInput(&history, 1)),
+//       chain.add_input(new HistoryInput(&history, 0)));
+//
+//   // For every field:
+//   history.push_frame(field_data);
+//   chain.render_to_fbo(...);
+//
+// Until <num_frames> frames have been pushed, asking for a frame older than
+// the oldest one gives the oldest one instead, which is what you would
+// typically do by hand at the start of a clip anyway.
+//
+// The FrameHistory must be used from the OpenGL context (or sharing contexts)
+// the chains are rendered in, and pushing a frame uploads it right away.
+// Textures that fall out of the ring are given back to the pool, whose fences
+// make sure they are not reused while the GPU could still be reading them.
+
+#include <epoxy/gl.h>
+#include <string>
+#include <vector>
+
+#include "flat_input.h"
+#include "fp16.h"
+#include "image_format.h"
+
+namespace movit {
+
+class ResourcePool;
+
+class FrameHistory {
+public:
+	// The arguments are as for FlatInput, plus the number of frames to keep
+	// (at least one).
+	FrameHistory(ImageFormat format, MovitPixelFormat pixel_format, GLenum type,
+	             unsigned width, unsigned height, unsigned num_frames,
+	             ResourcePool *resource_pool);
+	~FrameHistory();
+
+	// Upload a new frame, which becomes the one with age 0. The oldest frame
+	// (if we already have <num_frames>) is dropped. As with FlatInput, the data
+	// can either be a regular pointer, or a byte offset into a PBO.
+	void push_frame(const unsigned char *pixel_data, GLuint pbo = 0)
+	{
+		next_slot()->set_pixel_data(pixel_data, pbo);
+		upload_newest();
+	}
+
+	void push_frame(const unsigned short *pixel_data, GLuint pbo = 0)
+	{
+		next_slot()->set_pixel_data(pixel_data, pbo);
+		upload_newest();
+	}
+
+	void push_frame_fp16(const fp16_int_t *pixel_data, GLuint pbo = 0)
+	{
+		next_slot()->set_pixel_data_fp16(pixel_data, pbo);
+		upload_newest();
+	}
+
+	void push_frame(const float *pixel_data, GLuint pbo = 0)
+	{
+		next_slot()->set_pixel_data(pixel_data, pbo);
+		upload_newest();
+	}
+
+	// Forget all frames, e.g. on a cut.
+	void clear();
+
+	// The number of frames pushed so far, up to <num_frames>.
+	unsigned get_num_valid_frames() const { return num_valid_frames; }
+
+	const ImageFormat &get_image_format() const { return format; }
+	MovitPixelFormat get_pixel_format() const { return pixel_format; }
+	GLenum get_type() const { return type; }
+	unsigned get_width() const { return width; }
+	unsigned get_height() const { return height; }
+	unsigned get_num_frames() const { return slots.size(); }
+
+	// Intended for HistoryInput only: Get the texture holding the frame
+	// <age> frames back (clamped to the oldest one we have), generating
+	// mipmaps for it first if <need_mipmaps> is set and it does not have
+	// them already. At least one frame must have been pushed.
+	GLuint get_texture_num(unsigned age, bool need_mipmaps);
+
+private:
+	// Invalidate the oldest slot and make it the newest one.
+	FlatInput *next_slot();
+
+	// Upload the data just set on the newest slot.
+	void upload_newest();
+
+	ImageFormat format;
+	MovitPixelFormat pixel_format;
+	GLenum type;
+	unsigned width, height;
+	ResourcePool *resource_pool;
+
+	// The ring of frames. Each slot is a FlatInput that is never added
+	// to any chain, but used only to upload into (and hold) its texture.
+	// <newest> is the index of the slot with age 0; older frames come
+	// at lower indexes, wrapping around.
+	std::vector<FlatInput *> slots;
+	std::vector<bool> slot_has_mipmaps;
+	unsigned newest, num_valid_frames;
+};
+
+// An input that reads the frame <age> frames back in the given FrameHistory
+// (0 is the newest one), like a FlatInput with a texture given by
+// set_texture_num() (whose shader it shares). Since the texture is chosen
+// anew every time the chain is rendered, the same HistoryInput gives the
+// right frame after every push_frame().
+class HistoryInput : public FlatInput {
+public:
+	HistoryInput(FrameHistory *history, unsigned age);
+
+	std::string effect_type_id() const override { return "HistoryInput"; }
+
+	// The frames are uploaded by the FrameHistory, independently of
+	// the chains using them, so we cannot let the chain ask for sRGB
+	// decoding in the sampler; gamma expansion is done in the shader.
+	bool can_output_linear_gamma() const override { return false; }
+
+	void set_gl_state(GLuint glsl_program_num, const std::string& prefix, unsigned *sampler_num) override;
+
+private:
+	FrameHistory *history;
+	unsigned age;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_HISTORY_INPUT_H)
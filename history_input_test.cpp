@@ -0,0 +1,79 @@
+// Unit tests for FrameHistory and HistoryInput.
+
+#include <epoxy/gl.h>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "history_input.h"
+#include "mix_effect.h"
+#include "test_util.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+TEST(HistoryInputTest, AgesFollowPushes) {
+	const int width = 1, height = 2;
+	float frames[3][width * height] = {
+		{ 0.1, 0.2 },
+		{ 0.3, 0.4 },
+		{ 0.5, 0.6 },
+	};
+	float out_data[width * height];
+
+	EffectChainTester tester(nullptr, width, height);
+	FrameHistory history(linear_format(), FORMAT_GRAYSCALE, GL_FLOAT, width, height, 2,
+	                     tester.get_chain()->get_resource_pool());
+	tester.get_chain()->add_input(new HistoryInput(&history, 1));
+
+	// Until there are two frames, we get the oldest one we have.
+	history.push_frame(frames[0]);
+	EXPECT_EQ(1u, history.get_num_valid_frames());
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(frames[0], out_data, width, height);
+
+	history.push_frame(frames[1]);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(frames[0], out_data, width, height);
+
+	history.push_frame(frames[2]);
+	EXPECT_EQ(2u, history.get_num_valid_frames());
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(frames[1], out_data, width, height);
+
+	history.clear();
+	EXPECT_EQ(0u, history.get_num_valid_frames());
+	history.push_frame(frames[2]);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(frames[2], out_data, width, height);
+}
+
+TEST(HistoryInputTest, SeveralAgesInOneChain) {
+	const int width = 1, height = 1;
+	float frames[4][width * height] = { { 0.0 }, { 0.1 }, { 0.2 }, { 0.4 } };
+	float out_data[width * height];
+
+	EffectChainTester tester(nullptr, width, height);
+	EffectChain *chain = tester.get_chain();
+	FrameHistory history(linear_format(), FORMAT_GRAYSCALE, GL_FLOAT, width, height, 3,
+	                     chain->get_resource_pool());
+	Input *newest = chain->add_input(new HistoryInput(&history, 0));
+	Input *oldest = chain->add_input(new HistoryInput(&history, 2));
+	Effect *mix = chain->add_effect(new MixEffect(), newest, oldest);
+	ASSERT_TRUE(mix->set_float("strength_first", 1.0f));
+	ASSERT_TRUE(mix->set_float("strength_second", 1.0f));
+
+	for (unsigned i = 0; i < 4; ++i) {
+		history.push_frame(frames[i]);
+	}
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	EXPECT_NEAR(0.4 + 0.1, out_data[0], 1e-3);
+
+	// Each frame is uploaded only once; pushing a new one just rotates the ring.
+	history.push_frame(frames[0]);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	EXPECT_NEAR(0.0 + 0.2, out_data[0], 1e-3);
+}
+
+}  // namespace movit
@@ -1,8 +1,17 @@
 #include <epoxy/gl.h>
 #include <assert.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 #include <algorithm>
 #include <string>
+#include <vector>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 #include "init.h"
 #include "resource_pool.h"
@@ -26,6 +35,12 @@ string *movit_data_directory = nullptr;
 
 namespace {
 
+// See set_movit_measurement_cache_file() and set_movit_measurements().
+// Pointer for the same reason as movit_data_directory.
+string *measurement_cache_filename = nullptr;
+bool measurements_given = false;
+MovitMeasurements given_measurements;
+
 void measure_texel_subpixel_precision()
 {
 	ResourcePool resource_pool;
@@ -281,6 +296,146 @@ void measure_roundoff_problems()
 	check_error();
 }
 
+// The start of the line for the current GPU in the measurement cache file;
+// a tag for the format of the rest of the line, and the vendor, renderer
+// and version strings, each followed by a tab. If we ever measure something
+// more (or differently), the tag should be bumped, so that old entries
+// are simply ignored and measured again.
+string get_measurement_cache_key()
+{
+	string key = "movit-measurements-v1\t";
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+		const char *str = (const char *)glGetString(name);
+		check_error();
+		string value = (str == nullptr) ? "" : str;
+		replace(value.begin(), value.end(), '\t', ' ');
+		replace(value.begin(), value.end(), '\n', ' ');
+		key += value;
+		key += '\t';
+	}
+	return key;
+}
+
+// Reads all lines of the given file, without the newlines.
+// Returns false if the file could not be opened.
+bool read_lines(const string &filename, vector<string> *lines)
+{
+	FILE *fp = fopen(filename.c_str(), "r");
+	if (fp == nullptr) {
+		return false;
+	}
+
+	string line;
+	char buf[4096];
+	while (fgets(buf, sizeof(buf), fp) != nullptr) {
+		line += buf;
+		if (!line.empty() && line.back() == '\n') {
+			line.pop_back();
+			lines->push_back(line);
+			line.clear();
+		}
+	}
+	if (!line.empty()) {
+		lines->push_back(line);
+	}
+	fclose(fp);
+	return true;
+}
+
+}  // namespace
+
+// The measurements are stored one GPU per line, as the key followed by
+// the bit pattern of the texel subpixel precision in hex (so that we get
+// the exact same value back, regardless of locale) and the number of
+// wrongly rounded values. Lines that do not parse are ignored.
+bool load_movit_measurements_from_cache(const string &filename, const string &key, MovitMeasurements *measurements)
+{
+	vector<string> lines;
+	if (!read_lines(filename, &lines)) {
+		return false;
+	}
+
+	for (const string &line : lines) {
+		if (line.compare(0, key.size(), key) != 0) {
+			continue;
+		}
+		unsigned precision_bits;
+		int num_wrongly_rounded;
+		if (sscanf(line.c_str() + key.size(), "%x\t%d", &precision_bits, &num_wrongly_rounded) != 2) {
+			continue;
+		}
+		float texel_subpixel_precision;
+		static_assert(sizeof(texel_subpixel_precision) == sizeof(precision_bits), "unexpected float size");
+		memcpy(&texel_subpixel_precision, &precision_bits, sizeof(texel_subpixel_precision));
+		if (!(texel_subpixel_precision > 0.0f && texel_subpixel_precision <= 1.0f) ||
+		    num_wrongly_rounded < 0 || num_wrongly_rounded > 510) {
+			continue;
+		}
+		measurements->texel_subpixel_precision = texel_subpixel_precision;
+		measurements->num_wrongly_rounded = num_wrongly_rounded;
+		return true;
+	}
+	return false;
+}
+
+void save_movit_measurements_to_cache(const string &filename, const string &key, const MovitMeasurements &measurements)
+{
+	// Keep the entries for other GPUs (if any), and replace ours.
+	vector<string> lines;
+	read_lines(filename, &lines);
+	lines.erase(remove_if(lines.begin(), lines.end(), [&key](const string &line) {
+		return line.compare(0, key.size(), key) == 0;
+	}), lines.end());
+
+	unsigned precision_bits;
+	memcpy(&precision_bits, &measurements.texel_subpixel_precision, sizeof(precision_bits));
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%08x\t%d", precision_bits, measurements.num_wrongly_rounded);
+	lines.push_back(key + buf);
+
+	// Write to a temporary file and rename it into place, so that other
+	// processes never see a half-written file.
+	const string tmp_filename = filename + ".tmp." + to_string(getpid());
+	FILE *fp = fopen(tmp_filename.c_str(), "w");
+	if (fp == nullptr) {
+		return;
+	}
+	bool ok = true;
+	for (const string &line : lines) {
+		if (fprintf(fp, "%s\n", line.c_str()) < 0) {
+			ok = false;
+		}
+	}
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+	if (ok && rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		// Windows will not rename over an existing file, so we have to
+		// remove it first. This is not atomic; another process may find
+		// no file in between (and then just measure again), and if two
+		// processes save at the same time, one of the updates may be lost.
+		remove(filename.c_str());
+		ok = (rename(tmp_filename.c_str(), filename.c_str()) == 0);
+	}
+	if (!ok) {
+		remove(tmp_filename.c_str());
+	}
+}
+
+bool get_known_movit_measurements(const string &key, MovitMeasurements *measurements)
+{
+	if (measurements_given) {
+		*measurements = given_measurements;
+		return true;
+	}
+	if (measurement_cache_filename != nullptr) {
+		return load_movit_measurements_from_cache(*measurement_cache_filename, key, measurements);
+	}
+	return false;
+}
+
+namespace {
+
 bool check_extensions()
 {
 	// GLES generally doesn't use extensions as actively as desktop OpenGL.
@@ -423,11 +578,39 @@ bool init_movit(const string& data_directory, MovitDebugLevel debug_level)
 		movit_shader_model = MOVIT_ESSL_300;
 	}
 
-	measure_texel_subpixel_precision();
-	measure_roundoff_problems();
+	const string key = get_measurement_cache_key();
+	MovitMeasurements measurements;
+	if (get_known_movit_measurements(key, &measurements)) {
+		movit_texel_subpixel_precision = measurements.texel_subpixel_precision;
+		movit_num_wrongly_rounded = measurements.num_wrongly_rounded;
+	} else {
+		measure_texel_subpixel_precision();
+		measure_roundoff_problems();
+		if (measurement_cache_filename != nullptr) {
+			measurements.texel_subpixel_precision = movit_texel_subpixel_precision;
+			measurements.num_wrongly_rounded = movit_num_wrongly_rounded;
+			save_movit_measurements_to_cache(*measurement_cache_filename, key, measurements);
+		}
+	}
 
 	movit_initialized = true;
 	return true;
 }
 
+void set_movit_measurement_cache_file(const string &filename)
+{
+	assert(!movit_initialized);
+	delete measurement_cache_filename;
+	measurement_cache_filename = new string(filename);
+}
+
+void set_movit_measurements(const MovitMeasurements &measurements)
+{
+	assert(!movit_initialized);
+	assert(measurements.texel_subpixel_precision > 0.0f);
+	assert(measurements.num_wrongly_rounded >= 0);
+	measurements_given = true;
+	given_measurements = measurements;
+}
+
 }  // namespace movit
@@ -27,6 +27,46 @@ enum MovitDebugLevel {
 // only the first will count, and the second will always return true.
 bool init_movit(const std::string& data_directory, MovitDebugLevel debug_level) MUST_CHECK_RESULT;
 
+// As part of initialization, init_movit() measures a few properties of the GPU
+// (see movit_texel_subpixel_precision and movit_num_wrongly_rounded below)
+// by rendering and reading back the results. This takes some time,
+// which can matter for short-lived processes. There are two ways around it;
+// both must be set up before init_movit() is called.
+//
+// First, you can give a file where the measurements are cached between runs.
+// The entries are keyed on the OpenGL vendor, renderer and version strings
+// (and a version tag for the entry format), so if the driver or GPU changes,
+// the measurements are simply done again (and the file updated).
+// The file is created if it does not exist; if it cannot be read or written,
+// or an entry is corrupt, it is silently ignored.
+//
+// It is fine for multiple processes to use the same file; it is updated
+// by writing a new file and renaming it into place. Note that on Windows,
+// which cannot rename over an existing file, the old file is removed first,
+// so the update is not atomic there. Another process could then find
+// no cache and measure again, or an update could be lost; but the file
+// would never be left half-written.
+void set_movit_measurement_cache_file(const std::string &filename);
+
+// Second, if you already know the values (e.g. because you have called
+// init_movit() on the same machine earlier, and stored the values of
+// movit_texel_subpixel_precision and movit_num_wrongly_rounded from then),
+// you can give them directly, and no measurements will be done at all.
+// This takes priority over the cache file, if both are set.
+struct MovitMeasurements {
+	float texel_subpixel_precision;
+	int num_wrongly_rounded;
+};
+void set_movit_measurements(const MovitMeasurements &measurements);
+
+// For unit tests only. Do not use from other code.
+// Reading and writing the entry for the given key in a cache file
+// (see set_movit_measurement_cache_file()), and finding the measurements
+// set up by the two functions above, if any, for the GPU with the given key.
+bool load_movit_measurements_from_cache(const std::string &filename, const std::string &key, MovitMeasurements *measurements);
+void save_movit_measurements_to_cache(const std::string &filename, const std::string &key, const MovitMeasurements &measurements);
+bool get_known_movit_measurements(const std::string &key, MovitMeasurements *measurements);
+
 // GPU features. These are not intended for end-user use.
 
 // Whether init_movit() has been called.
@@ -0,0 +1,124 @@
+// Unit tests for the measurement caching in init_movit().
+//
+// Note that none of these call init_movit() itself, since that can
+// only be done once per process.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "init.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+const char *key_a = "movit-measurements-v1\tVendor A\tRenderer A\t3.0\t";
+const char *key_b = "movit-measurements-v1\tVendor B\tRenderer B\t4.5\t";
+
+// A cache file that is deleted when the test is done.
+class TempCacheFile {
+public:
+	TempCacheFile() : filename("init_test_cache." + to_string(getpid())) { remove(filename.c_str()); }
+	~TempCacheFile() { remove(filename.c_str()); }
+
+	void write(const string &contents)
+	{
+		FILE *fp = fopen(filename.c_str(), "w");
+		ASSERT_NE(nullptr, fp);
+		fputs(contents.c_str(), fp);
+		fclose(fp);
+	}
+
+	const string filename;
+};
+
+}  // namespace
+
+TEST(MeasurementCacheTest, RoundTrip) {
+	TempCacheFile cache;
+	MovitMeasurements measurements;
+	EXPECT_FALSE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+
+	save_movit_measurements_to_cache(cache.filename, key_a, { 1.0f / 64.0f, 3 });
+	save_movit_measurements_to_cache(cache.filename, key_b, { 1.0f / 256.0f, 0 });
+
+	// Both GPUs should be in the file, and give back the exact same values.
+	ASSERT_TRUE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+	EXPECT_EQ(1.0f / 64.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(3, measurements.num_wrongly_rounded);
+
+	ASSERT_TRUE(load_movit_measurements_from_cache(cache.filename, key_b, &measurements));
+	EXPECT_EQ(1.0f / 256.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(0, measurements.num_wrongly_rounded);
+
+	// Saving again should replace the existing entry, not add another one.
+	save_movit_measurements_to_cache(cache.filename, key_a, { 1.0f / 128.0f, 1 });
+	ASSERT_TRUE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+	EXPECT_EQ(1.0f / 128.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(1, measurements.num_wrongly_rounded);
+}
+
+TEST(MeasurementCacheTest, IgnoresOtherGPUs) {
+	TempCacheFile cache;
+	save_movit_measurements_to_cache(cache.filename, key_b, { 1.0f / 256.0f, 0 });
+
+	MovitMeasurements measurements;
+	EXPECT_FALSE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+
+	// An entry in an older (or newer) format for the same GPU
+	// should not be taken either.
+	cache.write("movit-measurements-v0\tVendor A\tRenderer A\t3.0\t3c800000\t0\n");
+	EXPECT_FALSE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+}
+
+TEST(MeasurementCacheTest, IgnoresCorruptLines) {
+	TempCacheFile cache;
+	MovitMeasurements measurements;
+
+	cache.write(string(key_a) + "not a number\n");
+	EXPECT_FALSE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+
+	// Out of range.
+	cache.write(string(key_a) + "7f800000\t0\n" + key_a + "3c800000\t-1\n");
+	EXPECT_FALSE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+
+	// A good line after the corrupt ones should still be found.
+	cache.write(string(key_a) + "garbage\n" + key_a + "3c800000\t2\n");
+	ASSERT_TRUE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+	EXPECT_EQ(1.0f / 64.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(2, measurements.num_wrongly_rounded);
+
+	// Saving should get rid of them.
+	save_movit_measurements_to_cache(cache.filename, key_a, { 1.0f / 256.0f, 0 });
+	ASSERT_TRUE(load_movit_measurements_from_cache(cache.filename, key_a, &measurements));
+	EXPECT_EQ(1.0f / 256.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(0, measurements.num_wrongly_rounded);
+}
+
+// This changes global state, so it is all done in one test.
+TEST(MeasurementCacheTest, GivenMeasurementsTakePriority) {
+	TempCacheFile cache;
+	save_movit_measurements_to_cache(cache.filename, key_a, { 1.0f / 64.0f, 3 });
+
+	MovitMeasurements measurements;
+	EXPECT_FALSE(get_known_movit_measurements(key_a, &measurements));
+
+	set_movit_measurement_cache_file(cache.filename);
+	ASSERT_TRUE(get_known_movit_measurements(key_a, &measurements));
+	EXPECT_EQ(1.0f / 64.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(3, measurements.num_wrongly_rounded);
+	EXPECT_FALSE(get_known_movit_measurements(key_b, &measurements));
+
+	set_movit_measurements({ 1.0f / 256.0f, 0 });
+	ASSERT_TRUE(get_known_movit_measurements(key_a, &measurements));
+	EXPECT_EQ(1.0f / 256.0f, measurements.texel_subpixel_precision);
+	EXPECT_EQ(0, measurements.num_wrongly_rounded);
+	ASSERT_TRUE(get_known_movit_measurements(key_b, &measurements));
+	EXPECT_EQ(1.0f / 256.0f, measurements.texel_subpixel_precision);
+}
+
+}  // namespace movit
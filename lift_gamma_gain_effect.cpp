@@ -1,6 +1,8 @@
 #include <epoxy/gl.h>
 #include <math.h>
+#include <stddef.h>
 
+#include "cpu_backend.h"
 #include "effect_util.h"
 #include "lift_gamma_gain_effect.h"
 #include "util.h"
@@ -29,7 +31,16 @@ string LiftGammaGainEffect::output_fragment_shader()
 void LiftGammaGainEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
 	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	compute_derived_uniforms();
+}
+
+void LiftGammaGainEffect::set_cpu_state()
+{
+	compute_derived_uniforms();
+}
 
+void LiftGammaGainEffect::compute_derived_uniforms()
+{
 	uniform_gain_pow_inv_gamma = RGBTriplet(
 		pow(gain.r, 1.0f / gamma.r),
 		pow(gain.g, 1.0f / gamma.g),
@@ -41,4 +52,31 @@ void LiftGammaGainEffect::set_gl_state(GLuint glsl_program_num, const string &pr
 		2.2f / gamma.b);
 }
 
+void LiftGammaGainEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                          unsigned y0, unsigned y1, float *dst) const
+{
+	// The alpha channel goes through the same computations as the others,
+	// but is then replaced by the input alpha.
+	const CPUPixel zero(0.0f), one(1.0f), inv_2_2(1.0f / 2.2f);
+	const CPUPixel lift_rgb(lift.r, lift.g, lift.b, 0.0f);
+	const CPUPixel inv_gamma22(uniform_inv_gamma22.r, uniform_inv_gamma22.g, uniform_inv_gamma22.b, 1.0f);
+	const CPUPixel gain_pow_inv_gamma(uniform_gain_pow_inv_gamma.r, uniform_gain_pow_inv_gamma.g, uniform_gain_pow_inv_gamma.b, 1.0f);
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			// Same as lift_gamma_gain_effect.frag, except that
+			// the clipping also takes care of NaNs.
+			const CPUPixel p = CPUPixel::load(in + x);
+			const CPUPixel alpha = p.broadcast<3>();
+			CPUPixel v = max(p / alpha, zero);
+			v = pow(v, inv_2_2);
+			v = v + lift_rgb * (one - v);
+			v = max(v, zero);
+			v = pow(v, inv_gamma22);
+			(v * gain_pow_inv_gamma * alpha).with_alpha_from(p).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
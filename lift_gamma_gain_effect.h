@@ -37,7 +37,15 @@ public:
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
 
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 private:
+	// Computes the uniforms below from lift, gamma and gain.
+	void compute_derived_uniforms();
+
 	RGBTriplet lift, gamma, gain;
 	RGBTriplet uniform_gain_pow_inv_gamma, uniform_inv_gamma22;
 };
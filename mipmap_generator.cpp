@@ -0,0 +1,238 @@
+#include <assert.h>
+#include <epoxy/gl.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "mipmap_generator.h"
+#include "resource_pool.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Must match TILE_SIZE in mipmap_generator.comp.
+const unsigned tile_size = 16;
+
+// How many levels one dispatch can generate.
+const unsigned max_levels_per_dispatch = 3;
+
+unsigned num_filter_taps(MipmapFilter filter)
+{
+	switch (filter) {
+	case MIPMAP_FILTER_BOX:
+		return 1;
+	case MIPMAP_FILTER_BILINEAR:
+		return 2;
+	case MIPMAP_FILTER_LANCZOS:
+		return 4;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+// The unnormalized filter weight for a tap <x> pixels from the center
+// (in the level we are filtering from).
+float filter_weight(MipmapFilter filter, float x)
+{
+	switch (filter) {
+	case MIPMAP_FILTER_BOX:
+		return 1.0f;
+	case MIPMAP_FILTER_BILINEAR:
+		return 1.0f - fabs(x) * 0.5f;
+	case MIPMAP_FILTER_LANCZOS: {
+		// Lanczos with a=2, stretched to twice the width since we are
+		// scaling down by 2x. Note that x is never zero.
+		float t = x * 0.5f;
+		return sin(M_PI * t) * sin(M_PI * t * 0.5f) / (M_PI * M_PI * t * t * 0.5f);
+	}
+	default:
+		assert(false);
+		return 0.0f;
+	}
+}
+
+const char *image_format_qualifier(GLenum internal_format)
+{
+	switch (internal_format) {
+	case GL_RGBA32F:
+		return "rgba32f";
+	case GL_RGBA16F:
+		return "rgba16f";
+	case GL_RGBA16:
+		return "rgba16";
+	case GL_RGBA8:
+		return "rgba8";
+	case GL_RGB10_A2:
+		return "rgb10_a2";
+	default:
+		return nullptr;
+	}
+}
+
+void set_uniform_1i(GLuint glsl_program_num, const char *name, int value)
+{
+	GLint location = glGetUniformLocation(glsl_program_num, name);
+	if (location != -1) {
+		glUniform1i(location, value);
+		check_error();
+	}
+}
+
+void set_uniform_1fv(GLuint glsl_program_num, const char *name, const float *values, unsigned num_values)
+{
+	GLint location = glGetUniformLocation(glsl_program_num, name);
+	if (location != -1) {
+		glUniform1fv(location, num_values, values);
+		check_error();
+	}
+}
+
+}  // namespace
+
+MipmapGenerator::MipmapGenerator(ResourcePool *resource_pool)
+	: resource_pool(resource_pool) {}
+
+MipmapGenerator::~MipmapGenerator()
+{
+	for (const auto &key_and_program : programs) {
+		resource_pool->release_glsl_program(key_and_program.second);
+	}
+}
+
+bool MipmapGenerator::supports_format(GLenum internal_format)
+{
+	return image_format_qualifier(internal_format) != nullptr;
+}
+
+unsigned MipmapGenerator::max_mipmap_level(unsigned width, unsigned height)
+{
+	unsigned level = 0;
+	while (width > 1 || height > 1) {
+		width = max(width / 2, 1u);
+		height = max(height / 2, 1u);
+		++level;
+	}
+	return level;
+}
+
+GLuint MipmapGenerator::get_program(MipmapFilter filter, GLenum internal_format)
+{
+	const auto key = make_pair(filter, internal_format);
+	const auto it = programs.find(key);
+	if (it != programs.end()) {
+		return it->second;
+	}
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "#define FILTER_TAPS %u\n#define IMAGE_FORMAT %s\n",
+		num_filter_taps(filter), image_format_qualifier(internal_format));
+	string shader =
+		"#version 150\n"
+		"#extension GL_ARB_compute_shader : enable\n"
+		"#extension GL_ARB_shader_image_load_store : enable\n";
+	shader += buf;
+	shader += read_file("mipmap_generator.comp");
+
+	GLuint glsl_program_num = resource_pool->compile_glsl_compute_program(shader);
+	programs.insert(make_pair(key, glsl_program_num));
+	return glsl_program_num;
+}
+
+void MipmapGenerator::generate(GLuint texture_num, GLenum internal_format,
+                               unsigned width, unsigned height, unsigned max_level,
+                               MipmapFilter filter)
+{
+	assert(filter != MIPMAP_FILTER_DRIVER);
+	assert(supports_format(internal_format));
+	assert(max_level <= max_mipmap_level(width, height));
+
+	// The sampler state needs to be such that textureLod() gives us
+	// bilinear samples from exactly the level we ask for, and the texture
+	// must be complete up to the levels we write.
+	resource_pool->allocate_texture_mipmaps(texture_num);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	check_error();
+	if (max_level == 0) {
+		return;
+	}
+
+	// Compute the filter, and the bilinear pairs for the first level.
+	// Taps 2k and 2k+1 always have the same sign (there is one lobe
+	// for every two taps), so the pairs are well-behaved.
+	const unsigned num_taps = num_filter_taps(filter);
+	float weights[8], pair_offsets[4], pair_weights[4];
+	float sum = 0.0f;
+	for (unsigned i = 0; i < 2 * num_taps; ++i) {
+		weights[i] = filter_weight(filter, float(i) - num_taps + 0.5f);
+		sum += weights[i];
+	}
+	for (unsigned i = 0; i < 2 * num_taps; ++i) {
+		weights[i] /= sum;
+	}
+	for (unsigned i = 0; i < num_taps; ++i) {
+		float w1 = weights[i * 2], w2 = weights[i * 2 + 1];
+		pair_weights[i] = w1 + w2;
+		pair_offsets[i] = float(i * 2) - num_taps + 0.5f + w2 / (w1 + w2);
+	}
+
+	GLuint instance_program_num = resource_pool->use_glsl_program(get_program(filter, internal_format));
+	check_error();
+
+	GLint texture_unit;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &texture_unit);
+	check_error();
+	set_uniform_1i(instance_program_num, "src_tex", texture_unit - GL_TEXTURE0);
+	set_uniform_1fv(instance_program_num, "weights", weights, 2 * num_taps);
+	set_uniform_1fv(instance_program_num, "pair_offsets", pair_offsets, num_taps);
+	set_uniform_1fv(instance_program_num, "pair_weights", pair_weights, num_taps);
+	set_uniform_1i(instance_program_num, "level1_image", 0);
+	set_uniform_1i(instance_program_num, "level2_image", 1);
+	set_uniform_1i(instance_program_num, "level3_image", 2);
+
+	unsigned level_width = width, level_height = height;
+	for (unsigned src_level = 0; src_level < max_level; src_level += max_levels_per_dispatch) {
+		unsigned num_levels = min(max_level - src_level, max_levels_per_dispatch);
+		set_uniform_1i(instance_program_num, "src_level", src_level);
+		set_uniform_1i(instance_program_num, "num_levels", num_levels);
+		GLint src_size_location = glGetUniformLocation(instance_program_num, "src_size");
+		glUniform2i(src_size_location, level_width, level_height);
+		check_error();
+
+		for (unsigned i = 0; i < num_levels; ++i) {
+			glBindImageTexture(i, texture_num, src_level + i + 1, GL_FALSE, 0, GL_WRITE_ONLY, internal_format);
+			check_error();
+		}
+
+		// Each workgroup covers a 16x16 tile of the first level we generate.
+		unsigned width1 = max(level_width / 2, 1u), height1 = max(level_height / 2, 1u);
+		glDispatchCompute((width1 + tile_size - 1) / tile_size, (height1 + tile_size - 1) / tile_size, 1);
+		check_error();
+
+		// The next dispatch (and whoever samples the mipmaps afterwards)
+		// reads the levels we just wrote through the texture unit.
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		check_error();
+
+		for (unsigned i = 0; i < num_levels; ++i) {
+			level_width = max(level_width / 2, 1u);
+			level_height = max(level_height / 2, 1u);
+		}
+	}
+
+	resource_pool->unuse_glsl_program(instance_program_num);
+}
+
+}  // namespace movit
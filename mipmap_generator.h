@@ -0,0 +1,92 @@
+#ifndef _MOVIT_MIPMAP_GENERATOR_H
+#define _MOVIT_MIPMAP_GENERATOR_H 1
+
+// A replacement for glGenerateMipmap() using compute shaders, used by
+// EffectChain for intermediate textures when asked to (see
+// EffectChain::set_mipmap_filter()).
+//
+// glGenerateMipmap() leaves the choice of filter to the driver, which
+// usually means a box filter (and some drivers implement it with a series
+// of draw calls, one per level). We instead generate up to three levels
+// in one compute shader dispatch: Each workgroup reads its part of the
+// source level from the texture, and keeps the intermediate levels in
+// shared memory (with enough of a border around it that the next level
+// can be filtered without looking at other workgroups' results).
+// We also only generate as many levels as we are asked to, so that
+// the typical case of scaling down 2x or 4x does not have to touch
+// the rest of the pyramid; the caller is expected to set GL_TEXTURE_MAX_LEVEL
+// so that the levels that were not generated are never sampled.
+//
+// Each level is exactly half the size of the previous one (rounded down),
+// with the filter centered between two pixels. For odd sizes, this means
+// the last row or column is only partially taken into account, just as
+// with most glGenerateMipmap() implementations.
+//
+// Only formats that can be written as images are supported (see
+// supports_format()), which notably excludes GL_SRGB8_ALPHA8;
+// the caller should fall back to glGenerateMipmap() for those.
+
+#include <epoxy/gl.h>
+#include <map>
+#include <utility>
+
+namespace movit {
+
+class ResourcePool;
+
+enum MipmapFilter {
+	// Use glGenerateMipmap(), ie., whatever the driver gives us.
+	MIPMAP_FILTER_DRIVER,
+
+	// 2x2 box filter. Should be similar to (or the same as)
+	// what most drivers do, but fewer passes.
+	MIPMAP_FILTER_BOX,
+
+	// 4x4 triangle (tent) filter, ie., bilinear interpolation
+	// scaled up by 2x. Somewhat softer than the box filter,
+	// but with markedly less aliasing.
+	MIPMAP_FILTER_BILINEAR,
+
+	// 8x8 Lanczos filter (a=2). Sharper than the two others, with
+	// little aliasing, but it has negative lobes, so it can overshoot
+	// a bit at sharp edges. Also the most expensive, although
+	// still much cheaper than a generic resampler.
+	MIPMAP_FILTER_LANCZOS,
+};
+
+class MipmapGenerator {
+public:
+	MipmapGenerator(ResourcePool *resource_pool);
+	~MipmapGenerator();
+
+	// Whether we can write to textures of the given internal format.
+	static bool supports_format(GLenum internal_format);
+
+	// Generate levels 1 through <max_level> (inclusive) of the given texture,
+	// which must have come from the ResourcePool, be <width> x <height>
+	// pixels at level 0, and be bound to GL_TEXTURE_2D on the active
+	// texture unit. <filter> cannot be MIPMAP_FILTER_DRIVER.
+	// Sets GL_TEXTURE_MAX_LEVEL to <max_level> and the minification filter
+	// to GL_LINEAR_MIPMAP_NEAREST, and changes the current program
+	// and image unit bindings.
+	void generate(GLuint texture_num, GLenum internal_format,
+	              unsigned width, unsigned height, unsigned max_level,
+	              MipmapFilter filter);
+
+	// The highest mipmap level there is for a texture of the given size
+	// (0 for a 1x1 texture).
+	static unsigned max_mipmap_level(unsigned width, unsigned height);
+
+private:
+	// Compiles the program if it does not exist yet.
+	GLuint get_program(MipmapFilter filter, GLenum internal_format);
+
+	ResourcePool *resource_pool;
+
+	// Programs compiled so far, by filter and format.
+	std::map<std::pair<MipmapFilter, GLenum>, GLuint> programs;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_MIPMAP_GENERATOR_H)
@@ -19,6 +19,9 @@ public:
 	bool needs_srgb_primaries() const override { return false; }
 	AlphaHandling alpha_handling() const override { return DONT_CARE_ALPHA_TYPE; }
 	bool one_to_one_sampling() const override { return true; }
+	Region get_needed_input_region(unsigned input_num, const Region &output_region) const override {
+		return Region(1.0f - output_region.x1, output_region.y0, 1.0f - output_region.x0, output_region.y1);
+	}
 };
 
 }  // namespace movit
@@ -1,3 +1,7 @@
+#include <stddef.h>
+#include <algorithm>
+
+#include "cpu_backend.h"
 #include "mix_effect.h"
 #include "util.h"
 
@@ -17,4 +21,22 @@ string MixEffect::output_fragment_shader()
 	return read_file("mix_effect.frag");
 }
 
+void MixEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                 unsigned y0, unsigned y1, float *dst) const
+{
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *first = inputs[0].row(y);
+		const float *second = inputs[1].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			const CPUPixel p =
+				CPUPixel(strength_first) * CPUPixel::load(first + x) +
+				CPUPixel(strength_second) * CPUPixel::load(second + x);
+
+			// See mix_effect.frag for why alpha is clamped.
+			p.with_alpha_from(min(max(p, CPUPixel(0.0f)), CPUPixel(1.0f))).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
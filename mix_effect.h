@@ -20,6 +20,10 @@ public:
 	unsigned num_inputs() const override { return 2; }
 	bool strong_one_to_one_sampling() const override { return true; }
 
+	bool has_cpu_implementation() const override { return true; }
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 	// TODO: In the common case where a+b=1, it would be useful to be able to set
 	// alpha_handling() to INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK. However, right now
 	// we have no way of knowing that at instantiation time.
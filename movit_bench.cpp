@@ -0,0 +1,595 @@
+// A benchmark of complete, realistic effect chains, as opposed to the
+// microbenchmarks of single effects in the unit tests (which are run with
+// e.g. “./resample_effect_test --benchmark”). Each graph is finalized and then
+// rendered a number of times at each of the given resolutions, re-uploading
+// the inputs for every frame as a real video application would.
+//
+// The results are written as JSON to stdout, for easy comparison between
+// versions or machines. For each graph and resolution, they contain:
+//
+//  - finalize_ms: Wall-clock time spent in finalize() (which includes
+//    compiling the shaders, unless they are already in the cache).
+//  - fps: Frames rendered per second, as measured from before the first
+//    frame is submitted until glFinish() returns after the last one.
+//  - cpu_submit_ms_avg, cpu_submit_ms_max: Time spent in render_to_fbo(),
+//    ie., the CPU cost of setting up and submitting each frame.
+//  - peak_texture_bytes: The largest (estimated) amount of texture memory
+//    held by the ResourcePool after any frame, including the inputs and all
+//    intermediate textures, whether in use or on the freelist.
+//
+// The multiviewer graphs are different; they render --chains small chains
+// (each scaling down one of four shared 1080p RGBA sources) into a grid in
+// one output, either by calling render_to_fbo() on each chain in turn
+// (“multiviewer”) or all at once with a ChainBatch (“multiviewer_batch”).
+//
+// Usage: movit_bench [--frames N] [--layers N] [--chains N]
+//                    [--graph broadcast|grading|multiviewer|multiviewer_batch]
+//                    [--resolution 720p|1080p|2160p]
+//
+// --graph and --resolution can be given multiple times; the default is to
+// run all graphs at all resolutions. The OpenGL context is set up the same
+// way as for the unit tests (see test_context.h), so with the EGL harness,
+// no display is needed, and Mesa's llvmpipe works fine.
+
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "chain_batch.h"
+#include "deinterlace_effect.h"
+#include "diffusion_effect.h"
+#include "effect_chain.h"
+#include "flat_input.h"
+#include "glow_effect.h"
+#include "image_format.h"
+#include "init.h"
+#include "lift_gamma_gain_effect.h"
+#include "overlay_effect.h"
+#include "resample_effect.h"
+#include "resource_pool.h"
+#include "saturation_effect.h"
+#include "test_context.h"
+#include "unsharp_mask_effect.h"
+#include "util.h"
+#include "ycbcr.h"
+#include "ycbcr_input.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace movit;
+
+namespace {
+
+struct Resolution {
+	const char *name;
+	unsigned width, height;
+};
+
+const Resolution resolutions[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "2160p", 3840, 2160 },
+};
+
+// The interlaced source material for the broadcast graph;
+// the fields are deinterlaced to a 1080p frame and then scaled.
+const unsigned source_width = 1920, source_field_height = 540;
+
+// The sources for the multiviewer graphs; progressive 1080p.
+const unsigned multiviewer_source_width = 1920, multiviewer_source_height = 1080;
+
+struct BenchResult {
+	string graph;
+	Resolution resolution;
+	unsigned num_layers;
+	unsigned num_chains;
+	size_t num_phases;
+	double finalize_ms;
+	double fps;
+	double cpu_submit_ms_avg, cpu_submit_ms_max;
+	size_t peak_texture_bytes;
+};
+
+// Planar 8-bit Y'CbCr 4:2:0 image data, with some non-constant content
+// so that the driver cannot take any shortcuts.
+struct YCbCrImage {
+	YCbCrImage(unsigned width, unsigned height)
+		: width(width), height(height),
+		  y(width * height), cb(width * height / 4), cr(width * height / 4)
+	{
+		for (unsigned i = 0; i < y.size(); ++i) {
+			y[i] = 16 + (i * 7) % 220;
+		}
+		for (unsigned i = 0; i < cb.size(); ++i) {
+			cb[i] = 16 + (i * 3) % 225;
+			cr[i] = 16 + (i * 5) % 225;
+		}
+	}
+
+	unsigned width, height;
+	vector<unsigned char> y, cb, cr;
+};
+
+YCbCrFormat get_rec709_ycbcr_format(unsigned chroma_subsampling)
+{
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_709;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = chroma_subsampling;
+	ycbcr_format.chroma_subsampling_y = chroma_subsampling;
+	ycbcr_format.cb_x_position = 0.0f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.0f;
+	ycbcr_format.cr_y_position = 0.5f;
+	return ycbcr_format;
+}
+
+ImageFormat get_rec709_image_format()
+{
+	ImageFormat format;
+	format.color_space = COLORSPACE_REC_709;
+	format.gamma_curve = GAMMA_REC_709;
+	return format;
+}
+
+YCbCrInput *add_ycbcr_input(EffectChain *chain, const YCbCrImage &image)
+{
+	YCbCrInput *input = new YCbCrInput(get_rec709_image_format(), get_rec709_ycbcr_format(2), image.width, image.height);
+	chain->add_input(input);
+	return input;
+}
+
+void set_ycbcr_pixel_data(YCbCrInput *input, const YCbCrImage &image)
+{
+	input->set_pixel_data(0, image.y.data());
+	input->set_pixel_data(1, image.cb.data());
+	input->set_pixel_data(2, image.cr.data());
+}
+
+// Everything needed to render one frame of a graph;
+// owned by the caller, since the chain refers to the pixel data.
+struct Graph {
+	EffectChain *chain = nullptr;
+	vector<YCbCrInput *> ycbcr_inputs;
+	vector<const YCbCrImage *> ycbcr_images;
+	vector<FlatInput *> flat_inputs;
+	vector<const unsigned char *> flat_images;
+	DeinterlaceEffect *deinterlace = nullptr;
+
+	// Re-upload all inputs, as if they were new frames.
+	void set_pixel_data(unsigned frame_num)
+	{
+		for (unsigned i = 0; i < ycbcr_inputs.size(); ++i) {
+			set_ycbcr_pixel_data(ycbcr_inputs[i], *ycbcr_images[i]);
+		}
+		for (unsigned i = 0; i < flat_inputs.size(); ++i) {
+			flat_inputs[i]->set_pixel_data(flat_images[i]);
+		}
+		if (deinterlace != nullptr) {
+			CHECK(deinterlace->set_int("current_field_position", frame_num % 2));
+		}
+	}
+};
+
+// Y'CbCr 4:2:0 fields → deinterlace → resample → overlay of <num_layers> graphics
+// layers (in addition to the video) → dithered Y'CbCr output. Typical of a
+// live production switcher.
+void build_broadcast_graph(EffectChain *chain, Graph *graph, unsigned width, unsigned height,
+                           unsigned num_layers,
+                           const YCbCrImage &field,
+                           const vector<unsigned char> &graphics)
+{
+	graph->chain = chain;
+
+	vector<Effect *> fields;
+	for (unsigned i = 0; i < 5; ++i) {
+		YCbCrInput *input = add_ycbcr_input(chain, field);
+		graph->ycbcr_inputs.push_back(input);
+		graph->ycbcr_images.push_back(&field);
+		fields.push_back(input);
+	}
+	graph->deinterlace = new DeinterlaceEffect();
+	Effect *last = chain->add_effect(graph->deinterlace, fields);
+
+	Effect *resample = chain->add_effect(new ResampleEffect(), last);
+	CHECK(resample->set_int("width", width));
+	CHECK(resample->set_int("height", height));
+	last = resample;
+
+	for (unsigned i = 0; i < num_layers; ++i) {
+		ImageFormat format;
+		format.color_space = COLORSPACE_sRGB;
+		format.gamma_curve = GAMMA_sRGB;
+		FlatInput *input = new FlatInput(format, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, GL_UNSIGNED_BYTE, width, height);
+		chain->add_input(input);
+		graph->flat_inputs.push_back(input);
+		graph->flat_images.push_back(graphics.data());
+		last = chain->add_effect(new OverlayEffect(), last, input);
+	}
+
+	chain->add_ycbcr_output(get_rec709_image_format(), OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, get_rec709_ycbcr_format(1));
+	chain->set_dither_bits(8);
+}
+
+// Y'CbCr 4:2:0 input → glow → diffusion → unsharp mask → lift/gamma/gain →
+// dithered 8-bit RGBA output. Typical of a finishing/grading stack.
+void build_grading_graph(EffectChain *chain, Graph *graph, const YCbCrImage &image)
+{
+	graph->chain = chain;
+
+	YCbCrInput *input = add_ycbcr_input(chain, image);
+	graph->ycbcr_inputs.push_back(input);
+	graph->ycbcr_images.push_back(&image);
+
+	chain->add_effect(new GlowEffect());
+	Effect *diffusion = chain->add_effect(new DiffusionEffect());
+	CHECK(diffusion->set_float("radius", 3.0f));
+	CHECK(diffusion->set_float("blurred_mix_amount", 0.3f));
+	Effect *unsharp_mask = chain->add_effect(new UnsharpMaskEffect());
+	CHECK(unsharp_mask->set_float("radius", 2.0f));
+	CHECK(unsharp_mask->set_float("amount", 0.5f));
+	Effect *lift_gamma_gain = chain->add_effect(new LiftGammaGainEffect());
+	const float gain[] = { 1.1f, 1.0f, 0.9f };
+	CHECK(lift_gamma_gain->set_vec3("gain", gain));
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+	chain->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain->set_dither_bits(8);
+}
+
+void create_output_fbo(unsigned width, unsigned height, GLuint *texnum, GLuint *fbo)
+{
+	glGenTextures(1, texnum);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, *texnum);
+	check_error();
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	check_error();
+
+	glGenFramebuffers(1, fbo);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+	check_error();
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texnum, 0);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+}
+
+BenchResult run_graph(const string &graph_name, const Resolution &resolution,
+                      unsigned num_layers, unsigned num_frames)
+{
+	const unsigned width = resolution.width, height = resolution.height;
+
+	// Input data; needs to outlive the chain.
+	YCbCrImage field(source_width, source_field_height);
+	YCbCrImage frame(width, height);
+	vector<unsigned char> graphics(width * height * 4);
+	for (unsigned i = 0; i < graphics.size(); ++i) {
+		graphics[i] = (i * 13) % 256;
+	}
+
+	// Use a pool of our own, so that the memory statistics only
+	// cover this graph, and shaders from earlier runs are not cached.
+	ResourcePool resource_pool;
+	BenchResult result;
+	result.graph = graph_name;
+	result.resolution = resolution;
+	result.num_layers = (graph_name == "broadcast") ? num_layers : 0;
+	result.num_chains = 1;
+	result.peak_texture_bytes = 0;
+
+	{
+		EffectChain chain(width, height, &resource_pool);
+		Graph graph;
+		if (graph_name == "broadcast") {
+			build_broadcast_graph(&chain, &graph, width, height, num_layers, field, graphics);
+		} else {
+			assert(graph_name == "grading");
+			build_grading_graph(&chain, &graph, frame);
+		}
+
+		steady_clock::time_point start = steady_clock::now();
+		chain.finalize();
+		result.finalize_ms = duration<double, milli>(steady_clock::now() - start).count();
+		result.num_phases = chain.get_phase_timing().size();
+
+		GLuint texnum, fbo;
+		create_output_fbo(width, height, &texnum, &fbo);
+
+		// Warm up, so that one-time costs (texture allocation,
+		// lazy driver compilation) do not count.
+		const unsigned num_warmup_frames = 3;
+		for (unsigned i = 0; i < num_warmup_frames; ++i) {
+			graph.set_pixel_data(i);
+			chain.render_to_fbo(fbo, width, height);
+		}
+		glFinish();
+		check_error();
+
+		double total_submit_ms = 0.0;
+		result.cpu_submit_ms_max = 0.0;
+		start = steady_clock::now();
+		for (unsigned i = 0; i < num_frames; ++i) {
+			graph.set_pixel_data(i);
+
+			steady_clock::time_point submit_start = steady_clock::now();
+			chain.render_to_fbo(fbo, width, height);
+			double submit_ms = duration<double, milli>(steady_clock::now() - submit_start).count();
+			total_submit_ms += submit_ms;
+			result.cpu_submit_ms_max = max(result.cpu_submit_ms_max, submit_ms);
+
+			ResourcePoolStatistics stats = resource_pool.get_statistics();
+			result.peak_texture_bytes = max(result.peak_texture_bytes,
+				stats.live_texture_bytes + stats.free_texture_bytes);
+		}
+		glFinish();
+		check_error();
+		double elapsed_s = duration<double>(steady_clock::now() - start).count();
+
+		result.fps = num_frames / elapsed_s;
+		result.cpu_submit_ms_avg = total_submit_ms / num_frames;
+
+		glDeleteFramebuffers(1, &fbo);
+		check_error();
+		glDeleteTextures(1, &texnum);
+		check_error();
+	}
+	return result;
+}
+
+// <num_chains> chains of 1080p RGBA input → resample to a tile → saturation →
+// sRGB output, tiled in a grid over the output. Every chain has its own
+// FlatInput, but they share four sources between them, so a ChainBatch
+// only needs to upload four textures per frame instead of <num_chains>.
+BenchResult run_multiviewer(const string &graph_name, const Resolution &resolution,
+                            unsigned num_chains, unsigned num_frames)
+{
+	const unsigned width = resolution.width, height = resolution.height;
+	const unsigned num_sources = 4;
+	const unsigned grid_size = ceil(sqrt(num_chains));
+	const unsigned tile_width = width / grid_size, tile_height = height / grid_size;
+	const bool batched = (graph_name == "multiviewer_batch");
+
+	vector<vector<unsigned char>> sources(num_sources);
+	for (unsigned i = 0; i < num_sources; ++i) {
+		sources[i].resize(multiviewer_source_width * multiviewer_source_height * 4);
+		for (unsigned j = 0; j < sources[i].size(); ++j) {
+			sources[i][j] = (j * (13 + i * 2)) % 256;
+		}
+	}
+
+	// All the chains share one pool, so that identical phases
+	// get the same shader programs.
+	ResourcePool resource_pool;
+	BenchResult result;
+	result.graph = graph_name;
+	result.resolution = resolution;
+	result.num_layers = 0;
+	result.num_chains = num_chains;
+	result.num_phases = 0;
+	result.peak_texture_bytes = 0;
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	vector<EffectChain *> chains;
+	vector<FlatInput *> inputs;
+	steady_clock::time_point start = steady_clock::now();
+	for (unsigned i = 0; i < num_chains; ++i) {
+		EffectChain *chain = new EffectChain(tile_width, tile_height, &resource_pool);
+		FlatInput *input = new FlatInput(format, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, GL_UNSIGNED_BYTE,
+			multiviewer_source_width, multiviewer_source_height);
+		chain->add_input(input);
+		Effect *resample = chain->add_effect(new ResampleEffect());
+		CHECK(resample->set_int("width", tile_width));
+		CHECK(resample->set_int("height", tile_height));
+		Effect *saturation = chain->add_effect(new SaturationEffect());
+		CHECK(saturation->set_float("saturation", 0.5f + 0.1f * (i % 8)));
+		chain->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+		chain->finalize();
+		result.num_phases += chain->get_phase_timing().size();
+		chains.push_back(chain);
+		inputs.push_back(input);
+	}
+	result.finalize_ms = duration<double, milli>(steady_clock::now() - start).count();
+
+	GLuint texnum, fbo;
+	create_output_fbo(width, height, &texnum, &fbo);
+
+	ChainBatch batch;
+	for (unsigned i = 0; i < num_chains; ++i) {
+		batch.add_chain(chains[i], fbo,
+			(i % grid_size) * tile_width, (i / grid_size) * tile_height,
+			tile_width, tile_height);
+	}
+
+	auto render_frame = [&] {
+		for (unsigned i = 0; i < num_chains; ++i) {
+			inputs[i]->set_pixel_data(sources[i % num_sources].data());
+		}
+		if (batched) {
+			batch.render();
+		} else {
+			for (unsigned i = 0; i < num_chains; ++i) {
+				glViewport((i % grid_size) * tile_width, (i / grid_size) * tile_height,
+					tile_width, tile_height);
+				check_error();
+				chains[i]->render_to_fbo(fbo, 0, 0);
+			}
+		}
+	};
+
+	const unsigned num_warmup_frames = 3;
+	for (unsigned i = 0; i < num_warmup_frames; ++i) {
+		render_frame();
+	}
+	glFinish();
+	check_error();
+
+	double total_submit_ms = 0.0;
+	result.cpu_submit_ms_max = 0.0;
+	start = steady_clock::now();
+	for (unsigned i = 0; i < num_frames; ++i) {
+		steady_clock::time_point submit_start = steady_clock::now();
+		render_frame();
+		double submit_ms = duration<double, milli>(steady_clock::now() - submit_start).count();
+		total_submit_ms += submit_ms;
+		result.cpu_submit_ms_max = max(result.cpu_submit_ms_max, submit_ms);
+
+		ResourcePoolStatistics stats = resource_pool.get_statistics();
+		result.peak_texture_bytes = max(result.peak_texture_bytes,
+			stats.live_texture_bytes + stats.free_texture_bytes);
+	}
+	glFinish();
+	check_error();
+	double elapsed_s = duration<double>(steady_clock::now() - start).count();
+
+	result.fps = num_frames / elapsed_s;
+	result.cpu_submit_ms_avg = total_submit_ms / num_frames;
+
+	glDeleteFramebuffers(1, &fbo);
+	check_error();
+	glDeleteTextures(1, &texnum);
+	check_error();
+	for (EffectChain *chain : chains) {
+		delete chain;
+	}
+	return result;
+}
+
+string json_string(const char *str)
+{
+	string ret = "\"";
+	for (const char *ptr = str; *ptr != '\0'; ++ptr) {
+		if (*ptr == '"' || *ptr == '\\') {
+			ret += '\\';
+		}
+		if ((unsigned char)*ptr >= 0x20) {
+			ret += *ptr;
+		}
+	}
+	ret += "\"";
+	return ret;
+}
+
+void print_results(const vector<BenchResult> &results, unsigned num_frames)
+{
+	printf("{\n");
+	printf("  \"gl_vendor\": %s,\n", json_string((const char *)glGetString(GL_VENDOR)).c_str());
+	printf("  \"gl_renderer\": %s,\n", json_string((const char *)glGetString(GL_RENDERER)).c_str());
+	printf("  \"gl_version\": %s,\n", json_string((const char *)glGetString(GL_VERSION)).c_str());
+	printf("  \"compute_shaders_supported\": %s,\n", movit_compute_shaders_supported ? "true" : "false");
+	printf("  \"frames\": %u,\n", num_frames);
+	printf("  \"results\": [\n");
+	for (unsigned i = 0; i < results.size(); ++i) {
+		const BenchResult &result = results[i];
+		printf("    {\n");
+		printf("      \"graph\": \"%s\",\n", result.graph.c_str());
+		printf("      \"resolution\": \"%s\",\n", result.resolution.name);
+		printf("      \"width\": %u,\n", result.resolution.width);
+		printf("      \"height\": %u,\n", result.resolution.height);
+		printf("      \"layers\": %u,\n", result.num_layers);
+		printf("      \"chains\": %u,\n", result.num_chains);
+		printf("      \"phases\": %zu,\n", result.num_phases);
+		printf("      \"finalize_ms\": %.3f,\n", result.finalize_ms);
+		printf("      \"fps\": %.3f,\n", result.fps);
+		printf("      \"cpu_submit_ms_avg\": %.3f,\n", result.cpu_submit_ms_avg);
+		printf("      \"cpu_submit_ms_max\": %.3f,\n", result.cpu_submit_ms_max);
+		printf("      \"peak_texture_bytes\": %zu\n", result.peak_texture_bytes);
+		printf("    }%s\n", (i == results.size() - 1) ? "" : ",");
+	}
+	printf("  ]\n");
+	printf("}\n");
+}
+
+void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [--frames N] [--layers N] [--chains N]\n", argv0);
+	fprintf(stderr, "          [--graph broadcast|grading|multiviewer|multiviewer_batch]\n");
+	fprintf(stderr, "          [--resolution 720p|1080p|2160p]\n");
+	exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+	unsigned num_frames = 100, num_layers = 4, num_chains = 16;
+	vector<string> graphs;
+	vector<Resolution> selected_resolutions;
+	for (int i = 1; i < argc; ++i) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (strcmp(argv[i], "--frames") == 0) {
+			num_frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--layers") == 0) {
+			num_layers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--chains") == 0) {
+			num_chains = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--graph") == 0) {
+			graphs.push_back(argv[++i]);
+			if (graphs.back() != "broadcast" && graphs.back() != "grading" &&
+			    graphs.back() != "multiviewer" && graphs.back() != "multiviewer_batch") {
+				usage(argv[0]);
+			}
+		} else if (strcmp(argv[i], "--resolution") == 0) {
+			const char *name = argv[++i];
+			bool found = false;
+			for (const Resolution &resolution : resolutions) {
+				if (strcmp(resolution.name, name) == 0) {
+					selected_resolutions.push_back(resolution);
+					found = true;
+				}
+			}
+			if (!found) {
+				usage(argv[0]);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (num_frames == 0 || num_chains == 0) {
+		usage(argv[0]);
+	}
+	if (graphs.empty()) {
+		graphs = { "broadcast", "grading", "multiviewer", "multiviewer_batch" };
+	}
+	if (selected_resolutions.empty()) {
+		selected_resolutions.assign(begin(resolutions), end(resolutions));
+	}
+
+	create_test_context();
+	CHECK(init_movit(".", MOVIT_DEBUG_OFF));
+
+	vector<BenchResult> results;
+	for (const string &graph : graphs) {
+		for (const Resolution &resolution : selected_resolutions) {
+			fprintf(stderr, "Running %s at %s...\n", graph.c_str(), resolution.name);
+			if (graph == "multiviewer" || graph == "multiviewer_batch") {
+				results.push_back(run_multiviewer(graph, resolution, num_chains, num_frames));
+			} else {
+				results.push_back(run_graph(graph, resolution, num_layers, num_frames));
+			}
+		}
+	}
+	print_results(results, num_frames);
+
+	destroy_test_context();
+	return 0;
+}
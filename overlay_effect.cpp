@@ -1,3 +1,6 @@
+#include <stddef.h>
+
+#include "cpu_backend.h"
 #include "overlay_effect.h"
 #include "util.h"
 
@@ -18,4 +21,21 @@ string OverlayEffect::output_fragment_shader()
 	return buf + read_file("overlay_effect.frag");
 }
 
+void OverlayEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                     unsigned y0, unsigned y1, float *dst) const
+{
+	const CPUImage &bottom = swap_inputs ? inputs[1] : inputs[0];
+	const CPUImage &top = swap_inputs ? inputs[0] : inputs[1];
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *b = bottom.row(y);
+		const float *t = top.row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			const CPUPixel top_pixel = CPUPixel::load(t + x);
+			const CPUPixel inv_alpha = CPUPixel(1.0f) - top_pixel.broadcast<3>();
+			(top_pixel + inv_alpha * CPUPixel::load(b + x)).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
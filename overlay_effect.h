@@ -33,6 +33,10 @@ public:
 	// to EffectChain, so postpone that optimization for later.
 	AlphaHandling alpha_handling() const override { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
 
+	bool has_cpu_implementation() const override { return true; }
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 private:
 	// If true, overlays input1 on top of input2 instead of vice versa.
 	// Must be set before finalize.
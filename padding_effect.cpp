@@ -1,6 +1,9 @@
 #include <epoxy/gl.h>
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
 
+#include "cpu_backend.h"
 #include "effect_util.h"
 #include "padding_effect.h"
 #include "util.h"
@@ -44,7 +47,11 @@ string PaddingEffect::output_fragment_shader()
 void PaddingEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
 	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	compute_uniforms();
+}
 
+void PaddingEffect::compute_uniforms()
+{
 	uniform_offset[0] = left / output_width;
 	uniform_offset[1] = (output_height - input_height - top) / output_height;
 
@@ -63,6 +70,57 @@ void PaddingEffect::set_gl_state(GLuint glsl_program_num, const string &prefix,
 	uniform_offset_topright[0] = input_width + 0.5f + border_offset_right;
 	uniform_offset_topright[1] = input_height + 0.5f - border_offset_top;
 }
+
+void PaddingEffect::set_cpu_state()
+{
+	compute_uniforms();
+}
+
+void PaddingEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                    unsigned y0, unsigned y1, float *dst) const
+{
+	const CPUPixel border(border_color.r, border_color.g, border_color.b, border_color.a);
+	for (unsigned y = y0; y < y1; ++y) {
+		float *out = dst + size_t(y - y0) * width * 4;
+
+		// Same as padding_effect.frag; y is the same for the entire row.
+		const float tc_y = ((y + 0.5f) / height - uniform_offset[1]) * uniform_scale[1];
+		const float tc_texels_y = tc_y * uniform_normalized_coords_to_texels[1];
+		const float coverage_y =
+			min(max(tc_texels_y + uniform_offset_bottomleft[1], 0.0f), 1.0f) *
+			min(max(uniform_offset_topright[1] - tc_texels_y, 0.0f), 1.0f);
+
+		for (unsigned x = 0; x < width; ++x) {
+			const float tc_x = ((x + 0.5f) / width - uniform_offset[0]) * uniform_scale[0];
+			const float tc_texels_x = tc_x * uniform_normalized_coords_to_texels[0];
+			const float coverage_x =
+				min(max(tc_texels_x + uniform_offset_bottomleft[0], 0.0f), 1.0f) *
+				min(max(uniform_offset_topright[0] - tc_texels_x, 0.0f), 1.0f);
+			const float coverage = coverage_x * coverage_y;
+
+			float *pixel = out + x * 4;
+			if (coverage <= 0.0f) {
+				border.store(pixel);
+			} else {
+				inputs[0].sample_bilinear(tc_x, tc_y, pixel);
+				(border + (CPUPixel::load(pixel) - border) * CPUPixel(coverage)).store(pixel);
+			}
+		}
+	}
+}
+
+Region PaddingEffect::get_needed_input_region(unsigned input_num, const Region &output_region) const
+{
+	// Same transformation as in the shader.
+	const float offset_x = left / output_width;
+	const float offset_y = (output_height - input_height - top) / output_height;
+	const float scale_x = float(output_width) / input_width;
+	const float scale_y = float(output_height) / input_height;
+	return Region((output_region.x0 - offset_x) * scale_x,
+	              (output_region.y0 - offset_y) * scale_y,
+	              (output_region.x1 - offset_x) * scale_x,
+	              (output_region.y1 - offset_y) * scale_y);
+}
 	
 // We don't change the pixels of the image itself, so the only thing that 
 // can make us less flexible is if the border color can be interpreted
@@ -48,8 +48,17 @@ public:
 	bool sets_virtual_output_size() const override { return false; }
 	void get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const override;
 	void inform_input_size(unsigned input_num, unsigned width, unsigned height) override;
+	Region get_needed_input_region(unsigned input_num, const Region &output_region) const override;
+
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
 
 private:
+	// Computes the uniforms below from the parameters and the input size.
+	void compute_uniforms();
+
 	RGBATuple border_color;
 	int input_width, input_height;
 	int output_width, output_height;
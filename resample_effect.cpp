@@ -8,12 +8,14 @@
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <algorithm>
 #include <mutex>
 #include <Eigen/Sparse>
 #include <Eigen/SparseQR>
 #include <Eigen/OrderingMethods>
 
+#include "cpu_backend.h"
 #include "effect_chain.h"
 #include "effect_util.h"
 #include "fp16.h"
@@ -677,6 +679,39 @@ ScalingWeights calculate_bilinear_scaling_weights(unsigned src_size, unsigned ds
 	return ret;
 }
 
+Region SingleResamplePassEffect::get_needed_input_region(unsigned input_num, const Region &output_region) const
+{
+	// With zoom or offset, the mapping between input and output is no longer
+	// trivial, so just ask for the entire line.
+	const bool horizontal = (direction == HORIZONTAL);
+	Region region = output_region;
+	if (fabs(zoom - 1.0f) > 1e-6 || fabs(offset) > 1e-6) {
+		if (horizontal) {
+			region.x0 = 0.0f;
+			region.x1 = 1.0f;
+		} else {
+			region.y0 = 0.0f;
+			region.y1 = 1.0f;
+		}
+		return region;
+	}
+
+	// Otherwise, the same area is sampled, plus the kernel radius
+	// (see calculate_scaling_weights()).
+	const int src_size = horizontal ? input_width : input_height;
+	const int dst_size = horizontal ? output_width : output_height;
+	const float radius_scaling_factor = min(float(dst_size) / float(src_size), 1.0f);
+	const float margin = (lrintf(LANCZOS_RADIUS / radius_scaling_factor) + 1) / float(src_size);
+	if (horizontal) {
+		region.x0 -= margin;
+		region.x1 += margin;
+	} else {
+		region.y0 -= margin;
+		region.y1 += margin;
+	}
+	return region;
+}
+
 void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
 {
 	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
@@ -723,28 +758,128 @@ void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const strin
 	}
 }
 
+void SingleResamplePassEffect::set_cpu_state()
+{
+	assert(input_width > 0);
+	assert(input_height > 0);
+	assert(output_width > 0);
+	assert(output_height > 0);
+
+	// A chain only ever uses one backend, so we can share the change
+	// tracking with set_gl_state().
+	if (input_width == last_input_width &&
+	    input_height == last_input_height &&
+	    output_width == last_output_width &&
+	    output_height == last_output_height &&
+	    offset == last_offset &&
+	    zoom == last_zoom) {
+		return;
+	}
+	last_input_width = input_width;
+	last_input_height = input_height;
+	last_output_width = output_width;
+	last_output_height = output_height;
+	last_offset = offset;
+	last_zoom = zoom;
+
+	int src_size, dst_size;
+	if (direction == SingleResamplePassEffect::HORIZONTAL) {
+		assert(input_height == output_height);
+		src_size = input_width;
+		dst_size = output_width;
+	} else if (direction == SingleResamplePassEffect::VERTICAL) {
+		assert(input_width == output_width);
+		src_size = input_height;
+		dst_size = output_height;
+	} else {
+		assert(false);
+	}
+
+	// Unroll the loops and the whole-pixel offset the same way
+	// resample_effect.frag does, and clamp like the texture sampler would.
+	// The weights need to be normalized, like combine_many_samples() does.
+	ScalingWeights weights = calculate_scaling_weights(src_size, dst_size, zoom, offset);
+	Tap<float> *taps = weights.bilinear_weights_fp32.get();
+	const int src_samples = weights.src_bilinear_samples;
+	for (unsigned y = 0; y < weights.dst_samples; ++y) {
+		normalize_sum(taps + y * src_samples, src_samples);
+	}
+	const int slice_size = src_size / weights.num_loops;
+	const int whole_pixel_offset = lrintf(offset);
+	cpu_num_taps = src_samples;
+	cpu_tap_indexes.resize(dst_size * src_samples);
+	cpu_tap_weights.resize(dst_size * src_samples);
+	for (int x = 0; x < dst_size; ++x) {
+		const int slice = x / weights.dst_samples;
+		const Tap<float> *tap = taps + (x % weights.dst_samples) * src_samples;
+		for (int i = 0; i < src_samples; ++i) {
+			const int src_x = lrintf(tap[i].pos * src_size - 0.5f) + slice * slice_size + whole_pixel_offset;
+			cpu_tap_indexes[x * src_samples + i] = min(max(src_x, 0), src_size - 1);
+			cpu_tap_weights[x * src_samples + i] = tap[i].weight;
+		}
+	}
+}
+
+void SingleResamplePassEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                               unsigned y0, unsigned y1, float *dst) const
+{
+	const CPUImage &input = inputs[0];
+	if (direction == SingleResamplePassEffect::VERTICAL) {
+		// Add together entire rows, which is nice and sequential.
+		for (unsigned y = y0; y < y1; ++y) {
+			float *out = dst + size_t(y - y0) * width * 4;
+			fill(out, out + width * 4, 0.0f);
+			for (int i = 0; i < cpu_num_taps; ++i) {
+				const float weight = cpu_tap_weights[y * cpu_num_taps + i];
+				const float *in = input.row(cpu_tap_indexes[y * cpu_num_taps + i]);
+				for (unsigned x = 0; x < width * 4; ++x) {
+					out[x] += weight * in[x];
+				}
+			}
+		}
+	} else {
+		for (unsigned y = y0; y < y1; ++y) {
+			const float *in = input.row(y);
+			float *out = dst + size_t(y - y0) * width * 4;
+			for (unsigned x = 0; x < width; ++x) {
+				const int *indexes = &cpu_tap_indexes[x * cpu_num_taps];
+				const float *weights = &cpu_tap_weights[x * cpu_num_taps];
+				CPUPixel sum(0.0f);
+				for (int i = 0; i < cpu_num_taps; ++i) {
+					sum = sum + CPUPixel(weights[i]) * CPUPixel::load(in + indexes[i] * 4);
+				}
+				sum.store(out + x * 4);
+			}
+		}
+	}
+}
+
 Support2DTexture::Support2DTexture()
 {
-	glGenTextures(1, &texnum);
-	check_error();
-	glBindTexture(GL_TEXTURE_2D, texnum);
-	check_error();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	check_error();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	check_error();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	check_error();
 }
 
 Support2DTexture::~Support2DTexture()
 {
-	glDeleteTextures(1, &texnum);
-	check_error();
+	if (texnum != 0) {
+		glDeleteTextures(1, &texnum);
+		check_error();
+	}
 }
 
 void Support2DTexture::update(GLint width, GLint height, GLenum internal_format, GLenum format, GLenum type, const GLvoid * data)
 {
+	if (texnum == 0) {
+		glGenTextures(1, &texnum);
+		check_error();
+		glBindTexture(GL_TEXTURE_2D, texnum);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		check_error();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		check_error();
+	}
 	glBindTexture(GL_TEXTURE_2D, texnum);
 	check_error();
 	if (width == last_texture_width &&
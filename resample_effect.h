@@ -20,6 +20,7 @@
 #include <stddef.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "effect.h"
 #include "fp16.h"
@@ -48,7 +49,9 @@ ScalingWeights calculate_bilinear_scaling_weights(unsigned src_size, unsigned ds
 
 // A simple manager for support data stored in a 2D texture.
 // Consider moving it to a shared location of more classes
-// should need similar functionality.
+// should need similar functionality. The texture is created
+// on the first update(), so that effects that are never rendered
+// through OpenGL (see EffectChain::set_backend()) do not need a context.
 class Support2DTexture {
 public:
 	Support2DTexture();
@@ -130,7 +133,14 @@ public:
 		*virtual_height = *height = this->output_height;
 	}
 
+	Region get_needed_input_region(unsigned input_num, const Region &output_region) const override;
+
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
+
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
 	
 	enum Direction { HORIZONTAL = 0, VERTICAL = 1 };
 
@@ -152,6 +162,14 @@ private:
 	int src_bilinear_samples, num_loops;
 	float slice_height;
 	Support2DTexture tex;
+
+	// For the CPU backend: For each output pixel along the direction
+	// of the pass, <cpu_num_taps> input pixel indexes (already clamped
+	// to the edge) and the weights to give them. Unlike the texture,
+	// these are not combined to make use of bilinear filtering.
+	int cpu_num_taps;
+	std::vector<int> cpu_tap_indexes;
+	std::vector<float> cpu_tap_weights;
 };
 
 }  // namespace movit
@@ -3,13 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <chrono>
 #include <map>
+#include <set>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <epoxy/gl.h>
 
 #include "init.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -41,7 +45,7 @@ ResourcePool::~ResourcePool()
 
 	for (GLuint free_texture_num : texture_freelist) {
 		assert(texture_formats.count(free_texture_num) != 0);
-		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num]);
+		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num], /*include_mipmaps=*/false);
 		glDeleteSync(texture_formats[free_texture_num].no_reuse_before);
 		texture_formats.erase(free_texture_num);
 		glDeleteTextures(1, &free_texture_num);
@@ -50,6 +54,13 @@ ResourcePool::~ResourcePool()
 	assert(texture_formats.empty());
 	assert(texture_freelist_bytes == 0);
 
+	for (GLuint free_texture_num : shared_texture_freelist) {
+		shared_textures.erase(free_texture_num);
+		glDeleteTextures(1, &free_texture_num);
+		check_error();
+	}
+	assert(shared_textures.empty());
+
 	void *context = get_gl_context_identifier();
 	cleanup_unlinked_fbos(context);
 
@@ -139,10 +150,16 @@ GLuint ResourcePool::compile_glsl_program(const string& vertex_shader,
 	const pair<string, string> key(vertex_shader, fragment_shader_processed);
 	if (programs.count(key)) {
 		// Already in the cache.
+		if (tracing_enabled()) {
+			trace_instant("resource_pool", "program cache hit");
+		}
+		++program_cache_hits;
 		glsl_program_num = programs[key];
 		increment_program_refcount(glsl_program_num);
 	} else {
 		// Not in the cache. Compile the shaders.
+		TraceScope trace_scope("resource_pool", "program cache miss (compile)");
+		++program_cache_misses;
 		GLuint vs_obj = compile_shader(vertex_shader, GL_VERTEX_SHADER);
 		check_error();
 		GLuint fs_obj = compile_shader(fragment_shader_processed, GL_FRAGMENT_SHADER);
@@ -212,6 +229,7 @@ void ResourcePool::release_glsl_program(GLuint glsl_program_num)
 		if (program_freelist.size() > program_freelist_max_length) {
 			delete_program(program_freelist.back());
 			program_freelist.pop_back();
+			++program_evictions;
 		}
 	}
 
@@ -226,10 +244,16 @@ GLuint ResourcePool::compile_glsl_compute_program(const string& compute_shader)
 	const string &key = compute_shader;
 	if (compute_programs.count(key)) {
 		// Already in the cache.
+		if (tracing_enabled()) {
+			trace_instant("resource_pool", "compute program cache hit");
+		}
+		++program_cache_hits;
 		glsl_program_num = compute_programs[key];
 		increment_program_refcount(glsl_program_num);
 	} else {
 		// Not in the cache. Compile the shader.
+		TraceScope trace_scope("resource_pool", "compute program cache miss (compile)");
+		++program_cache_misses;
 		GLuint cs_obj = compile_shader(compute_shader, GL_COMPUTE_SHADER);
 		check_error();
 		glsl_program_num = link_compute_program(cs_obj);
@@ -282,6 +306,8 @@ GLuint ResourcePool::use_glsl_program(GLuint glsl_program_num)
 	} else {
 		// We need to clone this program. (unuse_glsl_program()
 		// will later put it onto the list.)
+		TraceScope trace_scope("resource_pool", "clone program");
+		++program_clones;
 		map<GLuint, ShaderSpec>::iterator shader_it =
 			program_shaders.find(glsl_program_num);
 		if (shader_it == program_shaders.end()) {
@@ -320,35 +346,10 @@ void ResourcePool::unuse_glsl_program(GLuint instance_program_num)
 	pthread_mutex_unlock(&lock);
 }
 
-GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLsizei height)
+void ResourcePool::get_format_and_type(GLint internal_format, GLenum *format, GLenum *type)
 {
-	assert(width > 0);
-	assert(height > 0);
-
-	pthread_mutex_lock(&lock);
-	// See if there's a texture on the freelist we can use.
-	for (auto freelist_it = texture_freelist.begin();
-	     freelist_it != texture_freelist.end();
-	     ++freelist_it) {
-		GLuint texture_num = *freelist_it;
-		map<GLuint, Texture2D>::const_iterator format_it = texture_formats.find(texture_num);
-		assert(format_it != texture_formats.end());
-		if (format_it->second.internal_format == internal_format &&
-		    format_it->second.width == width &&
-		    format_it->second.height == height) {
-			texture_freelist_bytes -= estimate_texture_size(format_it->second);
-			texture_freelist.erase(freelist_it);
-			GLsync sync = format_it->second.no_reuse_before;
-			pthread_mutex_unlock(&lock);
-			glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
-			glDeleteSync(sync);
-			return texture_num;
-		}
-	}
-
 	// Find any reasonable format given the internal format; OpenGL validates it
 	// even though we give nullptr as pointer.
-	GLenum format;
 	switch (internal_format) {
 	case GL_RGBA32F_ARB:
 	case GL_RGBA16F_ARB:
@@ -356,7 +357,7 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RGBA8:
 	case GL_RGB10_A2:
 	case GL_SRGB8_ALPHA8:
-		format = GL_RGBA;
+		*format = GL_RGBA;
 		break;
 	case GL_RGB32F:
 	case GL_RGB16F:
@@ -367,19 +368,19 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_SRGB8:
 	case GL_RGB565:
 	case GL_RGB9_E5:
-		format = GL_RGB;
+		*format = GL_RGB;
 		break;
 	case GL_RG32F:
 	case GL_RG16F:
 	case GL_RG16:
 	case GL_RG8:
-		format = GL_RG;
+		*format = GL_RG;
 		break;
 	case GL_R32F:
 	case GL_R16F:
 	case GL_R16:
 	case GL_R8:
-		format = GL_RED;
+		*format = GL_RED;
 		break;
 	default:
 		// TODO: Add more here as needed.
@@ -387,7 +388,6 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	}
 
 	// Same with type; GLES is stricter than desktop OpenGL here.
-	GLenum type;
 	switch (internal_format) {
 	case GL_RGBA32F_ARB:
 	case GL_RGBA16F_ARB:
@@ -399,13 +399,13 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RG16F:
 	case GL_R32F:
 	case GL_R16F:
-		type = GL_FLOAT;
+		*type = GL_FLOAT;
 		break;
 	case GL_RGBA16:
 	case GL_RGB16:
 	case GL_RG16:
 	case GL_R16:
-		type = GL_UNSIGNED_SHORT;
+		*type = GL_UNSIGNED_SHORT;
 		break;
 	case GL_SRGB8_ALPHA8:
 	case GL_SRGB8:
@@ -415,17 +415,74 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RGB10:
 	case GL_RG8:
 	case GL_R8:
-		type = GL_UNSIGNED_BYTE;
+		*type = GL_UNSIGNED_BYTE;
 		break;
 	case GL_RGB565:
-		type = GL_UNSIGNED_SHORT_5_6_5;
+		*type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
 	default:
 		// TODO: Add more here as needed.
 		assert(false);
 	}
+}
 
+GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLsizei height)
+{
+	assert(width > 0);
+	assert(height > 0);
 
+	pthread_mutex_lock(&lock);
+	// See if there's a texture on the freelist we can use.
+	for (auto freelist_it = texture_freelist.begin();
+	     freelist_it != texture_freelist.end();
+	     ++freelist_it) {
+		GLuint texture_num = *freelist_it;
+		map<GLuint, Texture2D>::const_iterator format_it = texture_formats.find(texture_num);
+		assert(format_it != texture_formats.end());
+		if (format_it->second.internal_format == internal_format &&
+		    format_it->second.width == width &&
+		    format_it->second.height == height) {
+			texture_freelist_bytes -= estimate_texture_size(format_it->second, /*include_mipmaps=*/false);
+			texture_freelist.erase(freelist_it);
+			++texture_freelist_hits;
+			GLsync sync = format_it->second.no_reuse_before;
+			pthread_mutex_unlock(&lock);
+			if (tracing_enabled()) {
+				trace_instant("resource_pool", "texture freelist hit");
+			}
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			{
+				// glWaitSync() only makes the GPU wait, so this measures
+				// the call, not the stall.
+				TraceScope trace_scope("resource_pool", "enqueue glWaitSync");
+				glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
+			}
+			glDeleteSync(sync);
+			uint64_t elapsed_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+			// The previous user may have clamped the mipmap levels
+			// (e.g. MipmapGenerator does); set it back to the default,
+			// so that glGenerateMipmap() and sampling see all levels.
+			glBindTexture(GL_TEXTURE_2D, texture_num);
+			check_error();
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+			check_error();
+			glBindTexture(GL_TEXTURE_2D, 0);
+			check_error();
+
+			pthread_mutex_lock(&lock);
+			++num_sync_waits;
+			sync_wait_ns += elapsed_ns;
+			pthread_mutex_unlock(&lock);
+			return texture_num;
+		}
+	}
+
+	GLenum format, type;
+	get_format_and_type(internal_format, &format, &type);
+
+	TraceScope trace_scope("resource_pool", "texture freelist miss (allocate)");
+	++texture_freelist_misses;
 	GLuint texture_num;
 	glGenTextures(1, &texture_num);
 	check_error();
@@ -452,18 +509,19 @@ void ResourcePool::release_2d_texture(GLuint texture_num)
 	pthread_mutex_lock(&lock);
 	texture_freelist.push_front(texture_num);
 	assert(texture_formats.count(texture_num) != 0);
-	texture_freelist_bytes += estimate_texture_size(texture_formats[texture_num]);
+	texture_freelist_bytes += estimate_texture_size(texture_formats[texture_num], /*include_mipmaps=*/false);
 	texture_formats[texture_num].no_reuse_before = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
 	while (texture_freelist_bytes > texture_freelist_max_bytes) {
 		GLuint free_texture_num = texture_freelist.back();
 		texture_freelist.pop_back();
 		assert(texture_formats.count(free_texture_num) != 0);
-		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num]);
+		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num], /*include_mipmaps=*/false);
 		glDeleteSync(texture_formats[free_texture_num].no_reuse_before);
 		texture_formats.erase(free_texture_num);
 		glDeleteTextures(1, &free_texture_num);
 		check_error();
+		++texture_freelist_evictions;
 
 		// Unlink any lingering FBO related to this texture. We might
 		// not be in the right context, so don't delete it right away;
@@ -480,6 +538,71 @@ void ResourcePool::release_2d_texture(GLuint texture_num)
 	pthread_mutex_unlock(&lock);
 }
 
+GLuint ResourcePool::get_shared_texture(const string &key)
+{
+	pthread_mutex_lock(&lock);
+	auto key_it = shared_texture_by_key.find(key);
+	if (key_it == shared_texture_by_key.end()) {
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	GLuint texture_num = key_it->second;
+	SharedTexture &shared_texture = shared_textures[texture_num];
+	if (shared_texture.refcount++ == 0) {
+		shared_texture_freelist.remove(texture_num);
+	}
+	pthread_mutex_unlock(&lock);
+	return texture_num;
+}
+
+GLuint ResourcePool::add_shared_texture(const string &key, GLuint texture_num)
+{
+	pthread_mutex_lock(&lock);
+	auto key_it = shared_texture_by_key.find(key);
+	if (key_it != shared_texture_by_key.end()) {
+		// Someone else made the same texture in the meantime;
+		// use theirs instead.
+		GLuint existing_texture_num = key_it->second;
+		SharedTexture &shared_texture = shared_textures[existing_texture_num];
+		if (shared_texture.refcount++ == 0) {
+			shared_texture_freelist.remove(existing_texture_num);
+		}
+		pthread_mutex_unlock(&lock);
+		glDeleteTextures(1, &texture_num);
+		check_error();
+		return existing_texture_num;
+	}
+
+	assert(shared_textures.count(texture_num) == 0);
+	shared_texture_by_key.insert(make_pair(key, texture_num));
+	shared_textures.insert(make_pair(texture_num, SharedTexture{ key, 1 }));
+	pthread_mutex_unlock(&lock);
+	return texture_num;
+}
+
+void ResourcePool::release_shared_texture(GLuint texture_num)
+{
+	pthread_mutex_lock(&lock);
+	auto texture_it = shared_textures.find(texture_num);
+	assert(texture_it != shared_textures.end());
+	assert(texture_it->second.refcount > 0);
+	if (--texture_it->second.refcount == 0) {
+		shared_texture_freelist.push_front(texture_num);
+	}
+
+	while (shared_texture_freelist.size() > shared_texture_freelist_max_length) {
+		GLuint free_texture_num = shared_texture_freelist.back();
+		shared_texture_freelist.pop_back();
+		auto free_it = shared_textures.find(free_texture_num);
+		assert(free_it != shared_textures.end());
+		shared_texture_by_key.erase(free_it->second.key);
+		shared_textures.erase(free_it);
+		glDeleteTextures(1, &free_texture_num);
+		check_error();
+	}
+	pthread_mutex_unlock(&lock);
+}
+
 GLuint ResourcePool::create_fbo(GLuint texture0_num, GLuint texture1_num, GLuint texture2_num, GLuint texture3_num)
 {
 	void *context = get_gl_context_identifier();
@@ -737,11 +860,11 @@ void ResourcePool::add_master_program(GLuint program_num)
 	program_masters.insert(make_pair(program_num, program_num));
 }
 
-size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
+size_t ResourcePool::estimate_bytes_per_pixel(GLint internal_format)
 {
 	size_t bytes_per_pixel;
 
-	switch (texture_format.internal_format) {
+	switch (internal_format) {
 	case GL_RGBA32F_ARB:
 		bytes_per_pixel = 16;
 		break;
@@ -808,7 +931,157 @@ size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
 		assert(false);
 	}
 
-	return texture_format.width * texture_format.height * bytes_per_pixel;
+	return bytes_per_pixel;
+}
+
+size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format, bool include_mipmaps)
+{
+	size_t num_pixels = size_t(texture_format.width) * texture_format.height;
+	if (include_mipmaps && texture_format.has_mipmaps) {
+		size_t width = texture_format.width, height = texture_format.height;
+		while (width > 1 || height > 1) {
+			width = max<size_t>(width / 2, 1);
+			height = max<size_t>(height / 2, 1);
+			num_pixels += width * height;
+		}
+	}
+	return num_pixels * estimate_bytes_per_pixel(texture_format.internal_format);
+}
+
+void ResourcePool::mark_texture_mipmapped(GLuint texture_num)
+{
+	pthread_mutex_lock(&lock);
+	auto format_it = texture_formats.find(texture_num);
+	assert(format_it != texture_formats.end());
+	format_it->second.has_mipmaps = true;
+	pthread_mutex_unlock(&lock);
+}
+
+void ResourcePool::allocate_texture_mipmaps(GLuint texture_num)
+{
+	pthread_mutex_lock(&lock);
+	auto format_it = texture_formats.find(texture_num);
+	assert(format_it != texture_formats.end());
+	if (format_it->second.has_mipmaps) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	Texture2D texture_format = format_it->second;
+	format_it->second.has_mipmaps = true;
+	pthread_mutex_unlock(&lock);
+
+	GLenum format, type;
+	get_format_and_type(texture_format.internal_format, &format, &type);
+
+	GLsizei width = texture_format.width, height = texture_format.height;
+	for (GLint level = 1; width > 1 || height > 1; ++level) {
+		width = max(width / 2, 1);
+		height = max(height / 2, 1);
+		glTexImage2D(GL_TEXTURE_2D, level, texture_format.internal_format, width, height, 0, format, type, nullptr);
+		check_error();
+	}
+}
+
+ResourcePoolStatistics ResourcePool::get_statistics()
+{
+	ResourcePoolStatistics stats;
+
+	pthread_mutex_lock(&lock);
+
+	// Textures.
+	set<GLuint> free_textures(texture_freelist.begin(), texture_freelist.end());
+	map<tuple<GLint, GLsizei, GLsizei>, ResourcePoolStatistics::TextureClass> texture_classes;
+	for (const auto &texture_num_and_format : texture_formats) {
+		const Texture2D &format = texture_num_and_format.second;
+		auto key = make_tuple(format.internal_format, format.width, format.height);
+		auto class_it = texture_classes.find(key);
+		if (class_it == texture_classes.end()) {
+			ResourcePoolStatistics::TextureClass texture_class;
+			texture_class.internal_format = format.internal_format;
+			texture_class.width = format.width;
+			texture_class.height = format.height;
+			texture_class.num_live = texture_class.num_free = 0;
+			texture_class.live_bytes = texture_class.free_bytes = 0;
+			class_it = texture_classes.insert(make_pair(key, texture_class)).first;
+		}
+
+		size_t bytes = estimate_texture_size(format, /*include_mipmaps=*/true);
+		if (free_textures.count(texture_num_and_format.first)) {
+			++class_it->second.num_free;
+			class_it->second.free_bytes += bytes;
+			++stats.num_free_textures;
+			stats.free_texture_bytes += bytes;
+		} else {
+			++class_it->second.num_live;
+			class_it->second.live_bytes += bytes;
+			++stats.num_live_textures;
+			stats.live_texture_bytes += bytes;
+		}
+	}
+	for (const auto &key_and_class : texture_classes) {
+		stats.texture_classes.push_back(key_and_class.second);
+	}
+	stats.texture_freelist_hits = texture_freelist_hits;
+	stats.texture_freelist_misses = texture_freelist_misses;
+	stats.texture_freelist_evictions = texture_freelist_evictions;
+
+	// Programs.
+	stats.num_live_programs = program_refcount.size();
+	stats.num_free_programs = program_freelist.size();
+	stats.program_cache_hits = program_cache_hits;
+	stats.program_cache_misses = program_cache_misses;
+	stats.program_evictions = program_evictions;
+	stats.program_clones = program_clones;
+
+	// FBOs and VAOs, per context.
+	map<void *, ResourcePoolStatistics::ContextStatistics> contexts;
+	auto get_context_stats = [&contexts](void *context) -> ResourcePoolStatistics::ContextStatistics & {
+		auto context_it = contexts.find(context);
+		if (context_it == contexts.end()) {
+			ResourcePoolStatistics::ContextStatistics context_stats;
+			context_stats.context = context;
+			context_stats.num_live_fbos = context_stats.num_free_fbos = 0;
+			context_stats.num_live_vaos = context_stats.num_free_vaos = 0;
+			context_it = contexts.insert(make_pair(context, context_stats)).first;
+		}
+		return context_it->second;
+	};
+	for (const auto &key_and_fbo : fbo_formats) {
+		++get_context_stats(key_and_fbo.first.first).num_live_fbos;
+	}
+	for (const auto &context_and_freelist : fbo_freelist) {
+		ResourcePoolStatistics::ContextStatistics &context_stats = get_context_stats(context_and_freelist.first);
+		context_stats.num_free_fbos += context_and_freelist.second.size();
+		context_stats.num_live_fbos -= context_and_freelist.second.size();
+	}
+	for (const auto &key_and_vao : vao_formats) {
+		++get_context_stats(key_and_vao.first.first).num_live_vaos;
+	}
+	for (const auto &context_and_freelist : vao_freelist) {
+		ResourcePoolStatistics::ContextStatistics &context_stats = get_context_stats(context_and_freelist.first);
+		context_stats.num_free_vaos += context_and_freelist.second.size();
+		context_stats.num_live_vaos -= context_and_freelist.second.size();
+	}
+	for (const auto &context_and_stats : contexts) {
+		stats.contexts.push_back(context_and_stats.second);
+	}
+
+	stats.num_sync_waits = num_sync_waits;
+	stats.sync_wait_ns = sync_wait_ns;
+
+	pthread_mutex_unlock(&lock);
+	return stats;
+}
+
+void ResourcePool::reset_statistics()
+{
+	pthread_mutex_lock(&lock);
+	texture_freelist_hits = texture_freelist_misses = 0;
+	texture_freelist_evictions = 0;
+	program_cache_hits = program_cache_misses = 0;
+	program_evictions = program_clones = 0;
+	num_sync_waits = sync_wait_ns = 0;
+	pthread_mutex_unlock(&lock);
 }
 
 }  // namespace movit
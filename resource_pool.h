@@ -25,6 +25,7 @@
 #include <epoxy/gl.h>
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <list>
 #include <map>
 #include <set>
@@ -35,6 +36,62 @@
 
 namespace movit {
 
+// A snapshot of what a ResourcePool is holding and how well its caches
+// are doing; see ResourcePool::get_statistics(). Useful for tuning the
+// freelist limits given to the ResourcePool constructor. All byte counts are
+// estimates (see the caveats at the ResourcePool constructor), but unlike the
+// freelist limit, they do take mipmaps into account.
+struct ResourcePoolStatistics {
+	// Textures, grouped by format and dimensions. “Live” textures are those
+	// currently given out by create_2d_texture(); “free” ones are on the
+	// freelist, waiting to be reused.
+	struct TextureClass {
+		GLint internal_format;
+		GLsizei width, height;
+		size_t num_live, num_free;
+		size_t live_bytes, free_bytes;
+	};
+	std::vector<TextureClass> texture_classes;
+	size_t num_live_textures = 0, num_free_textures = 0;
+	size_t live_texture_bytes = 0, free_texture_bytes = 0;
+
+	// How often create_2d_texture() could reuse a texture from the freelist,
+	// and how many textures were deleted from it to stay under the limit.
+	uint64_t texture_freelist_hits = 0, texture_freelist_misses = 0;
+	uint64_t texture_freelist_evictions = 0;
+
+	// Compiled programs (both fragment and compute), not counting clones.
+	// Programs on the freelist are not used by any EffectChain, but kept
+	// around in case someone asks for them again.
+	size_t num_live_programs = 0, num_free_programs = 0;
+
+	// A hit is a call to compile_glsl_program() (or the compute shader
+	// equivalent) that found the program in the cache, including on the
+	// freelist; a miss means the program had to be compiled. Evictions are
+	// programs deleted from the freelist to stay under the limit. Clones are
+	// extra copies made by use_glsl_program() when a program is used by
+	// more than one thread at the same time.
+	uint64_t program_cache_hits = 0, program_cache_misses = 0;
+	uint64_t program_evictions = 0;
+	uint64_t program_clones = 0;
+
+	// FBOs and VAOs are per-context, so they are reported per context
+	// (as identified by get_gl_context_identifier()).
+	struct ContextStatistics {
+		void *context;
+		size_t num_live_fbos, num_free_fbos;
+		size_t num_live_vaos, num_free_vaos;
+	};
+	std::vector<ContextStatistics> contexts;
+
+	// Time spent waiting for the fence that guards a recycled texture
+	// against being overwritten while the GPU still reads from it.
+	// Note that this is a server-side wait (glWaitSync), so it measures
+	// only how long the driver blocks the calling thread, not any GPU stall.
+	uint64_t num_sync_waits = 0;
+	uint64_t sync_wait_ns = 0;
+};
+
 class ResourcePool {
 public:
 	// program_freelist_max_length is how many compiled programs that are unused to keep
@@ -45,7 +102,8 @@ public:
 	// texture_freelist_max_bytes is how many bytes of unused textures to keep around
 	// after they are no longer in use (in case a new texture of the same dimensions
 	// and format is needed). Note that the size estimate is very coarse; it does not
-	// take into account padding, metadata, and most importantly mipmapping.
+	// take into account padding, metadata, and most importantly mipmapping
+	// (unlike the estimates in get_statistics()).
 	// This means you should be prepared for actual memory usage of the freelist being
 	// twice this estimate or more.
 	ResourcePool(size_t program_freelist_max_length = 100,
@@ -94,6 +152,21 @@ public:
 	GLuint create_2d_texture(GLint internal_format, GLsizei width, GLsizei height);
 	void release_2d_texture(GLuint texture_num);
 
+	// Textures whose contents are computed once and then shared between any
+	// number of users (such as the noise used by DitherEffect), identified by
+	// a string key that describes the contents. get_shared_texture() returns
+	// the texture for the given key and takes a reference to it, or returns 0
+	// if there is none. In that case, you should create and fill one yourself,
+	// and hand it over to add_shared_texture(), which takes ownership and
+	// a reference, and returns the texture to use; this may be a different one,
+	// if another thread got there first. Give back the reference with
+	// release_shared_texture() when you are done with the texture.
+	// Unused shared textures are kept around (up to a small limit)
+	// in case someone needs them again.
+	GLuint get_shared_texture(const std::string &key);
+	GLuint add_shared_texture(const std::string &key, GLuint texture_num);
+	void release_shared_texture(GLuint texture_num);
+
 	// Allocate an FBO with the the given texture(s) bound as framebuffer attachment(s),
 	// or fetch a previous used if possible. Unbinds GL_FRAMEBUFFER afterwards.
 	// Keeps ownership of the FBO; you must call release_fbo() of deleting
@@ -132,6 +205,31 @@ public:
 	// thread/context, you never need to call this function.
 	void clean_context();
 
+	// Informs the ResourcePool that mipmaps have been generated for the given
+	// texture (which must have come from create_2d_texture()), so that the
+	// memory they take up can be accounted for.
+	void mark_texture_mipmapped(GLuint texture_num);
+
+	// Allocates (but does not fill) all mipmap levels for the given texture,
+	// which must have come from create_2d_texture() and be bound to
+	// GL_TEXTURE_2D on the active texture unit, and marks it as mipmapped.
+	// Does nothing if the texture already has mipmaps. Needed when the levels
+	// are to be written by something other than glGenerateMipmap(),
+	// such as MipmapGenerator.
+	void allocate_texture_mipmaps(GLuint texture_num);
+
+	// A coarse estimate of how many bytes one texel of the given internal
+	// format takes up in GPU memory; see the caveats at the constructor.
+	static size_t estimate_bytes_per_pixel(GLint internal_format);
+
+	// Returns a snapshot of the pool's contents and counters.
+	// Can be called at any time, and from any thread.
+	ResourcePoolStatistics get_statistics();
+
+	// Resets the counters (hits, misses, evictions, clones and sync waits)
+	// in the statistics to zero. Does not affect the resource counts.
+	void reset_statistics();
+
 private:
 	// Delete the given program and both its shaders.
 	void delete_program(GLuint program_num);
@@ -211,6 +309,7 @@ private:
 	struct Texture2D {
 		GLint internal_format;
 		GLsizei width, height;
+		bool has_mipmaps = false;
 		GLsync no_reuse_before = nullptr;
 	};
 
@@ -227,6 +326,18 @@ private:
 	std::list<GLuint> texture_freelist;
 	size_t texture_freelist_bytes;
 
+	// See get_shared_texture(). The freelist holds shared textures with no
+	// references (most recently released first); once it goes above
+	// <shared_texture_freelist_max_length>, elements are deleted off the end.
+	struct SharedTexture {
+		std::string key;
+		int refcount;
+	};
+	std::map<std::string, GLuint> shared_texture_by_key;
+	std::map<GLuint, SharedTexture> shared_textures;
+	std::list<GLuint> shared_texture_freelist;
+	static const size_t shared_texture_freelist_max_length = 16;
+
 	static const unsigned num_fbo_attachments = 4;
 	struct FBO {
 		GLuint fbo_num;
@@ -258,8 +369,23 @@ private:
 	typedef std::map<std::pair<void *, GLuint>, VAO>::iterator VAOFormatIterator;
 	std::map<void *, std::list<VAOFormatIterator>> vao_freelist;
 
-	// See the caveats at the constructor.
-	static size_t estimate_texture_size(const Texture2D &texture_format);
+	// Counters for get_statistics(); see ResourcePoolStatistics.
+	uint64_t texture_freelist_hits = 0, texture_freelist_misses = 0;
+	uint64_t texture_freelist_evictions = 0;
+	uint64_t program_cache_hits = 0, program_cache_misses = 0;
+	uint64_t program_evictions = 0, program_clones = 0;
+	uint64_t num_sync_waits = 0, sync_wait_ns = 0;
+
+	// See the caveats at the constructor. If <include_mipmaps> is true,
+	// includes all mipmap levels if mark_texture_mipmapped() has been called
+	// for the texture; this is used for get_statistics(). The freelist limit
+	// counts the base level only, so that it means what it always has
+	// (and so that a texture's size does not change while it is on the freelist).
+	static size_t estimate_texture_size(const Texture2D &texture_format, bool include_mipmaps);
+
+	// Find a format and type that can be given to glTexImage2D() together
+	// with the given internal format.
+	static void get_format_and_type(GLint internal_format, GLenum *format, GLenum *type);
 };
 
 }  // namespace movit
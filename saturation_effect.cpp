@@ -1,3 +1,6 @@
+#include <stddef.h>
+
+#include "cpu_backend.h"
 #include "saturation_effect.h"
 #include "util.h"
 
@@ -16,4 +19,21 @@ string SaturationEffect::output_fragment_shader()
 	return read_file("saturation_effect.frag");
 }
 
+void SaturationEffect::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                       unsigned y0, unsigned y1, float *dst) const
+{
+	for (unsigned y = y0; y < y1; ++y) {
+		const float *in = inputs[0].row(y);
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width * 4; x += 4) {
+			const CPUPixel p = CPUPixel::load(in + x);
+			const CPUPixel luminance =
+				CPUPixel(0.2126f) * p.broadcast<0>() +
+				CPUPixel(0.7152f) * p.broadcast<1>() +
+				CPUPixel(0.0722f) * p.broadcast<2>();
+			(luminance + (p - luminance) * CPUPixel(saturation)).with_alpha_from(p).store(out + x);
+		}
+	}
+}
+
 }  // namespace movit
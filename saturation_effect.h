@@ -21,6 +21,10 @@ public:
 	bool strong_one_to_one_sampling() const override { return true; }
 	std::string output_fragment_shader() override;
 
+	bool has_cpu_implementation() const override { return true; }
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 private:
 	float saturation;
 };
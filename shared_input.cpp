@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <epoxy/gl.h>
+
+#include "effect_chain.h"
+#include "resource_pool.h"
+#include "shared_input.h"
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+SharedSource::SharedSource(EffectChain *chain, const ImageFormat &format, OutputAlphaFormat alpha_format,
+                           unsigned width, unsigned height, GLint internal_format)
+	: chain(chain),
+	  format(format),
+	  alpha_format(alpha_format),
+	  width(width),
+	  height(height),
+	  internal_format(internal_format)
+{
+	assert(width > 0 && height > 0);
+	assert(alpha_format == OUTPUT_ALPHA_FORMAT_PREMULTIPLIED ||
+	       alpha_format == OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	pthread_mutex_init(&lock, nullptr);
+}
+
+SharedSource::~SharedSource()
+{
+	pthread_mutex_lock(&lock);
+	for (const Frame &frame : frames) {
+		// All SharedInputs should be gone by now.
+		assert(frame.refcount == 0);
+	}
+	while (!frames.empty()) {
+		delete_frame(frames.size() - 1);
+	}
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_destroy(&lock);
+}
+
+bool SharedSource::render_frame(int64_t frame_number)
+{
+	pthread_mutex_lock(&lock);
+	if (!frames.empty() && frames.back().frame_number == frame_number) {
+		pthread_mutex_unlock(&lock);
+		return false;
+	}
+
+	TraceScope trace_scope("render", "SharedSource::render_frame");
+	ResourcePool *resource_pool = chain->get_resource_pool();
+
+	Frame frame;
+	frame.frame_number = frame_number;
+	frame.has_mipmaps = false;
+	frame.refcount = 0;
+	frame.texture_num = resource_pool->create_2d_texture(internal_format, width, height);
+
+	// The texture might be recycled from someone who used mipmaps;
+	// render_to_texture() needs a non-mipmapped minification mode.
+	glBindTexture(GL_TEXTURE_2D, frame.texture_num);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	check_error();
+
+	chain->render_to_texture({{ frame.texture_num, GLenum(internal_format) }}, width, height);
+
+	frame.ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	check_error();
+	glFlush();  // Make the fence visible to other contexts.
+	check_error();
+
+	// The previous frame is no longer the newest; if nobody is using it,
+	// we can give it back right away.
+	if (!frames.empty() && frames.back().refcount == 0) {
+		delete_frame(frames.size() - 1);
+	}
+	frames.push_back(frame);
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+int64_t SharedSource::get_frame_number()
+{
+	pthread_mutex_lock(&lock);
+	int64_t frame_number = frames.empty() ? -1 : frames.back().frame_number;
+	pthread_mutex_unlock(&lock);
+	return frame_number;
+}
+
+GLuint SharedSource::acquire_frame(bool need_mipmaps)
+{
+	pthread_mutex_lock(&lock);
+	assert(!frames.empty());  // Forgot to call render_frame()?
+	Frame *frame = &frames.back();
+
+	glWaitSync(frame->ready, 0, GL_TIMEOUT_IGNORED);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, frame->texture_num);
+	check_error();
+
+	if (need_mipmaps && !frame->has_mipmaps) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+		check_error();
+		chain->get_resource_pool()->mark_texture_mipmapped(frame->texture_num);
+
+		// Consumers in other contexts need to wait for the mipmaps, too.
+		glDeleteSync(frame->ready);
+		check_error();
+		frame->ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		check_error();
+		glFlush();
+		check_error();
+		frame->has_mipmaps = true;
+	}
+
+	++frame->refcount;
+	GLuint texture_num = frame->texture_num;
+	pthread_mutex_unlock(&lock);
+	return texture_num;
+}
+
+void SharedSource::release_frame(GLuint texture_num)
+{
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < frames.size(); ++i) {
+		if (frames[i].texture_num != texture_num) {
+			continue;
+		}
+		assert(frames[i].refcount > 0);
+		if (--frames[i].refcount == 0 && i != frames.size() - 1) {
+			delete_frame(i);
+		}
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	assert(false);
+}
+
+void SharedSource::delete_frame(size_t frame_index)
+{
+	const Frame &frame = frames[frame_index];
+	glDeleteSync(frame.ready);
+	check_error();
+
+	// The pool puts a fence on the texture, so it will not be reused
+	// before any consumers still in the GPU's queue are done with it.
+	chain->get_resource_pool()->release_2d_texture(frame.texture_num);
+	frames.erase(frames.begin() + frame_index);
+}
+
+namespace {
+
+MovitPixelFormat pixel_format_for_alpha_format(OutputAlphaFormat alpha_format)
+{
+	if (alpha_format == OUTPUT_ALPHA_FORMAT_PREMULTIPLIED) {
+		return FORMAT_RGBA_PREMULTIPLIED_ALPHA;
+	} else {
+		assert(alpha_format == OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+		return FORMAT_RGBA_POSTMULTIPLIED_ALPHA;
+	}
+}
+
+}  // namespace
+
+// The type is only used when uploading, which we never do; however,
+// it needs to be something other than GL_UNSIGNED_BYTE, or FlatInput
+// would offer to do sRGB decoding in the texture sampler.
+SharedInput::SharedInput(SharedSource *source)
+	: FlatInput(source->get_image_format(), pixel_format_for_alpha_format(source->get_alpha_format()),
+	            GL_HALF_FLOAT, source->get_width(), source->get_height()),
+	  source(source)
+{
+}
+
+SharedInput::~SharedInput()
+{
+	if (held_texture_num != 0) {
+		source->release_frame(held_texture_num);
+	}
+}
+
+void SharedInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
+{
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+
+	// Take the new reference before giving back the old one,
+	// so that the frame is not freed if it is the same.
+	GLuint texture_num = source->acquire_frame(get_needs_mipmaps());
+	if (held_texture_num != 0) {
+		source->release_frame(held_texture_num);
+	}
+	held_texture_num = texture_num;
+	set_texture_num(texture_num);
+
+	FlatInput::set_gl_state(glsl_program_num, prefix, sampler_num);
+}
+
+}  // namespace movit
@@ -0,0 +1,142 @@
+#ifndef _MOVIT_SHARED_INPUT_H
+#define _MOVIT_SHARED_INPUT_H 1
+
+// SharedSource and SharedInput let several EffectChains consume the output
+// of a common, finalized EffectChain (the “producer”), so that expensive
+// work on a shared source is done only once per frame, no matter how many
+// chains use it. A typical example is a camera feed that is uploaded,
+// converted from Y'CbCr, gamma-expanded and deinterlaced once, and then
+// used by a program output, a preview and a multiviewer tile:
+//
+//   EffectChain producer(1920, 1080, pool);
+//   producer.add_input(ycbcr_input);
+//   producer.add_effect(new DeinterlaceEffect(), ...);
+//   producer.add_output(linear_format, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+//   producer.finalize();
+//   SharedSource source(&producer, linear_format, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED, 1920, 1080);
+//
+//   consumer_chain.add_input(new SharedInput(&source));
+//   ...
+//
+//   // For every frame:
+//   source.render_frame(frame_number);  // Only the first call renders.
+//   consumer_chain.render_to_fbo(...);
+//
+// The output is rendered into a texture from the producer's ResourcePool
+// (by default in GL_RGBA16F, which is enough to keep linear light without
+// banding), stamped with the frame number it was rendered for. Consumers
+// hold a reference to the texture until they render the next frame
+// (or are destroyed), so a texture is never given back to the pool while
+// a consumer could still be reading from it. The pool's usual fences then
+// make sure it is not overwritten before the GPU is done with it.
+//
+// Thread-safety: render_frame() can be called from multiple threads,
+// and consumers can live in different (but sharing) OpenGL contexts;
+// a fence is inserted after each frame, and consumers wait for it on the
+// GPU before they read from the texture. The producer chain itself must
+// not be rendered by anyone else.
+
+#include <epoxy/gl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "effect_chain.h"
+#include "flat_input.h"
+#include "image_format.h"
+
+namespace movit {
+
+class SharedSource {
+public:
+	// <format> and <alpha_format> must be the same as what was given to
+	// add_output() on <chain>, and <width> and <height> are the size to render
+	// it at. The chain must be finalized, and is not owned by the SharedSource.
+	// It must also outlive all SharedInputs using it.
+	SharedSource(EffectChain *chain, const ImageFormat &format, OutputAlphaFormat alpha_format,
+	             unsigned width, unsigned height, GLint internal_format = GL_RGBA16F);
+	~SharedSource();
+
+	// Renders the producer chain for the given frame, unless it has already
+	// been done; you would typically call this before rendering each of the
+	// consumer chains, or once before rendering all of them. Returns true if
+	// it actually rendered. Any frame number different from the last one
+	// counts as a new frame, so you can use e.g. timestamps.
+	//
+	// This must not be called from within another chain's render
+	// (which means it cannot be done lazily by SharedInput).
+	bool render_frame(int64_t frame_number);
+
+	// The frame number of the last frame rendered, or -1 if none.
+	int64_t get_frame_number();
+
+	const ImageFormat &get_image_format() const { return format; }
+	OutputAlphaFormat get_alpha_format() const { return alpha_format; }
+	unsigned get_width() const { return width; }
+	unsigned get_height() const { return height; }
+
+	// The remaining functions are intended for SharedInput only.
+
+	// Get a reference to the texture of the last frame rendered, generating
+	// mipmaps for it first if <need_mipmaps> is set. Before returning, makes
+	// the GPU wait until the frame is done rendering. Leaves GL_TEXTURE_2D
+	// on the active texture unit bound to the texture.
+	GLuint acquire_frame(bool need_mipmaps);
+
+	// Give back a reference taken by acquire_frame().
+	void release_frame(GLuint texture_num);
+
+private:
+	struct Frame {
+		int64_t frame_number;
+		GLuint texture_num;
+		GLsync ready;  // Signaled when the texture (and its mipmaps) are done.
+		bool has_mipmaps;
+
+		// Number of acquire_frame() calls not yet matched by a release_frame().
+		// The frame is kept around until this is zero and it is no longer
+		// the newest frame.
+		int refcount;
+	};
+
+	// Deletes the given frame from <frames> and gives its texture
+	// back to the pool. Must be called with <lock> held.
+	void delete_frame(size_t frame_index);
+
+	EffectChain *chain;
+	ImageFormat format;
+	OutputAlphaFormat alpha_format;
+	unsigned width, height;
+	GLint internal_format;
+
+	// Protects all the other members below.
+	pthread_mutex_t lock;
+
+	// The newest frame is at the back; the others are old frames
+	// that are still in use by some consumer.
+	std::vector<Frame> frames;
+};
+
+// An input that reads the last frame rendered by a SharedSource,
+// like a FlatInput with a texture given by set_texture_num()
+// (whose shader it shares).
+class SharedInput : public FlatInput {
+public:
+	SharedInput(SharedSource *source);
+	~SharedInput();
+
+	std::string effect_type_id() const override { return "SharedInput"; }
+
+	// Takes a reference to the current frame (and gives back
+	// the one for the previous frame, if any).
+	void set_gl_state(GLuint glsl_program_num, const std::string& prefix, unsigned *sampler_num) override;
+
+private:
+	SharedSource *source;
+	GLuint held_texture_num = 0;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_SHARED_INPUT_H)
@@ -0,0 +1,124 @@
+// Unit tests for SharedSource and SharedInput.
+
+#include <epoxy/gl.h>
+
+#include "effect_chain.h"
+#include "flat_input.h"
+#include "gtest/gtest.h"
+#include "mirror_effect.h"
+#include "resource_pool.h"
+#include "shared_input.h"
+#include "test_util.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+TEST(SharedInputTest, TwoConsumersRenderOnce) {
+	const int width = 3, height = 2;
+	float data[width * height * 4] = {
+		0.0, 0.0, 0.0, 1.0,
+		0.5, 0.0, 0.0, 1.0,
+		0.0, 0.5, 0.0, 1.0,
+		0.0, 0.0, 0.7, 1.0,
+		0.0, 0.3, 0.7, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+	};
+
+	// EffectChainTester flips the image to compensate for OpenGL's origin
+	// being at the bottom, but we give the data to the producer directly,
+	// so it comes out upside down.
+	float expected_data[width * height * 4] = {
+		0.0, 0.0, 0.7, 1.0,
+		0.0, 0.3, 0.7, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+		0.5, 0.0, 0.0, 1.0,
+		0.0, 0.5, 0.0, 1.0,
+	};
+	float mirrored_data[width * height * 4] = {
+		1.0, 1.0, 1.0, 1.0,
+		0.0, 0.3, 0.7, 1.0,
+		0.0, 0.0, 0.7, 1.0,
+		0.0, 0.5, 0.0, 1.0,
+		0.5, 0.0, 0.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+	};
+	float out_data[width * height * 4];
+
+	EffectChainTester producer_tester(nullptr, width, height);
+	EffectChain *producer = producer_tester.get_chain();
+	FlatInput *input = new FlatInput(linear_format(), FORMAT_RGBA_PREMULTIPLIED_ALPHA, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	producer->add_input(input);
+	producer->add_output(linear_format(), OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+	producer->finalize();
+
+	SharedSource source(producer, linear_format(), OUTPUT_ALPHA_FORMAT_PREMULTIPLIED, width, height);
+	EXPECT_EQ(-1, source.get_frame_number());
+	EXPECT_TRUE(source.render_frame(0));
+	EXPECT_FALSE(source.render_frame(0));
+	EXPECT_EQ(0, source.get_frame_number());
+
+	{
+		EffectChainTester tester(nullptr, width, height);
+		tester.get_chain()->add_input(new SharedInput(&source));
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+		expect_equal(expected_data, out_data, width * 4, height);
+	}
+	{
+		EffectChainTester tester(nullptr, width, height);
+		tester.get_chain()->add_input(new SharedInput(&source));
+		tester.get_chain()->add_effect(new MirrorEffect());
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+		expect_equal(mirrored_data, out_data, width * 4, height);
+	}
+
+	// Nobody uses the frame anymore, but it is still the newest one.
+	EXPECT_FALSE(source.render_frame(0));
+}
+
+TEST(SharedInputTest, NewFrameWhileOldIsHeld) {
+	const int width = 1, height = 4;
+	// Bottom to top; see TwoConsumersRenderOnce.
+	float data[width * height] = { 1.0, 0.5, 0.25, 0.0 };
+	float data2[width * height] = { 0.0, 0.5, 0.75, 1.0 };
+	float expected_data[width * height * 4] = {
+		0.0, 0.0, 0.0, 1.0,
+		0.25, 0.25, 0.25, 1.0,
+		0.5, 0.5, 0.5, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+	};
+	float expected_data2[width * height * 4] = {
+		1.0, 1.0, 1.0, 1.0,
+		0.75, 0.75, 0.75, 1.0,
+		0.5, 0.5, 0.5, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+	};
+	float out_data[width * height * 4];
+
+	EffectChainTester producer_tester(nullptr, width, height);
+	EffectChain *producer = producer_tester.get_chain();
+	FlatInput *input = new FlatInput(linear_format(), FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	producer->add_input(input);
+	producer->add_output(linear_format(), OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	producer->finalize();
+
+	SharedSource source(producer, linear_format(), OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, width, height);
+	source.render_frame(10);
+
+	EffectChainTester tester(nullptr, width, height);
+	tester.get_chain()->add_input(new SharedInput(&source));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 4, height);
+
+	// The consumer still holds frame 10, so this needs a new texture.
+	input->set_pixel_data(data2);
+	EXPECT_TRUE(source.render_frame(11));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data2, out_data, 4, height);
+}
+
+}  // namespace movit
@@ -0,0 +1,55 @@
+#include <assert.h>
+#include <epoxy/gl.h>
+
+#include "temporal_denoise_effect.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+TemporalDenoiseEffect::TemporalDenoiseEffect()
+	: strength(0.75f),
+	  threshold(0.1f)
+{
+	register_float("strength", &strength);
+	register_float("threshold", &threshold);
+	register_uniform_float("inv_width", &inv_width);
+	register_uniform_float("inv_height", &inv_height);
+}
+
+string TemporalDenoiseEffect::output_fragment_shader()
+{
+	return read_file("temporal_denoise_effect.comp");
+}
+
+void TemporalDenoiseEffect::inform_input_size(unsigned input_num, unsigned width, unsigned height)
+{
+	assert(input_num < 2);
+	widths[input_num] = width;
+	heights[input_num] = height;
+}
+
+void TemporalDenoiseEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+
+	// The motion vectors are in pixels of the current frame,
+	// so the previous output needs to have the same size.
+	assert(widths[0] == widths[1]);
+	assert(heights[0] == heights[1]);
+	inv_width = 1.0 / widths[0];
+	inv_height = 1.0 / heights[0];
+}
+
+void TemporalDenoiseEffect::get_compute_dimensions(unsigned output_width, unsigned output_height,
+                                                   unsigned *x, unsigned *y, unsigned *z) const
+{
+	// Each workgroup outputs one 8x8 block (see BLOCK_SIZE in the shader),
+	// so figure out the number of groups by simply rounding up.
+	*x = (output_width + 7) / 8;
+	*y = (output_height + 7) / 8;
+	*z = 1;
+}
+
+}  // namespace movit
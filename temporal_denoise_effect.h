@@ -0,0 +1,78 @@
+#ifndef _MOVIT_TEMPORAL_DENOISE_EFFECT_H
+#define _MOVIT_TEMPORAL_DENOISE_EFFECT_H 1
+
+// A motion-compensated, recursive temporal denoiser. Noise in video is
+// (mostly) uncorrelated between frames, so averaging a pixel with the
+// same point in earlier frames reduces it, as long as we actually find
+// the same point; if we simply average with the same pixel position,
+// anything that moves gets smeared out into ghosts.
+//
+// The effect takes two inputs: The current (noisy) frame, and the previous
+// _output_ of the effect, ie., the previous denoised frame. Feeding back
+// the output makes the filter recursive, so that it effectively averages
+// over many frames (with exponentially decaying weights) while only ever
+// looking at two. You will need to keep the output around yourself;
+// the simplest way is to render the chain to a texture, and then give
+// that to a FlatInput using set_texture_num() for the next frame.
+// (For the very first frame, give in the current frame for both inputs.)
+//
+// For each 8x8 block, we estimate a motion vector by block matching
+// on the luma of the two frames, coarse to fine: First, we search
+// a ±16-pixel range on a quarter-resolution copy of the frames, and then
+// refine the best match by ±1 sample at half and then full resolution.
+// The pyramid is built in shared memory from the pixels loaded for
+// the block, so there are no extra passes. (The zero vector is always
+// tried, too, with a small bonus, so that static areas with little texture
+// do not start to wander around due to the noise.) Then, each pixel is
+// blended with the motion-compensated previous output; the weight falls
+// off linearly with the difference between the two (and with how good
+// the match for the block was), so that occlusions, scene changes and
+// motion the search did not catch just show the current frame instead
+// of ghosting.
+// The weight for the previous frame is at most “strength” (0.0 disables
+// the effect; 0.9 is very strong denoising, averaging roughly the last
+// ten frames); “threshold” is the difference (in luma, after gamma
+// expansion) where blending stops. It should be set somewhat above
+// the noise level of the source.
+//
+// This effect requires compute shaders (see movit_compute_shaders_supported);
+// there is no fragment shader version, since the block matching depends
+// on sharing loaded pixels between all the pixels in a block.
+
+#include <epoxy/gl.h>
+#include <string>
+
+#include "effect.h"
+
+namespace movit {
+
+class TemporalDenoiseEffect : public Effect {
+public:
+	TemporalDenoiseEffect();
+	std::string effect_type_id() const override { return "TemporalDenoiseEffect"; }
+	std::string output_fragment_shader() override;
+
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num) override;
+
+	// First = current frame, second = previous output.
+	unsigned num_inputs() const override { return 2; }
+	bool is_compute_shader() const override { return true; }
+	void get_compute_dimensions(unsigned output_width, unsigned output_height,
+	                            unsigned *x, unsigned *y, unsigned *z) const override;
+
+	AlphaHandling alpha_handling() const override { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
+
+	void inform_input_size(unsigned input_num, unsigned width, unsigned height) override;
+
+private:
+	unsigned widths[2], heights[2];
+
+	float strength, threshold;
+
+	// Offset for one pixel in the horizontal and vertical direction (1/width, 1/height).
+	float inv_width, inv_height;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_TEMPORAL_DENOISE_EFFECT_H)
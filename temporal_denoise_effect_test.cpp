@@ -0,0 +1,172 @@
+// Unit tests for TemporalDenoiseEffect.
+
+#ifdef HAVE_BENCHMARK
+#include <benchmark/benchmark.h>
+#endif
+#include <epoxy/gl.h>
+#include <math.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "image_format.h"
+#include "input.h"
+#include "temporal_denoise_effect.h"
+#include "test_util.h"
+
+using namespace std;
+
+namespace movit {
+
+TEST(TemporalDenoiseEffectTest, StaticNoiseIsAveraged) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	const int width = 16, height = 16;
+	float prev_data[width * height];
+	float cur_data[width * height];
+	float expected_data[width * height];
+
+	// The previous output is flat, and the current frame is the same
+	// with ±0.02 checkerboard noise. The mean error for the block is 0.02,
+	// and so is the error for every pixel, so with a threshold of 0.1,
+	// the weight for the previous frame is 0.5 * (1 - 0.2) = 0.4.
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float noise = ((x + y) % 2 == 0) ? 0.02f : -0.02f;
+			prev_data[y * width + x] = 0.5f;
+			cur_data[y * width + x] = 0.5f + noise;
+			expected_data[y * width + x] = 0.5f + 0.6f * noise;
+		}
+	}
+	float out_data[width * height];
+
+	EffectChainTester tester(nullptr, width, height);
+	Effect *cur_input = tester.add_input(cur_data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	Effect *prev_input = tester.add_input(prev_data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	Effect *denoise_effect = tester.get_chain()->add_effect(new TemporalDenoiseEffect(), cur_input, prev_input);
+	ASSERT_TRUE(denoise_effect->set_float("strength", 0.5f));
+	ASSERT_TRUE(denoise_effect->set_float("threshold", 0.1f));
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+	expect_equal(expected_data, out_data, width, height);
+}
+
+namespace {
+
+// Pseudorandom values on a grid with four pixels between the points,
+// smoothly interpolated in between. Like most real images, this has
+// detail in both directions and does not repeat, so that block matching
+// can find a unique match even at quarter resolution.
+float grid_value(int i, int j)
+{
+	unsigned h = (i * 73856093u) ^ (j * 19349663u);
+	h = (h * 1103515245u + 12345u) & 0x7fffffff;
+	return (h >> 8) / float(1 << 23);
+}
+
+float pattern(int x, int y)
+{
+	// Offset so that we do not need to care about negative coordinates.
+	float fx = (x + 64) / 4.0f, fy = (y + 64) / 4.0f;
+	int i = int(floor(fx)), j = int(floor(fy));
+	float tx = fx - i, ty = fy - j;
+	float sx = tx * tx * (3.0f - 2.0f * tx), sy = ty * ty * (3.0f - 2.0f * ty);
+	float bottom = grid_value(i, j) * (1.0f - sx) + grid_value(i + 1, j) * sx;
+	float top = grid_value(i, j + 1) * (1.0f - sx) + grid_value(i + 1, j + 1) * sx;
+	return bottom * (1.0f - sy) + top * sy;
+}
+
+}  // namespace
+
+TEST(TemporalDenoiseEffectTest, MotionIsCompensated) {
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip()) return;
+
+	const int width = 32, height = 32;
+	const int dx = 6, dy = 2;
+	float prev_data[width * height];
+	float cur_data[width * height];
+
+	// The current frame is the previous one moved by (dx, dy) pixels,
+	// plus ±0.02 checkerboard noise. If the motion is found, we blend
+	// with the right pixels, with weight 1.0 * (1 - 0.2) = 0.8 (see
+	// StaticNoiseIsAveraged), which removes most of the noise.
+	// Without motion compensation, we would either get ghosting or
+	// (since the difference is large) no denoising at all.
+	float expected_data[width * height];
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float noise = ((x + y) % 2 == 0) ? 0.02f : -0.02f;
+			prev_data[y * width + x] = pattern(x, y);
+			cur_data[y * width + x] = pattern(x - dx, y - dy) + noise;
+			expected_data[y * width + x] = pattern(x - dx, y - dy) + 0.2f * noise;
+		}
+	}
+	float out_data[width * height];
+
+	EffectChainTester tester(nullptr, width, height);
+	Effect *cur_input = tester.add_input(cur_data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	Effect *prev_input = tester.add_input(prev_data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	Effect *denoise_effect = tester.get_chain()->add_effect(new TemporalDenoiseEffect(), cur_input, prev_input);
+	ASSERT_TRUE(denoise_effect->set_float("strength", 1.0f));
+	ASSERT_TRUE(denoise_effect->set_float("threshold", 0.1f));
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	// Along the edges, new content moves into the frame, and there is
+	// nothing to match it against, so only check the blocks in the middle.
+	float expected_center[16 * 16], out_center[16 * 16];
+	for (int y = 0; y < 16; ++y) {
+		for (int x = 0; x < 16; ++x) {
+			expected_center[y * 16 + x] = expected_data[(y + 8) * width + x + 8];
+			out_center[y * 16 + x] = out_data[(y + 8) * width + x + 8];
+		}
+	}
+	expect_equal(expected_center, out_center, 16, 16);
+}
+
+#ifdef HAVE_BENCHMARK
+namespace {
+
+struct TestFormat {
+	MovitPixelFormat input_format;
+	GLenum output_format;
+	size_t bytes_per_pixel;
+};
+TestFormat gray_format = { FORMAT_GRAYSCALE, GL_RED, 1 };
+TestFormat bgra_format = { FORMAT_BGRA_PREMULTIPLIED_ALPHA, GL_BGRA, 4 };
+
+}  // namespace
+
+void BM_TemporalDenoiseEffect(benchmark::State &state, TestFormat format)
+{
+	DisableComputeShadersTemporarily disabler(false);
+	if (disabler.should_skip(&state)) return;
+
+	unsigned width = state.range(0), height = state.range(1);
+
+	unique_ptr<float[]> cur_frame(new float[width * height * format.bytes_per_pixel]);
+	unique_ptr<float[]> prev_frame(new float[width * height * format.bytes_per_pixel]);
+	unique_ptr<float[]> out_data(new float[width * height * format.bytes_per_pixel]);
+
+	for (unsigned i = 0; i < width * height * format.bytes_per_pixel; ++i) {
+		cur_frame[i] = rand() / (RAND_MAX + 1.0);
+		prev_frame[i] = rand() / (RAND_MAX + 1.0);
+	}
+
+	EffectChainTester tester(nullptr, width, height);
+	Effect *cur_input = tester.add_input(cur_frame.get(), format.input_format, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	Effect *prev_input = tester.add_input(prev_frame.get(), format.input_format, COLORSPACE_sRGB, GAMMA_LINEAR, width, height);
+	tester.get_chain()->add_effect(new TemporalDenoiseEffect(), cur_input, prev_input);
+
+	tester.benchmark(state, out_data.get(), format.output_format, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+}
+BENCHMARK_CAPTURE(BM_TemporalDenoiseEffect, Gray, gray_format)->Args({720, 576})->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_TemporalDenoiseEffect, BGRA, bgra_format)->Args({720, 576})->Args({1280, 720})->Args({1920, 1080})->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+#endif
+
+}  // namespace movit
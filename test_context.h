@@ -0,0 +1,25 @@
+#ifndef _MOVIT_TEST_CONTEXT_H
+#define _MOVIT_TEST_CONTEXT_H 1
+
+// Creation of an OpenGL context for the unit tests and benchmarks. Which
+// implementation is used is chosen at configure time (--with-test-context):
+//
+//  - egl (test_context_egl.cpp): A context without any window or display,
+//    using EGL's surfaceless or device platforms. This works on headless
+//    servers and in CI, both with hardware and software (llvmpipe) renderers.
+//  - sdl (test_context_sdl.cpp): A context belonging to a hidden SDL window.
+//    Needs a display (or SDL_VIDEODRIVER=offscreen), but also works
+//    on platforms without EGL.
+//
+// Either way, the context is a core context of OpenGL 3.2 or newer,
+// and is made current on the calling thread. On failure, prints
+// an error message and exits.
+
+namespace movit {
+
+void create_test_context();
+void destroy_test_context();
+
+}  // namespace movit
+
+#endif  // !defined(_MOVIT_TEST_CONTEXT_H)
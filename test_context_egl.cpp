@@ -0,0 +1,144 @@
+// OpenGL context for tests and benchmarks, using EGL without any window
+// system. See test_context.h.
+//
+// We first try EGL_MESA_platform_surfaceless, which on Mesa picks the first
+// GPU render node and falls back to software rendering (llvmpipe) if there is
+// none. If that is not available (e.g. on NVIDIA's drivers), we go through the
+// devices from EGL_EXT_device_enumeration, using the first one that works.
+// Setting MOVIT_EGL_DEVICE=<n> skips the surfaceless platform and uses
+// device number <n> directly.
+
+#include <epoxy/egl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "test_context.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+EGLDisplay display = EGL_NO_DISPLAY;
+EGLContext context = EGL_NO_CONTEXT;
+
+bool has_client_extension(const char *extension)
+{
+	// Client extensions are only supported from EGL 1.5 (or with
+	// EGL_EXT_client_extensions); older implementations return nullptr.
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (extensions == nullptr) {
+		return false;
+	}
+	size_t len = strlen(extension);
+	for (const char *ptr = extensions; (ptr = strstr(ptr, extension)) != nullptr; ptr += len) {
+		if ((ptr == extensions || ptr[-1] == ' ') &&
+		    (ptr[len] == '\0' || ptr[len] == ' ')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Tries to initialize the given display and create a context on it.
+// On success, makes the context current and returns true.
+bool try_display(EGLDisplay dpy)
+{
+	if (dpy == EGL_NO_DISPLAY) {
+		return false;
+	}
+	EGLint major, minor;
+	if (!eglInitialize(dpy, &major, &minor)) {
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		eglTerminate(dpy);
+		return false;
+	}
+
+	// We never render to anything but FBOs, so we do not need a surface,
+	// and if possible, not even a config.
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	if (!epoxy_has_egl_extension(dpy, "EGL_KHR_no_config_context")) {
+		static const EGLint config_attribs[] = {
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_NONE
+		};
+		EGLint num_configs = 0;
+		if (!eglChooseConfig(dpy, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+			eglTerminate(dpy);
+			return false;
+		}
+	}
+
+	// Use a core context, because Mesa only allows certain OpenGL versions in core.
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 2,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, context_attribs);
+	if (ctx == EGL_NO_CONTEXT) {
+		eglTerminate(dpy);
+		return false;
+	}
+	if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+		eglDestroyContext(dpy, ctx);
+		eglTerminate(dpy);
+		return false;
+	}
+
+	display = dpy;
+	context = ctx;
+	return true;
+}
+
+}  // namespace
+
+void create_test_context()
+{
+	const char *device_str = getenv("MOVIT_EGL_DEVICE");
+
+	if (device_str == nullptr && has_client_extension("EGL_MESA_platform_surfaceless")) {
+		if (try_display(eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr))) {
+			return;
+		}
+	}
+
+	if (has_client_extension("EGL_EXT_device_enumeration") &&
+	    has_client_extension("EGL_EXT_platform_device")) {
+		EGLint num_devices = 0;
+		if (eglQueryDevicesEXT(0, nullptr, &num_devices) && num_devices > 0) {
+			vector<EGLDeviceEXT> devices(num_devices);
+			eglQueryDevicesEXT(num_devices, devices.data(), &num_devices);
+			for (EGLint i = 0; i < num_devices; ++i) {
+				if (device_str != nullptr && atoi(device_str) != i) {
+					continue;
+				}
+				if (try_display(eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr))) {
+					return;
+				}
+			}
+		}
+	}
+
+	fprintf(stderr, "Could not create a headless OpenGL context with EGL (error 0x%x).\n", eglGetError());
+	fprintf(stderr, "You may want to reconfigure with --with-test-context=sdl.\n");
+	exit(1);
+}
+
+void destroy_test_context()
+{
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+	context = EGL_NO_CONTEXT;
+	display = EGL_NO_DISPLAY;
+}
+
+}  // namespace movit
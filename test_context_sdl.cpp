@@ -1,18 +1,24 @@
-#define GTEST_HAS_EXCEPTIONS 0
+// OpenGL context for tests and benchmarks, using SDL. See test_context.h.
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_error.h>
 #include <SDL2/SDL_video.h>
-#ifdef HAVE_BENCHMARK
-#include <benchmark/benchmark.h>
-#endif
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "gtest/gtest.h"
+#include "test_context.h"
 
-int main(int argc, char **argv) {
-	// Set up an OpenGL context using SDL.
+namespace movit {
+
+namespace {
+
+SDL_Window *window = nullptr;
+SDL_GLContext context = nullptr;
+
+}  // namespace
+
+void create_test_context()
+{
 	if (SDL_Init(SDL_INIT_VIDEO) == -1) {
 		fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
 		exit(1);
@@ -29,30 +35,29 @@ int main(int argc, char **argv) {
 	// See also init.cpp for how to enable debugging.
 //	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
 
-	SDL_Window *window = SDL_CreateWindow("OpenGL window for unit test",
+	window = SDL_CreateWindow("OpenGL window for unit test",
 		SDL_WINDOWPOS_UNDEFINED,
 		SDL_WINDOWPOS_UNDEFINED,
 		32, 32,
-		SDL_WINDOW_OPENGL);
-	SDL_GLContext context = SDL_GL_CreateContext(window);
-	assert(context != nullptr);
-
-	int err;
-	if (argc >= 2 && strcmp(argv[1], "--benchmark") == 0) {
-#ifdef HAVE_BENCHMARK
-		--argc;
-		::benchmark::Initialize(&argc, argv + 1);
-		if (::benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
-		::benchmark::RunSpecifiedBenchmarks();
-		err = 0;
-#else
-		fprintf(stderr, "No support for microbenchmarks compiled in.\n");
-		err = 1;
-#endif
-	} else {
-		testing::InitGoogleTest(&argc, argv);
-		err = RUN_ALL_TESTS();
+		SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == nullptr) {
+		fprintf(stderr, "SDL_CreateWindow failed: %s\n", SDL_GetError());
+		exit(1);
 	}
+	context = SDL_GL_CreateContext(window);
+	if (context == nullptr) {
+		fprintf(stderr, "SDL_GL_CreateContext failed: %s\n", SDL_GetError());
+		exit(1);
+	}
+}
+
+void destroy_test_context()
+{
+	SDL_GL_DeleteContext(context);
+	SDL_DestroyWindow(window);
+	context = nullptr;
+	window = nullptr;
 	SDL_Quit();
-	return err;
 }
+
+}  // namespace movit
@@ -1,14 +1,18 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <algorithm>
+#include <memory>
 #include <epoxy/gl.h>
 #include <gtest/gtest.h>
 #include <gtest/gtest-message.h>
 
 #include "flat_input.h"
 #include "init.h"
+#include "lift_gamma_gain_effect.h"
 #include "resource_pool.h"
+#include "saturation_effect.h"
 #include "test_util.h"
 #include "util.h"
 
@@ -42,6 +46,23 @@ void vertical_flip(T *data, unsigned width, unsigned height)
 	}
 }
 
+// For the CPU backend, which only renders to RGBA floats or 8-bit values.
+void render_to_cpu_rgba(EffectChain *chain, float *dst, unsigned width, unsigned height)
+{
+	chain->render_to_cpu(dst, width, height);
+}
+
+void render_to_cpu_rgba(EffectChain *chain, unsigned char *dst, unsigned width, unsigned height)
+{
+	chain->render_to_cpu(dst, width, height);
+}
+
+template<class T>
+void render_to_cpu_rgba(EffectChain *chain, T *dst, unsigned width, unsigned height)
+{
+	assert(false);
+}
+
 void init_movit_for_test()
 {
        CHECK(init_movit(".", MOVIT_DEBUG_OFF));
@@ -212,6 +233,34 @@ void EffectChainTester::internal_run(const std::vector<T *> &out_data, GLenum fo
 		finalize_chain(color_space, gamma_curve, alpha_format);
 	}
 
+	if (chain.get_backend() == BACKEND_CPU) {
+		assert(out_data.size() == 1);
+		unique_ptr<T[]> rgba(new T[width * height * 4]);
+		render_to_cpu_rgba(&chain, rgba.get(), width, height);
+#ifdef HAVE_BENCHMARK
+		if (benchmark_state != nullptr) {
+			for (auto _ : *benchmark_state) {
+				render_to_cpu_rgba(&chain, rgba.get(), width, height);
+			}
+			benchmark_state->SetItemsProcessed(benchmark_state->iterations() * width * height);
+		}
+#endif
+
+		T *ptr = out_data[0];
+		if (format == GL_RGBA) {
+			copy(rgba.get(), rgba.get() + width * height * 4, ptr);
+			vertical_flip(ptr, width * 4, height);
+		} else {
+			const unsigned component = (format == GL_ALPHA) ? 3 : (format == GL_BLUE) ? 2 : 0;
+			assert(format == GL_RED || format == GL_BLUE || format == GL_ALPHA);
+			for (unsigned j = 0; j < width * height; ++j) {
+				ptr[j] = rgba[j * 4 + component];
+			}
+			vertical_flip(ptr, width, height);
+		}
+		return;
+	}
+
 	GLuint type;
 	if (framebuffer_format == GL_RGBA8) {
 		type = GL_UNSIGNED_BYTE;
@@ -479,6 +528,54 @@ double linear_to_srgb(double x)
 	}
 }
 
+ImageFormat linear_format()
+{
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+	return format;
+}
+
+vector<float> random_rgba(size_t num_pixels, bool random_alpha)
+{
+	vector<float> data(num_pixels * 4);
+	for (size_t i = 0; i < num_pixels; ++i) {
+		data[i * 4 + 0] = rand() / (RAND_MAX + 1.0);
+		data[i * 4 + 1] = rand() / (RAND_MAX + 1.0);
+		data[i * 4 + 2] = rand() / (RAND_MAX + 1.0);
+		data[i * 4 + 3] = random_alpha ? rand() / (RAND_MAX + 1.0) : 1.0f;
+	}
+	return data;
+}
+
+void write_le16(unsigned char *dst, uint16_t x)
+{
+	dst[0] = x & 0xff;
+	dst[1] = x >> 8;
+}
+
+vector<Effect *> make_grading_effects()
+{
+	const float lift[] = { 0.02f, 0.0f, 0.01f };
+	const float gamma[] = { 0.9f, 1.0f, 0.8f };
+	const float gain[] = { 0.9f, 0.95f, 0.9f };
+
+	Effect *lgg = new LiftGammaGainEffect();
+	CHECK(lgg->set_vec3("lift", lift));
+	CHECK(lgg->set_vec3("gamma", gamma));
+	CHECK(lgg->set_vec3("gain", gain));
+	Effect *saturation = new SaturationEffect();
+	CHECK(saturation->set_float("saturation", 0.8f));
+	return { lgg, saturation };
+}
+
+void add_grading_effects(EffectChain *chain)
+{
+	for (Effect *effect : make_grading_effects()) {
+		chain->add_effect(effect);
+	}
+}
+
 DisableComputeShadersTemporarily::DisableComputeShadersTemporarily(bool disable_compute_shaders)
 	: disable_compute_shaders(disable_compute_shaders)
 {
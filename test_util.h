@@ -5,6 +5,8 @@
 #ifdef HAVE_BENCHMARK
 #include <benchmark/benchmark.h>
 #endif
+#include <vector>
+
 #include "effect_chain.h"
 #include "fp16.h"
 #include "image_format.h"
@@ -79,6 +81,23 @@ double srgb_to_linear(double x);
 // Undefined for values outside 0.0..1.0.
 double linear_to_srgb(double x);
 
+// sRGB primaries with linear gamma, the simplest format for input and output.
+ImageFormat linear_format();
+
+// <num_pixels> RGBA pixels of random values in 0.0..1.0 (from rand()).
+// Alpha is 1.0 unless <random_alpha> is set.
+std::vector<float> random_rgba(size_t num_pixels, bool random_alpha = false);
+
+// Stores <x> as two bytes, least significant first, like the 16-bit
+// Y'CbCr formats do.
+void write_le16(unsigned char *dst, uint16_t x);
+
+// The effects of a mild color grading (lift/gamma/gain and saturation),
+// with some curvature, but keeping colors in 0.0..1.0 in range. They all
+// have CPU implementations. add_grading_effects() adds them to <chain>.
+std::vector<Effect *> make_grading_effects();
+void add_grading_effects(EffectChain *chain);
+
 // A RAII class to pretend temporarily that we don't support compute shaders
 // even if we do. Useful for testing or benchmarking the fragment shader path
 // also on systems that support compute shaders.
@@ -0,0 +1,169 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string>
+
+#include "trace.h"
+
+using namespace std;
+
+namespace movit {
+
+atomic<bool> movit_tracing_active(false);
+
+namespace {
+
+// Protects trace_file and first_event.
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+FILE *trace_file = nullptr;
+bool first_event = true;
+
+// Thread IDs in the trace are small integers, given out in the order
+// the threads first record an event. The GPU track gets its own ID
+// that is not used by any thread.
+const int gpu_track_tid = 0;
+atomic<int> next_tid(1);
+
+int get_trace_tid()
+{
+	static thread_local int tid = next_tid.fetch_add(1);
+	return tid;
+}
+
+string json_escape(const string &str)
+{
+	string ret;
+	for (char ch : str) {
+		switch (ch) {
+		case '"':
+			ret += "\\\"";
+			break;
+		case '\\':
+			ret += "\\\\";
+			break;
+		case '\n':
+			ret += "\\n";
+			break;
+		case '\t':
+			ret += "\\t";
+			break;
+		default:
+			if ((unsigned char)ch < 0x20) {
+				char buf[16];
+				snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)ch);
+				ret += buf;
+			} else {
+				ret += ch;
+			}
+		}
+	}
+	return ret;
+}
+
+// Must be called with trace_lock held.
+void write_event_locked(const string &json)
+{
+	if (trace_file == nullptr) {
+		return;
+	}
+	fprintf(trace_file, "%s%s", first_event ? "\n" : ",\n", json.c_str());
+	first_event = false;
+}
+
+string format_args(const TraceArgs &args)
+{
+	string ret = "{";
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (i != 0) {
+			ret += ",";
+		}
+		ret += "\"" + json_escape(args[i].first) + "\":\"" + json_escape(args[i].second) + "\"";
+	}
+	ret += "}";
+	return ret;
+}
+
+void write_event(const char *category, const string &name, char phase,
+                 double start_us, double duration_us, int tid, const TraceArgs &args)
+{
+	char buf[256];
+	string json = "{\"name\":\"" + json_escape(name) + "\",\"cat\":\"" + json_escape(category) + "\"";
+	if (phase == 'X') {
+		snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+			start_us, duration_us, tid);
+	} else {
+		snprintf(buf, sizeof(buf), ",\"ph\":\"%c\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+			phase, start_us, tid);
+	}
+	json += buf;
+	if (!args.empty()) {
+		json += ",\"args\":" + format_args(args);
+	}
+	json += "}";
+
+	pthread_mutex_lock(&trace_lock);
+	write_event_locked(json);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void close_trace_file_locked()
+{
+	if (trace_file != nullptr) {
+		fprintf(trace_file, "\n]\n");
+		fclose(trace_file);
+		trace_file = nullptr;
+	}
+}
+
+}  // namespace
+
+bool start_tracing(const string &filename)
+{
+	pthread_mutex_lock(&trace_lock);
+	close_trace_file_locked();
+	trace_file = fopen(filename.c_str(), "w");
+	if (trace_file == nullptr) {
+		perror(filename.c_str());
+		movit_tracing_active = false;
+		pthread_mutex_unlock(&trace_lock);
+		return false;
+	}
+	fprintf(trace_file, "[");
+	first_event = true;
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", gpu_track_tid);
+	write_event_locked(buf);
+
+	movit_tracing_active = true;
+	pthread_mutex_unlock(&trace_lock);
+	return true;
+}
+
+void stop_tracing()
+{
+	pthread_mutex_lock(&trace_lock);
+	movit_tracing_active = false;
+	close_trace_file_locked();
+	pthread_mutex_unlock(&trace_lock);
+}
+
+double trace_timestamp_us(chrono::steady_clock::time_point time)
+{
+	return chrono::duration_cast<chrono::nanoseconds>(time.time_since_epoch()).count() * 1e-3;
+}
+
+void trace_complete(const char *category, const string &name,
+                    double start_us, double duration_us,
+                    TraceTrack track, const TraceArgs &args)
+{
+	int tid = (track == TRACE_TRACK_GPU) ? gpu_track_tid : get_trace_tid();
+	write_event(category, name, 'X', start_us, duration_us, tid, args);
+}
+
+void trace_instant(const char *category, const string &name, const TraceArgs &args)
+{
+	double now_us = trace_timestamp_us(chrono::steady_clock::now());
+	write_event(category, name, 'i', now_us, 0.0, get_trace_tid(), args);
+}
+
+}  // namespace movit
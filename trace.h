@@ -0,0 +1,115 @@
+#ifndef _MOVIT_TRACE_H
+#define _MOVIT_TRACE_H 1
+
+// Optional tracing of where Movit spends its time, written as trace events
+// in the JSON format understood by chrome://tracing and Perfetto
+// (ui.perfetto.dev). Tracing covers finalize() and its individual steps,
+// shader compilation, ResourcePool cache hits, misses and sync waits,
+// input uploads, and the CPU submission of each phase. If timer queries
+// are supported, the GPU execution of each phase is also shown, on its own
+// “GPU” track, as “Phase N (GPU)”. (With tiled rendering, that is one event per phase and render,
+// as long as all its tiles together; see EffectChain::set_tile_size().)
+//
+// Tracing is process-wide and off by default; when it is off, the cost of
+// the instrumentation is a single relaxed atomic load per trace point.
+//
+// Thread-safety: All functions can be called from multiple threads at the same
+// time; events are tagged with the thread they came from.
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+
+namespace movit {
+
+// Start writing trace events to the given file, overwriting it if it exists.
+// Returns false if the file could not be opened. If tracing is already active,
+// the previous file is closed first.
+bool start_tracing(const std::string &filename) MUST_CHECK_RESULT;
+
+// Stop tracing, and finish and close the file. Events that are recorded
+// after this (e.g. GPU timings that come back late) are silently dropped.
+void stop_tracing();
+
+// Everything below is intended for use from within Movit only.
+
+extern std::atomic<bool> movit_tracing_active;
+
+inline bool tracing_enabled()
+{
+	return movit_tracing_active.load(std::memory_order_relaxed);
+}
+
+// Extra arguments for an event, shown when it is selected in the viewer.
+typedef std::vector<std::pair<std::string, std::string>> TraceArgs;
+
+// Which track an event should show up on.
+enum TraceTrack {
+	TRACE_TRACK_CURRENT_THREAD,
+	TRACE_TRACK_GPU,
+};
+
+// Microseconds since an arbitrary, but fixed, point in time.
+double trace_timestamp_us(std::chrono::steady_clock::time_point time);
+
+// Record an event spanning the given time interval.
+void trace_complete(const char *category, const std::string &name,
+                    double start_us, double duration_us,
+                    TraceTrack track = TRACE_TRACK_CURRENT_THREAD,
+                    const TraceArgs &args = TraceArgs());
+
+// Record an event that happens at a single point in time (now).
+void trace_instant(const char *category, const std::string &name,
+                   const TraceArgs &args = TraceArgs());
+
+// Records an event from construction to destruction (typically, the end
+// of the current scope) on the current thread. Does nothing if tracing
+// was not enabled at construction time.
+class TraceScope {
+public:
+	TraceScope(const char *category, const char *name, const TraceArgs &args = TraceArgs())
+		: active(tracing_enabled())
+	{
+		if (active) {
+			this->category = category;
+			this->name = name;
+			this->args = args;
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~TraceScope()
+	{
+		if (active) {
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			double start_us = trace_timestamp_us(start);
+			trace_complete(category, name, start_us, trace_timestamp_us(end) - start_us,
+			               TRACE_TRACK_CURRENT_THREAD, args);
+		}
+	}
+
+	// Add an argument after the fact, e.g. when the outcome is not known
+	// at construction time.
+	void add_arg(const std::string &key, const std::string &value)
+	{
+		if (active) {
+			args.push_back(std::make_pair(key, value));
+		}
+	}
+
+private:
+	bool active;
+	const char *category;
+	std::string name;
+	TraceArgs args;
+	std::chrono::steady_clock::time_point start;
+};
+
+}  // namespace movit
+
+#endif  // !defined(_MOVIT_TRACE_H)
@@ -7,6 +7,11 @@ out vec2 tc;
 // Will be overridden by compile_glsl_program() if needed.
 // (It cannot just be prepended, as #version must be before everything.)
 #define FLIP_ORIGIN 0
+#define TILED 0
+
+#if TILED
+uniform vec2 tile_tc_scale, tile_tc_offset;
+#endif
 
 void main()
 {
@@ -18,6 +23,9 @@ void main()
 	//   0.000  0.000  0.000  1.000
 	gl_Position = vec4(2.0 * position.x - 1.0, 2.0 * position.y - 1.0, -1.0, 1.0);
 	tc = texcoord;
+#if TILED
+	tc = tc * tile_tc_scale + tile_tc_offset;
+#endif
 #if FLIP_ORIGIN
 	tc.y = 1.0f - tc.y;
 #endif
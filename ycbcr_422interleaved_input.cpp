@@ -5,6 +5,7 @@
 
 #include "effect_util.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 #include "ycbcr.h"
 #include "ycbcr_422interleaved_input.h"
@@ -58,6 +59,7 @@ void YCbCr422InterleavedInput::set_gl_state(GLuint glsl_program_num, const strin
 
 		if (texture_num[channel] == 0) {
 			// (Re-)upload the texture.
+			TraceScope trace_scope("upload", "YCbCr422InterleavedInput upload");
 			GLuint format, internal_format;
 			if (channel == CHANNEL_LUMA) {
 				format = GL_RG;
@@ -0,0 +1,221 @@
+#include <Eigen/Core>
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "effect_util.h"
+#include "util.h"
+#include "ycbcr.h"
+#include "ycbcr_compute_input.h"
+
+using namespace Eigen;
+using namespace std;
+
+namespace movit {
+
+YCbCrComputeInput::YCbCrComputeInput(const ImageFormat &image_format,
+                                     const YCbCrFormat &ycbcr_format,
+                                     unsigned width, unsigned height,
+                                     YCbCrComputeLayout layout)
+	: image_format(image_format),
+	  ycbcr_format(ycbcr_format),
+	  layout(layout),
+	  width(width),
+	  height(height),
+	  pixel_data(nullptr),
+	  pbo(0),
+	  needs_update(false),
+	  tex(0),
+	  buf(0)
+{
+	if (layout == YCBCR_COMPUTE_LAYOUT_Y41P) {
+		assert(ycbcr_format.chroma_subsampling_x == 4);
+		assert(width % 8 == 0);
+	} else {
+		assert(ycbcr_format.chroma_subsampling_x == 2);
+		assert(width % 2 == 0);
+	}
+	if (layout == YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16) {
+		assert(ycbcr_format.chroma_subsampling_y == 1 || ycbcr_format.chroma_subsampling_y == 2);
+	} else {
+		assert(ycbcr_format.chroma_subsampling_y == 1);
+	}
+	assert(height % ycbcr_format.chroma_subsampling_y == 0);
+	change_ycbcr_format(ycbcr_format);
+
+	pitch = default_pitch();
+
+	register_uniform_int("offset_words", &uniform_offset_words);
+	register_uniform_int("pitch_words", &uniform_pitch_words);
+	register_uniform_int("chroma_plane_words", &uniform_chroma_plane_words);
+	register_uniform_int("width", &uniform_width);
+	register_uniform_int("height", &uniform_height);
+	register_uniform_int("shift", &uniform_shift);
+	register_uniform_float("inv_max_value", &uniform_inv_max_value);
+	register_uniform_mat3("inv_ycbcr_matrix", &uniform_ycbcr_matrix);
+	register_uniform_vec3("offset", uniform_offset);
+	register_uniform_vec2("chroma_position", uniform_chroma_position);
+}
+
+YCbCrComputeInput::~YCbCrComputeInput()
+{
+	if (tex != 0) {
+		glDeleteTextures(1, &tex);
+		check_error();
+	}
+	if (buf != 0) {
+		glDeleteBuffers(1, &buf);
+		check_error();
+	}
+}
+
+unsigned YCbCrComputeInput::default_pitch() const
+{
+	switch (layout) {
+	case YCBCR_COMPUTE_LAYOUT_UYVY:
+	case YCBCR_COMPUTE_LAYOUT_YUYV:
+		return width * 2;
+	case YCBCR_COMPUTE_LAYOUT_Y41P:
+		return width / 8 * 12;
+	case YCBCR_COMPUTE_LAYOUT_V210:
+		// 48 pixels to 128 bytes.
+		return (width + 47) / 48 * 128;
+	case YCBCR_COMPUTE_LAYOUT_YUYV16:
+		return width * 4;
+	case YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16:
+		return width * 2;
+	default:
+		assert(false);
+	}
+}
+
+size_t YCbCrComputeInput::get_frame_size() const
+{
+	size_t rows = height;
+	if (layout == YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16) {
+		rows += height / ycbcr_format.chroma_subsampling_y;
+	}
+	return rows * pitch;
+}
+
+void YCbCrComputeInput::change_ycbcr_format(const YCbCrFormat &ycbcr_format)
+{
+	assert(ycbcr_format.chroma_subsampling_x == this->ycbcr_format.chroma_subsampling_x);
+	assert(ycbcr_format.chroma_subsampling_y == this->ycbcr_format.chroma_subsampling_y);
+	assert(fabs(ycbcr_format.cb_x_position - ycbcr_format.cr_x_position) < 1e-6);
+	assert(fabs(ycbcr_format.cb_y_position - ycbcr_format.cr_y_position) < 1e-6);
+
+	switch (layout) {
+	case YCBCR_COMPUTE_LAYOUT_UYVY:
+	case YCBCR_COMPUTE_LAYOUT_YUYV:
+	case YCBCR_COMPUTE_LAYOUT_Y41P:
+		assert(ycbcr_format.num_levels == 256);
+		break;
+	case YCBCR_COMPUTE_LAYOUT_V210:
+		assert(ycbcr_format.num_levels == 1024);
+		break;
+	default:
+		assert(ycbcr_format.num_levels >= 256 && ycbcr_format.num_levels <= 65536);
+		break;
+	}
+	this->ycbcr_format = ycbcr_format;
+}
+
+bool YCbCrComputeInput::set_int(const std::string& key, int value)
+{
+	if (key == "needs_mipmaps") {
+		// We currently do not support this.
+		return (value == 0);
+	}
+	return Effect::set_int(key, value);
+}
+
+void YCbCrComputeInput::get_compute_dimensions(unsigned output_width, unsigned output_height,
+                                               unsigned *x, unsigned *y, unsigned *z) const
+{
+	// Each workgroup outputs 16x16 pixels (see the shader).
+	*x = (output_width + 15) / 16;
+	*y = (output_height + 15) / 16;
+	*z = 1;
+}
+
+string YCbCrComputeInput::output_fragment_shader()
+{
+	static const char *layout_names[] = {
+		"UYVY", "YUYV", "Y41P", "V210", "YUYV16", "SEMIPLANAR16"
+	};
+	char buf[256];
+	snprintf(buf, sizeof(buf), "#define LAYOUT_%s 1\n#define SUBSAMPLING_X %d\n#define SUBSAMPLING_Y %d\n",
+		layout_names[layout], ycbcr_format.chroma_subsampling_x, ycbcr_format.chroma_subsampling_y);
+	return buf + read_file("ycbcr_compute_input.comp");
+}
+
+void YCbCrComputeInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
+{
+	compute_ycbcr_matrix(ycbcr_format, uniform_offset, &uniform_ycbcr_matrix);
+
+	// Everything is scaled to 0..(num_levels - 1) before the conversion,
+	// so the matrix should not do any extra scaling.
+	unsigned bits = 0;
+	while ((1 << bits) < ycbcr_format.num_levels) {
+		++bits;
+	}
+	uniform_shift = 16 - bits;
+	uniform_inv_max_value = 1.0f / (ycbcr_format.num_levels - 1);
+
+	// Chroma sample i is centered on luma sample i * subsampling + position * (subsampling - 1);
+	// see compute_chroma_offset() for the equivalent for textures.
+	uniform_chroma_position[0] = ycbcr_format.cb_x_position * (ycbcr_format.chroma_subsampling_x - 1);
+	uniform_chroma_position[1] = ycbcr_format.cb_y_position * (ycbcr_format.chroma_subsampling_y - 1);
+
+	uniform_width = width;
+	uniform_height = height;
+	uniform_pitch_words = pitch / 4;
+	uniform_chroma_plane_words = pitch / 4 * height;
+
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+	if (tex == 0) {
+		glGenTextures(1, &tex);
+		check_error();
+		needs_update = true;
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, tex);
+	check_error();
+
+	if (needs_update) {
+		GLuint source;
+		if (pbo != 0) {
+			// Read straight from the PBO; no copy needed.
+			const uintptr_t offset = reinterpret_cast<uintptr_t>(pixel_data);
+			assert(offset % 4 == 0);
+			uniform_offset_words = offset / 4;
+			source = pbo;
+		} else {
+			assert(pixel_data != nullptr);
+			if (buf == 0) {
+				glGenBuffers(1, &buf);
+				check_error();
+			}
+			glBindBuffer(GL_TEXTURE_BUFFER, buf);
+			check_error();
+			glBufferData(GL_TEXTURE_BUFFER, get_frame_size(), pixel_data, GL_STREAM_DRAW);
+			check_error();
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			check_error();
+			uniform_offset_words = 0;
+			source = buf;
+		}
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, source);
+		check_error();
+		needs_update = false;
+	}
+
+	// Not a sampler2D, so it cannot go through register_uniform_sampler2d().
+	set_uniform_int(glsl_program_num, prefix, "raw", *sampler_num);
+	++*sampler_num;
+}
+
+}  // namespace movit
@@ -0,0 +1,160 @@
+#ifndef _MOVIT_YCBCR_COMPUTE_INPUT_H
+#define _MOVIT_YCBCR_COMPUTE_INPUT_H 1
+
+// YCbCrComputeInput is an alternative to YCbCrInput for packed and other
+// Y'CbCr layouts that do not map well to OpenGL textures. Instead of
+// uploading each plane as a texture, the raw frame is copied as-is (one
+// memcpy, or none if you give it a PBO) into a buffer texture, and a compute
+// shader unpacks the samples, upsamples the chroma and converts to R'G'B',
+// all in one dispatch. Supporting a new layout is just a matter of adding
+// an unpacking function to the shader.
+//
+// Chroma is upsampled with a Catmull-Rom (cubic) filter instead of
+// the bilinear filtering YCbCrInput and YCbCr422InterleavedInput use,
+// so it is noticeably sharper; chroma siting is taken from the YCbCrFormat
+// as usual. Like with the other Y'CbCr inputs, this is done in non-linear
+// light, and the chain does the gamma expansion afterwards (typically in
+// the same compute shader phase).
+//
+// This needs compute shaders (see movit_compute_shaders_supported);
+// if you don't have them, use YCbCrRepacker and YCbCrInput instead,
+// which handle the same layouts on the CPU.
+
+#include <epoxy/gl.h>
+#include <string>
+
+#include "effect.h"
+#include "image_format.h"
+#include "input.h"
+#include "ycbcr.h"
+
+namespace movit {
+
+enum YCbCrComputeLayout {
+	// 8-bit 4:2:2, interleaved as Cb Y'0 Cr Y'1.
+	YCBCR_COMPUTE_LAYOUT_UYVY,
+
+	// 8-bit 4:2:2, interleaved as Y'0 Cb Y'1 Cr (also known as YUY2).
+	YCBCR_COMPUTE_LAYOUT_YUYV,
+
+	// 8-bit 4:1:1, eight pixels in 12 bytes as
+	// Cb0 Y'0 Cr0 Y'1 Cb4 Y'2 Cr4 Y'3 Y'4 Y'5 Y'6 Y'7 (also known as Y41P).
+	YCBCR_COMPUTE_LAYOUT_Y41P,
+
+	// 10-bit 4:2:2, six pixels in four 32-bit little-endian words
+	// as used by most SDI capture cards (also known as v210).
+	YCBCR_COMPUTE_LAYOUT_V210,
+
+	// 10- to 16-bit 4:2:2 in 16-bit little-endian words, interleaved as
+	// Y'0 Cb Y'1 Cr, with each sample in the top bits of its word
+	// (e.g. Y210 or Y212).
+	YCBCR_COMPUTE_LAYOUT_YUYV16,
+
+	// 10- to 16-bit 4:2:0 or 4:2:2 in 16-bit little-endian words,
+	// with each sample in the top bits of its word; all of Y' first,
+	// then Cb and Cr interleaved (e.g. P010 or P210). Both planes have
+	// the same pitch, and the second one starts right after the first.
+	YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16,
+};
+
+class YCbCrComputeInput : public Input {
+public:
+	// <ycbcr_format> must match <layout>, ie., chroma_subsampling_x
+	// must be 2 (or 4 for YCBCR_COMPUTE_LAYOUT_Y41P), chroma_subsampling_y
+	// must be 1 (or 2, for 4:2:0 YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16),
+	// and num_levels must be 256 for the 8-bit layouts and 1024 for v210.
+	// For the 16-bit layouts, num_levels decides how many of the top bits
+	// are used. Since Cb and Cr are always sampled together here, they
+	// must also have the same position.
+	YCbCrComputeInput(const ImageFormat &image_format,
+	                  const YCbCrFormat &ycbcr_format,
+	                  unsigned width, unsigned height,
+	                  YCbCrComputeLayout layout);
+	~YCbCrComputeInput();
+
+	std::string effect_type_id() const override { return "YCbCrComputeInput"; }
+
+	bool can_output_linear_gamma() const override { return false; }
+	AlphaHandling alpha_handling() const override { return OUTPUT_BLANK_ALPHA; }
+	bool is_compute_shader() const override { return true; }
+	void get_compute_dimensions(unsigned output_width, unsigned output_height,
+	                            unsigned *x, unsigned *y, unsigned *z) const override;
+
+	std::string output_fragment_shader() override;
+
+	// Uploads the frame if it has changed since last time.
+	void set_gl_state(GLuint glsl_program_num, const std::string& prefix, unsigned *sampler_num) override;
+
+	unsigned get_width() const override { return width; }
+	unsigned get_height() const override { return height; }
+	Colorspace get_color_space() const override { return image_format.color_space; }
+	GammaCurve get_gamma_curve() const override { return image_format.gamma_curve; }
+	bool can_supply_mipmaps() const override { return false; }
+
+	// The size of a frame in bytes, given the current pitch.
+	size_t get_frame_size() const;
+
+	// Tells the input where to fetch the raw frame, which must be
+	// get_frame_size() bytes long. As with the other inputs, if you change
+	// the data, you must call set_pixel_data() again (using the same pointer
+	// is fine), or invalidate_pixel_data().
+	//
+	// The data can either be a regular pointer (if pbo==0), or a byte offset
+	// into a PBO, which must then be a multiple of four. In the latter case,
+	// the PBO is used directly as the storage for the buffer texture,
+	// so there is no copy at all.
+	void set_pixel_data(const unsigned char *pixel_data, GLuint pbo = 0)
+	{
+		this->pixel_data = pixel_data;
+		this->pbo = pbo;
+		invalidate_pixel_data();
+	}
+
+	void invalidate_pixel_data() { needs_update = true; }
+
+	// The distance between the start of two rows, in bytes.
+	// The default is the width rounded up to whole groups of pixels,
+	// except for v210, which (by convention) is rounded up to a multiple
+	// of 128 bytes. Must be a multiple of four.
+	void set_pitch(unsigned pitch)
+	{
+		assert(pitch % 4 == 0);
+		this->pitch = pitch;
+		invalidate_pixel_data();
+	}
+
+	// You can change the Y'CbCr format (but not the layout or chroma
+	// subsampling) freely, also after finalize.
+	void change_ycbcr_format(const YCbCrFormat &ycbcr_format);
+
+	bool set_int(const std::string& key, int value) override;
+
+private:
+	// The pitch used if set_pitch() is not called; see there.
+	unsigned default_pitch() const;
+
+	ImageFormat image_format;
+	YCbCrFormat ycbcr_format;
+	YCbCrComputeLayout layout;
+	unsigned width, height, pitch;
+
+	const unsigned char *pixel_data;
+	GLuint pbo;
+	bool needs_update;
+
+	// The buffer texture we read from, and the buffer object holding
+	// the data if it was not given in a PBO.
+	GLuint tex, buf;
+
+	// Positions in the buffer are in 32-bit words.
+	int uniform_offset_words, uniform_pitch_words, uniform_chroma_plane_words;
+	int uniform_width, uniform_height, uniform_shift;
+	float uniform_inv_max_value;
+	Eigen::Matrix3d uniform_ycbcr_matrix;
+	float uniform_offset[3];
+	float uniform_chroma_position[2];
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_YCBCR_COMPUTE_INPUT_H)
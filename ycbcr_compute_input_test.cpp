@@ -0,0 +1,296 @@
+// Unit tests for YCbCrComputeInput.
+
+#include <epoxy/gl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "init.h"
+#include "test_util.h"
+#include "util.h"
+#include "ycbcr_compute_input.h"
+#include "ycbcr_input.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+void write_le32(unsigned char *dst, uint32_t x)
+{
+	write_le16(dst, x & 0xffff);
+	write_le16(dst + 2, x >> 16);
+}
+
+// Packs planar Y'CbCr (<bits> bits per sample, chroma subsampled as
+// <layout> requires) into the raw frame <input> expects, with its default pitch.
+vector<unsigned char> pack_frame(const YCbCrComputeInput &input, YCbCrComputeLayout layout,
+                                 unsigned chroma_subsampling_y, unsigned bits,
+                                 const unsigned *luma, const unsigned *cb, const unsigned *cr)
+{
+	const unsigned width = input.get_width(), height = input.get_height();
+	const unsigned chroma_height = height / chroma_subsampling_y;
+	const unsigned rows = (layout == YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16) ? height + chroma_height : height;
+	const unsigned pitch = input.get_frame_size() / rows;
+	const unsigned shift = 16 - bits;
+
+	vector<unsigned char> data(input.get_frame_size());
+	for (unsigned y = 0; y < height; ++y) {
+		unsigned char *row = &data[y * pitch];
+		const unsigned *l = luma + y * width;
+		switch (layout) {
+		case YCBCR_COMPUTE_LAYOUT_UYVY:
+		case YCBCR_COMPUTE_LAYOUT_YUYV:
+			for (unsigned x = 0; x < width / 2; ++x) {
+				const unsigned c = y * (width / 2) + x;
+				const unsigned char uyvy[] = { (unsigned char)cb[c], (unsigned char)l[x * 2], (unsigned char)cr[c], (unsigned char)l[x * 2 + 1] };
+				const unsigned char yuyv[] = { uyvy[1], uyvy[0], uyvy[3], uyvy[2] };
+				memcpy(row + x * 4, (layout == YCBCR_COMPUTE_LAYOUT_UYVY) ? uyvy : yuyv, 4);
+			}
+			break;
+		case YCBCR_COMPUTE_LAYOUT_Y41P:
+			for (unsigned x = 0; x < width / 8; ++x) {
+				const unsigned c = y * (width / 4) + x * 2;
+				const unsigned values[] = {
+					cb[c], l[x * 8 + 0], cr[c], l[x * 8 + 1], cb[c + 1], l[x * 8 + 2],
+					cr[c + 1], l[x * 8 + 3], l[x * 8 + 4], l[x * 8 + 5], l[x * 8 + 6], l[x * 8 + 7]
+				};
+				for (unsigned i = 0; i < 12; ++i) {
+					row[x * 12 + i] = values[i];
+				}
+			}
+			break;
+		case YCBCR_COMPUTE_LAYOUT_V210:
+			for (unsigned x = 0; x < width / 6; ++x) {
+				const unsigned *lb = l + x * 6;
+				const unsigned *cbb = cb + y * (width / 2) + x * 3;
+				const unsigned *crb = cr + y * (width / 2) + x * 3;
+				write_le32(row + x * 16 + 0, cbb[0] | (lb[0] << 10) | (crb[0] << 20));
+				write_le32(row + x * 16 + 4, lb[1] | (cbb[1] << 10) | (lb[2] << 20));
+				write_le32(row + x * 16 + 8, crb[1] | (lb[3] << 10) | (cbb[2] << 20));
+				write_le32(row + x * 16 + 12, lb[4] | (crb[2] << 10) | (lb[5] << 20));
+			}
+			break;
+		case YCBCR_COMPUTE_LAYOUT_YUYV16:
+			for (unsigned x = 0; x < width / 2; ++x) {
+				const unsigned c = y * (width / 2) + x;
+				write_le16(row + x * 8 + 0, l[x * 2] << shift);
+				write_le16(row + x * 8 + 2, cb[c] << shift);
+				write_le16(row + x * 8 + 4, l[x * 2 + 1] << shift);
+				write_le16(row + x * 8 + 6, cr[c] << shift);
+			}
+			break;
+		case YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16:
+			for (unsigned x = 0; x < width; ++x) {
+				write_le16(row + x * 2, l[x] << shift);
+			}
+			break;
+		}
+	}
+	if (layout == YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16) {
+		for (unsigned y = 0; y < chroma_height; ++y) {
+			unsigned char *row = &data[(height + y) * pitch];
+			for (unsigned x = 0; x < width / 2; ++x) {
+				const unsigned c = y * (width / 2) + x;
+				write_le16(row + x * 4 + 0, cb[c] << shift);
+				write_le16(row + x * 4 + 2, cr[c] << shift);
+			}
+		}
+	}
+	return data;
+}
+
+YCbCrFormat get_format(unsigned chroma_subsampling_x, unsigned chroma_subsampling_y, unsigned bits)
+{
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 1 << bits;
+	ycbcr_format.chroma_subsampling_x = chroma_subsampling_x;
+	ycbcr_format.chroma_subsampling_y = chroma_subsampling_y;
+	ycbcr_format.cb_x_position = 0.0f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.0f;
+	ycbcr_format.cr_y_position = 0.5f;
+	return ycbcr_format;
+}
+
+}  // namespace
+
+TEST(YCbCrComputeInputTest, PureColorsInAllLayouts) {
+	// Divisible by both six (for v210) and eight (for Y41P).
+	const unsigned width = 24, height = 5;
+
+	// One pure color per row, calculated with the formulas in Rec. 601
+	// section 2.5.4 (same as in YCbCrInputTest.Simple444).
+	const unsigned row_y[] = { 16, 235, 81, 145, 41 };
+	const unsigned row_cb[] = { 128, 128, 90, 54, 240 };
+	const unsigned row_cr[] = { 128, 128, 240, 34, 110 };
+	const float row_rgb[][3] = {
+		{ 0.0f, 0.0f, 0.0f },
+		{ 1.0f, 1.0f, 1.0f },
+		{ 1.0f, 0.0f, 0.0f },
+		{ 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f },
+	};
+
+	float expected_data[width * height * 4];
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			for (unsigned c = 0; c < 3; ++c) {
+				expected_data[(y * width + x) * 4 + c] = row_rgb[y][c];
+			}
+			expected_data[(y * width + x) * 4 + 3] = 1.0f;
+		}
+	}
+
+	for (YCbCrComputeLayout layout : { YCBCR_COMPUTE_LAYOUT_UYVY, YCBCR_COMPUTE_LAYOUT_YUYV,
+	                                   YCBCR_COMPUTE_LAYOUT_Y41P, YCBCR_COMPUTE_LAYOUT_V210,
+	                                   YCBCR_COMPUTE_LAYOUT_YUYV16, YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16 }) {
+		const bool eight_bit = (layout == YCBCR_COMPUTE_LAYOUT_UYVY ||
+		                        layout == YCBCR_COMPUTE_LAYOUT_YUYV ||
+		                        layout == YCBCR_COMPUTE_LAYOUT_Y41P);
+		const unsigned bits = eight_bit ? 8 : 10;
+		const unsigned chroma_subsampling_x = (layout == YCBCR_COMPUTE_LAYOUT_Y41P) ? 4 : 2;
+
+		// For 10-bit, the same values, just with two extra zero bits.
+		vector<unsigned> luma, cb, cr;
+		for (unsigned y = 0; y < height; ++y) {
+			luma.insert(luma.end(), width, row_y[y] << (bits - 8));
+			cb.insert(cb.end(), width / chroma_subsampling_x, row_cb[y] << (bits - 8));
+			cr.insert(cr.end(), width / chroma_subsampling_x, row_cr[y] << (bits - 8));
+		}
+
+		ImageFormat format;
+		format.color_space = COLORSPACE_sRGB;
+		format.gamma_curve = GAMMA_sRGB;
+
+		EffectChainTester tester(nullptr, width, height);
+		if (!movit_compute_shaders_supported) {
+			fprintf(stderr, "Skipping test; no support for compile shaders.\n");
+			return;
+		}
+		YCbCrComputeInput *input = new YCbCrComputeInput(format, get_format(chroma_subsampling_x, 1, bits), width, height, layout);
+		vector<unsigned char> data = pack_frame(*input, layout, 1, bits, luma.data(), cb.data(), cr.data());
+		input->set_pixel_data(data.data());
+		tester.get_chain()->add_input(input);
+
+		float out_data[width * height * 4];
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+		// Y'CbCr isn't 100% accurate (the input values are rounded),
+		// so we need some leeway.
+		SCOPED_TRACE(layout);
+		expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+	}
+}
+
+TEST(YCbCrComputeInputTest, MatchesYCbCrInputOnSmoothChroma) {
+	// 10-bit 4:2:0 with random luma, and chroma that changes linearly
+	// in both directions. Both linear and cubic interpolation reproduce
+	// that exactly, except near the edges, so if the siting is the same,
+	// the two should be the same in the middle of the picture.
+	const unsigned width = 24, height = 16, bits = 10;
+	const unsigned chroma_width = width / 2, chroma_height = height / 2;
+	vector<unsigned> luma(width * height), cb(chroma_width * chroma_height), cr(chroma_width * chroma_height);
+	vector<uint16_t> luma16(luma.size()), cb16(cb.size()), cr16(cr.size());
+	for (unsigned i = 0; i < luma.size(); ++i) {
+		luma16[i] = luma[i] = 64 + rand() % 877;
+	}
+	for (unsigned y = 0; y < chroma_height; ++y) {
+		for (unsigned x = 0; x < chroma_width; ++x) {
+			cb16[y * chroma_width + x] = cb[y * chroma_width + x] = 300 + x * 20 + y * 30;
+			cr16[y * chroma_width + x] = cr[y * chroma_width + x] = 700 - x * 25 + y * 10;
+		}
+	}
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+	const YCbCrFormat ycbcr_format = get_format(2, 2, bits);
+
+	vector<float> expected_data(width * height * 4), out_data(width * height * 4);
+	{
+		EffectChainTester tester(nullptr, width, height);
+		YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height, YCBCR_INPUT_PLANAR, GL_UNSIGNED_SHORT);
+		input->set_pixel_data(0, luma16.data());
+		input->set_pixel_data(1, cb16.data());
+		input->set_pixel_data(2, cr16.data());
+		tester.get_chain()->add_input(input);
+		tester.run(expected_data.data(), GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+	vector<unsigned char> data;
+	{
+		EffectChainTester tester(nullptr, width, height);
+		if (!movit_compute_shaders_supported) {
+			fprintf(stderr, "Skipping test; no support for compile shaders.\n");
+			return;
+		}
+		YCbCrComputeInput *input = new YCbCrComputeInput(format, ycbcr_format, width, height, YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16);
+		data = pack_frame(*input, YCBCR_COMPUTE_LAYOUT_SEMIPLANAR16, 2, bits, luma.data(), cb.data(), cr.data());
+		input->set_pixel_data(data.data());
+		tester.get_chain()->add_input(input);
+		tester.run(out_data.data(), GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+
+	// Compare only the middle, two chroma samples away from the edges.
+	const unsigned border = 4;
+	const unsigned inner_width = width - 2 * border, inner_height = height - 2 * border;
+	vector<float> expected_inner, out_inner;
+	for (unsigned y = border; y < height - border; ++y) {
+		const unsigned begin = (y * width + border) * 4, end = begin + inner_width * 4;
+		expected_inner.insert(expected_inner.end(), expected_data.begin() + begin, expected_data.begin() + end);
+		out_inner.insert(out_inner.end(), out_data.begin() + begin, out_data.begin() + end);
+	}
+	expect_equal(expected_inner.data(), out_inner.data(), inner_width * 4, inner_height);
+}
+
+TEST(YCbCrComputeInputTest, ReadsDirectlyFromPBO) {
+	const unsigned width = 2, height = 2, pbo_offset = 64;
+
+	// Gray and white on top, black and white at the bottom.
+	const unsigned luma[] = { 126, 235, 16, 235 };
+	const unsigned chroma[] = { 128, 128 };
+	float expected_data[] = {
+		0.5f, 1.0f,
+		0.0f, 1.0f,
+	};
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	EffectChainTester tester(nullptr, width, height);
+	if (!movit_compute_shaders_supported) {
+		fprintf(stderr, "Skipping test; no support for compile shaders.\n");
+		return;
+	}
+	YCbCrComputeInput *input = new YCbCrComputeInput(format, get_format(2, 1, 8), width, height, YCBCR_COMPUTE_LAYOUT_UYVY);
+	vector<unsigned char> data = pack_frame(*input, YCBCR_COMPUTE_LAYOUT_UYVY, 1, 8, luma, chroma, chroma);
+
+	GLuint pbo;
+	glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER_ARB, pbo_offset + data.size(), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_PIXEL_UNPACK_BUFFER_ARB, pbo_offset, data.size(), data.data());
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	input->set_pixel_data((unsigned char *)BUFFER_OFFSET(pbo_offset), pbo);
+	tester.get_chain()->add_input(input);
+
+	float out_data[width * height];
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// 126 is not exactly halfway between 16 and 235.
+	expect_equal(expected_data, out_data, width, height, 0.01, 0.005);
+
+	glDeleteBuffers(1, &pbo);
+}
+
+}  // namespace movit
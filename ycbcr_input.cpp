@@ -1,12 +1,16 @@
 #include <Eigen/Core>
 #include <Eigen/LU>
+#include <math.h>
 #include <epoxy/gl.h>
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 
 #include "effect_util.h"
+#include "init.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 #include "ycbcr.h"
 #include "ycbcr_input.h"
@@ -16,6 +20,100 @@ using namespace std;
 
 namespace movit {
 
+namespace {
+
+// The four-tap kernels for YCbCrInput::ChromaFilter, at distance <x>
+// from the sample; all are zero for |x| >= 2.
+float chroma_kernel(int filter, float x)
+{
+	x = fabs(x);
+	if (x >= 2.0f) {
+		return 0.0f;
+	}
+	if (filter == YCbCrInput::CHROMA_FILTER_LANCZOS) {
+		if (x < 1e-6f) {
+			return 1.0f;
+		}
+		const float px = M_PI * x;
+		return 2.0f * sin(px) * sin(px * 0.5f) / (px * px);
+	}
+
+	// The Mitchell-Netravali family of cubics.
+	float B, C;
+	if (filter == YCbCrInput::CHROMA_FILTER_BICUBIC) {
+		B = C = 1.0f / 3.0f;
+	} else {
+		assert(filter == YCbCrInput::CHROMA_FILTER_CATMULL_ROM);
+		B = 0.0f;
+		C = 0.5f;
+	}
+	if (x < 1.0f) {
+		return ((12.0f - 9.0f * B - 6.0f * C) * x * x * x +
+		        (-18.0f + 12.0f * B + 6.0f * C) * x * x +
+		        (6.0f - 2.0f * B)) * (1.0f / 6.0f);
+	} else {
+		return ((-B - 6.0f * C) * x * x * x +
+		        (6.0f * B + 30.0f * C) * x * x +
+		        (-12.0f * B - 48.0f * C) * x +
+		        (8.0f * B + 24.0f * C)) * (1.0f / 6.0f);
+	}
+}
+
+// Computes the taps for upsampling one direction of a chroma plane of <size>
+// samples, subsampled by <subsampling> with the given chroma position.
+// Output pixel <phase> of each chroma sample n lies at f = n + (phase -
+// pos * (subsampling - 1)) / subsampling in chroma sample units, so its four
+// taps are the same for all n, relative to n; they are stored as normalized
+// texture coordinates relative to sample n's left edge. The two outer taps
+// are sampled at texel centers, and the two middle ones (which always have
+// the same sign) are merged into one bilinear lookup, like in ResampleEffect.
+//
+// If the direction is not subsampled, there is only one phase, with one tap.
+void compute_chroma_taps(int filter, float pos, unsigned subsampling, unsigned size, float *offsets, float *weights)
+{
+	for (unsigned i = 0; i < YCbCrInput::MAX_CHROMA_PHASES * 3; ++i) {
+		offsets[i] = weights[i] = 0.0f;
+	}
+	if (subsampling == 1) {
+		offsets[0] = 0.5f / size;
+		weights[0] = 1.0f;
+		return;
+	}
+	assert(subsampling <= YCbCrInput::MAX_CHROMA_PHASES);
+
+	const float num_subtexels = size / movit_texel_subpixel_precision;
+	const float inv_num_subtexels = movit_texel_subpixel_precision / size;
+	for (unsigned phase = 0; phase < subsampling; ++phase) {
+		const float f = (phase - pos * (subsampling - 1)) / subsampling;
+		const int base = lrintf(floor(f));
+		const float t = f - base;
+
+		float w[4], sum = 0.0f;
+		for (int i = 0; i < 4; ++i) {
+			w[i] = chroma_kernel(filter, t - (i - 1));
+			if (fabs(w[i]) < 1e-6f) {
+				// At the kernel's zero crossings; make sure the middle
+				// two do not end up with different signs.
+				w[i] = 0.0f;
+			}
+			sum += w[i];
+		}
+		for (int i = 0; i < 4; ++i) {
+			w[i] /= sum;
+		}
+
+		float *o = offsets + phase * 3, *wt = weights + phase * 3;
+		o[0] = (base - 1 + 0.5f) / size;
+		wt[0] = w[0];
+		combine_two_samples(w[1], w[2], (base + 0.5f) / size, 1.0f / size, float(size),
+		                    num_subtexels, inv_num_subtexels, &o[1], &wt[1], nullptr);
+		o[2] = (base + 2 + 0.5f) / size;
+		wt[2] = w[3];
+	}
+}
+
+}  // namespace
+
 YCbCrInput::YCbCrInput(const ImageFormat &image_format,
                        const YCbCrFormat &ycbcr_format,
                        unsigned width, unsigned height,
@@ -25,6 +123,8 @@ YCbCrInput::YCbCrInput(const ImageFormat &image_format,
 	  ycbcr_format(ycbcr_format),
 	  ycbcr_input_splitting(ycbcr_input_splitting),
 	  needs_mipmaps(false),
+	  chroma_filter(CHROMA_FILTER_BILINEAR),
+	  use_chroma_filter(false),
 	  type(type),
 	  width(width),
 	  height(height),
@@ -60,6 +160,20 @@ YCbCrInput::YCbCrInput(const ImageFormat &image_format,
 	register_uniform_vec3("offset", uniform_offset);
 	register_uniform_vec2("cb_offset", (float *)&uniform_cb_offset);
 	register_uniform_vec2("cr_offset", (float *)&uniform_cr_offset);
+
+	if (ycbcr_input_splitting != YCBCR_INPUT_INTERLEAVED) {
+		register_int("chroma_filter", &chroma_filter);
+		register_uniform_vec2("chroma_size", uniform_chroma_size);
+		register_uniform_vec2("inv_chroma_size", uniform_inv_chroma_size);
+		register_uniform_vec3_array("cb_taps_x_offsets", uniform_cb_taps_x.offsets, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cb_taps_x_weights", uniform_cb_taps_x.weights, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cb_taps_y_offsets", uniform_cb_taps_y.offsets, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cb_taps_y_weights", uniform_cb_taps_y.weights, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cr_taps_x_offsets", uniform_cr_taps_x.offsets, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cr_taps_x_weights", uniform_cr_taps_x.weights, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cr_taps_y_offsets", uniform_cr_taps_y.offsets, MAX_CHROMA_PHASES);
+		register_uniform_vec3_array("cr_taps_y_weights", uniform_cr_taps_y.weights, MAX_CHROMA_PHASES);
+	}
 }
 
 YCbCrInput::~YCbCrInput()
@@ -69,7 +183,7 @@ YCbCrInput::~YCbCrInput()
 	}
 }
 
-void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
+void YCbCrInput::compute_conversion_uniforms()
 {
 	compute_ycbcr_matrix(ycbcr_format, uniform_offset, &uniform_ycbcr_matrix, type);
 
@@ -83,6 +197,42 @@ void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, uns
 	uniform_cr_offset.y = compute_chroma_offset(
 		ycbcr_format.cr_y_position, ycbcr_format.chroma_subsampling_y, heights[2]);
 
+	if (use_chroma_filter) {
+		assert(ycbcr_format.chroma_subsampling_x == finalized_subsampling_x);
+		assert(ycbcr_format.chroma_subsampling_y == finalized_subsampling_y);
+		uniform_chroma_size[0] = widths[1];
+		uniform_chroma_size[1] = heights[1];
+		uniform_inv_chroma_size[0] = 1.0f / widths[1];
+		uniform_inv_chroma_size[1] = 1.0f / heights[1];
+		compute_chroma_taps(chroma_filter, ycbcr_format.cb_x_position, ycbcr_format.chroma_subsampling_x, widths[1],
+			uniform_cb_taps_x.offsets, uniform_cb_taps_x.weights);
+		compute_chroma_taps(chroma_filter, ycbcr_format.cb_y_position, ycbcr_format.chroma_subsampling_y, heights[1],
+			uniform_cb_taps_y.offsets, uniform_cb_taps_y.weights);
+		compute_chroma_taps(chroma_filter, ycbcr_format.cr_x_position, ycbcr_format.chroma_subsampling_x, widths[2],
+			uniform_cr_taps_x.offsets, uniform_cr_taps_x.weights);
+		compute_chroma_taps(chroma_filter, ycbcr_format.cr_y_position, ycbcr_format.chroma_subsampling_y, heights[2],
+			uniform_cr_taps_y.offsets, uniform_cr_taps_y.weights);
+	}
+}
+
+void YCbCrInput::decide_chroma_filter()
+{
+	// Only bother with the filter if there is something to upsample.
+	use_chroma_filter = (chroma_filter != CHROMA_FILTER_BILINEAR &&
+		ycbcr_input_splitting != YCBCR_INPUT_INTERLEAVED &&
+		(ycbcr_format.chroma_subsampling_x > 1 || ycbcr_format.chroma_subsampling_y > 1));
+	if (use_chroma_filter) {
+		assert(ycbcr_format.chroma_subsampling_x <= MAX_CHROMA_PHASES);
+		assert(ycbcr_format.chroma_subsampling_y <= MAX_CHROMA_PHASES);
+	}
+	finalized_subsampling_x = ycbcr_format.chroma_subsampling_x;
+	finalized_subsampling_y = ycbcr_format.chroma_subsampling_y;
+}
+
+void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsigned *sampler_num)
+{
+	compute_conversion_uniforms();
+
 	for (unsigned channel = 0; channel < num_channels; ++channel) {
 		glActiveTexture(GL_TEXTURE0 + *sampler_num + channel);
 		check_error();
@@ -120,6 +270,7 @@ void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, uns
 			}
 
 			// (Re-)upload the texture.
+			TraceScope trace_scope("upload", "YCbCrInput upload");
 			texture_num[channel] = resource_pool->create_2d_texture(internal_format, widths[channel], heights[channel]);
 			glBindTexture(GL_TEXTURE_2D, texture_num[channel]);
 			check_error();
@@ -138,6 +289,7 @@ void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, uns
 			if (needs_mipmaps) {
 				glGenerateMipmap(GL_TEXTURE_2D);
 				check_error();
+				resource_pool->mark_texture_mipmapped(texture_num[channel]);
 			}
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 			check_error();
@@ -167,6 +319,115 @@ void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, uns
 	*sampler_num += num_channels;
 }
 
+void YCbCrInput::set_cpu_state()
+{
+	// There is no shader to keep in sync with, so the filter
+	// and the subsampling can change freely here.
+	decide_chroma_filter();
+	compute_conversion_uniforms();
+}
+
+float YCbCrInput::get_texel(unsigned channel, unsigned component, unsigned num_components, unsigned x, unsigned y) const
+{
+	const size_t index = size_t(y) * pitch[channel] + x;
+	if (type == GL_UNSIGNED_INT_2_10_10_10_REV) {
+		const uint32_t word = reinterpret_cast<const uint32_t *>(pixel_data[channel])[index];
+		return ((word >> (component * 10)) & 0x3ff) * (1.0f / 1023.0f);
+	} else if (type == GL_UNSIGNED_SHORT) {
+		return reinterpret_cast<const uint16_t *>(pixel_data[channel])[index * num_components + component] * (1.0f / 65535.0f);
+	} else {
+		assert(type == GL_UNSIGNED_BYTE);
+		return pixel_data[channel][index * num_components + component] * (1.0f / 255.0f);
+	}
+}
+
+float YCbCrInput::sample_bilinear(unsigned channel, unsigned component, unsigned num_components, float x, float y) const
+{
+	const int w = widths[channel], h = heights[channel];
+	const float fx = min(max(x * w - 0.5f, -1.0f), float(w));
+	const float fy = min(max(y * h - 0.5f, -1.0f), float(h));
+	const int ix = int(floorf(fx)), iy = int(floorf(fy));
+	const float wx = fx - ix, wy = fy - iy;
+	const unsigned x0 = min(max(ix, 0), w - 1), x1 = min(max(ix + 1, 0), w - 1);
+	const unsigned y0 = min(max(iy, 0), h - 1), y1 = min(max(iy + 1, 0), h - 1);
+
+	const float p00 = get_texel(channel, component, num_components, x0, y0);
+	const float p01 = get_texel(channel, component, num_components, x1, y0);
+	const float p10 = get_texel(channel, component, num_components, x0, y1);
+	const float p11 = get_texel(channel, component, num_components, x1, y1);
+	const float top = p00 + wx * (p01 - p00);
+	const float bottom = p10 + wx * (p11 - p10);
+	return top + wy * (bottom - top);
+}
+
+float YCbCrInput::sample_filtered(unsigned channel, unsigned component, unsigned num_components,
+                                  const ChromaTaps &taps_x, const ChromaTaps &taps_y, unsigned x, unsigned y) const
+{
+	const unsigned phase_x = x % ycbcr_format.chroma_subsampling_x;
+	const unsigned phase_y = y % ycbcr_format.chroma_subsampling_y;
+	const float block_x = float(x / ycbcr_format.chroma_subsampling_x) / widths[channel];
+	const float block_y = float(y / ycbcr_format.chroma_subsampling_y) / heights[channel];
+	const unsigned num_taps_x = ycbcr_format.chroma_subsampling_x > 1 ? 3 : 1;
+	const unsigned num_taps_y = ycbcr_format.chroma_subsampling_y > 1 ? 3 : 1;
+
+	float sum = 0.0f;
+	for (unsigned j = 0; j < num_taps_y; ++j) {
+		const float tc_y = block_y + taps_y.offsets[phase_y * 3 + j];
+		float row = 0.0f;
+		for (unsigned i = 0; i < num_taps_x; ++i) {
+			const float tc_x = block_x + taps_x.offsets[phase_x * 3 + i];
+			row += taps_x.weights[phase_x * 3 + i] * sample_bilinear(channel, component, num_components, tc_x, tc_y);
+		}
+		sum += taps_y.weights[phase_y * 3 + j] * row;
+	}
+	return sum;
+}
+
+void YCbCrInput::render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+                                 unsigned y0, unsigned y1, float *dst) const
+{
+	for (unsigned channel = 0; channel < num_channels; ++channel) {
+		assert(pixel_data[channel] != nullptr && pbos[channel] == 0);
+	}
+	assert(width == widths[0] && height == heights[0]);
+
+	Matrix3f ycbcr_matrix = uniform_ycbcr_matrix.cast<float>();
+	for (unsigned y = y0; y < y1; ++y) {
+		// See ycbcr_input.frag; the data has a top-left origin.
+		const unsigned data_y = height - 1 - y;
+		const float tc_y = (data_y + 0.5f) / height;
+		float *out = dst + size_t(y - y0) * width * 4;
+		for (unsigned x = 0; x < width; ++x) {
+			const float tc_x = (x + 0.5f) / width;
+			Vector3f ycbcr;
+			if (ycbcr_input_splitting == YCBCR_INPUT_INTERLEAVED) {
+				for (unsigned c = 0; c < 3; ++c) {
+					ycbcr[c] = get_texel(0, c, 3, x, data_y);
+				}
+			} else if (use_chroma_filter) {
+				const unsigned cr_channel = (ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) ? 1 : 2;
+				const unsigned num_components = (ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) ? 2 : 1;
+				ycbcr[0] = get_texel(0, 0, 1, x, data_y);
+				ycbcr[1] = sample_filtered(1, 0, num_components, uniform_cb_taps_x, uniform_cb_taps_y, x, data_y);
+				ycbcr[2] = sample_filtered(cr_channel, num_components - 1, num_components, uniform_cr_taps_x, uniform_cr_taps_y, x, data_y);
+			} else if (ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) {
+				ycbcr[0] = get_texel(0, 0, 1, x, data_y);
+				ycbcr[1] = sample_bilinear(1, 0, 2, tc_x + uniform_cb_offset.x, tc_y + uniform_cb_offset.y);
+				ycbcr[2] = sample_bilinear(1, 1, 2, tc_x + uniform_cr_offset.x, tc_y + uniform_cr_offset.y);
+			} else {
+				ycbcr[0] = get_texel(0, 0, 1, x, data_y);
+				ycbcr[1] = sample_bilinear(1, 0, 1, tc_x + uniform_cb_offset.x, tc_y + uniform_cb_offset.y);
+				ycbcr[2] = sample_bilinear(2, 0, 1, tc_x + uniform_cr_offset.x, tc_y + uniform_cr_offset.y);
+			}
+			const Vector3f rgb = ycbcr_matrix * (ycbcr - Vector3f(uniform_offset[0], uniform_offset[1], uniform_offset[2]));
+			out[x * 4 + 0] = rgb[0];
+			out[x * 4 + 1] = rgb[1];
+			out[x * 4 + 2] = rgb[2];
+			out[x * 4 + 3] = 1.0f;
+		}
+	}
+}
+
 string YCbCrInput::output_fragment_shader()
 {
 	string frag_shader;
@@ -185,8 +446,20 @@ string YCbCrInput::output_fragment_shader()
 		frag_shader += "#define Y_CB_CR_SAME_TEXTURE 0\n#define CB_CR_SAME_TEXTURE 0\n";
 	}
 
+	decide_chroma_filter();
+	if (use_chroma_filter) {
+		char buf[256];
+		snprintf(buf, sizeof(buf), "#define CHROMA_FILTER 1\n#define SUBSAMPLING_X %d\n#define SUBSAMPLING_Y %d\n#define CHROMA_TAPS_X %d\n#define CHROMA_TAPS_Y %d\n",
+			finalized_subsampling_x, finalized_subsampling_y,
+			finalized_subsampling_x > 1 ? 3 : 1, finalized_subsampling_y > 1 ? 3 : 1);
+		frag_shader += buf;
+	}
+
 	frag_shader += read_file("ycbcr_input.frag");
 	frag_shader += "#undef CB_CR_SAME_TEXTURE\n#undef Y_CB_CR_SAME_TEXTURE\n";
+	if (use_chroma_filter) {
+		frag_shader += "#undef CHROMA_FILTER\n#undef SUBSAMPLING_X\n#undef SUBSAMPLING_Y\n#undef CHROMA_TAPS_X\n#undef CHROMA_TAPS_Y\n";
+	}
 	return frag_shader;
 }
 
@@ -218,6 +491,11 @@ bool YCbCrInput::set_int(const std::string& key, int value)
 			return false;
 		}
 	}
+	if (key == "chroma_filter") {
+		if (value < CHROMA_FILTER_BILINEAR || value > CHROMA_FILTER_LANCZOS) {
+			return false;
+		}
+	}
 	return Effect::set_int(key, value);
 }
 
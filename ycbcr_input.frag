@@ -7,6 +7,30 @@
 // uniform vec3 PREFIX(offset);
 // uniform vec2 PREFIX(cb_offset);
 // uniform vec2 PREFIX(cr_offset);
+// uniform vec2 PREFIX(chroma_size);  // If CHROMA_FILTER.
+// uniform vec2 PREFIX(inv_chroma_size);
+// uniform vec3 PREFIX(cb_taps_x_offsets)[4], PREFIX(cb_taps_x_weights)[4];
+// uniform vec3 PREFIX(cb_taps_y_offsets)[4], PREFIX(cb_taps_y_weights)[4];
+// uniform vec3 PREFIX(cr_taps_x_offsets)[4], PREFIX(cr_taps_x_weights)[4];
+// uniform vec3 PREFIX(cr_taps_y_offsets)[4], PREFIX(cr_taps_y_weights)[4];
+
+#ifdef CHROMA_FILTER
+// Separable filtering with (up to) three bilinear lookups in each direction,
+// relative to the start of the chroma sample the pixel belongs to;
+// see compute_chroma_taps() in the C++ code.
+vec4 PREFIX(filter_chroma)(sampler2D tex, vec2 base_tc, vec3 x_offsets, vec3 x_weights, vec3 y_offsets, vec3 y_weights)
+{
+	vec4 sum = vec4(0.0);
+	for (int j = 0; j < CHROMA_TAPS_Y; ++j) {
+		vec4 row = vec4(0.0);
+		for (int i = 0; i < CHROMA_TAPS_X; ++i) {
+			row += x_weights[i] * tex2D(tex, base_tc + vec2(x_offsets[i], y_offsets[j]));
+		}
+		sum += y_weights[j] * row;
+	}
+	return sum;
+}
+#endif
 
 vec4 FUNCNAME(vec2 tc) {
 	// OpenGL's origin is bottom-left, but most graphics software assumes
@@ -19,7 +43,30 @@ vec4 FUNCNAME(vec2 tc) {
 	ycbcr = tex2D(PREFIX(tex_y), tc).xyz;
 #else
 	ycbcr.x = tex2D(PREFIX(tex_y), tc).x;
-  #if CB_CR_SAME_TEXTURE
+  #ifdef CHROMA_FILTER
+	// Find which chroma sample we are in, and which of the output pixels
+	// within it (the phase); tc is always at a pixel center, so the phase
+	// is never close to rounding the wrong way.
+	vec2 chroma_pos = tc * PREFIX(chroma_size);
+	vec2 block = floor(chroma_pos);
+	ivec2 phase = ivec2((chroma_pos - block) * vec2(SUBSAMPLING_X, SUBSAMPLING_Y));
+	vec2 base_tc = block * PREFIX(inv_chroma_size);
+    #define CB_TAPS PREFIX(cb_taps_x_offsets)[phase.x], PREFIX(cb_taps_x_weights)[phase.x], PREFIX(cb_taps_y_offsets)[phase.y], PREFIX(cb_taps_y_weights)[phase.y]
+    #define CR_TAPS PREFIX(cr_taps_x_offsets)[phase.x], PREFIX(cr_taps_x_weights)[phase.x], PREFIX(cr_taps_y_offsets)[phase.y], PREFIX(cr_taps_y_weights)[phase.y]
+    #if CB_CR_SAME_TEXTURE
+      #if CB_CR_OFFSETS_EQUAL
+	ycbcr.yz = PREFIX(filter_chroma)(PREFIX(tex_cbcr), base_tc, CB_TAPS).xy;
+      #else
+	ycbcr.y = PREFIX(filter_chroma)(PREFIX(tex_cbcr), base_tc, CB_TAPS).x;
+	ycbcr.z = PREFIX(filter_chroma)(PREFIX(tex_cbcr), base_tc, CR_TAPS).y;
+      #endif
+    #else
+	ycbcr.y = PREFIX(filter_chroma)(PREFIX(tex_cb), base_tc, CB_TAPS).x;
+	ycbcr.z = PREFIX(filter_chroma)(PREFIX(tex_cr), base_tc, CR_TAPS).x;
+    #endif
+    #undef CB_TAPS
+    #undef CR_TAPS
+  #elif CB_CR_SAME_TEXTURE
     #if CB_CR_OFFSETS_EQUAL
 	ycbcr.yz = tex2D(PREFIX(tex_cbcr), tc + PREFIX(cb_offset)).xy;
     #else
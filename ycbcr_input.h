@@ -14,8 +14,13 @@
 //   * 10-bit interleaved (chunked) Y'CbCr packed into 32-bit words
 //     (10:10:10:2), no subsampling (4:4:4 only).
 //
-// For the planar and semiplanar cases, it upsamples planes as needed, using
-// the default linear upsampling OpenGL gives you. Note that YCbCr422InterleavedInput
+// For the planar and semiplanar cases, it upsamples planes as needed, by
+// default using the linear upsampling OpenGL gives you. Optionally, you can
+// ask for a sharper four-tap filter instead (see “chroma_filter”); this is
+// still done in the same phase as the conversion, with no extra texture
+// bounce, and the two middle taps in each direction are merged into one
+// bilinear lookup, so it costs three lookups per subsampled direction
+// (e.g. nine for 4:2:0) instead of four. Note that YCbCr422InterleavedInput
 // supports the important special case of 8-bit 4:2:2 interleaved.
 
 #include <epoxy/gl.h>
@@ -71,6 +76,12 @@ public:
 	// Uploads the texture if it has changed since last time.
 	void set_gl_state(GLuint glsl_program_num, const std::string& prefix, unsigned *sampler_num) override;
 
+	// Reads straight from the pixel data; PBOs and textures are not supported.
+	bool has_cpu_implementation() const override { return true; }
+	void set_cpu_state() override;
+	void render_cpu_rows(const CPUImage *inputs, unsigned width, unsigned height,
+	                     unsigned y0, unsigned y1, float *dst) const override;
+
 	unsigned get_width() const override { return width; }
 	unsigned get_height() const override { return height; }
 	Colorspace get_color_space() const override { return image_format.color_space; }
@@ -165,7 +176,9 @@ public:
 	// although with one limitation: If Cb and Cr come from the same
 	// texture and their offsets offsets are the same (ie., within 1e-6)
 	// when finalizing, they most continue to be so forever, as this
-	// optimization is compiled into the shader.
+	// optimization is compiled into the shader. Similarly, if you use
+	// a chroma filter other than CHROMA_FILTER_BILINEAR, the subsampling
+	// must stay the same after finalize.
 	//
 	// If you change subsampling parameters, you'll need to call
 	// set_width() / set_height() again after this.
@@ -178,21 +191,80 @@ public:
 
 	bool set_int(const std::string& key, int value) override;
 
+	// Values for the “chroma_filter” parameter, which must be set before
+	// finalize. All except CHROMA_FILTER_BILINEAR are four-tap filters,
+	// evaluated at the exact chroma siting for each output pixel.
+	// Directions that are not subsampled are never filtered.
+	// The subsampling can not be changed after finalize when using them.
+	enum ChromaFilter {
+		// OpenGL's bilinear filtering; the default.
+		CHROMA_FILTER_BILINEAR = 0,
+
+		// Mitchell-Netravali (B = C = 1/3); a little soft, but with
+		// hardly any ringing.
+		CHROMA_FILTER_BICUBIC = 1,
+
+		// Catmull-Rom (B = 0, C = 1/2); sharper, and goes through
+		// the original samples.
+		CHROMA_FILTER_CATMULL_ROM = 2,
+
+		// Lanczos with a = 2; the sharpest of the three.
+		CHROMA_FILTER_LANCZOS = 3,
+	};
+
+	// Subsampling factors above this are not supported
+	// with the four-tap filters.
+	static const unsigned MAX_CHROMA_PHASES = 4;
+
 private:
 	// Release the texture in the given channel if we have any, and it is owned by us.
 	void possibly_release_texture(unsigned channel);
 
+	// Computes the conversion matrix and the chroma offsets (and taps,
+	// if filtering), for both set_gl_state() and set_cpu_state().
+	void compute_conversion_uniforms();
+
+	// Sets use_chroma_filter from chroma_filter and the current format,
+	// and remembers the subsampling it was decided for.
+	void decide_chroma_filter();
+
+	// For each output pixel phase within a chroma sample (in one direction),
+	// up to three texture coordinates and weights; the coordinates are
+	// relative to the start of the chroma sample. See compute_chroma_taps().
+	struct ChromaTaps {
+		float offsets[MAX_CHROMA_PHASES * 3];
+		float weights[MAX_CHROMA_PHASES * 3];
+	};
+
+	// For render_cpu_rows(): Component <component> (of <num_components>)
+	// of the given texel in the given channel, normalized to 0..1 the same
+	// way the texture would be, and the same bilinearly filtered at
+	// texture coordinates (x, y), with clamp-to-edge.
+	float get_texel(unsigned channel, unsigned component, unsigned num_components, unsigned x, unsigned y) const;
+	float sample_bilinear(unsigned channel, unsigned component, unsigned num_components, float x, float y) const;
+
+	// The same as the shader does with chroma_filter set; the weighted sum of
+	// bilinear samples from the given taps, for the pixel at (x, y)
+	// (counted from the top).
+	float sample_filtered(unsigned channel, unsigned component, unsigned num_components,
+	                      const ChromaTaps &taps_x, const ChromaTaps &taps_y, unsigned x, unsigned y) const;
+
 	ImageFormat image_format;
 	YCbCrFormat ycbcr_format;
 	GLuint num_channels;
 	YCbCrInputSplitting ycbcr_input_splitting;
 	int needs_mipmaps;  // Only allowed if ycbcr_input_splitting == YCBCR_INPUT_INTERLEAVED.
+	int chroma_filter;
+	bool use_chroma_filter;  // See decide_chroma_filter().
+	unsigned finalized_subsampling_x, finalized_subsampling_y;
 	GLenum type;
 	GLuint pbos[3], texture_num[3];
 	GLint uniform_tex_y, uniform_tex_cb, uniform_tex_cr;
 	Eigen::Matrix3d uniform_ycbcr_matrix;
 	float uniform_offset[3];
 	Point2D uniform_cb_offset, uniform_cr_offset;
+	float uniform_chroma_size[2], uniform_inv_chroma_size[2];
+	ChromaTaps uniform_cb_taps_x, uniform_cb_taps_y, uniform_cr_taps_x, uniform_cr_taps_y;
 	bool cb_cr_offsets_equal;
 
 	unsigned width, height, widths[3], heights[3];
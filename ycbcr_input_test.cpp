@@ -1,7 +1,11 @@
 // Unit tests for YCbCrInput. Also tests the matrix functions in ycbcr.cpp directly.
 
 #include <epoxy/gl.h>
+#include <math.h>
 #include <stddef.h>
+#include <stdlib.h>
+
+#include <algorithm>
 
 #include <Eigen/Core>
 #include <Eigen/LU>
@@ -11,6 +15,7 @@
 #include "test_util.h"
 #include "util.h"
 #include "resource_pool.h"
+#include "ycbcr.h"
 #include "ycbcr_input.h"
 
 using namespace std;
@@ -740,6 +745,225 @@ TEST(YCbCrInputTest, ExternalTexture) {
 	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
 }
 
+namespace {
+
+// Reference versions of the YCbCrInput::ChromaFilter kernels.
+double reference_chroma_kernel(int filter, double x)
+{
+	x = fabs(x);
+	if (filter == YCbCrInput::CHROMA_FILTER_LANCZOS) {
+		if (x < 1e-9) {
+			return 1.0;
+		} else if (x >= 2.0) {
+			return 0.0;
+		}
+		return sin(M_PI * x) / (M_PI * x) * sin(M_PI * x / 2.0) / (M_PI * x / 2.0);
+	}
+	const double B = (filter == YCbCrInput::CHROMA_FILTER_BICUBIC) ? 1.0 / 3.0 : 0.0;
+	const double C = (filter == YCbCrInput::CHROMA_FILTER_BICUBIC) ? 1.0 / 3.0 : 0.5;
+	if (x < 1.0) {
+		return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.0;
+	} else if (x < 2.0) {
+		return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.0;
+	} else {
+		return 0.0;
+	}
+}
+
+// Upsamples one chroma plane (stored with <stride> bytes between samples)
+// directly with the four-tap kernel, with edge samples repeated.
+void upsample_chroma_reference(int filter, const unsigned char *src, unsigned stride,
+                               unsigned width, unsigned height,
+                               unsigned subsampling_x, unsigned subsampling_y,
+                               float pos_x, float pos_y, double *dst)
+{
+	const int chroma_width = width / subsampling_x, chroma_height = height / subsampling_y;
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			const double fx = (x - pos_x * (subsampling_x - 1)) / subsampling_x;
+			const double fy = (y - pos_y * (subsampling_y - 1)) / subsampling_y;
+			const int x0 = (subsampling_x == 1) ? x : int(floor(fx)) - 1;
+			const int y0 = (subsampling_y == 1) ? y : int(floor(fy)) - 1;
+			const int num_x = (subsampling_x == 1) ? 1 : 4;
+			const int num_y = (subsampling_y == 1) ? 1 : 4;
+
+			double sum = 0.0, total_weight = 0.0;
+			for (int j = y0; j < y0 + num_y; ++j) {
+				const double wy = (num_y == 1) ? 1.0 : reference_chroma_kernel(filter, fy - j);
+				for (int i = x0; i < x0 + num_x; ++i) {
+					const double wx = (num_x == 1) ? 1.0 : reference_chroma_kernel(filter, fx - i);
+					const int cx = min(max(i, 0), chroma_width - 1);
+					const int cy = min(max(j, 0), chroma_height - 1);
+					sum += wx * wy * src[(cy * chroma_width + cx) * stride] / 255.0;
+					total_weight += wx * wy;
+				}
+			}
+			dst[y * width + x] = sum / total_weight;
+		}
+	}
+}
+
+}  // namespace
+
+TEST(YCbCrInputTest, ChromaFilters) {
+	const unsigned width = 16, height = 8;
+	const int filters[] = {
+		YCbCrInput::CHROMA_FILTER_BICUBIC,
+		YCbCrInput::CHROMA_FILTER_CATMULL_ROM,
+		YCbCrInput::CHROMA_FILTER_LANCZOS,
+	};
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	// 4:2:0 planar with left-sited chroma, and 4:1:1 semiplanar
+	// with Cb and Cr in different places (so they need separate lookups).
+	for (YCbCrInputSplitting splitting : { YCBCR_INPUT_PLANAR, YCBCR_INPUT_SPLIT_Y_AND_CBCR }) {
+		YCbCrFormat ycbcr_format;
+		ycbcr_format.luma_coefficients = YCBCR_REC_709;
+		ycbcr_format.full_range = false;
+		ycbcr_format.num_levels = 256;
+		if (splitting == YCBCR_INPUT_PLANAR) {
+			ycbcr_format.chroma_subsampling_x = 2;
+			ycbcr_format.chroma_subsampling_y = 2;
+			ycbcr_format.cb_x_position = ycbcr_format.cr_x_position = 0.0f;
+			ycbcr_format.cb_y_position = ycbcr_format.cr_y_position = 0.5f;
+		} else {
+			ycbcr_format.chroma_subsampling_x = 4;
+			ycbcr_format.chroma_subsampling_y = 1;
+			ycbcr_format.cb_x_position = 0.0f;
+			ycbcr_format.cr_x_position = 0.5f;
+			ycbcr_format.cb_y_position = ycbcr_format.cr_y_position = 0.5f;
+		}
+		const unsigned chroma_size = width * height / (ycbcr_format.chroma_subsampling_x * ycbcr_format.chroma_subsampling_y);
+
+		unsigned char y[width * height], cb_cr[chroma_size * 2];
+		for (unsigned i = 0; i < width * height; ++i) {
+			y[i] = 16 + rand() % 220;
+		}
+		for (unsigned i = 0; i < chroma_size * 2; ++i) {
+			cb_cr[i] = 16 + rand() % 225;
+		}
+		const unsigned char *cb = cb_cr, *cr = cb_cr + chroma_size;
+		unsigned stride = 1;
+		if (splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) {
+			cr = cb_cr + 1;
+			stride = 2;
+		}
+
+		float offset[3];
+		Eigen::Matrix3d ycbcr_to_rgb;
+		compute_ycbcr_matrix(ycbcr_format, offset, &ycbcr_to_rgb);
+
+		for (int filter : filters) {
+			double ref_cb[width * height], ref_cr[width * height];
+			upsample_chroma_reference(filter, cb, stride, width, height,
+				ycbcr_format.chroma_subsampling_x, ycbcr_format.chroma_subsampling_y,
+				ycbcr_format.cb_x_position, ycbcr_format.cb_y_position, ref_cb);
+			upsample_chroma_reference(filter, cr, stride, width, height,
+				ycbcr_format.chroma_subsampling_x, ycbcr_format.chroma_subsampling_y,
+				ycbcr_format.cr_x_position, ycbcr_format.cr_y_position, ref_cr);
+
+			float expected_data[width * height * 4];
+			for (unsigned yy = 0; yy < height; ++yy) {
+				for (unsigned xx = 0; xx < width; ++xx) {
+					const unsigned i = yy * width + xx;
+					Eigen::Vector3d ycbcr(y[i] / 255.0 - offset[0], ref_cb[i] - offset[1], ref_cr[i] - offset[2]);
+					Eigen::Vector3d rgb = ycbcr_to_rgb * ycbcr;
+					expected_data[i * 4 + 0] = rgb[0];
+					expected_data[i * 4 + 1] = rgb[1];
+					expected_data[i * 4 + 2] = rgb[2];
+					expected_data[i * 4 + 3] = 1.0f;
+				}
+			}
+
+			float out_data[width * height * 4];
+			EffectChainTester tester(nullptr, width, height);
+			YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height, splitting);
+			ASSERT_TRUE(input->set_int("chroma_filter", filter));
+			input->set_pixel_data(0, y);
+			input->set_pixel_data(1, cb_cr);
+			if (splitting == YCBCR_INPUT_PLANAR) {
+				input->set_pixel_data(2, cr);
+			}
+			tester.get_chain()->add_input(input);
+			tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+			// Only the texture filtering precision (for the merged
+			// middle taps) should make a difference.
+			expect_equal(expected_data, out_data, width * 4, height, 0.01, 0.002);
+		}
+	}
+}
+
+TEST(YCbCrInputTest, ChromaFilterIsSharperThanBilinear) {
+	const unsigned width = 8, height = 1;
+
+	// A hard chroma edge in the middle, 4:2:2 with centered chroma.
+	unsigned char y[width * height] = { 126, 126, 126, 126, 126, 126, 126, 126 };
+	unsigned char cb[width * height / 2] = { 16, 16, 240, 240 };
+	unsigned char cr[width * height / 2] = { 128, 128, 128, 128 };
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 2;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	// The blue channel just left and right of the edge.
+	float edge[2][2];
+	for (int filter : { int(YCbCrInput::CHROMA_FILTER_BILINEAR), int(YCbCrInput::CHROMA_FILTER_CATMULL_ROM) }) {
+		float out_data[width * height * 4];
+		EffectChainTester tester(nullptr, width, height);
+		YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+		ASSERT_TRUE(input->set_int("chroma_filter", filter));
+		input->set_pixel_data(0, y);
+		input->set_pixel_data(1, cb);
+		input->set_pixel_data(2, cr);
+		tester.get_chain()->add_input(input);
+		tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+		edge[filter != YCbCrInput::CHROMA_FILTER_BILINEAR][0] = out_data[3 * 4 + 2];
+		edge[filter != YCbCrInput::CHROMA_FILTER_BILINEAR][1] = out_data[4 * 4 + 2];
+	}
+
+	// Both are symmetric around the edge, but Catmull-Rom has a steeper step.
+	EXPECT_LT(edge[1][0], edge[0][0] - 0.02);
+	EXPECT_GT(edge[1][1], edge[0][1] + 0.02);
+}
+
+TEST(YCbCrInputTest, InvalidChromaFilterIsRejected) {
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 2;
+	ycbcr_format.chroma_subsampling_y = 2;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput input(format, ycbcr_format, 4, 4);
+	EXPECT_TRUE(input.set_int("chroma_filter", YCbCrInput::CHROMA_FILTER_LANCZOS));
+	EXPECT_FALSE(input.set_int("chroma_filter", YCbCrInput::CHROMA_FILTER_LANCZOS + 1));
+	EXPECT_FALSE(input.set_int("chroma_filter", -1));
+}
+
 TEST(YCbCrTest, WikipediaRec601ForwardMatrix) {
 	YCbCrFormat ycbcr_format;
 	ycbcr_format.luma_coefficients = YCBCR_REC_601;
@@ -0,0 +1,317 @@
+#include <assert.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cpu_backend.h"
+#include "util.h"
+#include "ycbcr_input.h"
+#include "ycbcr_repacker.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Reads a 16-bit little-endian word.
+inline uint16_t read_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+#ifdef __SSE2__
+
+// The even-numbered 16-bit words of <a> followed by those of <b>
+// (or the odd-numbered ones, for odd_words()). _mm_packs_epi32() saturates
+// to signed 16-bit, so the words are sign-extended first, which makes them
+// come through unchanged.
+inline __m128i even_words(__m128i a, __m128i b)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+inline __m128i odd_words(__m128i a, __m128i b)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+}
+
+// The SIMD parts of repack_yuyv_row(). They do as many whole blocks of
+// pixels as they can, and return how many pixels that was.
+inline unsigned repack_yuyv_row_sse2(const unsigned char *src, unsigned width, unsigned,
+                                     unsigned char *y, unsigned char *cb, unsigned char *cr)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+	unsigned x;
+	for (x = 0; x + 16 <= width; x += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2 + 16));
+		const __m128i luma = _mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_and_si128(b, low_bytes));
+		const __m128i chroma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));  // Cb Cr Cb Cr...
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(y + x), luma);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(cb + x / 2), _mm_packus_epi16(_mm_and_si128(chroma, low_bytes), chroma));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(cr + x / 2), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), chroma));
+	}
+	return x;
+}
+
+inline unsigned repack_yuyv_row_sse2(const unsigned char *src, unsigned width, unsigned shift,
+                                     uint16_t *y, uint16_t *cb, uint16_t *cr)
+{
+	const __m128i shift_count = _mm_cvtsi32_si128(shift);
+	unsigned x;
+	for (x = 0; x + 8 <= width; x += 8) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4 + 16));
+		const __m128i chroma = odd_words(a, b);  // Cb Cr Cb Cr...
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(y + x), _mm_srl_epi16(even_words(a, b), shift_count));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(cb + x / 2), _mm_srl_epi16(even_words(chroma, chroma), shift_count));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(cr + x / 2), _mm_srl_epi16(odd_words(chroma, chroma), shift_count));
+	}
+	return x;
+}
+
+#endif
+
+// Shared by YUYVRepacker and YUYV16Repacker; <bytes_per_sample> is 1 or 2,
+// and for 2, each sample is shifted down by <shift> bits.
+template<class T, unsigned bytes_per_sample>
+void repack_yuyv_row(const unsigned char *src, unsigned width, unsigned shift, T *y, T *cb, T *cr)
+{
+	unsigned x0 = 0;
+#ifdef __SSE2__
+	x0 = repack_yuyv_row_sse2(src, width, shift, y, cb, cr) / 2;
+#endif
+	for (unsigned x = x0; x < width / 2; ++x) {
+		const unsigned char *s = src + x * 4 * bytes_per_sample;
+		if (bytes_per_sample == 1) {
+			y[x * 2 + 0] = s[0];
+			cb[x] = s[1];
+			y[x * 2 + 1] = s[2];
+			cr[x] = s[3];
+		} else {
+			y[x * 2 + 0] = read_le16(s + 0) >> shift;
+			cb[x] = read_le16(s + 2) >> shift;
+			y[x * 2 + 1] = read_le16(s + 4) >> shift;
+			cr[x] = read_le16(s + 6) >> shift;
+		}
+	}
+}
+
+}  // namespace
+
+YCbCrRepacker::YCbCrRepacker(unsigned width, unsigned height,
+                             unsigned chroma_subsampling_x, unsigned chroma_subsampling_y,
+                             GLenum type)
+	: width(width),
+	  height(height),
+	  chroma_subsampling_x(chroma_subsampling_x),
+	  chroma_subsampling_y(chroma_subsampling_y),
+	  type(type),
+	  pbo(0)
+{
+	assert(width % chroma_subsampling_x == 0);
+	assert(height % chroma_subsampling_y == 0);
+	assert(type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT);
+}
+
+YCbCrRepacker::~YCbCrRepacker()
+{
+	if (pbo != 0) {
+		glDeleteBuffers(1, &pbo);
+		check_error();
+	}
+}
+
+size_t YCbCrRepacker::plane_offset(unsigned plane) const
+{
+	const size_t bytes_per_sample = (type == GL_UNSIGNED_SHORT) ? 2 : 1;
+	const size_t luma_size = size_t(width) * height * bytes_per_sample;
+	const size_t chroma_size = luma_size / (chroma_subsampling_x * chroma_subsampling_y);
+	assert(plane <= 3);
+	return (plane == 0) ? 0 : luma_size + (plane - 1) * chroma_size;
+}
+
+size_t YCbCrRepacker::get_output_size() const
+{
+	return plane_offset(3);
+}
+
+void YCbCrRepacker::repack(const unsigned char * const *src, const unsigned *src_pitch, unsigned char *dst) const
+{
+	unsigned char * const planes[3] = { dst + plane_offset(0), dst + plane_offset(1), dst + plane_offset(2) };
+
+	// Strips must not split a chroma row, so count in those. For all the
+	// layouts, the source is as large as the repacked output, so each
+	// chroma row touches twice its share of the output.
+	const unsigned chroma_rows = height / chroma_subsampling_y;
+	parallel_for_strips(2 * get_output_size() / chroma_rows, chroma_rows, [&](unsigned y0, unsigned y1) {
+		repack_rows(src, src_pitch, y0 * chroma_subsampling_y, y1 * chroma_subsampling_y, planes);
+	});
+}
+
+void YCbCrRepacker::repack_to_input(const unsigned char * const *src, const unsigned *src_pitch, YCbCrInput *input)
+{
+	const size_t size = get_output_size();
+	if (pbo == 0) {
+		glGenBuffers(1, &pbo);
+		check_error();
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	check_error();
+
+	// Orphan the old storage, in case the GPU is still uploading from it.
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	check_error();
+	unsigned char *dst = (unsigned char *)glMapBufferRange(
+		GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	check_error();
+	assert(dst != nullptr);
+
+	repack(src, src_pitch, dst);
+
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	check_error();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	check_error();
+
+	set_pixel_data(input, (const unsigned char *)BUFFER_OFFSET(0), pbo);
+}
+
+void YCbCrRepacker::set_pixel_data(YCbCrInput *input, const unsigned char *dst, GLuint pbo) const
+{
+	assert(input->get_width() == width);
+	assert(input->get_height() == height);
+	for (unsigned channel = 0; channel < 3; ++channel) {
+		const unsigned char *plane = dst + plane_offset(channel);
+		if (type == GL_UNSIGNED_SHORT) {
+			input->set_pixel_data(channel, reinterpret_cast<const uint16_t *>(plane), pbo);
+		} else {
+			input->set_pixel_data(channel, plane, pbo);
+		}
+		input->set_pitch(channel, (channel == 0) ? width : width / chroma_subsampling_x);
+	}
+}
+
+YUYVRepacker::YUYVRepacker(unsigned width, unsigned height)
+	: YCbCrRepacker(width, height, 2, 1, GL_UNSIGNED_BYTE) {}
+
+void YUYVRepacker::repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+                               unsigned y0, unsigned y1, unsigned char * const *dst) const
+{
+	for (unsigned y = y0; y < y1; ++y) {
+		repack_yuyv_row<unsigned char, 1>(src[0] + size_t(y) * src_pitch[0], width, 0,
+			dst[0] + size_t(y) * width,
+			dst[1] + size_t(y) * (width / 2),
+			dst[2] + size_t(y) * (width / 2));
+	}
+}
+
+Y41PRepacker::Y41PRepacker(unsigned width, unsigned height)
+	: YCbCrRepacker(width, height, 4, 1, GL_UNSIGNED_BYTE)
+{
+	assert(width % 8 == 0);
+}
+
+void Y41PRepacker::repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+                               unsigned y0, unsigned y1, unsigned char * const *dst) const
+{
+	for (unsigned y = y0; y < y1; ++y) {
+		const unsigned char *s = src[0] + size_t(y) * src_pitch[0];
+		unsigned char *luma = dst[0] + size_t(y) * width;
+		unsigned char *cb = dst[1] + size_t(y) * (width / 4);
+		unsigned char *cr = dst[2] + size_t(y) * (width / 4);
+		for (unsigned x = 0; x < width / 8; ++x, s += 12) {
+			cb[x * 2 + 0] = s[0];
+			luma[x * 8 + 0] = s[1];
+			cr[x * 2 + 0] = s[2];
+			luma[x * 8 + 1] = s[3];
+			cb[x * 2 + 1] = s[4];
+			luma[x * 8 + 2] = s[5];
+			cr[x * 2 + 1] = s[6];
+			for (unsigned i = 0; i < 5; ++i) {
+				luma[x * 8 + 3 + i] = s[7 + i];
+			}
+		}
+	}
+}
+
+YUYV16Repacker::YUYV16Repacker(unsigned width, unsigned height, unsigned bits)
+	: YCbCrRepacker(width, height, 2, 1, GL_UNSIGNED_SHORT),
+	  shift(16 - bits)
+{
+	assert(bits > 8 && bits <= 16);
+}
+
+void YUYV16Repacker::repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+                                 unsigned y0, unsigned y1, unsigned char * const *dst) const
+{
+	uint16_t * const planes[3] = {
+		reinterpret_cast<uint16_t *>(dst[0]),
+		reinterpret_cast<uint16_t *>(dst[1]),
+		reinterpret_cast<uint16_t *>(dst[2])
+	};
+	for (unsigned y = y0; y < y1; ++y) {
+		repack_yuyv_row<uint16_t, 2>(src[0] + size_t(y) * src_pitch[0], width, shift,
+			planes[0] + size_t(y) * width,
+			planes[1] + size_t(y) * (width / 2),
+			planes[2] + size_t(y) * (width / 2));
+	}
+}
+
+SemiplanarMSBRepacker::SemiplanarMSBRepacker(unsigned width, unsigned height, unsigned bits, unsigned chroma_subsampling_y)
+	: YCbCrRepacker(width, height, 2, chroma_subsampling_y, GL_UNSIGNED_SHORT),
+	  shift(16 - bits)
+{
+	assert(bits > 8 && bits <= 16);
+	assert(chroma_subsampling_y == 1 || chroma_subsampling_y == 2);
+}
+
+void SemiplanarMSBRepacker::repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+                                        unsigned y0, unsigned y1, unsigned char * const *dst) const
+{
+	uint16_t *luma = reinterpret_cast<uint16_t *>(dst[0]);
+	uint16_t *cb = reinterpret_cast<uint16_t *>(dst[1]);
+	uint16_t *cr = reinterpret_cast<uint16_t *>(dst[2]);
+	const unsigned chroma_width = width / 2;
+
+#ifdef __SSE2__
+	const __m128i shift_count = _mm_cvtsi32_si128(shift);
+#endif
+
+	for (unsigned y = y0; y < y1; ++y) {
+		const unsigned char *s = src[0] + size_t(y) * src_pitch[0];
+		uint16_t *d = luma + size_t(y) * width;
+		unsigned x = 0;
+#ifdef __SSE2__
+		for ( ; x + 8 <= width; x += 8) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + x * 2));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(d + x), _mm_srl_epi16(v, shift_count));
+		}
+#endif
+		for ( ; x < width; ++x) {
+			d[x] = read_le16(s + x * 2) >> shift;
+		}
+	}
+	for (unsigned y = y0 / chroma_subsampling_y; y < y1 / chroma_subsampling_y; ++y) {
+		const unsigned char *s = src[1] + size_t(y) * src_pitch[1];
+		uint16_t *d_cb = cb + size_t(y) * chroma_width;
+		uint16_t *d_cr = cr + size_t(y) * chroma_width;
+		unsigned x = 0;
+#ifdef __SSE2__
+		for ( ; x + 8 <= chroma_width; x += 8) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + x * 4));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + x * 4 + 16));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(d_cb + x), _mm_srl_epi16(even_words(a, b), shift_count));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(d_cr + x), _mm_srl_epi16(odd_words(a, b), shift_count));
+		}
+#endif
+		for ( ; x < chroma_width; ++x) {
+			d_cb[x] = read_le16(s + x * 4 + 0) >> shift;
+			d_cr[x] = read_le16(s + x * 4 + 2) >> shift;
+		}
+	}
+}
+
+}  // namespace movit
@@ -0,0 +1,164 @@
+#ifndef _MOVIT_YCBCR_REPACKER_H
+#define _MOVIT_YCBCR_REPACKER_H 1
+
+// YCbCrRepacker converts Y'CbCr data in layouts that YCbCrInput cannot
+// read directly (e.g. YUYV, 4:1:1 packed, or 10- and 12-bit samples that
+// are stored in the top bits of 16-bit words) into planar Y'CbCr that it can.
+// This happens on the CPU, spread out over all cores, and the result can
+// go straight into a PBO that is then uploaded asynchronously, so the
+// repacking does not cost an extra copy of the frame.
+//
+// Each source layout is a subclass that implements repack_rows(); all the
+// rest (threading, PBO handling and hooking up the input) is shared, so new
+// layouts need neither shader changes nor changes to YCbCrInput. Typical use:
+//
+//   YUYVRepacker repacker(width, height);
+//   ycbcr_format.chroma_subsampling_x = repacker.get_chroma_subsampling_x();
+//   ycbcr_format.chroma_subsampling_y = repacker.get_chroma_subsampling_y();
+//   YCbCrInput *input = new YCbCrInput(image_format, ycbcr_format, width, height,
+//                                      YCBCR_INPUT_PLANAR, repacker.get_type());
+//   ...
+//   // Every frame:
+//   repacker.repack_to_input(frame, width * 2, input);
+//
+// The repacked samples are stored in their natural range (ie., a 10-bit
+// sample goes from 0 to 1023, even if it was left-aligned in the source),
+// so set YCbCrFormat::num_levels the same way as for unpacked data.
+
+#include <epoxy/gl.h>
+#include <stddef.h>
+
+namespace movit {
+
+class YCbCrInput;
+
+class YCbCrRepacker {
+public:
+	// <type> is the type of the repacked data; GL_UNSIGNED_BYTE
+	// or GL_UNSIGNED_SHORT, like for YCbCrInput.
+	YCbCrRepacker(unsigned width, unsigned height,
+	              unsigned chroma_subsampling_x, unsigned chroma_subsampling_y,
+	              GLenum type);
+	virtual ~YCbCrRepacker();
+
+	// What the YCbCrInput that gets the repacked data must be created with
+	// (always with YCBCR_INPUT_PLANAR).
+	unsigned get_width() const { return width; }
+	unsigned get_height() const { return height; }
+	unsigned get_chroma_subsampling_x() const { return chroma_subsampling_x; }
+	unsigned get_chroma_subsampling_y() const { return chroma_subsampling_y; }
+	GLenum get_type() const { return type; }
+
+	// The size of the repacked frame, in bytes. The planes (Y', Cb, Cr)
+	// are stored one after the other, without any padding.
+	size_t get_output_size() const;
+
+	// Repack a frame from <src> into <dst>, which must be get_output_size()
+	// bytes large. <src> and <src_pitch> (in bytes) give one entry for each
+	// plane of the source; see each subclass. There is also a shorthand for
+	// the single-plane case.
+	void repack(const unsigned char * const *src, const unsigned *src_pitch, unsigned char *dst) const;
+	void repack(const unsigned char *src, unsigned src_pitch, unsigned char *dst) const
+	{
+		repack(&src, &src_pitch, dst);
+	}
+
+	// Repack a frame into a PBO owned by the repacker, and point <input>
+	// at it. Must be called with the OpenGL context current. The PBO is
+	// orphaned for each frame, so this does not need to wait for the GPU
+	// to finish uploading the previous one; however, for the same reason,
+	// a given repacker can only feed one input at a time.
+	void repack_to_input(const unsigned char * const *src, const unsigned *src_pitch, YCbCrInput *input);
+	void repack_to_input(const unsigned char *src, unsigned src_pitch, YCbCrInput *input)
+	{
+		repack_to_input(&src, &src_pitch, input);
+	}
+
+	// Point <input> at a frame that has already been repacked
+	// (with repack()) into <dst>, which can either be a regular pointer
+	// (if pbo==0) or a byte offset into <pbo>, like for set_pixel_data().
+	void set_pixel_data(YCbCrInput *input, const unsigned char *dst, GLuint pbo = 0) const;
+
+protected:
+	// Repack source rows [y0, y1> (counted from the first row in memory,
+	// and always a whole number of chroma rows) into the planes given by
+	// <dst>, which point to the start of each plane, not to row y0.
+	// The planes are tightly packed, ie., have a pitch of
+	// width (or width / chroma_subsampling_x) samples.
+	//
+	// This is called concurrently for different row ranges, so it must
+	// not touch any state. It is the only thing a subclass needs to do.
+	virtual void repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+	                         unsigned y0, unsigned y1, unsigned char * const *dst) const = 0;
+
+	const unsigned width, height;
+	const unsigned chroma_subsampling_x, chroma_subsampling_y;
+	const GLenum type;
+
+private:
+	// Byte offset of each of the planes in the repacked frame.
+	size_t plane_offset(unsigned plane) const;
+
+	GLuint pbo;
+};
+
+// 8-bit 4:2:2, with samples interleaved as Y'0 Cb Y'1 Cr (also known
+// as YUY2). The source is a single plane. (For Cb Y'0 Cr Y'1, see
+// YCbCr422InterleavedInput, which can upload that directly.)
+class YUYVRepacker : public YCbCrRepacker {
+public:
+	YUYVRepacker(unsigned width, unsigned height);
+
+protected:
+	void repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+	                 unsigned y0, unsigned y1, unsigned char * const *dst) const override;
+};
+
+// 8-bit 4:1:1 (as used by NTSC DV), packed in groups of eight pixels
+// into 12 bytes as Cb0 Y'0 Cr0 Y'1 Cb4 Y'2 Cr4 Y'3 Y'4 Y'5 Y'6 Y'7
+// (also known as Y41P). The source is a single plane, and the width
+// must be divisible by eight.
+class Y41PRepacker : public YCbCrRepacker {
+public:
+	Y41PRepacker(unsigned width, unsigned height);
+
+protected:
+	void repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+	                 unsigned y0, unsigned y1, unsigned char * const *dst) const override;
+};
+
+// <bits>-bit 4:2:2 in 16-bit little-endian words, interleaved as
+// Y'0 Cb Y'1 Cr, with each sample in the top <bits> bits of its word
+// (e.g. Y210 for 10-bit, Y212 for 12-bit). The source is a single plane.
+class YUYV16Repacker : public YCbCrRepacker {
+public:
+	YUYV16Repacker(unsigned width, unsigned height, unsigned bits);
+
+protected:
+	void repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+	                 unsigned y0, unsigned y1, unsigned char * const *dst) const override;
+
+private:
+	const unsigned shift;
+};
+
+// <bits>-bit 4:2:0 or 4:2:2 (depending on <chroma_subsampling_y>) in
+// 16-bit little-endian words, with each sample in the top <bits> bits of
+// its word, semiplanar: Y' in the first source plane, and then Cb and Cr
+// interleaved in the second (e.g. P010, P210, P016). YCbCrInput can take
+// semiplanar data, but not with the samples left-aligned like this.
+class SemiplanarMSBRepacker : public YCbCrRepacker {
+public:
+	SemiplanarMSBRepacker(unsigned width, unsigned height, unsigned bits, unsigned chroma_subsampling_y);
+
+protected:
+	void repack_rows(const unsigned char * const *src, const unsigned *src_pitch,
+	                 unsigned y0, unsigned y1, unsigned char * const *dst) const override;
+
+private:
+	const unsigned shift;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_YCBCR_REPACKER_H)
@@ -0,0 +1,233 @@
+// Unit tests for YCbCrRepacker and its subclasses. Each test packs random
+// planar data into the source layout by hand, and then checks that repacking
+// gives back exactly the planar data, and that rendering through a PBO gives
+// the same as giving the planar data directly to YCbCrInput.
+
+#include <epoxy/gl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "test_util.h"
+#include "util.h"
+#include "ycbcr_input.h"
+#include "ycbcr_repacker.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+// Random planar Y'CbCr, laid out the same way as the repacked data
+// (Y', then Cb, then Cr), with <bits>-bit samples.
+template<class T>
+vector<T> random_planes(const YCbCrRepacker &repacker, unsigned bits)
+{
+	vector<T> planes(repacker.get_output_size() / sizeof(T));
+	for (T &sample : planes) {
+		sample = rand() % (1 << bits);
+	}
+	return planes;
+}
+
+YCbCrFormat get_format(const YCbCrRepacker &repacker, unsigned bits)
+{
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_709;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 1 << bits;
+	ycbcr_format.chroma_subsampling_x = repacker.get_chroma_subsampling_x();
+	ycbcr_format.chroma_subsampling_y = repacker.get_chroma_subsampling_y();
+	ycbcr_format.cb_x_position = 0.0f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.0f;
+	ycbcr_format.cr_y_position = 0.5f;
+	return ycbcr_format;
+}
+
+// Checks that <repacker> turns <src> into <planes>, both in memory
+// and through its PBO.
+template<class T>
+void check_repacker(YCbCrRepacker *repacker, unsigned bits,
+                    const unsigned char * const *src, const unsigned *src_pitch,
+                    const vector<T> &planes)
+{
+	const unsigned width = repacker->get_width(), height = repacker->get_height();
+	const unsigned chroma_size = width * height / (repacker->get_chroma_subsampling_x() * repacker->get_chroma_subsampling_y());
+
+	vector<unsigned char> repacked(repacker->get_output_size());
+	repacker->repack(src, src_pitch, repacked.data());
+	ASSERT_EQ(planes.size() * sizeof(T), repacked.size());
+	EXPECT_EQ(0, memcmp(planes.data(), repacked.data(), repacked.size()));
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+	const YCbCrFormat ycbcr_format = get_format(*repacker, bits);
+
+	vector<float> expected_data(width * height * 4), out_data(width * height * 4);
+	{
+		EffectChainTester tester(nullptr, width, height);
+		YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height, YCBCR_INPUT_PLANAR, repacker->get_type());
+		input->set_pixel_data(0, planes.data());
+		input->set_pixel_data(1, planes.data() + width * height);
+		input->set_pixel_data(2, planes.data() + width * height + chroma_size);
+		tester.get_chain()->add_input(input);
+		tester.run(expected_data.data(), GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+	{
+		EffectChainTester tester(nullptr, width, height);
+		YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height, YCBCR_INPUT_PLANAR, repacker->get_type());
+		repacker->repack_to_input(src, src_pitch, input);
+		tester.get_chain()->add_input(input);
+		tester.run(out_data.data(), GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	}
+	expect_equal(expected_data.data(), out_data.data(), width * 4, height);
+}
+
+template<class T>
+void check_repacker(YCbCrRepacker *repacker, unsigned bits,
+                    const unsigned char *src, unsigned src_pitch,
+                    const vector<T> &planes)
+{
+	check_repacker(repacker, bits, &src, &src_pitch, planes);
+}
+
+}  // namespace
+
+TEST(YCbCrRepackerTest, YUYV) {
+	// Wide enough to have both whole SIMD blocks and some pixels left over.
+	const unsigned width = 20, height = 4;
+	YUYVRepacker repacker(width, height);
+	vector<unsigned char> planes = random_planes<unsigned char>(repacker, 8);
+	const unsigned char *luma = planes.data(), *cb = luma + width * height, *cr = cb + width * height / 2;
+
+	vector<unsigned char> data(width * height * 2);
+	for (unsigned i = 0; i < width * height / 2; ++i) {
+		data[i * 4 + 0] = luma[i * 2];
+		data[i * 4 + 1] = cb[i];
+		data[i * 4 + 2] = luma[i * 2 + 1];
+		data[i * 4 + 3] = cr[i];
+	}
+	check_repacker(&repacker, 8, data.data(), width * 2, planes);
+}
+
+TEST(YCbCrRepackerTest, Y41P) {
+	const unsigned width = 16, height = 3;
+	Y41PRepacker repacker(width, height);
+	vector<unsigned char> planes = random_planes<unsigned char>(repacker, 8);
+	const unsigned char *luma = planes.data(), *cb = luma + width * height, *cr = cb + width * height / 4;
+
+	// Pad each row, to check that the pitch is respected.
+	const unsigned pitch = width * 12 / 8 + 5;
+	vector<unsigned char> data(pitch * height);
+	for (unsigned y = 0; y < height; ++y) {
+		for (unsigned x = 0; x < width / 8; ++x) {
+			unsigned char *d = &data[y * pitch + x * 12];
+			const unsigned char *l = luma + y * width + x * 8;
+			const unsigned c = y * width / 4 + x * 2;
+			const unsigned char packed[] = {
+				cb[c], l[0], cr[c], l[1], cb[c + 1], l[2], cr[c + 1], l[3], l[4], l[5], l[6], l[7]
+			};
+			memcpy(d, packed, sizeof(packed));
+		}
+	}
+	check_repacker(&repacker, 8, data.data(), pitch, planes);
+}
+
+TEST(YCbCrRepackerTest, TwelveBitYUYV) {
+	const unsigned width = 22, height = 4;
+	YUYV16Repacker repacker(width, height, 12);
+	vector<uint16_t> planes = random_planes<uint16_t>(repacker, 12);
+	const uint16_t *luma = planes.data(), *cb = luma + width * height, *cr = cb + width * height / 2;
+
+	// The low four bits are garbage, and must be ignored.
+	vector<unsigned char> data(width * height * 4);
+	for (unsigned i = 0; i < width * height / 2; ++i) {
+		write_le16(&data[i * 8 + 0], (luma[i * 2] << 4) | (rand() & 0xf));
+		write_le16(&data[i * 8 + 2], (cb[i] << 4) | (rand() & 0xf));
+		write_le16(&data[i * 8 + 4], (luma[i * 2 + 1] << 4) | (rand() & 0xf));
+		write_le16(&data[i * 8 + 6], (cr[i] << 4) | (rand() & 0xf));
+	}
+	check_repacker(&repacker, 12, data.data(), width * 4, planes);
+}
+
+TEST(YCbCrRepackerTest, SemiplanarTenBit) {
+	for (unsigned chroma_subsampling_y : { 1, 2 }) {  // P210 and P010.
+		const unsigned width = 20, height = 6;
+		SemiplanarMSBRepacker repacker(width, height, 10, chroma_subsampling_y);
+		vector<uint16_t> planes = random_planes<uint16_t>(repacker, 10);
+		const unsigned chroma_height = height / chroma_subsampling_y;
+		const uint16_t *luma = planes.data(), *cb = luma + width * height, *cr = cb + width * chroma_height / 2;
+
+		vector<unsigned char> y_data(width * height * 2), cbcr_data(width * chroma_height * 2);
+		for (unsigned i = 0; i < width * height; ++i) {
+			write_le16(&y_data[i * 2], luma[i] << 6);
+		}
+		for (unsigned i = 0; i < width * chroma_height / 2; ++i) {
+			write_le16(&cbcr_data[i * 4 + 0], cb[i] << 6);
+			write_le16(&cbcr_data[i * 4 + 2], cr[i] << 6);
+		}
+		const unsigned char *src[] = { y_data.data(), cbcr_data.data() };
+		const unsigned src_pitch[] = { width * 2, width * 2 };
+		check_repacker(&repacker, 10, src, src_pitch, planes);
+	}
+}
+
+TEST(YCbCrRepackerTest, LargeFrameInManyStrips) {
+	// Large enough to be split over all cores, in many strips each.
+	const unsigned width = 1280, height = 720;
+	YUYVRepacker repacker(width, height);
+	vector<unsigned char> planes = random_planes<unsigned char>(repacker, 8);
+	const unsigned char *luma = planes.data(), *cb = luma + width * height, *cr = cb + width * height / 2;
+
+	vector<unsigned char> data(width * height * 2);
+	for (unsigned i = 0; i < width * height / 2; ++i) {
+		data[i * 4 + 0] = luma[i * 2];
+		data[i * 4 + 1] = cb[i];
+		data[i * 4 + 2] = luma[i * 2 + 1];
+		data[i * 4 + 3] = cr[i];
+	}
+
+	vector<unsigned char> repacked(repacker.get_output_size());
+	repacker.repack(data.data(), width * 2, repacked.data());
+	EXPECT_EQ(planes, repacked);
+}
+
+TEST(YCbCrRepackerTest, PBOIsReusedBetweenFrames) {
+	const unsigned width = 4, height = 2;
+	YUYVRepacker repacker(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+	YCbCrFormat ycbcr_format = get_format(repacker, 8);
+	ycbcr_format.full_range = true;
+
+	EffectChainTester tester(nullptr, width, height);
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height, YCBCR_INPUT_PLANAR, repacker.get_type());
+	tester.get_chain()->add_input(input);
+
+	// Black, then white; the second frame must not see the first.
+	for (unsigned char luma : { 0, 255 }) {
+		vector<unsigned char> data(width * height * 2);
+		for (unsigned i = 0; i < width * height / 2; ++i) {
+			data[i * 4 + 0] = data[i * 4 + 2] = luma;
+			data[i * 4 + 1] = data[i * 4 + 3] = 128;
+		}
+		repacker.repack_to_input(data.data(), width * 2, input);
+
+		float out_data[width * height];
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+		for (float x : out_data) {
+			EXPECT_NEAR(luma / 255.0f, x, 1e-3);
+		}
+	}
+}
+
+}  // namespace movit